@@ -0,0 +1,186 @@
+#include "../src/btree.h"
+#include "../src/constants.h"
+#include "../src/cursor.h"
+#include "../src/table.h"
+
+#include <time.h>
+
+#define BENCH_DB_FILE "concurrent_lookup.db"
+#define BENCH_NUM_ROWS 600
+#define BENCH_SECONDS 1
+#define BENCH_MAX_THREADS 256
+
+typedef struct {
+  Table *table;
+  uint32_t seed;
+  volatile bool *stop;
+  uint64_t operations;
+  uint64_t misses;
+} Worker;
+
+static double now_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Looks up random keys until told to stop.
+ *
+ * Keys are drawn from the preloaded even keys, so every lookup should hit.
+ * Misses are counted to catch a reader that saw a half-written node.
+ */
+static void *reader_main(void *argument) {
+  Worker *worker = argument;
+  Row row;
+
+  while (!*worker->stop) {
+    worker->seed = worker->seed * 1103515245 + 12345;
+    uint32_t key = 2 * ((worker->seed >> 8) % BENCH_NUM_ROWS + 1);
+    if (!table_get(worker->table, key, &row) || row.id != key) {
+      worker->misses++;
+    }
+    worker->operations++;
+  }
+
+  return NULL;
+}
+
+/*
+ * Inserts odd keys between the preloaded ones until told to stop.
+ *
+ * Once the table is full, it keeps re-inserting existing keys. Those inserts
+ * are rejected as duplicates, but they still lock their leaf first, so readers
+ * keep having to validate against a moving writer.
+ */
+static void *writer_main(void *argument) {
+  Worker *worker = argument;
+  Row row;
+  strcpy(row.username, "writer");
+  strcpy(row.email, "writer@example.com");
+
+  while (!*worker->stop) {
+    worker->seed = worker->seed * 1103515245 + 12345;
+    row.id = 2 * ((worker->seed >> 8) % BENCH_NUM_ROWS) + 1;
+    if (table_insert(worker->table, &row) == EXECUTE_TABLE_FULL) {
+      row.id += 1;
+      table_insert(worker->table, &row);
+    }
+    worker->operations++;
+  }
+
+  return NULL;
+}
+
+/*
+ * Runs num_threads readers, and optionally one writer, for BENCH_SECONDS.
+ *
+ * Returns the number of lookups per second.
+ */
+static double run(Table *table, uint32_t num_threads, bool with_writer) {
+  pthread_t threads[BENCH_MAX_THREADS + 1];
+  Worker workers[BENCH_MAX_THREADS + 1];
+  volatile bool stop = false;
+
+  uint32_t num_workers = num_threads + (with_writer ? 1 : 0);
+  for (uint32_t i = 0; i < num_workers; i++) {
+    workers[i].table = table;
+    workers[i].seed = i + 1;
+    workers[i].stop = &stop;
+    workers[i].operations = 0;
+    workers[i].misses = 0;
+  }
+
+  double start = now_seconds();
+  for (uint32_t i = 0; i < num_threads; i++) {
+    pthread_create(&threads[i], NULL, reader_main, &workers[i]);
+  }
+  if (with_writer) {
+    pthread_create(&threads[num_threads], NULL, writer_main,
+                   &workers[num_threads]);
+  }
+
+  sleep(BENCH_SECONDS);
+  stop = true;
+
+  uint64_t lookups = 0;
+  uint64_t misses = 0;
+  for (uint32_t i = 0; i < num_workers; i++) {
+    pthread_join(threads[i], NULL);
+    if (i < num_threads) {
+      lookups += workers[i].operations;
+      misses += workers[i].misses;
+    }
+  }
+  double elapsed = now_seconds() - start;
+
+  if (misses > 0) {
+    printf("Error: %lu lookups missed a key that is in the table.\n",
+           (unsigned long)misses);
+    exit(EXIT_FAILURE);
+  }
+
+  return lookups / elapsed;
+}
+
+/*
+ * Measures point lookup throughput against the number of reader threads.
+ *
+ * Usage: concurrent_lookup [-w] [max_threads]
+ *
+ * The thread count doubles from 1 up to max_threads, which defaults to the
+ * number of online CPUs. With -w, one more thread inserts into the table
+ * during every run.
+ */
+int main(int argc, char *argv[]) {
+  bool with_writer = false;
+  long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-w") == 0) {
+      with_writer = true;
+    } else {
+      max_threads = atol(argv[i]);
+    }
+  }
+  if (max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+    printf("Thread count must be between 1 and %d.\n", BENCH_MAX_THREADS);
+    exit(EXIT_FAILURE);
+  }
+
+  unlink(BENCH_DB_FILE);
+  char error[SQLITEDB_ERRMSG_SIZE];
+  Table *table = db_open(BENCH_DB_FILE, error);
+  if (table == NULL) {
+    printf("%s\n", error);
+    exit(EXIT_FAILURE);
+  }
+
+  Row rows[BENCH_NUM_ROWS];
+  for (uint32_t i = 0; i < BENCH_NUM_ROWS; i++) {
+    rows[i].id = 2 * (i + 1);
+    sprintf(rows[i].username, "user%d", rows[i].id);
+    sprintf(rows[i].email, "person%d@example.com", rows[i].id);
+  }
+  uint32_t num_inserted;
+  table_bulk_insert(table, rows, BENCH_NUM_ROWS, &num_inserted);
+
+  printf("%s\n", with_writer ? "Point lookups with one concurrent writer"
+                             : "Point lookups");
+  printf("%-8s %14s %8s\n", "threads", "lookups/s", "speedup");
+
+  double single_thread = 0;
+  for (uint32_t num_threads = 1; num_threads <= max_threads;
+       num_threads *= 2) {
+    double throughput = run(table, num_threads, with_writer);
+    if (num_threads == 1) {
+      single_thread = throughput;
+    }
+    printf("%-8d %14.0f %8.2f\n", num_threads, throughput,
+           throughput / single_thread);
+  }
+
+  db_close(table);
+  unlink(BENCH_DB_FILE);
+  return 0;
+}
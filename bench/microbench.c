@@ -0,0 +1,561 @@
+#include "../src/btree.h"
+#include "../src/constants.h"
+#include "../src/cursor.h"
+#include "../src/node.h"
+#include "../src/pager.h"
+#include "../src/scan.h"
+#include "../src/serialize.h"
+#include "../src/sqlitedb.h"
+#include "../src/table.h"
+
+#include <time.h>
+
+#define BENCH_DB_FILE "microbench.db"
+#define BENCH_DEFAULT_SECONDS 0.2
+#define BENCH_WARMUP_FRACTION 0.1
+#define BENCH_MAX_SAMPLES (1 << 20)
+#define BENCH_MAX_RESULTS 64
+#define BENCH_NAME_SIZE 48
+#define BENCH_NUM_KEYS 4096
+#define BENCH_MISS_BATCH 16
+
+#ifndef BENCH_BUILD
+#define BENCH_BUILD "unknown"
+#endif
+
+typedef void (*BenchFunction)(void *context, uint32_t num_ops);
+typedef void (*BenchPrepare)(void *context);
+
+typedef struct {
+  char name[BENCH_NAME_SIZE];
+  uint64_t ops;
+  double ns_per_op;
+  double ops_per_sec;
+  double p50_ns;
+  double p99_ns;
+  double allocations_per_op;
+  double bytes_per_op;
+} BenchResult;
+
+typedef struct {
+  Table *table;
+  Pager *pager;
+  uint32_t page_num;
+  uint32_t num_pages;
+  uint32_t keys[BENCH_NUM_KEYS];
+  uint32_t next_key;
+  Row row;
+  uint8_t buffer[sizeof(Row)];
+} BenchContext;
+
+static double bench_seconds = BENCH_DEFAULT_SECONDS;
+static const char *bench_filter = NULL;
+static double samples[BENCH_MAX_SAMPLES];
+static BenchResult results[BENCH_MAX_RESULTS];
+static uint32_t num_results = 0;
+static volatile uint64_t bench_sink;
+
+static uint64_t allocation_count = 0;
+static uint64_t allocation_bytes = 0;
+
+/*
+ * The engine is linked in statically, so these wrappers stand in for the C
+ * library's allocator everywhere in the process and count every allocation
+ * before handing it on. Scans allocate from several threads, so the counters
+ * are updated atomically.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static void count_allocation(size_t size) {
+  __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&allocation_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+  count_allocation(size);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_allocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+  count_allocation(size);
+  return __libc_realloc(pointer, size);
+}
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b) {
+  double left = *(const double *)a;
+  double right = *(const double *)b;
+  return (left > right) - (left < right);
+}
+
+/*
+ * Fills a context's key array with keys drawn at random from [first, first +
+ * count), so the timed loops do not pay for the random number generator.
+ */
+static void fill_keys(BenchContext *context, uint32_t first, uint32_t count) {
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < BENCH_NUM_KEYS; i++) {
+    seed = seed * 1103515245 + 12345;
+    context->keys[i] = first + (seed >> 8) % count;
+  }
+  context->next_key = 0;
+}
+
+/*
+ * Puts the keys 1 to count at the start of a context's key array, in order or
+ * shuffled.
+ */
+static void order_keys(BenchContext *context, uint32_t count, bool shuffle) {
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < count; i++) {
+    context->keys[i] = i + 1;
+  }
+  for (uint32_t i = count - 1; shuffle && i > 0; i--) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t j = (seed >> 8) % (i + 1);
+    uint32_t key = context->keys[i];
+    context->keys[i] = context->keys[j];
+    context->keys[j] = key;
+  }
+}
+
+static uint32_t next_key(BenchContext *context) {
+  uint32_t key = context->keys[context->next_key];
+  context->next_key = (context->next_key + 1) % BENCH_NUM_KEYS;
+  return key;
+}
+
+/*
+ * Times one benchmark and records its result.
+ *
+ * Parameters:
+ * - name: The benchmark's name in the report.
+ * - batch: Runs a batch of operations. Only this is timed.
+ * - prepare: Optionally puts the context back into its starting state before
+ * every batch, untimed.
+ * - context: Passed to both functions.
+ * - batch_size: The number of operations in a batch.
+ *
+ * A single operation can take only a few nanoseconds, less than reading the
+ * clock, so operations are timed in batches, and p50 and p99 are taken over
+ * the per-operation time of each batch. Batches run for a warmup period first
+ * and then until bench_seconds have passed. Allocations are counted over the
+ * measured batches, including their prepare calls.
+ *
+ * Benchmarks whose name does not contain the filter are skipped.
+ *
+ * Does not return a value.
+ */
+static void bench_measure(const char *name, BenchFunction batch,
+                          BenchPrepare prepare, void *context,
+                          uint32_t batch_size) {
+  if (bench_filter != NULL && strstr(name, bench_filter) == NULL) {
+    return;
+  }
+  if (num_results == BENCH_MAX_RESULTS) {
+    printf("Too many benchmarks.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t warmup_end = now_ns() + bench_seconds * BENCH_WARMUP_FRACTION * 1e9;
+  while (now_ns() < warmup_end) {
+    if (prepare != NULL) {
+      prepare(context);
+    }
+    batch(context, batch_size);
+  }
+
+  uint32_t num_samples = 0;
+  uint64_t timed_ns = 0;
+  uint64_t allocations = allocation_count;
+  uint64_t bytes = allocation_bytes;
+  uint64_t end = now_ns() + bench_seconds * 1e9;
+  while (num_samples < BENCH_MAX_SAMPLES && now_ns() < end) {
+    if (prepare != NULL) {
+      prepare(context);
+    }
+    uint64_t start = now_ns();
+    batch(context, batch_size);
+    uint64_t elapsed = now_ns() - start;
+    timed_ns += elapsed;
+    samples[num_samples++] = (double)elapsed / batch_size;
+  }
+  allocations = allocation_count - allocations;
+  bytes = allocation_bytes - bytes;
+
+  qsort(samples, num_samples, sizeof(double), compare_samples);
+  BenchResult *result = &results[num_results++];
+  snprintf(result->name, BENCH_NAME_SIZE, "%s", name);
+  result->ops = (uint64_t)num_samples * batch_size;
+  result->ns_per_op = (double)timed_ns / result->ops;
+  result->ops_per_sec = result->ops / (timed_ns / 1e9);
+  result->p50_ns = samples[num_samples / 2];
+  result->p99_ns = samples[(uint64_t)num_samples * 99 / 100];
+  result->allocations_per_op = (double)allocations / result->ops;
+  result->bytes_per_op = (double)bytes / result->ops;
+
+  printf("%-28s %10.1f %14.0f %10.1f %10.1f %10.2f %10.1f\n", result->name,
+         result->ns_per_op, result->ops_per_sec, result->p50_ns,
+         result->p99_ns, result->allocations_per_op, result->bytes_per_op);
+}
+
+static void get_page_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    bench_sink += *(uint8_t *)get_page(context->pager, next_key(context));
+  }
+}
+
+/*
+ * Reads pages spread evenly over the file, so each one is a different page.
+ */
+static void get_page_miss_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  uint32_t stride = context->num_pages / num_ops;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    bench_sink += *(uint8_t *)get_page(context->pager, i * stride);
+  }
+}
+
+/*
+ * Empties the pager's cache, so every get_page in the next batch is a miss.
+ * The file stays in the operating system's cache, so a miss costs a page
+ * allocation and a read system call, not a disk access.
+ */
+static void get_page_miss_prepare(void *argument) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < context->num_pages; i++) {
+    free(context->pager->pages[i]);
+    context->pager->pages[i] = NULL;
+  }
+}
+
+static void leaf_node_find_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    Cursor *cursor =
+        leaf_node_find(context->table, context->page_num, next_key(context));
+    bench_sink += cursor->cell_num;
+    free(cursor);
+  }
+}
+
+static void table_find_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    Cursor *cursor = table_find(context->table, next_key(context));
+    bench_sink += cursor->cell_num;
+    cursor_close(cursor);
+  }
+}
+
+static void leaf_node_insert_prepare(void *argument) {
+  BenchContext *context = argument;
+  initialize_leaf_node(get_page(context->pager, context->page_num));
+}
+
+/*
+ * Fills an empty leaf. Sequential inserts always append; random inserts take
+ * keys in a shuffled order, so most of them shift cells to make room.
+ */
+static void leaf_node_insert_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  void *node = get_page(context->pager, context->page_num);
+  Cursor cursor = {.table = context->table, .page_num = context->page_num};
+  for (uint32_t i = 0; i < num_ops; i++) {
+    uint32_t key = context->keys[i];
+    cursor.cell_num = leaf_node_find_cell(node, i, key);
+    leaf_node_insert(&cursor, key, &context->row);
+  }
+}
+
+static void check_scan(uint64_t num_rows, uint32_t expected) {
+  if (num_rows != expected) {
+    printf("Error: scan saw %lu rows, expected %d.\n", (unsigned long)num_rows,
+           expected);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Scans the whole table, which must hold num_ops rows, and checks that every
+ * row was seen.
+ */
+static void cursor_scan_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  Cursor *cursor = table_start(context->table);
+  uint32_t num_rows = 0;
+  while (!cursor->end_of_table) {
+    deserialize_row(cursor_value(cursor), &context->row);
+    bench_sink += context->row.id;
+    num_rows++;
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  check_scan(num_rows, num_ops);
+}
+
+static void scan_count_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  ScanQuery query = {.aggregate = SCAN_COUNT,
+                     .filter_column = SCAN_COLUMN_NONE};
+  ScanResult result;
+  scan_run(context->table, &query, &result);
+  check_scan(result.count, num_ops);
+}
+
+static void serialize_row_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    context->row.id = i;
+    serialize_row(&context->row, context->buffer);
+  }
+  bench_sink += context->buffer[0];
+}
+
+static void deserialize_row_batch(void *argument, uint32_t num_ops) {
+  BenchContext *context = argument;
+  for (uint32_t i = 0; i < num_ops; i++) {
+    deserialize_row(context->buffer, &context->row);
+    bench_sink += context->row.id;
+  }
+}
+
+static uint32_t table_height(Table *table) {
+  void *node = get_page(table->pager, table->root_page_num);
+  uint32_t height = 1;
+  while (get_node_type(node) == NODE_INTERNAL) {
+    node = get_page(table->pager, *internal_node_child(node, 0));
+    height++;
+  }
+  return height;
+}
+
+static void make_row(Row *row, uint32_t id) {
+  row->id = id;
+  sprintf(row->username, "user%d", id);
+  sprintf(row->email, "person%d@example.com", id);
+}
+
+/*
+ * Appends rows with keys first_id + 1 to num_rows to a table holding keys 1 to
+ * first_id, one leaf at a time. Stops early if the pager runs out of pages.
+ *
+ * Returns the number of rows in the table.
+ */
+static uint32_t fill_table(Table *table, uint32_t first_id, uint32_t num_rows) {
+  Row rows[LEAF_NODE_MAX_CELLS];
+  uint32_t total = first_id;
+  while (total < num_rows) {
+    uint32_t count = num_rows - total < LEAF_NODE_MAX_CELLS
+                         ? num_rows - total
+                         : LEAF_NODE_MAX_CELLS;
+    for (uint32_t i = 0; i < count; i++) {
+      make_row(&rows[i], total + i + 1);
+    }
+    uint32_t num_inserted;
+    ExecuteResult result = table_bulk_insert(table, rows, count, &num_inserted);
+    total += num_inserted;
+    if (result == EXECUTE_TABLE_FULL) {
+      break;
+    }
+  }
+  return total;
+}
+
+/*
+ * Opens the bench database afresh, exiting if it cannot be opened.
+ */
+static Table *open_empty_table(void) {
+  char error[SQLITEDB_ERRMSG_SIZE];
+  unlink(BENCH_DB_FILE);
+  Table *table = db_open(BENCH_DB_FILE, error);
+  if (table == NULL) {
+    printf("%s\n", error);
+    exit(EXIT_FAILURE);
+  }
+  return table;
+}
+
+/*
+ * Measures table_find on the largest tree of each height that fits in the
+ * pager.
+ *
+ * A first pass grows one table a leaf at a time and records the most rows
+ * seen at each height. Each height then gets a fresh table of that size.
+ * Heights past what TABLE_MAX_PAGES can hold are not reported.
+ *
+ * Returns the number of rows in the largest table.
+ */
+static uint32_t bench_table_find(BenchContext *context) {
+  uint32_t max_rows[TABLE_MAX_HEIGHT + 1] = {0};
+
+  Table *table = open_empty_table();
+  uint32_t num_rows = 0;
+  while (true) {
+    uint32_t grown =
+        fill_table(table, num_rows, num_rows + LEAF_NODE_MAX_CELLS);
+    if (grown == num_rows) {
+      break;
+    }
+    num_rows = grown;
+    uint32_t height = table_height(table);
+    if (height > TABLE_MAX_HEIGHT) {
+      break;
+    }
+    max_rows[height] = num_rows;
+  }
+  db_close(table);
+
+  for (uint32_t height = 1; height <= TABLE_MAX_HEIGHT; height++) {
+    if (max_rows[height] == 0) {
+      continue;
+    }
+    context->table = open_empty_table();
+    fill_table(context->table, 0, max_rows[height]);
+    fill_keys(context, 1, max_rows[height]);
+
+    char name[BENCH_NAME_SIZE];
+    snprintf(name, BENCH_NAME_SIZE, "table_find/height_%d", height);
+    bench_measure(name, table_find_batch, NULL, context, 256);
+    db_close(context->table);
+  }
+
+  return num_rows;
+}
+
+static void write_json(const char *filename, const char *revision) {
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    printf("Unable to open %s.\n", filename);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"version\": \"%s\",\n", SQLITEDB_VERSION);
+  fprintf(file, "  \"revision\": \"%s\",\n", revision);
+  fprintf(file, "  \"build\": \"%s\",\n", BENCH_BUILD);
+  fprintf(file, "  \"timestamp\": %ld,\n", (long)time(NULL));
+  fprintf(file, "  \"seconds_per_benchmark\": %g,\n", bench_seconds);
+  fprintf(file, "  \"benchmarks\": [\n");
+  for (uint32_t i = 0; i < num_results; i++) {
+    BenchResult *result = &results[i];
+    fprintf(file,
+            "    {\"name\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.2f, "
+            "\"ops_per_sec\": %.0f, \"p50_ns\": %.2f, \"p99_ns\": %.2f, "
+            "\"allocations_per_op\": %.4f, \"bytes_per_op\": %.2f}%s\n",
+            result->name, (unsigned long)result->ops, result->ns_per_op,
+            result->ops_per_sec, result->p50_ns, result->p99_ns,
+            result->allocations_per_op, result->bytes_per_op,
+            i + 1 < num_results ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+}
+
+/*
+ * Runs single-threaded microbenchmarks of the pager, node search, insert,
+ * scan and row serialization code.
+ *
+ * Usage: microbench [-t seconds] [-j file] [-r revision] [filter]
+ *
+ * Each benchmark runs for the given number of seconds, 0.2 by default. Only
+ * benchmarks whose name contains the filter are run. With -j, the results are
+ * also written to a JSON file, labelled with the revision given by -r, so they
+ * can be compared across versions.
+ */
+int main(int argc, char *argv[]) {
+  const char *json_file = NULL;
+  const char *revision = "unknown";
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      bench_seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      json_file = argv[++i];
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      revision = argv[++i];
+    } else {
+      bench_filter = argv[i];
+    }
+  }
+  if (bench_seconds <= 0) {
+    printf("Seconds must be positive.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  static BenchContext context;
+  make_row(&context.row, 1);
+  serialize_row(&context.row, context.buffer);
+
+  printf("%-28s %10s %14s %10s %10s %10s %10s\n", "benchmark", "ns/op",
+         "ops/s", "p50 ns", "p99 ns", "allocs/op", "bytes/op");
+
+  uint32_t num_rows = bench_table_find(&context);
+
+  // The largest table from the table_find runs is reused from here on
+  context.table = open_empty_table();
+  fill_table(context.table, 0, num_rows);
+
+  context.page_num = table_start(context.table)->page_num;
+  uint32_t leaf_cells =
+      *leaf_node_num_cells(get_page(context.table->pager, context.page_num));
+  fill_keys(&context, *leaf_node_key(get_page(context.table->pager,
+                                              context.page_num),
+                                     0),
+            leaf_cells);
+  bench_measure("leaf_node_find", leaf_node_find_batch, NULL, &context, 256);
+
+  bench_measure("cursor_scan", cursor_scan_batch, NULL, &context, num_rows);
+  bench_measure("scan_run/count", scan_count_batch, NULL, &context, num_rows);
+
+  context.pager = context.table->pager;
+  context.page_num = get_unused_page_num(context.pager);
+  order_keys(&context, LEAF_NODE_MAX_CELLS, false);
+  bench_measure("leaf_node_insert/sequential", leaf_node_insert_batch,
+                leaf_node_insert_prepare, &context, LEAF_NODE_MAX_CELLS);
+  order_keys(&context, LEAF_NODE_MAX_CELLS, true);
+  bench_measure("leaf_node_insert/random", leaf_node_insert_batch,
+                leaf_node_insert_prepare, &context, LEAF_NODE_MAX_CELLS);
+  initialize_leaf_node(get_page(context.pager, context.page_num));
+  db_close(context.table);
+
+  // A bare pager over the closed file, so its cache can be emptied at will
+  char error[SQLITEDB_ERRMSG_SIZE];
+  context.pager = pager_open(BENCH_DB_FILE, error);
+  if (context.pager == NULL) {
+    printf("%s\n", error);
+    exit(EXIT_FAILURE);
+  }
+  context.num_pages = context.pager->num_pages;
+  fill_keys(&context, 0, context.num_pages);
+  bench_measure("get_page/hit", get_page_batch, NULL, &context, 256);
+  uint32_t miss_batch = context.num_pages < BENCH_MISS_BATCH
+                            ? context.num_pages
+                            : BENCH_MISS_BATCH;
+  bench_measure("get_page/miss", get_page_miss_batch, get_page_miss_prepare,
+                &context, miss_batch);
+  pager_close(context.pager);
+
+  bench_measure("serialize_row", serialize_row_batch, NULL, &context, 256);
+  bench_measure("deserialize_row", deserialize_row_batch, NULL, &context, 256);
+
+  if (json_file != NULL) {
+    write_json(json_file, revision);
+  }
+
+  unlink(BENCH_DB_FILE);
+  return 0;
+}
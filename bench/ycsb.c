@@ -0,0 +1,851 @@
+#include "../src/btree.h"
+#include "../src/constants.h"
+#include "../src/cursor.h"
+#include "../src/node.h"
+#include "../src/serialize.h"
+#include "../src/snapshot.h"
+#include "../src/table.h"
+
+#include <math.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define YCSB_DEFAULT_RECORDS 500
+#define YCSB_DEFAULT_OPERATIONS 5000
+#define YCSB_DEFAULT_SCAN_LENGTH 100
+#define YCSB_MAX_THREADS 64
+#define YCSB_ZIPFIAN_CONSTANT 0.99
+#define YCSB_LOAD_BATCH 64
+#define YCSB_SUB_BUCKET_BITS 4
+#define YCSB_SUB_BUCKETS (1 << YCSB_SUB_BUCKET_BITS)
+#define YCSB_HISTOGRAM_SIZE (64 * YCSB_SUB_BUCKETS)
+#define YCSB_BAR_WIDTH 40
+#define YCSB_PROMPT "db > "
+#define YCSB_RESPONSE_SIZE 4096
+
+typedef enum {
+  OPERATION_READ,
+  OPERATION_UPDATE,
+  OPERATION_INSERT,
+  OPERATION_SCAN,
+  OPERATION_READ_MODIFY_WRITE,
+  NUM_OPERATIONS
+} Operation;
+
+static const char *operation_names[NUM_OPERATIONS] = {
+    "read", "update", "insert", "scan", "read-modify-write"};
+
+typedef enum {
+  DISTRIBUTION_ZIPFIAN,
+  DISTRIBUTION_UNIFORM,
+  DISTRIBUTION_LATEST
+} Distribution;
+
+static const char *distribution_names[] = {"zipfian", "uniform", "latest"};
+
+typedef struct {
+  char name;
+  double proportions[NUM_OPERATIONS];
+  Distribution distribution;
+} Workload;
+
+// The core YCSB workloads, with their default key distributions
+static const Workload workloads[] = {
+    {'a', {0.5, 0.5, 0, 0, 0}, DISTRIBUTION_ZIPFIAN},
+    {'b', {0.95, 0.05, 0, 0, 0}, DISTRIBUTION_ZIPFIAN},
+    {'c', {1, 0, 0, 0, 0}, DISTRIBUTION_ZIPFIAN},
+    {'d', {0.95, 0, 0.05, 0, 0}, DISTRIBUTION_LATEST},
+    {'e', {0, 0, 0.05, 0.95, 0}, DISTRIBUTION_ZIPFIAN},
+    {'f', {0.5, 0, 0, 0, 0.5}, DISTRIBUTION_ZIPFIAN},
+};
+
+typedef struct {
+  uint64_t items;
+  double theta;
+  double alpha;
+  double zeta_n;
+  double eta;
+} Zipfian;
+
+typedef struct {
+  uint64_t histogram[YCSB_HISTOGRAM_SIZE];
+  uint64_t count;
+  uint64_t failed;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} OperationStats;
+
+/*
+ * One connection to the engine: the table itself, or a REPL process fed
+ * through its standard input.
+ */
+typedef struct {
+  Table *table;
+  pid_t pid;
+  FILE *input;
+  int output_fd;
+  char buffer[YCSB_RESPONSE_SIZE];
+  size_t buffer_start;
+  size_t buffer_end;
+  char response[YCSB_RESPONSE_SIZE];
+} Client;
+
+typedef struct {
+  Client *client;
+  uint64_t seed;
+  uint32_t num_operations;
+  OperationStats stats[NUM_OPERATIONS];
+} Worker;
+
+typedef struct {
+  Workload workload;
+  uint32_t num_records;
+  uint32_t num_operations;
+  uint32_t num_threads;
+  uint32_t max_scan_length;
+  const char *repl;
+  const char *json_file;
+} Options;
+
+static Options options;
+static Zipfian zipfian;
+static uint32_t next_insert_key;
+static uint32_t latest_key;
+static bool *acknowledged;
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *seed) {
+  // xorshift64*
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * 2685821657736338717ULL;
+}
+
+static double next_double(uint64_t *seed) {
+  return (next_random(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Prepares a zipfian generator over [0, items), following Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases", as YCSB does.
+ * Rank 0 is the most popular.
+ */
+static void zipfian_init(Zipfian *generator, uint64_t items, double theta) {
+  double zeta_2 = 1 + pow(0.5, theta);
+  generator->items = items;
+  generator->theta = theta;
+  generator->alpha = 1 / (1 - theta);
+  generator->zeta_n = 0;
+  for (uint64_t i = 1; i <= items; i++) {
+    generator->zeta_n += 1 / pow(i, theta);
+  }
+  generator->eta = (1 - pow(2.0 / items, 1 - theta)) /
+                   (1 - zeta_2 / generator->zeta_n);
+}
+
+static uint64_t zipfian_next(Zipfian *generator, uint64_t *seed) {
+  double u = next_double(seed);
+  double uz = u * generator->zeta_n;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + pow(0.5, generator->theta)) {
+    return 1;
+  }
+  uint64_t rank = generator->items *
+                  pow(generator->eta * u - generator->eta + 1,
+                      generator->alpha);
+  return rank < generator->items ? rank : generator->items - 1;
+}
+
+static uint64_t fnv_hash(uint64_t value) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < 8; i++) {
+    hash ^= value & 0xff;
+    hash *= 1099511628211ULL;
+    value >>= 8;
+  }
+  return hash;
+}
+
+/*
+ * Picks the key of an existing row.
+ *
+ * Zipfian ranks are hashed onto the keys, so the popular keys are spread over
+ * the whole table rather than bunched at the start, like YCSB's scrambled
+ * zipfian. Latest ranks count back from the most recent insert.
+ */
+static uint32_t choose_key(uint64_t *seed) {
+  switch (options.workload.distribution) {
+  case DISTRIBUTION_UNIFORM:
+    return 1 + next_random(seed) % options.num_records;
+  case DISTRIBUTION_LATEST: {
+    uint32_t latest = __atomic_load_n(&latest_key, __ATOMIC_ACQUIRE);
+    uint64_t rank = zipfian_next(&zipfian, seed);
+    return rank < latest ? latest - rank : 1;
+  }
+  default:
+    return 1 + fnv_hash(zipfian_next(&zipfian, seed)) % options.num_records;
+  }
+}
+
+/*
+ * Records that an insert finished, and moves latest_key past every key that
+ * has now finished along with all the keys before it. Concurrent inserts can
+ * finish out of order, and reads must only pick keys that are already in.
+ */
+static void acknowledge_insert(uint32_t key) {
+  uint32_t last_key = options.num_records + options.num_operations;
+  __atomic_store_n(&acknowledged[key], true, __ATOMIC_RELEASE);
+  uint32_t latest = __atomic_load_n(&latest_key, __ATOMIC_ACQUIRE);
+  while (latest < last_key &&
+         __atomic_load_n(&acknowledged[latest + 1], __ATOMIC_ACQUIRE)) {
+    if (__atomic_compare_exchange_n(&latest_key, &latest, latest + 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      latest++;
+    }
+  }
+}
+
+static void make_row(Row *row, uint32_t id, uint64_t version) {
+  row->id = id;
+  sprintf(row->username, "user%d", id);
+  sprintf(row->email, "person%d.%lu@example.com", id, (unsigned long)version);
+}
+
+/*
+ * Reads a REPL's output up to and including its next prompt, and stores what
+ * came before the prompt in the client's response.
+ *
+ * Output past the size of the response, such as the rows of a long scan, is
+ * read and counted but not kept.
+ *
+ * Returns the number of lines in the response.
+ */
+static uint32_t repl_read_response(Client *client) {
+  size_t prompt_length = strlen(YCSB_PROMPT);
+  char tail[sizeof(YCSB_PROMPT)] = {0};
+  size_t length = 0;
+  uint32_t num_lines = 0;
+
+  while (true) {
+    if (client->buffer_start == client->buffer_end) {
+      ssize_t bytes_read =
+          read(client->output_fd, client->buffer, sizeof(client->buffer));
+      if (bytes_read <= 0) {
+        printf("The REPL exited unexpectedly.\n");
+        exit(EXIT_FAILURE);
+      }
+      client->buffer_start = 0;
+      client->buffer_end = bytes_read;
+    }
+    char c = client->buffer[client->buffer_start++];
+    memmove(tail, tail + 1, prompt_length - 1);
+    tail[prompt_length - 1] = c;
+    if (length < YCSB_RESPONSE_SIZE - 1) {
+      client->response[length] = c;
+    }
+    length++;
+    if (c == '\n') {
+      num_lines++;
+    }
+    if (length >= prompt_length && strcmp(tail, YCSB_PROMPT) == 0) {
+      break;
+    }
+  }
+
+  length -= prompt_length;
+  client->response[length < YCSB_RESPONSE_SIZE ? length
+                                               : YCSB_RESPONSE_SIZE - 1] = '\0';
+  return num_lines;
+}
+
+/*
+ * Sends one statement to a REPL and waits for it to finish.
+ *
+ * Returns the number of lines it printed.
+ */
+static uint32_t repl_run(Client *client, const char *format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  vfprintf(client->input, format, arguments);
+  va_end(arguments);
+  fputc('\n', client->input);
+  fflush(client->input);
+  return repl_read_response(client);
+}
+
+/*
+ * Starts the REPL binary on the database file, connected through two pipes.
+ */
+static void repl_open(Client *client, const char *filename) {
+  int input_pipe[2];
+  int output_pipe[2];
+  if (pipe(input_pipe) == -1 || pipe(output_pipe) == -1) {
+    printf("Error creating pipes: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  client->pid = fork();
+  if (client->pid == -1) {
+    printf("Error starting the REPL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  if (client->pid == 0) {
+    dup2(input_pipe[0], STDIN_FILENO);
+    dup2(output_pipe[1], STDOUT_FILENO);
+    close(input_pipe[0]);
+    close(input_pipe[1]);
+    close(output_pipe[0]);
+    close(output_pipe[1]);
+    execl(options.repl, options.repl, filename, (char *)NULL);
+    _exit(127);
+  }
+
+  close(input_pipe[0]);
+  close(output_pipe[1]);
+  client->input = fdopen(input_pipe[1], "w");
+  client->output_fd = output_pipe[0];
+  repl_read_response(client);
+}
+
+static void repl_close(Client *client) {
+  fprintf(client->input, ".exit\n");
+  fclose(client->input);
+  close(client->output_fd);
+  waitpid(client->pid, NULL, 0);
+}
+
+static bool client_read(Client *client, uint32_t key) {
+  if (client->table != NULL) {
+    Row row;
+    return table_get(client->table, key, &row) && row.id == key;
+  }
+  repl_run(client, "select where id = %d", key);
+  return client->response[0] == '(';
+}
+
+static bool client_write(Client *client, Operation operation, Row *row) {
+  if (client->table != NULL) {
+    if (operation == OPERATION_INSERT) {
+      return table_insert(client->table, row) == EXECUTE_SUCCESS;
+    }
+    return table_update(client->table, row) == EXECUTE_SUCCESS;
+  }
+  repl_run(client, "%s %d %s %s",
+           operation == OPERATION_INSERT ? "insert" : "update", row->id,
+           row->username, row->email);
+  return strcmp(client->response, "Executed.\n") == 0;
+}
+
+/*
+ * Reads up to length rows in key order, starting at the first key at or
+ * after start. In-process scans read a snapshot, so they never wait for
+ * writers. The REPL has no limit clause, so it reads every row from start on.
+ */
+static bool client_scan(Client *client, uint32_t start, uint32_t length) {
+  if (client->table == NULL) {
+    // The last line is the "Executed." that ends every select
+    return repl_run(client, "select where id > %d", start - 1) > 1;
+  }
+
+  Snapshot *snapshot = snapshot_open(client->table);
+  Cursor *cursor = snapshot_find(snapshot, start);
+  uint32_t num_cells = *leaf_node_num_cells(snapshot->leaf_image);
+  if (num_cells == 0) {
+    cursor->end_of_table = true;
+  } else if (cursor->cell_num >= num_cells) {
+    cursor->cell_num = num_cells - 1;
+    cursor_advance(cursor);
+  }
+
+  Row row;
+  uint32_t num_rows = 0;
+  while (num_rows < length && !cursor->end_of_table) {
+    deserialize_row(cursor_value(cursor), &row);
+    num_rows++;
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  snapshot_close(snapshot);
+  return num_rows > 0;
+}
+
+static Operation choose_operation(uint64_t *seed) {
+  double u = next_double(seed);
+  for (int i = 0; i < NUM_OPERATIONS; i++) {
+    u -= options.workload.proportions[i];
+    if (u < 0) {
+      return i;
+    }
+  }
+  return OPERATION_READ;
+}
+
+static uint32_t histogram_index(uint64_t ns) {
+  if (ns < YCSB_SUB_BUCKETS) {
+    return ns;
+  }
+  uint32_t exponent = 63 - __builtin_clzll(ns);
+  uint32_t sub_bucket = (ns >> (exponent - YCSB_SUB_BUCKET_BITS)) &
+                        (YCSB_SUB_BUCKETS - 1);
+  return (exponent - YCSB_SUB_BUCKET_BITS + 1) * YCSB_SUB_BUCKETS + sub_bucket;
+}
+
+/*
+ * Returns the smallest latency that falls into a histogram bucket.
+ */
+static uint64_t histogram_value(uint32_t index) {
+  if (index < YCSB_SUB_BUCKETS) {
+    return index;
+  }
+  uint32_t exponent = index / YCSB_SUB_BUCKETS + YCSB_SUB_BUCKET_BITS - 1;
+  return (uint64_t)(YCSB_SUB_BUCKETS + index % YCSB_SUB_BUCKETS)
+         << (exponent - YCSB_SUB_BUCKET_BITS);
+}
+
+static uint64_t histogram_percentile(OperationStats *stats, double percentile) {
+  uint64_t rank = stats->count * percentile / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < YCSB_HISTOGRAM_SIZE; i++) {
+    seen += stats->histogram[i];
+    if (seen > rank) {
+      return histogram_value(i);
+    }
+  }
+  return stats->max_ns;
+}
+
+static void record(OperationStats *stats, uint64_t ns, bool succeeded) {
+  stats->histogram[histogram_index(ns)]++;
+  stats->count++;
+  stats->failed += succeeded ? 0 : 1;
+  stats->total_ns += ns;
+  if (ns > stats->max_ns) {
+    stats->max_ns = ns;
+  }
+}
+
+/*
+ * Runs one thread's share of the operations.
+ *
+ * Inserts take the next unused key, so the table only grows at its end, as
+ * in YCSB. An insert the table has no room for counts as failed.
+ */
+static void *worker_main(void *argument) {
+  Worker *worker = argument;
+  Client *client = worker->client;
+  Row row;
+
+  for (uint32_t i = 0; i < worker->num_operations; i++) {
+    Operation operation = choose_operation(&worker->seed);
+    uint64_t start = now_ns();
+    bool succeeded = true;
+
+    switch (operation) {
+    case OPERATION_READ:
+      succeeded = client_read(client, choose_key(&worker->seed));
+      break;
+    case OPERATION_UPDATE:
+      make_row(&row, choose_key(&worker->seed), worker->seed);
+      succeeded = client_write(client, OPERATION_UPDATE, &row);
+      break;
+    case OPERATION_INSERT: {
+      uint32_t key = __atomic_fetch_add(&next_insert_key, 1, __ATOMIC_RELAXED);
+      make_row(&row, key, 0);
+      succeeded = client_write(client, OPERATION_INSERT, &row);
+      if (succeeded) {
+        acknowledge_insert(key);
+      }
+      break;
+    }
+    case OPERATION_SCAN: {
+      uint32_t length = 1 + next_random(&worker->seed) % options.max_scan_length;
+      succeeded = client_scan(client, choose_key(&worker->seed), length);
+      break;
+    }
+    case OPERATION_READ_MODIFY_WRITE: {
+      uint32_t key = choose_key(&worker->seed);
+      succeeded = client_read(client, key);
+      make_row(&row, key, worker->seed);
+      succeeded = client_write(client, OPERATION_UPDATE, &row) && succeeded;
+      break;
+    }
+    default:
+      break;
+    }
+
+    record(&worker->stats[operation], now_ns() - start, succeeded);
+  }
+
+  return NULL;
+}
+
+/*
+ * Loads rows with keys 1 to num_records into an empty database.
+ */
+static void load(Client *client) {
+  if (client->table == NULL) {
+    for (uint32_t id = 1; id <= options.num_records; id++) {
+      Row row;
+      make_row(&row, id, 0);
+      if (!client_write(client, OPERATION_INSERT, &row)) {
+        printf("Error: could only load %d records.\n", id - 1);
+        exit(EXIT_FAILURE);
+      }
+    }
+    return;
+  }
+
+  Row rows[YCSB_LOAD_BATCH];
+  for (uint32_t first = 1; first <= options.num_records;
+       first += YCSB_LOAD_BATCH) {
+    uint32_t count = options.num_records - first + 1 < YCSB_LOAD_BATCH
+                         ? options.num_records - first + 1
+                         : YCSB_LOAD_BATCH;
+    for (uint32_t i = 0; i < count; i++) {
+      make_row(&rows[i], first + i, 0);
+    }
+    uint32_t num_inserted;
+    if (table_bulk_insert(client->table, rows, count, &num_inserted) ==
+        EXECUTE_TABLE_FULL) {
+      printf("Error: could only load %d records.\n", first - 1 + num_inserted);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void format_ns(uint64_t ns, char *buffer, size_t size) {
+  if (ns < 1000) {
+    snprintf(buffer, size, "%luns", (unsigned long)ns);
+  } else if (ns < 1000000) {
+    snprintf(buffer, size, "%.1fus", ns / 1e3);
+  } else if (ns < 1000000000) {
+    snprintf(buffer, size, "%.1fms", ns / 1e6);
+  } else {
+    snprintf(buffer, size, "%.2fs", ns / 1e9);
+  }
+}
+
+/*
+ * Prints a latency histogram, folding the fine buckets into powers of two.
+ */
+static void print_histogram(OperationStats *stats) {
+  uint64_t counts[64] = {0};
+  uint64_t largest = 0;
+  for (uint32_t i = 0; i < YCSB_HISTOGRAM_SIZE; i++) {
+    if (stats->histogram[i] > 0) {
+      uint64_t value = histogram_value(i);
+      uint32_t exponent = value == 0 ? 0 : 63 - __builtin_clzll(value);
+      counts[exponent] += stats->histogram[i];
+      if (counts[exponent] > largest) {
+        largest = counts[exponent];
+      }
+    }
+  }
+
+  for (uint32_t exponent = 0; exponent < 64; exponent++) {
+    if (counts[exponent] == 0) {
+      continue;
+    }
+    char low[16];
+    char high[16];
+    format_ns(exponent == 0 ? 0 : 1ULL << exponent, low, sizeof(low));
+    format_ns(1ULL << (exponent + 1), high, sizeof(high));
+    int width = counts[exponent] * YCSB_BAR_WIDTH / largest;
+    printf("  %8s - %-8s %10lu %.*s\n", low, high,
+           (unsigned long)counts[exponent], width > 0 ? width : 1,
+           "########################################");
+  }
+}
+
+static void write_json(OperationStats *stats, double load_seconds,
+                       double run_seconds) {
+  FILE *file = fopen(options.json_file, "w");
+  if (file == NULL) {
+    printf("Unable to open %s.\n", options.json_file);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"workload\": \"%c\",\n", options.workload.name);
+  fprintf(file, "  \"distribution\": \"%s\",\n",
+          distribution_names[options.workload.distribution]);
+  fprintf(file, "  \"path\": \"%s\",\n",
+          options.repl != NULL ? "repl" : "in-process");
+  fprintf(file, "  \"records\": %d,\n", options.num_records);
+  fprintf(file, "  \"operations\": %d,\n", options.num_operations);
+  fprintf(file, "  \"threads\": %d,\n", options.num_threads);
+  fprintf(file, "  \"load_seconds\": %.6f,\n", load_seconds);
+  fprintf(file, "  \"run_seconds\": %.6f,\n", run_seconds);
+  fprintf(file, "  \"ops_per_sec\": %.0f,\n",
+          options.num_operations / run_seconds);
+  fprintf(file, "  \"operations_by_type\": [\n");
+  bool first = true;
+  for (int i = 0; i < NUM_OPERATIONS; i++) {
+    if (stats[i].count == 0) {
+      continue;
+    }
+    fprintf(file,
+            "%s    {\"name\": \"%s\", \"count\": %lu, \"failed\": %lu, "
+            "\"mean_ns\": %.0f, \"p50_ns\": %lu, \"p95_ns\": %lu, "
+            "\"p99_ns\": %lu, \"max_ns\": %lu, \"histogram\": [",
+            first ? "" : ",\n", operation_names[i],
+            (unsigned long)stats[i].count, (unsigned long)stats[i].failed,
+            (double)stats[i].total_ns / stats[i].count,
+            (unsigned long)histogram_percentile(&stats[i], 50),
+            (unsigned long)histogram_percentile(&stats[i], 95),
+            (unsigned long)histogram_percentile(&stats[i], 99),
+            (unsigned long)stats[i].max_ns);
+    bool first_bucket = true;
+    for (uint32_t j = 0; j < YCSB_HISTOGRAM_SIZE; j++) {
+      if (stats[i].histogram[j] > 0) {
+        fprintf(file, "%s[%lu, %lu]", first_bucket ? "" : ", ",
+                (unsigned long)histogram_value(j),
+                (unsigned long)stats[i].histogram[j]);
+        first_bucket = false;
+      }
+    }
+    fprintf(file, "]}");
+    first = false;
+  }
+  fprintf(file, "\n  ]\n}\n");
+  fclose(file);
+}
+
+static void report(OperationStats *stats, double load_seconds,
+                   double run_seconds) {
+  printf("Load: %d records in %.3f s (%.0f records/s)\n", options.num_records,
+         load_seconds, options.num_records / load_seconds);
+  printf("Run: %d operations in %.3f s (%.0f ops/s)\n\n",
+         options.num_operations, run_seconds,
+         options.num_operations / run_seconds);
+
+  printf("%-18s %10s %8s %9s %9s %9s %9s %9s\n", "operation", "count",
+         "failed", "mean", "p50", "p95", "p99", "max");
+  for (int i = 0; i < NUM_OPERATIONS; i++) {
+    if (stats[i].count == 0) {
+      continue;
+    }
+    char mean[16], p50[16], p95[16], p99[16], max[16];
+    format_ns(stats[i].total_ns / stats[i].count, mean, sizeof(mean));
+    format_ns(histogram_percentile(&stats[i], 50), p50, sizeof(p50));
+    format_ns(histogram_percentile(&stats[i], 95), p95, sizeof(p95));
+    format_ns(histogram_percentile(&stats[i], 99), p99, sizeof(p99));
+    format_ns(stats[i].max_ns, max, sizeof(max));
+    printf("%-18s %10lu %8lu %9s %9s %9s %9s %9s\n", operation_names[i],
+           (unsigned long)stats[i].count, (unsigned long)stats[i].failed,
+           mean, p50, p95, p99, max);
+  }
+
+  for (int i = 0; i < NUM_OPERATIONS; i++) {
+    if (stats[i].count > 0) {
+      printf("\n%s latency\n", operation_names[i]);
+      print_histogram(&stats[i]);
+    }
+  }
+
+  if (options.json_file != NULL) {
+    write_json(stats, load_seconds, run_seconds);
+  }
+}
+
+static void usage() {
+  printf("Usage: ycsb [-w a|b|c|d|e|f] [-d zipfian|uniform|latest] "
+         "[-r records] [-o operations] [-t threads] [-s max_scan_length] "
+         "[-R repl] [-j file]\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parse_options(int argc, char *argv[]) {
+  options.workload = workloads[0];
+  options.num_records = YCSB_DEFAULT_RECORDS;
+  options.num_operations = YCSB_DEFAULT_OPERATIONS;
+  options.num_threads = 1;
+  options.max_scan_length = YCSB_DEFAULT_SCAN_LENGTH;
+
+  int distribution = -1;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' ||
+        i + 1 >= argc) {
+      usage();
+    }
+    char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 'w': {
+      bool found = false;
+      for (size_t j = 0; j < sizeof(workloads) / sizeof(workloads[0]); j++) {
+        if (value[0] == workloads[j].name && value[1] == '\0') {
+          options.workload = workloads[j];
+          found = true;
+        }
+      }
+      if (!found) {
+        usage();
+      }
+      break;
+    }
+    case 'd':
+      for (int j = 0; j < 3; j++) {
+        if (strcmp(value, distribution_names[j]) == 0) {
+          distribution = j;
+        }
+      }
+      if (distribution == -1) {
+        usage();
+      }
+      break;
+    case 'r':
+      options.num_records = atoi(value);
+      break;
+    case 'o':
+      options.num_operations = atoi(value);
+      break;
+    case 't':
+      options.num_threads = atoi(value);
+      break;
+    case 's':
+      options.max_scan_length = atoi(value);
+      break;
+    case 'R':
+      options.repl = value;
+      break;
+    case 'j':
+      options.json_file = value;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (distribution != -1) {
+    options.workload.distribution = distribution;
+  }
+
+  if (options.num_records < 1 || options.num_operations < 1 ||
+      options.max_scan_length < 1) {
+    printf("Records, operations and scan length must be positive.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (options.num_threads < 1 || options.num_threads > YCSB_MAX_THREADS) {
+    printf("Thread count must be between 1 and %d.\n", YCSB_MAX_THREADS);
+    exit(EXIT_FAILURE);
+  }
+  if (options.repl != NULL && options.num_threads > 1) {
+    // Separate REPL processes on one file would not see each other's writes
+    printf("The REPL path runs a single thread.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Runs a YCSB-style workload against the engine.
+ *
+ * Usage: ycsb [-w a|b|c|d|e|f] [-d zipfian|uniform|latest] [-r records]
+ *             [-o operations] [-t threads] [-s max_scan_length] [-R repl]
+ *             [-j file]
+ *
+ * The workloads are YCSB's core ones: a is half reads, half updates; b is 95%
+ * reads; c is read only; d reads the latest inserts; e scans short ranges;
+ * f reads and then updates the same row. -d replaces the workload's key
+ * distribution.
+ *
+ * A fresh temporary database is loaded with the given number of records,
+ * then the operations are split across the threads. By default the engine
+ * runs in this process; with -R, statements are sent through the standard
+ * input of the REPL binary given instead. Throughput and per-operation
+ * latency histograms are printed, and with -j also written as JSON.
+ */
+int main(int argc, char *argv[]) {
+  parse_options(argc, argv);
+
+  const char *directory = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+  char filename[256];
+  snprintf(filename, sizeof(filename), "%s/ycsb-XXXXXX", directory);
+  int fd = mkstemp(filename);
+  if (fd == -1) {
+    printf("Unable to create a temporary database in %s.\n", directory);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  zipfian_init(&zipfian, options.num_records, YCSB_ZIPFIAN_CONSTANT);
+  next_insert_key = options.num_records + 1;
+  latest_key = options.num_records;
+  acknowledged =
+      calloc(options.num_records + options.num_operations + 1, sizeof(bool));
+
+  printf("Workload %c: %d records, %d operations, %s keys, %d thread%s, %s\n",
+         options.workload.name, options.num_records, options.num_operations,
+         distribution_names[options.workload.distribution],
+         options.num_threads, options.num_threads == 1 ? "" : "s",
+         options.repl != NULL ? "through the REPL" : "in-process");
+
+  static Client client;
+  if (options.repl != NULL) {
+    repl_open(&client, filename);
+  } else {
+    char error[SQLITEDB_ERRMSG_SIZE];
+    client.table = db_open(filename, error);
+    if (client.table == NULL) {
+      printf("%s\n", error);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  uint64_t start = now_ns();
+  load(&client);
+  double load_seconds = (now_ns() - start) / 1e9;
+
+  Worker *workers = calloc(options.num_threads, sizeof(Worker));
+  pthread_t threads[YCSB_MAX_THREADS];
+  start = now_ns();
+  for (uint32_t i = 0; i < options.num_threads; i++) {
+    workers[i].client = &client;
+    workers[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    workers[i].num_operations = options.num_operations / options.num_threads +
+                                (i < options.num_operations %
+                                         options.num_threads
+                                     ? 1
+                                     : 0);
+    pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+  }
+  for (uint32_t i = 0; i < options.num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double run_seconds = (now_ns() - start) / 1e9;
+
+  static OperationStats totals[NUM_OPERATIONS];
+  for (uint32_t i = 0; i < options.num_threads; i++) {
+    for (int j = 0; j < NUM_OPERATIONS; j++) {
+      OperationStats *from = &workers[i].stats[j];
+      OperationStats *to = &totals[j];
+      for (uint32_t k = 0; k < YCSB_HISTOGRAM_SIZE; k++) {
+        to->histogram[k] += from->histogram[k];
+      }
+      to->count += from->count;
+      to->failed += from->failed;
+      to->total_ns += from->total_ns;
+      to->max_ns = from->max_ns > to->max_ns ? from->max_ns : to->max_ns;
+    }
+  }
+  report(totals, load_seconds, run_seconds);
+
+  if (options.repl != NULL) {
+    repl_close(&client);
+  } else {
+    db_close(client.table);
+  }
+  char wal_filename[sizeof(filename) + 4];
+  snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+  unlink(filename);
+  unlink(wal_filename);
+  free(workers);
+  free(acknowledged);
+  return 0;
+}
@@ -1,11 +1,11 @@
 describe 'database' do
   before do
-    `rm -rf test.db`
+    `rm -rf test.db test.db-wal`
   end
 
-    def run_script(commands)
+    def run_script(commands, options = [])
       raw_output = nil
-      IO.popen("./main test.db", "r+") do |pipe|
+      IO.popen(["./main", *options, "test.db"], "r+") do |pipe|
         commands.each do |command|
           pipe.puts command
         end
@@ -137,15 +137,195 @@ describe 'database' do
       expect(result).to match_array([
         "db > Constants:",
         "ROW_SIZE: 293",
-        "COMMON_NODE_HEADER_SIZE: 6",
-        "LEAF_NODE_HEADER_SIZE: 10",
+        "COMMON_NODE_HEADER_SIZE: 12",
+        "LEAF_NODE_HEADER_SIZE: 16",
         "LEAF_NODE_CELL_SIZE: 297",
-        "LEAF_NODE_SPACE_FOR_CELLS: 4086",
+        "LEAF_NODE_SPACE_FOR_CELLS: 4080",
         "LEAF_NODE_MAX_CELLS: 13",
         "db > ",
       ])
     end
 
+    it 'times and profiles statements' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        ".timer on",
+        ".profile on",
+        "select",
+        ".timer off",
+        ".profile off",
+        "select",
+        ".exit",
+      ])
+      expect(result[0..2]).to eq([
+        "db > Executed.",
+        "db > db > db > (1, user1, person1@example.com)",
+        "Executed.",
+      ])
+      expect(result[3]).to match(/^Run Time: real \d+\.\d{6} cpu \d+\.\d{6}$/)
+      expect(result[4]).to match(/^Pages: read \d+ written 0 cache hits \d+ misses \d+$/)
+      expect(result[5]).to eq("Profile:")
+      ["parse", "descent", "page I/O", "serialize", "output", "other"].each_with_index do |phase, i|
+        expect(result[6 + i]).to match(/^  #{Regexp.escape(phase)} +\d+\.\d{6} +\d+\.\d%$/)
+      end
+      expect(result[12..]).to eq([
+        "db > db > db > (1, user1, person1@example.com)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'prints pager and tree statistics' do
+      script = (1..14).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".stats"
+      script << ".exit"
+      result = run_script(script)
+
+      pager = result[14..-12]
+      expect(pager[0]).to eq("db > Pager:")
+      expect(pager[1]).to match(/^  cache hits: \d+$/)
+      expect(pager[2..4]).to eq([
+        "  cache misses: 3",
+        "  cache evictions: 0",
+        "  cached pages: 3",
+      ])
+      # The log header, then a frame per insert and two more for the split
+      expect(pager[5..7]).to eq([
+        "  bytes read: 0",
+        "  bytes written: #{16 + 16 * (12 + 4096)}",
+        "  fsyncs: 15",
+      ])
+      expect(result[-11..]).to eq([
+        "Tree:",
+        "  height: 2",
+        "  rows: 14",
+        "  pages: 3",
+        "  leaf pages: 2",
+        "  internal pages: 1",
+        "  free pages: 0",
+        "  leaf fill: 53.8%",
+        "  internal fill: 0.2%",
+        "  splits: 1",
+        "db > ",
+      ])
+    end
+
+    it 'logs slow statements' do
+      `rm -f test.log`
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        ".slowlog test.log 0",
+        "insert 2 user2 person2@example.com",
+        "select",
+        ".slowlog off",
+        "select",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > Executed.",
+        "db > db > Executed.",
+        "db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "Executed.",
+        "db > db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "Executed.",
+        "db > ",
+      ])
+
+      log = File.readlines("test.log", chomp: true)
+      `rm -f test.log`
+      expect(log.length).to eq(2)
+      expect(log[0]).to match(/^\d{4}-\d\d-\d\dT\d\d:\d\d:\d\dZ duration_ms=\d+\.\d{3} pages=\d+ cache_misses=\d+ io_wait_ms=\d+\.\d{3} rows_examined=0 rows_returned=0 sql="insert 2 user2 person2@example.com"$/)
+      expect(log[1]).to match(/ rows_examined=2 rows_returned=2 sql="select"$/)
+    end
+
+    it 'leaves rolled back inserts out of the row estimate' do
+      insert = lambda { |i| "insert #{i} user#{i} person#{i}@example.com" }
+      script = (1..20).map(&insert) + ["explain select", "begin"] +
+               (21..23).map(&insert) + ["rollback", "explain select", "begin",
+               insert.call(21), "savepoint s", insert.call(22),
+               insert.call(23), "rollback to s", "commit", "explain select",
+               ".exit"]
+      result = run_script(script)
+      estimates = result.grep(/SCAN table/).map { |line| line[/est\. rows=\d+/] }
+      expect(estimates).to eq(["est. rows=20", "est. rows=20", "est. rows=21"])
+    end
+
+    it 'explains statements' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        "insert 2 user2 person2@example.com",
+        "explain select",
+        "explain select count(*) where username = user2",
+        "explain analyze select sum(id) where id > 1",
+        "explain analyze insert 3 user3 person3@example.com",
+        "explain explain select",
+        "select count(*)",
+        ".exit",
+      ])
+      expect(result[0..3]).to eq([
+        "db > Executed.",
+        "db > Executed.",
+        "db > SCAN table in key order (est. rows=2 pages=1)",
+        "Executed.",
+      ])
+      expect(result[4]).to eq("db > AGGREGATE count(*)")
+      expect(result[5]).to match(/^  PARALLEL SCAN table on up to \d+ workers?, filter username = user2 on rows \(est\. rows=1 pages=1\)$/)
+      expect(result[7]).to match(/^db > AGGREGATE sum\(id\) \(actual rows=1 examined=1 pages=1 time=\d+\.\d{3} ms\)$/)
+      expect(result[8]).to match(/^  RANGE SCAN table id > 1 \(est\. rows=1 pages=1; actual rows=1 examined=1 pages=1 time=\d+\.\d{3} ms\)$/)
+      expect(result[10]).to match(/^db > INSERT, SEEK table_find id = 3 \(est\. rows=1 pages=1; actual rows=1 examined=0 pages=\d+ time=\d+\.\d{3} ms\)$/)
+      expect(result[11..]).to eq([
+        "Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > (3)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'chooses access paths from table statistics' do
+      script = (1..100).map do |i|
+        "insert #{i} user#{i % 4} person#{i}@example.com"
+      end
+      script += [
+        "explain select where id = 50",
+        "select where id = 50",
+        "explain analyze select count(*) where id < 11",
+        "select count(*) where id > 90",
+        "analyze",
+        "explain select where username = user1",
+        "insert 101 user1 person101@example.com",
+        "explain select",
+        ".exit",
+      ]
+      result = run_script(script)
+      expect(result[100..103]).to eq([
+        "db > SEEK table_find id = 50 (est. rows=1 pages=2)",
+        "Executed.",
+        "db > (50, user2, person50@example.com)",
+        "Executed.",
+      ])
+      # A selective range is read by a cursor, never by the parallel scan
+      expect(result[104]).to match(/^db > AGGREGATE count\(\*\) \(actual rows=1 examined=11 pages=4 time=\d+\.\d{3} ms\)$/)
+      expect(result[105]).to match(/^  RANGE SCAN table id < 11 \(est\. rows=10 pages=4; actual rows=10 examined=11 pages=4 time=\d+\.\d{3} ms\)$/)
+      expect(result[106..109]).to eq([
+        "Executed.",
+        "db > (10)",
+        "Executed.",
+        "db > Executed.",
+      ])
+      expect(result[110]).to match(/^db > PARALLEL SCAN table on up to \d+ workers?, filter username = user1 on rows \(est\. rows=25 pages=15\)$/)
+      expect(result[111..]).to eq([
+        "Executed.",
+        "db > Executed.",
+        "db > SCAN table in key order (est. rows=101 pages=16)",
+        "Executed.",
+        "db > ",
+      ])
+    end
 
     it 'prints an error message if there is a duplicate id' do
       script = [
@@ -164,6 +344,53 @@ describe 'database' do
       ])
     end
 
+    it 'updates a row in place' do
+      script = (1..14).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script += [
+        "update 9 renamed renamed@example.com",
+        "update 15 user15 person15@example.com",
+        "select where id > 7",
+        ".exit",
+      ]
+      result = run_script(script)
+      expect(result[14...(result.length)]).to eq([
+        "db > Executed.",
+        "db > Error: No such key.",
+        "db > (8, user8, person8@example.com)",
+        "(9, renamed, renamed@example.com)",
+      ] + (10..14).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } + [
+        "Executed.",
+        "db > ",
+      ])
+
+      `rm -rf test.db`
+      result = run_script(script, ["--cow"])
+      expect(result[14...(result.length)]).to eq([
+        "db > Executed.",
+        "db > Error: No such key.",
+        "db > (8, user8, person8@example.com)",
+        "(9, renamed, renamed@example.com)",
+      ] + (10..14).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } + [
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'flushes the prompt before waiting for input' do
+      IO.popen(["./main", "test.db"], "r+") do |pipe|
+        # Without the flush, the prompt sits in the buffer while the REPL
+        # waits for a line the other end only sends once it sees the prompt
+        expect(IO.select([pipe], nil, nil, 5)).to be_truthy
+        expect(pipe.readpartial(64)).to eq("db > ")
+        pipe.puts "insert 1 user1 person1@example.com"
+        expect(IO.select([pipe], nil, nil, 5)).to be_truthy
+        expect(pipe.readpartial(64)).to eq("Executed.\ndb > ")
+        pipe.puts ".exit"
+      end
+    end
+
     it 'allows printing out the structure of a 3-leaf-node btree' do
         script = (1..14).map do |i|
           "insert #{i} user#{i} person#{i}@example.com"
@@ -193,7 +420,613 @@ describe 'database' do
           "    - 12",
           "    - 13",
           "    - 14",
-          "db > Need to implement searching an internal node",
+          "db > Executed.",
+          "db > ",
         ])
     end
-end
\ No newline at end of file
+
+    it 'prints all rows in a multi-level tree' do
+      script = (1..30).to_a.reverse.map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << "select"
+      script << ".exit"
+      result = run_script(script)
+
+      expect(result[30...(result.length)]).to eq(
+        ["db > (1, user1, person1@example.com)"] +
+        (2..30).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+        ["Executed.", "db > "]
+      )
+    end
+
+    it 'imports rows from a csv file' do
+      # -0 is the id 0
+      File.write("test.csv", "id,username,email\n" + (1..40).to_a.shuffle.map { |i|
+        "#{i},user#{i},person#{i}@example.com\n"
+      }.join + "-0,user0,person0@example.com\n")
+      result = run_script([
+        "insert 5 user5 person5@example.com",
+        ".import test.csv",
+        "select",
+        ".exit",
+      ])
+      File.delete("test.csv")
+
+      expect(result[0...2]).to eq([
+        "db > Executed.",
+        "db > Imported 40 rows (1 duplicate keys skipped).",
+      ])
+      expect(result[2...(result.length)]).to eq(
+        ["db > (0, user0, person0@example.com)"] +
+        (1..40).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+        ["Executed.", "db > "]
+      )
+    end
+
+    it 'builds an empty table from an import in packed leaves' do
+      ids = (1..30).to_a + [7, 21]
+      File.write("test.csv", ids.shuffle.map { |i|
+        "#{i},user#{i},person#{i}@example.com\n"
+      }.join)
+      result = run_script([
+        ".import test.csv",
+        ".btree",
+        ".exit",
+      ])
+      File.delete("test.csv")
+
+      expect(result).to eq([
+        "db > Imported 30 rows (2 duplicate keys skipped).",
+        "db > Tree:",
+        "- internal (size 2)",
+        "  - leaf (size 13)",
+      ] + (1..13).map { |i| "    - #{i}" } + [
+        "  - key 13",
+        "  - leaf (size 13)",
+      ] + (14..26).map { |i| "    - #{i}" } + [
+        "  - key 26",
+        "  - leaf (size 4)",
+      ] + (27..30).map { |i| "    - #{i}" } + [
+        "db > ",
+      ])
+    end
+
+    it 'undoes an import that does not fit' do
+      File.write("test.csv", (1..2000).map { |i|
+        "#{i},user#{i},person#{i}@example.com\n"
+      }.join)
+      result = run_script([
+        ".import test.csv",
+        "select count(*)",
+        "begin",
+        "insert 5000 user5000 person5000@example.com",
+        ".import test.csv",
+        "commit",
+        "select count(*)",
+        ".exit",
+      ])
+      File.delete("test.csv")
+
+      expect(result).to eq([
+        "db > Error: Table full.",
+        "db > (0)",
+        "Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Error: Table full.",
+        "db > Executed.",
+        "db > (1)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'rejects an import with a malformed row' do
+      File.write("test.tsv", "1\tuser1\tperson1@example.com\n2\tuser2\n")
+      result = run_script([
+        ".import test.tsv tsv",
+        "select",
+        ".exit",
+      ])
+      File.delete("test.tsv")
+
+      expect(result).to eq([
+        "db > Error on line 2: Syntax error. Could not parse row.",
+        "db > Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'undoes a restore that does not fit' do
+      require 'zlib'
+      body = (1..2000).map { |i|
+        username = "user#{i}"
+        email = "person#{i}@example.com"
+        [i, username.bytesize].pack("VC") + username +
+          [email.bytesize].pack("C") + email
+      }.join
+      File.binwrite("test.dump", "SQLTDUMP" + [1, 0].pack("VV") + body +
+                    [2000, Zlib.crc32(body)].pack("Q<V"))
+      result = run_script([
+        ".restore test.dump",
+        "select count(*)",
+        ".exit",
+      ])
+      File.delete("test.dump")
+
+      expect(result).to eq([
+        "db > Error: Table full.",
+        "db > (0)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'restores a dump into an empty database' do
+      script = (1..30).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".dump test.dump"
+      script << ".exit"
+      result = run_script(script)
+      expect(result[-2]).to eq("db > Dumped 30 rows.")
+
+      `rm -rf test.db`
+      result = run_script([
+        ".restore test.dump",
+        "select",
+        ".exit",
+      ])
+      File.delete("test.dump")
+
+      expect(result).to eq(
+        ["db > Restored 30 rows.", "db > (1, user1, person1@example.com)"] +
+        (2..30).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+        ["Executed.", "db > "]
+      )
+    end
+
+    it 'refuses to restore a corrupt dump' do
+      run_script([
+        "insert 1 user1 person1@example.com",
+        ".dump test.dump",
+        ".exit",
+      ])
+      dump = File.binread("test.dump")
+      dump[20] = (dump[20].ord ^ 1).chr
+      File.binwrite("test.dump", dump)
+
+      `rm -rf test.db`
+      result = run_script([
+        ".restore test.dump",
+        "select",
+        ".exit",
+      ])
+      File.delete("test.dump")
+
+      expect(result).to eq([
+        "db > Error: 'test.dump' is corrupt.",
+        "db > Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'takes a backup while the database stays open' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        ".backup test.backup",
+        "insert 2 user2 person2@example.com",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > Executed.",
+        "db > Backup complete: 1 pages copied.",
+        "db > Executed.",
+        "db > ",
+      ])
+
+      `mv test.backup test.db`
+      result = run_script([
+        "select",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > (1, user1, person1@example.com)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'recopies pages written to while a backup runs' do
+      script = (1..21).map do |i|
+        "insert #{i * 2} user#{i * 2} person#{i * 2}@example.com"
+      end
+      # One page per step, so each insert lands between two steps
+      script << ".backup test.backup 1"
+      inserted = [1, 17, 3, 43, 5, 19, 7, 45, 9]
+      script += inserted.map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".exit"
+      result = run_script(script)
+
+      # The 4 pages take 2 passes, since the inserts dirty pages the first
+      # pass already copied
+      expect(result[21...(result.length)]).to eq([
+        "db > db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "Backup complete: 8 pages copied.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > ",
+      ])
+
+      `mv test.backup test.db`
+      result = run_script([
+        "select",
+        ".exit",
+      ])
+      ids = ((1..21).map { |i| i * 2 } + inserted.first(6)).sort
+      expect(result).to eq(
+        ["db > (#{ids[0]}, user#{ids[0]}, person#{ids[0]}@example.com)"] +
+        ids.drop(1).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+        ["Executed.", "db > "]
+      )
+    end
+
+    it 'vacuums the tree into packed leaves' do
+      script = (1..20).to_a.reverse.map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".vacuum"
+      script << ".btree"
+      script << ".exit"
+      result = run_script(script)
+
+      expect(result[20...(result.length)]).to eq([
+        "db > Vacuumed 3 pages into 3.",
+        "db > Tree:",
+        "- internal (size 1)",
+        "  - leaf (size 11)",
+      ] + (1..11).map { |i| "    - #{i}" } + [
+        "  - key 11",
+        "  - leaf (size 9)",
+      ] + (12..20).map { |i| "    - #{i}" } + [
+        "db > ",
+      ])
+
+      result = run_script([
+        "select",
+        ".exit",
+      ])
+      expect(result.length).to eq(22)
+    end
+
+    it 'compacts sparse leaves and reuses the freed page' do
+      script = (1..21).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".compact"
+      script << ".btree"
+      script << ".exit"
+      result = run_script(script)
+
+      expect(result[21...(result.length)]).to eq([
+        "db > Freed 1 pages.",
+        "db > Tree:",
+        "- internal (size 1)",
+        "  - leaf (size 13)",
+      ] + (1..13).map { |i| "    - #{i}" } + [
+        "  - key 13",
+        "  - leaf (size 8)",
+      ] + (14..21).map { |i| "    - #{i}" } + [
+        "db > ",
+      ])
+
+      script = (22..27).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << ".exit"
+      run_script(script)
+      expect(File.size("test.db")).to eq(4 * 4096)
+    end
+
+    it 'rolls back a transaction' do
+      result = run_script([
+        "insert 1 user1 person1@example.com",
+        "begin",
+        "insert 2 user2 person2@example.com",
+        "select",
+        "rollback",
+        "select",
+        "commit",
+        ".exit",
+      ])
+      expect(result).to match_array([
+        "db > Executed.",
+        "db > Executed.",
+        "db > Executed.",
+        "db > (1, user1, person1@example.com)",
+        "(2, user2, person2@example.com)",
+        "Executed.",
+        "db > Executed.",
+        "db > (1, user1, person1@example.com)",
+        "Executed.",
+        "db > Error: No transaction is active.",
+        "db > ",
+      ])
+    end
+
+    it 'rolls back to a savepoint and keeps the rest of the transaction' do
+      script = ["begin"]
+      script += (1..10).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << "savepoint a"
+      script += (11..30).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script << "rollback to a"
+      script << "rollback to b"
+      script << "commit"
+      script << ".exit"
+      result = run_script(script)
+      expect(result[-3...(result.length)]).to eq([
+        "db > Error: No such savepoint.",
+        "db > Executed.",
+        "db > ",
+      ])
+
+      result = run_script([
+        "select",
+        ".exit",
+      ])
+      expect(result.length).to eq(12)
+      expect(result[-3]).to eq("(10, user10, person10@example.com)")
+      expect(File.exist?("test.db-wal")).to eq(false)
+    end
+
+    it 'keeps a copy-on-write database across reopens' do
+      script = (1..14).map do |i|
+        "insert #{i} user#{i} person#{i}@example.com"
+      end
+      script += [
+        "begin",
+        "insert 15 user15 person15@example.com",
+        "savepoint a",
+        "rollback",
+        ".vacuum",
+        ".exit",
+      ]
+      result = run_script(script, ["--cow"])
+      expect(result[-6...(result.length)]).to eq([
+        "db > Executed.",
+        "db > Executed.",
+        "db > Error: Not supported in copy-on-write mode.",
+        "db > Executed.",
+        "db > Error: Not supported in copy-on-write mode.",
+        "db > ",
+      ])
+
+      result = run_script([
+        ".btree",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > Tree:",
+        "- internal (size 1)",
+        "  - leaf (size 7)",
+      ] + (1..7).map { |i| "    - #{i}" } + [
+        "  - key 7",
+        "  - leaf (size 7)",
+      ] + (8..14).map { |i| "    - #{i}" } + [
+        "db > ",
+      ])
+    end
+
+    it 'reports a failed write and keeps every earlier commit' do
+      # A 40 KB file size limit makes writes to the log fail partway
+      output = nil
+      IO.popen(["sh", "-c", "trap '' XFSZ; ulimit -f 80; exec ./main test.db"], "r+") do |pipe|
+        (1..400).each do |i|
+          pipe.puts "insert #{i} user#{i} person#{i}@example.com"
+        end
+        pipe.puts ".exit"
+        pipe.close_write
+        output = pipe.gets(nil).split("\n")
+      end
+      num_committed = output.count("db > Executed.")
+      error = output[num_committed]
+      expect(error).to match(/^db > Error writing write-ahead log: \d+$/)
+      expect(output).to eq(
+        ["db > Executed."] * num_committed + [error] * (400 - num_committed) + ["db > "]
+      )
+
+      result = run_script([
+        "select count(*)",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > (#{num_committed})",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'serves inserts, gets and selects over a socket' do
+      require 'socket'
+      frame = lambda { |body| [body.bytesize].pack("N") + body }
+      row = lambda do |id, username, email|
+        [id, username.bytesize].pack("NC") + username +
+          [email.bytesize].pack("C") + email
+      end
+
+      `rm -f test.sock`
+      server = IO.popen(["./main", "--server", "./test.sock", "test.db"])
+      expect(server.gets).to eq("Listening on ./test.sock\n")
+
+      socket = UNIXSocket.new("./test.sock")
+      responses = lambda do |count|
+        (1..count).map { socket.read(socket.read(4).unpack1("N")) }
+      end
+      socket.write(frame.call([1].pack("C") + row.call(1, "user1", "person1@example.com")))
+      socket.write(frame.call([1].pack("C") + row.call(1, "user1", "person1@example.com")))
+      socket.write(frame.call([2, 1].pack("CN")))
+      socket.write(frame.call([2, 2].pack("CN")))
+      socket.write(frame.call([3].pack("C")))
+      expect(responses.call(5)).to eq([
+        [0].pack("C"),
+        [1].pack("C"),
+        [0].pack("C") + row.call(1, "user1", "person1@example.com"),
+        [3].pack("C"),
+        [0, 1].pack("CN") + row.call(1, "user1", "person1@example.com"),
+      ])
+      socket.close
+
+      Process.kill("TERM", server.pid)
+      server.close
+      expect(File.exist?("test.sock")).to eq(false)
+
+      result = run_script([
+        "select",
+        ".exit",
+      ])
+      expect(result).to eq([
+        "db > (1, user1, person1@example.com)",
+        "Executed.",
+        "db > ",
+      ])
+    end
+
+    it 'logs slow requests served over a socket' do
+      require 'socket'
+      frame = lambda { |body| [body.bytesize].pack("N") + body }
+
+      `rm -f test.sock test.log`
+      server = IO.popen(["./main", "--server", "./test.sock", "--slowlog", "test.log", "0", "test.db"])
+      expect(server.gets).to eq("Listening on ./test.sock\n")
+
+      socket = UNIXSocket.new("./test.sock")
+      socket.write(frame.call([1, 1, 5].pack("CNC") + "user1" + [19].pack("C") + "person1@example.com"))
+      socket.write(frame.call([2, 1].pack("CN")))
+      socket.write(frame.call([3].pack("C")))
+      3.times { socket.read(socket.read(4).unpack1("N")) }
+      socket.close
+
+      Process.kill("TERM", server.pid)
+      server.close
+      log = File.readlines("test.log", chomp: true)
+      `rm -f test.log`
+      expect(log.length).to eq(3)
+      expect(log[0]).to match(/ rows_returned=0 sql="insert 1 user1 person1@example.com"$/)
+      expect(log[1]).to match(/ rows_returned=1 sql="select where id = 1"$/)
+      expect(log[2]).to match(/ rows_returned=1 sql="select"$/)
+    end
+
+    it 'serves metrics in the OpenMetrics format' do
+      require 'socket'
+      `rm -f test.sock test-metrics.sock`
+      server = IO.popen(["./main", "--server", "./test.sock", "--metrics", "./test-metrics.sock", "test.db"])
+      expect(server.gets).to eq("Listening on ./test.sock\n")
+      expect(server.gets).to eq("Serving metrics on ./test-metrics.sock\n")
+
+      socket = UNIXSocket.new("./test.sock")
+      socket.write([5, 2, 1].pack("NCN"))
+      expect(socket.read(5)).to eq([1, 3].pack("NC"))
+      socket.close
+
+      scrape = lambda do |path|
+        metrics = UNIXSocket.new("./test-metrics.sock")
+        metrics.write("GET #{path} HTTP/1.1\r\nHost: localhost\r\n\r\n")
+        response = metrics.read
+        metrics.close
+        response.split("\r\n\r\n", 2)
+      end
+      header, body = scrape.call("/metrics")
+      expect(header).to start_with("HTTP/1.1 200 OK\r\n")
+      expect(header).to include("Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8")
+      lines = body.split("\n")
+      expect(lines).to include(
+        "# TYPE sqlitedb_cache_hits counter",
+        "sqlitedb_rows 0",
+        "sqlitedb_tree_height 1",
+        "sqlitedb_request_seconds_count{op=\"get\"} 1",
+        "sqlitedb_request_seconds_count{op=\"insert\"} 0",
+      )
+      expect(lines.last).to eq("# EOF")
+      expect(scrape.call("/")[0]).to start_with("HTTP/1.1 404 Not Found\r\n")
+
+      Process.kill("TERM", server.pid)
+      server.close
+      expect(File.exist?("test-metrics.sock")).to eq(false)
+    end
+
+    it 'counts, sums and filters rows with a parallel scan' do
+      script = (1..30).map do |i|
+        "insert #{i} user#{i % 3} person#{i}@example.com"
+      end
+      script += [
+        "select count(*)",
+        "select sum(id)",
+        "select count(*) where username = user1",
+        "select sum(id) where id > 25",
+        "select where email = person7@example.com",
+        "select where name = user1",
+        ".exit",
+      ]
+      result = run_script(script)
+      expect(result[30..-1]).to eq([
+        "db > (30)",
+        "Executed.",
+        "db > (465)",
+        "Executed.",
+        "db > (10)",
+        "Executed.",
+        "db > (140)",
+        "Executed.",
+        "db > (7, user1, person7@example.com)",
+        "Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > ",
+      ])
+    end
+
+    it 'drives a database through the public API alone' do
+      `make -s tests`
+      `rm -f test.backup`
+      result = `./build/debug/test/api_test test.db test.backup`.split("\n")
+      `rm -f test.backup`
+      expect(result).to eq([
+        "duplicate insert: 8 Error: Duplicate key.",
+        "bind id -1: 7 ID must be positive.",
+        "select where id > ?: 39 user39 person39@example.com; 40 user40 person40@example.com;",
+        "select count(*): 40;",
+        "cursor from 20: 20 user20 person20@example.com; 21 user21 person21@example.com; 22 user22 person22@example.com;",
+        "Backup complete: 6 pages copied.",
+        "backup rows: 40",
+        "vacuum to 101%: 3 Fill factor must be between 1 and 100.",
+        "Vacuumed 6 pages into 5.",
+        "select count(*): 40;",
+        "profile: rows examined 40, pages written 0",
+        "stats: rows 40, leaf pages 4, height 2",
+      ])
+    end
+
+    it 'runs async lookups and scans through the public API' do
+      `make -s tests`
+      result = `./build/debug/test/async_test test.db`.split("\n")
+      expect(result).to eq([
+        "get 1: (1, user1, person1@example.com), completed 1 time(s)",
+        "get 150: (150, user150, person150@example.com), completed 1 time(s)",
+        "get 300: (300, user300, person300@example.com), completed 1 time(s)",
+        "get 301: not found, completed 1 time(s)",
+        "scan: 300 rows in key order, completed 1 time(s)",
+      ])
+    end
+end
@@ -0,0 +1,541 @@
+#include "async.h"
+#include "btree.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "snapshot.h"
+
+/*
+ * Sets up an io_uring for page reads.
+ *
+ * Parameters:
+ * - ring: A pointer to the AsyncRing structure to fill in.
+ *
+ * The submission and completion rings are mapped straight from the kernel,
+ * so no library is needed. If the kernel does not offer io_uring, it is
+ * disabled, or its rings cannot be mapped, ring->fd is left at -1 and pages
+ * are read synchronously instead.
+ *
+ * An eventfd is registered with the ring for an event loop to wait on. The
+ * ring's own descriptor is not used for that, since not every kernel reports
+ * it readable when a completion is posted.
+ *
+ * Does not return a value.
+ */
+static void async_ring_open(AsyncRing *ring) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->event_fd = -1;
+  ring->fd = syscall(__NR_io_uring_setup, ASYNC_QUEUE_DEPTH, &params);
+  if (ring->fd == -1) {
+    return;
+  }
+
+  ring->num_entries = params.sq_entries;
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+    ring->sq_ring_size = ring->cq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = ring->sq_ring;
+  if (!single_mmap) {
+    ring->cq_ring =
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  }
+  ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    if (ring->sqes != MAP_FAILED) {
+      munmap(ring->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cq_ring != ring->sq_ring && ring->cq_ring != MAP_FAILED) {
+      munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+    ring->fd = -1;
+    return;
+  }
+
+  uint8_t *sq = ring->sq_ring;
+  ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+  ring->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+  uint8_t *cq = ring->cq_ring;
+  ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+  ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+  ring->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ring->event_fd != -1 &&
+      syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_EVENTFD,
+              &ring->event_fd, 1) == -1) {
+    close(ring->event_fd);
+    ring->event_fd = -1;
+  }
+}
+
+/*
+ * Unmaps and closes an io_uring.
+ *
+ * Does not return a value.
+ */
+static void async_ring_close(AsyncRing *ring) {
+  if (ring->fd == -1) {
+    return;
+  }
+  munmap(ring->sqes, ring->num_entries * sizeof(struct io_uring_sqe));
+  if (ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+  if (ring->event_fd != -1) {
+    close(ring->event_fd);
+  }
+}
+
+/*
+ * Queues the read of a page into a fresh buffer.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - page_num: The page to read. The read is tagged with it, so its completion
+ * knows which page arrived.
+ *
+ * The read only goes to the kernel at the next async_poll, together with
+ * every other read queued meanwhile.
+ *
+ * Does not return a value.
+ */
+static void async_submit_read(AsyncEngine *engine, uint32_t page_num) {
+  AsyncRing *ring = &engine->ring;
+  void *buffer = malloc(PAGE_SIZE);
+  engine->reads[page_num] = buffer;
+
+  uint32_t tail = *ring->sq_tail;
+  uint32_t index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = engine->table->pager->file_descriptor;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = PAGE_SIZE;
+  sqe->off = (uint64_t)page_num * PAGE_SIZE;
+  sqe->user_data = page_num;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  engine->num_unsubmitted++;
+  engine->num_in_flight++;
+}
+
+/*
+ * Makes sure a page is in the cache before an operation reads it.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - op: The operation that wants the page.
+ * - page_num: The page.
+ *
+ * A page that is cached, or that the pager would not read from disk anyway,
+ * is ready right away. Otherwise the operation waits on the page, and the
+ * first operation to wait on it starts the read, so a page wanted by many
+ * operations at once is read once. Reads beyond the queue depth wait their
+ * turn.
+ *
+ * Returns true if the page is ready, or false if the operation is suspended
+ * until the read completes.
+ */
+static bool async_page_ready(AsyncEngine *engine, AsyncOp *op,
+                             uint32_t page_num) {
+  Pager *pager = engine->table->pager;
+  if (__atomic_load_n(&pager->pages[page_num], __ATOMIC_ACQUIRE) != NULL) {
+    return true;
+  }
+
+  uint32_t file_length = __atomic_load_n(&pager->file_length, __ATOMIC_ACQUIRE);
+  uint32_t num_file_pages = (file_length + PAGE_SIZE - 1) / PAGE_SIZE;
+  if (engine->ring.fd == -1 || page_num >= num_file_pages ||
+      page_num >= pager->num_pages) {
+    get_page(pager, page_num);
+    return true;
+  }
+
+  op->next = engine->waiters[page_num];
+  engine->waiters[page_num] = op;
+  if (op->next == NULL) {
+    if (engine->num_in_flight < engine->ring.num_entries) {
+      async_submit_read(engine, page_num);
+    } else {
+      uint32_t slot =
+          (engine->deferred_head + engine->num_deferred++) % TABLE_MAX_PAGES;
+      engine->deferred_pages[slot] = page_num;
+    }
+  }
+  return false;
+}
+
+/*
+ * Ends an operation once its callback has run for the last time.
+ *
+ * Does not return a value.
+ */
+static void async_finish(AsyncEngine *engine, AsyncOp *op) {
+  snapshot_close(op->snapshot);
+  for (uint32_t i = 0; i < TABLE_MAX_HEIGHT; i++) {
+    free(op->images[i]);
+  }
+  free(op);
+  engine->num_pending_ops--;
+}
+
+/*
+ * Moves a scan on to the next subtree after the node at its current depth is
+ * done.
+ *
+ * Returns true if there is one, with op->page_num and op->depth set to it, or
+ * false if the scan is over.
+ */
+static bool async_scan_next(AsyncOp *op) {
+  while (op->depth > 0) {
+    op->depth--;
+    void *node = op->images[op->depth];
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_index = ++op->child_indexes[op->depth];
+    if (child_index <= num_keys) {
+      op->page_num = child_index == num_keys
+                         ? *internal_node_right_child(node)
+                         : *internal_node_child(node, child_index);
+      op->depth++;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Runs an operation until it needs a page that is not cached, or completes.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - op: The operation.
+ *
+ * This is the body of the operation as a coroutine: all of its state lives
+ * in the AsyncOp, so it can stop at any page and pick up from there when the
+ * page arrives. Every node is copied out at the operation's snapshot, so it
+ * sees one version of the tree however long it is suspended.
+ *
+ * A lookup descends to its leaf and reports the row, or NULL if the key is
+ * not there. A scan walks the tree depth first, one copied node per level,
+ * and reports every row in key order, then NULL.
+ *
+ * Does not return a value.
+ */
+static void async_resume(AsyncEngine *engine, AsyncOp *op) {
+  Pager *pager = engine->table->pager;
+  Row row;
+
+  while (async_page_ready(engine, op, op->page_num)) {
+    if (op->images[op->depth] == NULL) {
+      op->images[op->depth] = malloc(PAGE_SIZE);
+    }
+    void *node = op->images[op->depth];
+    pager_read_version(pager, op->page_num, op->snapshot->version, node);
+
+    if (get_node_type(node) == NODE_INTERNAL) {
+      if (op->scan) {
+        op->child_indexes[op->depth] = 0;
+        op->page_num = *internal_node_num_keys(node) == 0
+                           ? *internal_node_right_child(node)
+                           : *internal_node_child(node, 0);
+        op->depth++;
+      } else {
+        uint32_t child_index = internal_node_find_child(node, op->key);
+        op->page_num = *internal_node_child(node, child_index);
+      }
+      continue;
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (!op->scan) {
+      uint32_t cell_num = leaf_node_find_cell(node, num_cells, op->key);
+      if (cell_num < num_cells && *leaf_node_key(node, cell_num) == op->key) {
+        deserialize_row(leaf_node_value(node, cell_num), &row);
+        op->callback(op->context, &row);
+      } else {
+        op->callback(op->context, NULL);
+      }
+      async_finish(engine, op);
+      return;
+    }
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+      deserialize_row(leaf_node_value(node, i), &row);
+      op->callback(op->context, &row);
+    }
+    if (!async_scan_next(op)) {
+      op->callback(op->context, NULL);
+      async_finish(engine, op);
+      return;
+    }
+  }
+}
+
+/*
+ * Starts an operation at the root of a new snapshot.
+ *
+ * Does not return a value.
+ */
+static void async_start(AsyncEngine *engine, bool scan, uint32_t key,
+                        AsyncCallback callback, void *context) {
+  AsyncOp *op = calloc(1, sizeof(AsyncOp));
+  op->scan = scan;
+  op->key = key;
+  op->callback = callback;
+  op->context = context;
+  op->snapshot = snapshot_open(engine->table);
+  op->page_num = op->snapshot->root_page_num;
+  engine->num_pending_ops++;
+
+  async_resume(engine, op);
+}
+
+/*
+ * Opens an engine for running lookups and scans without blocking on disk.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * An engine belongs to the one thread that calls it, typically the thread of
+ * an event loop, and reads pages through an io_uring of ASYNC_QUEUE_DEPTH
+ * entries. Other threads may keep using the table meanwhile.
+ *
+ * Returns a pointer to the new AsyncEngine.
+ */
+AsyncEngine *async_open(Table *table) {
+  AsyncEngine *engine = calloc(1, sizeof(AsyncEngine));
+  engine->table = table;
+  async_ring_open(&engine->ring);
+  return engine;
+}
+
+/*
+ * Finishes every pending operation and closes the engine.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ *
+ * Does not return a value.
+ */
+void async_close(AsyncEngine *engine) {
+  while (engine->num_pending_ops > 0) {
+    async_poll(engine, true);
+  }
+  async_ring_close(&engine->ring);
+  free(engine);
+}
+
+/*
+ * Returns a descriptor that becomes readable when reads have completed, for
+ * the caller's event loop to watch, or -1 if reads are synchronous. It stays
+ * readable until the next async_poll.
+ */
+int async_fd(AsyncEngine *engine) {
+  AsyncRing *ring = &engine->ring;
+  return ring->event_fd != -1 ? ring->event_fd : ring->fd;
+}
+
+/*
+ * Looks up a key.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - key: The key to find.
+ * - callback: Called once, with the row, or with NULL if there is no such key.
+ * - context: Passed to the callback.
+ *
+ * If every page on the way is cached, the callback runs before this returns.
+ * Otherwise the lookup is suspended on the first missing page and continued
+ * by async_poll.
+ *
+ * Does not return a value.
+ */
+void async_get(AsyncEngine *engine, uint32_t key, AsyncCallback callback,
+               void *context) {
+  async_start(engine, false, key, callback, context);
+}
+
+/*
+ * Scans the whole table.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - callback: Called with each row in key order, then once with NULL.
+ * - context: Passed to the callback.
+ *
+ * Suspends on missing pages like async_get.
+ *
+ * Does not return a value.
+ */
+void async_scan(AsyncEngine *engine, AsyncCallback callback, void *context) {
+  async_start(engine, true, 0, callback, context);
+}
+
+/*
+ * Puts a page that arrived in the cache and continues the operations
+ * waiting on it.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - page_num: The page that was read.
+ * - bytes_read: The result of the read: the number of bytes read, or a
+ * negative errno.
+ *
+ * A failed read fails the pager, see pager_fail, and the page is stood in
+ * for by an empty leaf, as get_page does, so the waiting operations still
+ * finish.
+ *
+ * Does not return a value.
+ */
+static void async_finish_read(AsyncEngine *engine, uint32_t page_num,
+                              int bytes_read) {
+  AsyncRing *ring = &engine->ring;
+  Pager *pager = engine->table->pager;
+  void *page = engine->reads[page_num];
+  engine->reads[page_num] = NULL;
+  if (bytes_read < 0) {
+    pager_fail(pager, "Error reading file", -bytes_read);
+    memset(page, 0, PAGE_SIZE);
+    initialize_leaf_node(page);
+  } else {
+    memset((uint8_t *)page + bytes_read, 0, PAGE_SIZE - bytes_read);
+  }
+  void *cached = NULL;
+  if (!__atomic_compare_exchange_n(&pager->pages[page_num], &cached, page,
+                                   false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(page);
+  }
+
+  while (engine->num_deferred > 0 &&
+         engine->num_in_flight < ring->num_entries) {
+    uint32_t deferred = engine->deferred_pages[engine->deferred_head];
+    engine->deferred_head = (engine->deferred_head + 1) % TABLE_MAX_PAGES;
+    engine->num_deferred--;
+    async_submit_read(engine, deferred);
+  }
+
+  AsyncOp *op = engine->waiters[page_num];
+  engine->waiters[page_num] = NULL;
+  while (op != NULL) {
+    AsyncOp *next = op->next;
+    async_resume(engine, op);
+    op = next;
+  }
+}
+
+/*
+ * Takes back the reads queued since the last submission, and finishes them
+ * as failed.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - error_number: Why they could not be submitted.
+ *
+ * The kernel has not seen the entries yet, so moving the tail back removes
+ * them from the ring. Reads the waiting operations start meanwhile are
+ * queued again for the next call to async_poll.
+ *
+ * Does not return a value.
+ */
+static void async_fail_unsubmitted(AsyncEngine *engine, int error_number) {
+  AsyncRing *ring = &engine->ring;
+  uint32_t num_failed = engine->num_unsubmitted;
+  uint32_t tail = *ring->sq_tail - num_failed;
+  uint32_t page_nums[TABLE_MAX_PAGES];
+  for (uint32_t i = 0; i < num_failed; i++) {
+    page_nums[i] = ring->sqes[(tail + i) & *ring->sq_mask].user_data;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+  engine->num_unsubmitted = 0;
+  engine->num_in_flight -= num_failed;
+
+  for (uint32_t i = 0; i < num_failed; i++) {
+    async_finish_read(engine, page_nums[i], -error_number);
+  }
+}
+
+/*
+ * Submits the queued reads, and continues the operations whose pages have
+ * arrived.
+ *
+ * Parameters:
+ * - engine: A pointer to the AsyncEngine structure.
+ * - wait: Whether to block until at least one read completes, if any are in
+ * flight.
+ *
+ * Each arrived page is put in the pager's cache, unless another thread
+ * cached it first, and every operation waiting on it is resumed. The reads
+ * those operations start in turn are submitted by the next call. Reads the
+ * kernel refuses to take are finished as failed, see async_fail_unsubmitted,
+ * unless it only asks for them to be tried again.
+ *
+ * Returns the number of operations still pending.
+ */
+uint32_t async_poll(AsyncEngine *engine, bool wait) {
+  AsyncRing *ring = &engine->ring;
+  if (ring->fd == -1) {
+    return engine->num_pending_ops;
+  }
+
+  // Every completion posted from here on signals the eventfd again. A count
+  // that cannot be cleared only wakes the event loop once more than needed.
+  if (ring->event_fd != -1) {
+    uint64_t num_events;
+    ssize_t bytes_read = read(ring->event_fd, &num_events, sizeof(num_events));
+    (void)bytes_read;
+  }
+
+  uint32_t min_complete = wait && engine->num_in_flight > 0 ? 1 : 0;
+  if (engine->num_unsubmitted > 0 || min_complete > 0) {
+    int submitted =
+        syscall(__NR_io_uring_enter, ring->fd, engine->num_unsubmitted,
+                min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                NULL, 0);
+    if (submitted == -1 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      async_fail_unsubmitted(engine, errno);
+    }
+    if (submitted > 0) {
+      engine->num_unsubmitted -= submitted;
+    }
+  }
+
+  uint32_t head = *ring->cq_head;
+  uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    uint32_t page_num = cqe->user_data;
+    int bytes_read = cqe->res;
+    head++;
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    engine->num_in_flight--;
+
+    async_finish_read(engine, page_num, bytes_read);
+  }
+
+  return engine->num_pending_ops;
+}
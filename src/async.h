@@ -0,0 +1,16 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "constants.h"
+
+#define ASYNC_QUEUE_DEPTH 256
+
+AsyncEngine *async_open(Table *table);
+void async_close(AsyncEngine *engine);
+int async_fd(AsyncEngine *engine);
+void async_get(AsyncEngine *engine, uint32_t key, AsyncCallback callback,
+               void *context);
+void async_scan(AsyncEngine *engine, AsyncCallback callback, void *context);
+uint32_t async_poll(AsyncEngine *engine, bool wait);
+
+#endif
@@ -0,0 +1,270 @@
+#include "backup.h"
+#include "pager.h"
+
+/*
+ * Checks whether a page has to be (re)copied: either it was never copied in
+ * this backup, or it was written to after the copy was taken.
+ */
+static bool backup_page_is_stale(Backup *backup, uint32_t page_num) {
+  Pager *pager = backup->table->pager;
+  return !backup->copied[page_num] ||
+         backup->copied_write_counters[page_num] !=
+             pager->page_write_counters[page_num];
+}
+
+/*
+ * Copies a run of consecutive pages to the backup file with one write.
+ *
+ * Parameters:
+ * - backup: A pointer to the Backup in progress.
+ * - first_page_num: The first page of the run.
+ * - num_pages: The number of pages in the run.
+ * - buffer: Scratch space for num_pages pages.
+ *
+ * Cached pages are copied from memory, since they may hold changes that have
+ * not been written back yet. Pages that are not cached have never been
+ * modified in this session, so they are read straight from the database file
+ * without pulling them into the cache.
+ *
+ * A failed write is remembered in backup->error, and the backup fails when
+ * it completes.
+ *
+ * Does not return a value.
+ */
+static void backup_copy_run(Backup *backup, uint32_t first_page_num,
+                            uint32_t num_pages, void *buffer) {
+  Pager *pager = backup->table->pager;
+
+  for (uint32_t i = 0; i < num_pages; i++) {
+    uint32_t page_num = first_page_num + i;
+    void *destination = buffer + i * PAGE_SIZE;
+
+    if (pager->pages[page_num] != NULL) {
+      memcpy(destination, pager->pages[page_num], PAGE_SIZE);
+    } else if (pread(pager->file_descriptor, destination, PAGE_SIZE,
+                     (off_t)page_num * PAGE_SIZE) != PAGE_SIZE) {
+      memset(destination, 0, PAGE_SIZE);
+    }
+    backup->copied[page_num] = true;
+    backup->copied_write_counters[page_num] =
+        pager->page_write_counters[page_num];
+  }
+
+  ssize_t bytes_written = pwrite(backup->file_descriptor, buffer,
+                                 num_pages * PAGE_SIZE,
+                                 (off_t)first_page_num * PAGE_SIZE);
+  if (bytes_written != num_pages * PAGE_SIZE && backup->error == 0) {
+    backup->error = bytes_written == -1 ? errno : EIO;
+  }
+  backup->pages_copied += num_pages;
+}
+
+/*
+ * Copies stale pages from the current pass position onwards.
+ *
+ * Parameters:
+ * - backup: A pointer to the Backup in progress.
+ * - max_pages: The most pages to copy before returning.
+ *
+ * Returns true if the end of the database was reached.
+ */
+static bool backup_copy_pages(Backup *backup, uint32_t max_pages) {
+  Pager *pager = backup->table->pager;
+  void *buffer = malloc(BACKUP_PAGES_PER_STEP * PAGE_SIZE);
+  uint32_t copied = 0;
+
+  while (backup->next_page_num < pager->num_pages && copied < max_pages) {
+    uint32_t page_num = backup->next_page_num;
+    if (!backup_page_is_stale(backup, page_num)) {
+      backup->next_page_num++;
+      continue;
+    }
+
+    uint32_t run_length = 1;
+    while (page_num + run_length < pager->num_pages &&
+           run_length < BACKUP_PAGES_PER_STEP &&
+           copied + run_length < max_pages &&
+           backup_page_is_stale(backup, page_num + run_length)) {
+      run_length++;
+    }
+
+    backup_copy_run(backup, page_num, run_length, buffer);
+    backup->next_page_num += run_length;
+    copied += run_length;
+  }
+
+  free(buffer);
+  return backup->next_page_num >= pager->num_pages;
+}
+
+/*
+ * Counts the pages that changed since they were copied.
+ */
+static uint32_t backup_num_stale_pages(Backup *backup) {
+  uint32_t num_stale = 0;
+  for (uint32_t i = 0; i < backup->table->pager->num_pages; i++) {
+    if (backup_page_is_stale(backup, i)) {
+      num_stale++;
+    }
+  }
+  return num_stale;
+}
+
+/*
+ * Makes the backup file complete and durable, then moves it into place.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure whose backup is finishing.
+ * - pages_copied: Set to the number of pages the backup copied in all.
+ * - error: Set to why the backup failed, up to SQLITEDB_ERRMSG_SIZE bytes,
+ * when it returns EXECUTE_ERROR.
+ *
+ * Runs between statements, so nothing can change the pages while the last
+ * stale ones are copied. The copy is sized to the database, synced, and
+ * renamed over the destination, so the destination is either the previous
+ * file or a complete backup.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_ERROR if the backup could not be
+ * written, in which case the destination is left as it was.
+ */
+static ExecuteResult backup_complete(Table *table, uint32_t *pages_copied,
+                                     char *error) {
+  Backup *backup = table->backup;
+  Pager *pager = table->pager;
+
+  backup->next_page_num = 0;
+  backup_copy_pages(backup, UINT32_MAX);
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  if (backup->error != 0) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error writing backup: %d",
+             backup->error);
+    close(backup->file_descriptor);
+    unlink(backup->temp_filename);
+    result = EXECUTE_ERROR;
+  } else if (ftruncate(backup->file_descriptor,
+                       (off_t)pager->num_pages * PAGE_SIZE) == -1 ||
+             fsync(backup->file_descriptor) == -1 ||
+             close(backup->file_descriptor) == -1 ||
+             rename(backup->temp_filename, backup->filename) == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error finishing backup: %d", errno);
+    unlink(backup->temp_filename);
+    result = EXECUTE_ERROR;
+  }
+  *pages_copied = backup->pages_copied;
+
+  free(backup->filename);
+  free(backup->temp_filename);
+  free(backup);
+  table->backup = NULL;
+  return result;
+}
+
+/*
+ * Starts an online backup of the database file.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - filename: Where the backup should be written.
+ * - pages_per_step: The most pages to copy in one step.
+ * - error: Set to why the backup could not start, up to SQLITEDB_ERRMSG_SIZE
+ * bytes, when it returns EXECUTE_ERROR.
+ *
+ * The pages are copied in steps between statements (see backup_step), so
+ * inserts keep running while the backup is taken. The copy goes to a
+ * temporary file next to the destination until it is complete.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_ERROR if a backup is already running
+ * or the temporary file cannot be created.
+ */
+ExecuteResult backup_start(Table *table, const char *filename,
+                           uint32_t pages_per_step, char *error) {
+  if (table->backup != NULL) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE,
+             "Error: A backup to '%s' is already running.",
+             table->backup->filename);
+    return EXECUTE_ERROR;
+  }
+
+  Backup *backup = malloc(sizeof(Backup));
+  backup->table = table;
+  backup->filename = strdup(filename);
+  backup->temp_filename = malloc(strlen(filename) + 5);
+  sprintf(backup->temp_filename, "%s.tmp", filename);
+  backup->file_descriptor =
+      open(backup->temp_filename, O_WRONLY | O_CREAT | O_TRUNC,
+           S_IWUSR | S_IRUSR);
+  if (backup->file_descriptor == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s'.",
+             backup->temp_filename);
+    free(backup->filename);
+    free(backup->temp_filename);
+    free(backup);
+    return EXECUTE_ERROR;
+  }
+
+  backup->next_page_num = 0;
+  backup->pages_per_step = pages_per_step;
+  backup->num_passes = 1;
+  backup->pages_copied = 0;
+  backup->error = 0;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    backup->copied[i] = false;
+  }
+  table->backup = backup;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Advances a running backup by at most the pages_per_step it was started
+ * with.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - pages_copied: Set to the number of pages the backup copied in all if this
+ * step completed it, and to 0 otherwise.
+ * - error: Set as for backup_complete.
+ *
+ * Each pass walks the whole file and copies the pages that are stale. Pages
+ * dirtied by statements that ran since the previous pass are picked up again.
+ * When a pass ends with no more than one step's worth of stale pages left, or
+ * after BACKUP_MAX_PASSES passes, the remaining pages are copied at once and
+ * the backup is completed.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_ERROR if the backup was completed and
+ * failed.
+ */
+ExecuteResult backup_step(Table *table, uint32_t *pages_copied, char *error) {
+  Backup *backup = table->backup;
+  *pages_copied = 0;
+  if (backup == NULL) {
+    return EXECUTE_SUCCESS;
+  }
+
+  if (!backup_copy_pages(backup, backup->pages_per_step)) {
+    return EXECUTE_SUCCESS;
+  }
+
+  if (backup_num_stale_pages(backup) <= backup->pages_per_step ||
+      backup->num_passes >= BACKUP_MAX_PASSES) {
+    return backup_complete(table, pages_copied, error);
+  }
+  backup->next_page_num = 0;
+  backup->num_passes++;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Completes a running backup without waiting for further steps. Used when
+ * the database is closed or vacuumed.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_ERROR, with error set as for
+ * backup_complete, if the backup failed.
+ */
+ExecuteResult backup_finish(Table *table, char *error) {
+  if (table->backup == NULL) {
+    return EXECUTE_SUCCESS;
+  }
+  uint32_t pages_copied;
+  return backup_complete(table, &pages_copied, error);
+}
@@ -0,0 +1,14 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include "constants.h"
+
+#define BACKUP_PAGES_PER_STEP 256
+#define BACKUP_MAX_PASSES 8
+
+ExecuteResult backup_start(Table *table, const char *filename,
+                           uint32_t pages_per_step, char *error);
+ExecuteResult backup_step(Table *table, uint32_t *pages_copied, char *error);
+ExecuteResult backup_finish(Table *table, char *error);
+
+#endif
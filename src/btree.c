@@ -1,7 +1,10 @@
 #include "btree.h"
+#include "cursor.h"
 #include "node.h"
 #include "pager.h"
 #include "serialize.h"
+#include "stats.h"
+#include "trace.h"
 
 /*
  * Initializes a leaf node.
@@ -51,6 +54,8 @@ void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
     return;
   }
 
+  pager_mark_dirty(cursor->table->pager, cursor->page_num);
+
   if (cursor->cell_num < num_cells) {
     // Make room for new cell
     for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
@@ -177,32 +182,91 @@ uint32_t *internal_node_child(void *node, uint32_t child_num) {
  * Returns a pointer to the key in the internal node.
  */
 uint32_t *internal_node_key(void *node, uint32_t key_num) {
-  return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+  return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
 /*
  * Retrieves the maximum key from a node.
  *
  * Parameters:
+ * - pager: A pointer to the Pager structure.
  * - node: A pointer to the node.
  *
  * The function first determines the type of the node using the get_node_type
  * function.
  *
- * If the node is an internal node, the function retrieves the last key in the
- * node (which is the maximum key as the keys are sorted in ascending order).
+ * If the node is an internal node, the keys it stores only describe its left
+ * children, so the function descends into the right child to find the largest
+ * key in the subtree.
  *
  * If the node is a leaf node, the function retrieves the last key in the node
  * (which is the maximum key as the keys are sorted in ascending order).
  *
- * Returns the maximum key in the node.
+ * Returns the maximum key in the subtree rooted at the node.
  */
-uint32_t get_node_max_key(void *node) {
+uint32_t get_node_max_key(Pager *pager, void *node) {
   switch (get_node_type(node)) {
   case NODE_INTERNAL:
-    return *internal_node_key(node, *internal_node_num_keys(node) - 1);
+    return get_node_max_key(pager,
+                            get_page(pager, *internal_node_right_child(node)));
   case NODE_LEAF:
     return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+  default:
+    // Free and meta pages are never linked into the tree
+    return 0;
+  }
+}
+
+/*
+ * Finds the index of the child that should contain a key.
+ *
+ * Parameters:
+ * - node: A pointer to the internal node.
+ * - key: The key to look for.
+ *
+ * The function performs a binary search over the keys of the internal node.
+ * Each key is the maximum key of the child to its left, so the first key that
+ * is greater than or equal to the search key identifies the child. If no such
+ * key exists, the right child is chosen.
+ *
+ * Returns the index of the child (num_keys for the right child).
+ */
+uint32_t internal_node_find_child(void *node, uint32_t key) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  // Binary search
+  uint32_t min_index = 0;
+  uint32_t max_index = num_keys; // there is one more child than key
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    uint32_t key_to_right = *internal_node_key(node, index);
+    if (key_to_right >= key) {
+      max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
+/*
+ * Replaces the key that describes a child of an internal node.
+ *
+ * Parameters:
+ * - node: A pointer to the internal node.
+ * - old_key: The previous maximum key of the child.
+ * - new_key: The new maximum key of the child.
+ *
+ * If the child is the right child it has no key of its own, and nothing is
+ * changed.
+ *
+ * Does not return a value.
+ */
+void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key) {
+  uint32_t old_child_index = internal_node_find_child(node, old_key);
+  if (old_child_index < *internal_node_num_keys(node)) {
+    *internal_node_key(node, old_child_index) = new_key;
   }
 }
 
@@ -241,6 +305,117 @@ void set_node_root(void *node, bool is_root) {
   *((uint8_t *)(node + IS_ROOT_OFFSET)) = value;
 }
 
+/*
+ * Retrieves the parent pointer of a node.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * The function calculates the memory address of the parent pointer by adding
+ * the offset of the parent pointer to the base address of the node. The value
+ * is meaningless for the root node.
+ *
+ * Returns a pointer to the page number of the node's parent.
+ */
+uint32_t *node_parent(void *node) { return node + PARENT_POINTER_OFFSET; }
+
+/*
+ * Returns the first page of the table's freelist, or 0 if it is empty.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ *
+ * The root has no parent, so the parent pointer slot of the root page holds
+ * the head of the freelist. Each free page holds the next free page in its own
+ * parent pointer slot. Files written before freelists existed may have any
+ * value in the root's slot, so the head only counts if it names a free page.
+ */
+uint32_t table_freelist_head(Table *table) {
+  Pager *pager = table->pager;
+  uint32_t head = *node_parent(get_page(pager, table->root_page_num));
+
+  if (head == table->root_page_num || head >= pager->num_pages ||
+      get_node_type(get_page(pager, head)) != NODE_FREE) {
+    return 0;
+  }
+  return head;
+}
+
+/*
+ * Allocates a page for a new node.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ *
+ * Reuses the first page on the freelist if there is one. Otherwise the new
+ * page goes onto the end of the database file.
+ *
+ * Returns the page number of the allocated page.
+ */
+uint32_t table_allocate_page(Table *table) {
+  Pager *pager = table->pager;
+  uint32_t head = table_freelist_head(table);
+  if (head == 0) {
+    return get_unused_page_num(pager);
+  }
+
+  void *root = get_page(pager, table->root_page_num);
+  pager_mark_dirty(pager, table->root_page_num);
+  *node_parent(root) = *node_parent(get_page(pager, head));
+  return head;
+}
+
+/*
+ * Returns a page that is no longer part of the tree to the freelist.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ * - page_num: The page to release.
+ *
+ * The page keeps its version counter, so a caller that has it locked can
+ * still unlock it, and optimistic readers still on it start over.
+ *
+ * Does not return a value.
+ */
+void table_free_page(Table *table, uint32_t page_num) {
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  void *page = get_page(pager, page_num);
+
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, table->root_page_num);
+  uint32_t version = *node_version(page);
+  memset(page, 0, PAGE_SIZE);
+  *node_version(page) = version;
+  set_node_type(page, NODE_FREE);
+  *node_parent(page) = table_freelist_head(table);
+  *node_parent(root) = page_num;
+}
+
+/*
+ * Points every child of an internal node back at that node.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - page_num: The page number of the internal node.
+ *
+ * Used after the cells of an internal node have been moved to another page,
+ * so that later splits of the children find the correct parent.
+ *
+ * Does not return a value.
+ */
+void internal_node_adopt_children(Pager *pager, uint32_t page_num) {
+  void *node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t child_page_num = *internal_node_child(node, i);
+    void *child = get_page(pager, child_page_num);
+    pager_mark_dirty(pager, child_page_num);
+    *node_parent(child) = page_num;
+  }
+}
+
 /*
  * Creates a new root for a B-Tree when the old root is split.
  *
@@ -250,8 +425,10 @@ void set_node_root(void *node, bool is_root) {
  *
  * The function first retrieves the old root and the right child.
  * It then allocates a new page for the left child and copies the old root to
- * the left child. The left child is not a root node, so its root flag is set to
- * false.
+ * the left child. The new page may be a freed one that an optimistic reader is
+ * still on, so it is locked during the copy and keeps its own version counter.
+ * The left child is not a root node, so its root flag is set to false. If the old root was an internal node, its children now live under the
+ * left child and are re-parented to it.
  *
  * The function then re-initializes the old root to be the new root node and
  * sets its root flag to true. The new root has one key, which is the maximum
@@ -263,19 +440,180 @@ void set_node_root(void *node, bool is_root) {
 void create_new_root(Table *table, uint32_t right_child_page_num) {
   void *root = get_page(table->pager, table->root_page_num);
   void *right_child = get_page(table->pager, right_child_page_num);
-  uint32_t left_child_page_num = get_unused_page_num(table->pager);
+  uint32_t left_child_page_num = table_allocate_page(table);
   void *left_child = get_page(table->pager, left_child_page_num);
+  TRACE_PROBE3(new__root, table->root_page_num, left_child_page_num,
+               right_child_page_num);
 
+  pager_mark_dirty(table->pager, table->root_page_num);
+  pager_mark_dirty(table->pager, right_child_page_num);
+  pager_mark_dirty(table->pager, left_child_page_num);
+  node_lock(left_child);
+  uint32_t version = *node_version(left_child);
   memcpy(left_child, root, PAGE_SIZE);
+  *node_version(left_child) = version;
   set_node_root(left_child, false);
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    internal_node_adopt_children(table->pager, left_child_page_num);
+  }
 
   initialize_internal_node(root);
   set_node_root(root, true);
   *internal_node_num_keys(root) = 1;
   *internal_node_child(root, 0) = left_child_page_num;
-  uint32_t left_child_max_key = get_node_max_key(left_child);
+  uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
   *internal_node_key(root, 0) = left_child_max_key;
   *internal_node_right_child(root) = right_child_page_num;
+  *node_parent(left_child) = table->root_page_num;
+  *node_parent(right_child) = table->root_page_num;
+  node_unlock(left_child);
+}
+
+/*
+ * Adds a new child to an internal node.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ * - parent_page_num: The page number of the internal node.
+ * - child_page_num: The page number of the child to be added.
+ *
+ * The child is placed according to its maximum key. If it holds larger keys
+ * than the current right child, it becomes the new right child and the old
+ * right child moves into the cells. Otherwise the cells after the insertion
+ * point are shifted right to make room.
+ *
+ * If the internal node is full, it is split instead.
+ *
+ * Does not return a value.
+ */
+void internal_node_insert(Table *table, uint32_t parent_page_num,
+                          uint32_t child_page_num) {
+  void *parent = get_page(table->pager, parent_page_num);
+  void *child = get_page(table->pager, child_page_num);
+  uint32_t child_max_key = get_node_max_key(table->pager, child);
+  uint32_t index = internal_node_find_child(parent, child_max_key);
+
+  uint32_t original_num_keys = *internal_node_num_keys(parent);
+  if (original_num_keys >= INTERNAL_NODE_MAX_KEYS) {
+    internal_node_split_and_insert(table, parent_page_num, child_page_num);
+    return;
+  }
+
+  pager_mark_dirty(table->pager, parent_page_num);
+  pager_mark_dirty(table->pager, child_page_num);
+  *node_parent(child) = parent_page_num;
+
+  uint32_t right_child_page_num = *internal_node_right_child(parent);
+  void *right_child = get_page(table->pager, right_child_page_num);
+
+  *internal_node_num_keys(parent) = original_num_keys + 1;
+
+  if (child_max_key > get_node_max_key(table->pager, right_child)) {
+    // Replace right child
+    *internal_node_child(parent, original_num_keys) = right_child_page_num;
+    *internal_node_key(parent, original_num_keys) =
+        get_node_max_key(table->pager, right_child);
+    *internal_node_right_child(parent) = child_page_num;
+  } else {
+    // Make room for the new cell
+    for (uint32_t i = original_num_keys; i > index; i--) {
+      memcpy(internal_node_cell(parent, i), internal_node_cell(parent, i - 1),
+             INTERNAL_NODE_CELL_SIZE);
+    }
+    *internal_node_child(parent, index) = child_page_num;
+    *internal_node_key(parent, index) = child_max_key;
+  }
+}
+
+/*
+ * Splits a full internal node and adds a new child to the appropriate half.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ * - page_num: The page number of the full internal node.
+ * - child_page_num: The page number of the child to be added.
+ *
+ * The function lays out every child of the node, plus the new one, in key
+ * order. The lower half stays in the existing node and the upper half moves to
+ * a newly allocated node, whose children are re-parented to it.
+ *
+ * If the split node is the root, a new root is created above both halves.
+ * Otherwise the parent's key for the split node is updated and the new node is
+ * inserted into the parent, which may split in turn.
+ *
+ * Does not return a value.
+ */
+void internal_node_split_and_insert(Table *table, uint32_t page_num,
+                                    uint32_t child_page_num) {
+  Pager *pager = table->pager;
+  __atomic_fetch_add(&table->num_splits, 1, __ATOMIC_RELAXED);
+  void *old_node = get_page(pager, page_num);
+  uint32_t old_max = get_node_max_key(pager, old_node);
+  uint32_t child_max_key =
+      get_node_max_key(pager, get_page(pager, child_page_num));
+
+  uint32_t num_keys = *internal_node_num_keys(old_node);
+  uint32_t total = num_keys + 2;
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+  uint32_t keys[INTERNAL_NODE_MAX_KEYS + 2];
+
+  // The new child goes before the child currently covering its keys, or last
+  // if it holds larger keys than every existing child
+  uint32_t new_index = internal_node_find_child(old_node, child_max_key);
+  if (child_max_key > old_max) {
+    new_index = num_keys + 1;
+  }
+
+  uint32_t j = 0;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    if (i == new_index) {
+      children[j] = child_page_num;
+      keys[j] = child_max_key;
+      j++;
+    }
+    children[j] = *internal_node_child(old_node, i);
+    keys[j] = (i < num_keys) ? *internal_node_key(old_node, i) : old_max;
+    j++;
+  }
+  if (new_index == num_keys + 1) {
+    children[j] = child_page_num;
+    keys[j] = child_max_key;
+  }
+
+  uint32_t left_count = total / 2;
+  uint32_t new_page_num = table_allocate_page(table);
+  TRACE_PROBE2(internal__split, page_num, new_page_num);
+  void *new_node = get_page(pager, new_page_num);
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, new_page_num);
+  initialize_internal_node(new_node);
+
+  *internal_node_num_keys(old_node) = left_count - 1;
+  for (uint32_t i = 0; i < left_count - 1; i++) {
+    *internal_node_child(old_node, i) = children[i];
+    *internal_node_key(old_node, i) = keys[i];
+  }
+  *internal_node_right_child(old_node) = children[left_count - 1];
+
+  *internal_node_num_keys(new_node) = total - left_count - 1;
+  for (uint32_t i = left_count; i < total - 1; i++) {
+    *internal_node_child(new_node, i - left_count) = children[i];
+    *internal_node_key(new_node, i - left_count) = keys[i];
+  }
+  *internal_node_right_child(new_node) = children[total - 1];
+
+  internal_node_adopt_children(pager, page_num);
+  internal_node_adopt_children(pager, new_page_num);
+
+  if (is_node_root(old_node)) {
+    create_new_root(table, new_page_num);
+  } else {
+    uint32_t parent_page_num = *node_parent(old_node);
+    void *parent = get_page(pager, parent_page_num);
+    pager_mark_dirty(pager, parent_page_num);
+    update_internal_node_key(parent, old_max, keys[left_count - 1]);
+    internal_node_insert(table, parent_page_num, new_page_num);
+  }
 }
 
 /*
@@ -292,21 +630,29 @@ void create_new_root(Table *table, uint32_t right_child_page_num) {
  *
  * The function then inserts the new key-value pair into the appropriate node.
  * If the old node is a root node, the function creates a new root.
- * Otherwise, the function updates the parent of the nodes.
+ * Otherwise, the function updates the parent's key for the old node and
+ * inserts the new node into the parent.
  *
  * The function also updates the number of cells in both nodes.
  *
  * Does not return a value.
  */
 void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
-  void *old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void *new_node = get_page(cursor->table->pager, new_page_num);
+  Pager *pager = cursor->table->pager;
+  __atomic_fetch_add(&cursor->table->num_splits, 1, __ATOMIC_RELAXED);
+  void *old_node = get_page(pager, cursor->page_num);
+  uint32_t old_max = get_node_max_key(pager, old_node);
+  uint32_t new_page_num = table_allocate_page(cursor->table);
+  TRACE_PROBE3(leaf__split, cursor->page_num, new_page_num, key);
+  void *new_node = get_page(pager, new_page_num);
+  pager_mark_dirty(pager, cursor->page_num);
+  pager_mark_dirty(pager, new_page_num);
   initialize_leaf_node(new_node);
+  *node_parent(new_node) = *node_parent(old_node);
 
   for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
     void *destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+    if (i >= (int32_t)LEAF_NODE_LEFT_SPLIT_COUNT) {
       destination_node = new_node;
     } else {
       destination_node = old_node;
@@ -314,9 +660,10 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
     uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
     void *destination = leaf_node_cell(destination_node, index_within_node);
 
-    if (i == cursor->cell_num) {
-      serialize_row(value, destination);
-    } else if (i > cursor->cell_num) {
+    if (i == (int32_t)cursor->cell_num) {
+      *(uint32_t *)destination = key;
+      serialize_row(value, destination + LEAF_NODE_KEY_SIZE);
+    } else if (i > (int32_t)cursor->cell_num) {
       memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
     } else {
       memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
@@ -329,7 +676,428 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
   if (is_node_root(old_node)) {
     return create_new_root(cursor->table, new_page_num);
   } else {
-    printf("Need to implement updating parent after split\n");
-    exit(EXIT_FAILURE);
+    uint32_t parent_page_num = *node_parent(old_node);
+    uint32_t new_max = get_node_max_key(pager, old_node);
+    void *parent = get_page(pager, parent_page_num);
+
+    pager_mark_dirty(pager, parent_page_num);
+    update_internal_node_key(parent, old_max, new_max);
+    internal_node_insert(cursor->table, parent_page_num, new_page_num);
   }
-}
\ No newline at end of file
+}
+
+/*
+ * Finds the page number of the rightmost leaf of the tree.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ *
+ * Follows right children from the root down to a leaf.
+ *
+ * Returns the page number of the rightmost leaf.
+ */
+uint32_t table_last_leaf(Table *table) {
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(table->pager, page_num);
+
+  while (get_node_type(node) == NODE_INTERNAL) {
+    page_num = *internal_node_right_child(node);
+    node = get_page(table->pager, page_num);
+  }
+
+  return page_num;
+}
+
+/*
+ * Inserts a batch of rows sorted by key.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ * - rows: The rows to insert, sorted by id with no repeated ids.
+ * - num_rows: The number of rows in the batch.
+ * - num_inserted: Set to the number of rows that were inserted. Rows whose key
+ * already exists in the table are skipped.
+ *
+ * Rows with keys beyond the current maximum key are appended to the rightmost
+ * leaf without searching the tree. When that leaf is full, a new empty leaf is
+ * started instead of splitting it in half, so appended leaves end up
+ * completely full. Rows that fall inside the existing key range go through the
+ * regular insert path.
+ *
+ * Other threads may be reading the tree meanwhile. An append locks the leaf
+ * for the row it adds. A new leaf is linked in with the rightmost path locked
+ * by table_find_for_update, as a split of the old leaf would be.
+ *
+ * Stops before allocating a page the pager cannot hold.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_TABLE_FULL if the batch did not fit.
+ */
+ExecuteResult table_bulk_insert(Table *table, Row *rows, uint32_t num_rows,
+                                uint32_t *num_inserted) {
+  Pager *pager = table->pager;
+  uint32_t leaf_page_num = table_last_leaf(table);
+  void *leaf = get_page(pager, leaf_page_num);
+
+  *num_inserted = 0;
+  for (uint32_t i = 0; i < num_rows; i++) {
+    Row *row = &rows[i];
+    uint32_t num_cells = *leaf_node_num_cells(leaf);
+
+    // A split may need a new page on every level, plus a new root
+    if (pager->num_pages + TABLE_MAX_HEIGHT + 1 > TABLE_MAX_PAGES) {
+      return EXECUTE_TABLE_FULL;
+    }
+
+    if (num_cells > 0 && row->id <= *leaf_node_key(leaf, num_cells - 1)) {
+      Cursor *cursor = table_find_for_update(table, row->id);
+      void *node = get_page(pager, cursor->page_num);
+      if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+          *leaf_node_key(node, cursor->cell_num) != row->id) {
+        leaf_node_insert(cursor, row->id, row);
+        *num_inserted += 1;
+      }
+      cursor_close(cursor);
+      leaf_page_num = table_last_leaf(table);
+      leaf = get_page(pager, leaf_page_num);
+      continue;
+    }
+
+    if (num_cells < LEAF_NODE_MAX_CELLS) {
+      pager_mark_dirty(pager, leaf_page_num);
+      node_lock(leaf);
+      *leaf_node_key(leaf, num_cells) = row->id;
+      serialize_row(row, leaf_node_value(leaf, num_cells));
+      *leaf_node_num_cells(leaf) = num_cells + 1;
+      node_unlock(leaf);
+      *num_inserted += 1;
+      continue;
+    }
+
+    Cursor *cursor = table_find_for_update(table, row->id);
+    uint32_t new_page_num = table_allocate_page(table);
+    void *new_leaf = get_page(pager, new_page_num);
+    pager_mark_dirty(pager, new_page_num);
+    initialize_leaf_node(new_leaf);
+    *leaf_node_key(new_leaf, 0) = row->id;
+    serialize_row(row, leaf_node_value(new_leaf, 0));
+    *leaf_node_num_cells(new_leaf) = 1;
+
+    if (is_node_root(leaf)) {
+      create_new_root(table, new_page_num);
+    } else {
+      internal_node_insert(table, *node_parent(leaf), new_page_num);
+    }
+    cursor_close(cursor);
+    *num_inserted += 1;
+
+    leaf_page_num = new_page_num;
+    leaf = new_leaf;
+  }
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Moves a non-root node to another page.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure, which contains the B-Tree.
+ * - from_page_num: The page the node currently lives on.
+ * - to_page_num: The unused page the node should move to.
+ *
+ * The node is copied, the parent's pointer to it is redirected, and if the
+ * node is internal its children are re-parented. The old page is left as is
+ * for the caller to reuse or truncate.
+ *
+ * Does not return a value.
+ */
+void btree_move_page(Table *table, uint32_t from_page_num,
+                     uint32_t to_page_num) {
+  Pager *pager = table->pager;
+  void *from = get_page(pager, from_page_num);
+  void *to = get_page(pager, to_page_num);
+  pager_mark_dirty(pager, to_page_num);
+  memcpy(to, from, PAGE_SIZE);
+
+  void *parent = get_page(pager, *node_parent(to));
+  pager_mark_dirty(pager, *node_parent(to));
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    if (*internal_node_child(parent, i) == from_page_num) {
+      *internal_node_child(parent, i) = to_page_num;
+      break;
+    }
+  }
+
+  if (get_node_type(to) == NODE_INTERNAL) {
+    internal_node_adopt_children(pager, to_page_num);
+  }
+}
+
+/*
+ * Prepares a builder that loads an empty table bottom-up.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder to initialize.
+ * - table: A pointer to the Table structure. Its root must be an empty leaf.
+ * - fill_percent: How full to pack each node, from 1 to 100. Values below 100
+ * leave room for later inserts without immediate splits.
+ *
+ * Does not return a value.
+ */
+void table_builder_init(TableBuilder *builder, Table *table,
+                        uint32_t fill_percent) {
+  builder->table = table;
+  builder->leaf_capacity = LEAF_NODE_MAX_CELLS * fill_percent / 100;
+  builder->internal_capacity = INTERNAL_NODE_MAX_KEYS * fill_percent / 100;
+  if (builder->leaf_capacity < 1) {
+    builder->leaf_capacity = 1;
+  }
+  if (builder->internal_capacity < 1) {
+    builder->internal_capacity = 1;
+  }
+  builder->height = 0;
+  builder->last_key = 0;
+  builder->num_rows = 0;
+}
+
+/*
+ * Starts a new node on one level of the tree under construction.
+ */
+static uint32_t table_builder_open_node(TableBuilder *builder, uint32_t level) {
+  uint32_t page_num = get_unused_page_num(builder->table->pager);
+  void *node = get_page(builder->table->pager, page_num);
+  pager_mark_dirty(builder->table->pager, page_num);
+
+  if (level == 0) {
+    initialize_leaf_node(node);
+  } else {
+    initialize_internal_node(node);
+  }
+  if (level == builder->height) {
+    builder->height++;
+    builder->nodes_per_level[level] = 0;
+  }
+  builder->open_pages[level] = page_num;
+  builder->nodes_per_level[level]++;
+
+  return page_num;
+}
+
+/*
+ * Hands a finished node to the level above it.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder.
+ * - level: The level of the parent that receives the node.
+ * - child_page_num: The finished node. Its maximum key is the last key added
+ * to the builder, because rows arrive in order.
+ *
+ * The parent keeps its newest child as the right child. Adding another child
+ * moves the previous right child into the cells. A parent that is already
+ * full is itself finished first, and a new parent is started.
+ */
+static void table_builder_push(TableBuilder *builder, uint32_t level,
+                               uint32_t child_page_num) {
+  Pager *pager = builder->table->pager;
+
+  if (level == builder->height) {
+    uint32_t page_num = table_builder_open_node(builder, level);
+    void *node = get_page(pager, page_num);
+    *internal_node_right_child(node) = child_page_num;
+    pager_mark_dirty(pager, child_page_num);
+    *node_parent(get_page(pager, child_page_num)) = page_num;
+    return;
+  }
+
+  uint32_t page_num = builder->open_pages[level];
+  void *node = get_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  if (num_keys >= builder->internal_capacity) {
+    table_builder_push(builder, level + 1, page_num);
+    page_num = table_builder_open_node(builder, level);
+    node = get_page(pager, page_num);
+    *internal_node_right_child(node) = child_page_num;
+  } else {
+    uint32_t right_child_page_num = *internal_node_right_child(node);
+    *internal_node_num_keys(node) = num_keys + 1;
+    *internal_node_child(node, num_keys) = right_child_page_num;
+    *internal_node_key(node, num_keys) =
+        get_node_max_key(pager, get_page(pager, right_child_page_num));
+    *internal_node_right_child(node) = child_page_num;
+  }
+  pager_mark_dirty(pager, child_page_num);
+  *node_parent(get_page(pager, child_page_num)) = page_num;
+}
+
+/*
+ * Appends a row to the table under construction.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder.
+ * - row: The row to append. Its id must be larger than every id added before.
+ *
+ * Rows fill the current leaf up to the builder's capacity. The next row then
+ * starts a new leaf, and the full one is linked into the level above.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_TABLE_FULL if the pager could not hold
+ * the pages needed to finish the tree.
+ */
+ExecuteResult table_builder_add(TableBuilder *builder, Row *row) {
+  Pager *pager = builder->table->pager;
+
+  // Leave room for a new node on every level plus the final one on each level
+  if (pager->num_pages + 2 * (builder->height + 1) > TABLE_MAX_PAGES ||
+      builder->height == TABLE_MAX_HEIGHT - 1) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  if (builder->height == 0) {
+    table_builder_open_node(builder, 0);
+  }
+
+  void *leaf = get_page(pager, builder->open_pages[0]);
+  uint32_t num_cells = *leaf_node_num_cells(leaf);
+  if (num_cells >= builder->leaf_capacity) {
+    uint32_t full_page_num = builder->open_pages[0];
+    table_builder_push(builder, 1, full_page_num);
+    leaf = get_page(pager, table_builder_open_node(builder, 0));
+    num_cells = 0;
+  }
+
+  pager_mark_dirty(pager, builder->open_pages[0]);
+  *leaf_node_key(leaf, num_cells) = row->id;
+  serialize_row(row, leaf_node_value(leaf, num_cells));
+  *leaf_node_num_cells(leaf) = num_cells + 1;
+
+  builder->last_key = row->id;
+  builder->num_rows++;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Allocates empty leaves for a caller that fills them itself.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder.
+ * - num_leaves: The number of leaves to allocate.
+ * - page_nums: Set to the page numbers of the leaves, which are consecutive.
+ *
+ * The leaves are marked dirty up front, so they can then be filled from
+ * several threads without going through the pager. Each one is linked into the
+ * tree by table_builder_add_leaf once it is filled.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_TABLE_FULL, without allocating anything,
+ * if the pager could not hold the leaves and the internal nodes above them.
+ */
+ExecuteResult table_builder_open_leaves(TableBuilder *builder,
+                                        uint32_t num_leaves,
+                                        uint32_t *page_nums) {
+  Pager *pager = builder->table->pager;
+
+  uint32_t num_pages = num_leaves;
+  uint32_t height = 1;
+  for (uint32_t n = num_leaves; n > 1; height++) {
+    n = (n + builder->internal_capacity) / (builder->internal_capacity + 1);
+    num_pages += n;
+  }
+  if (pager->num_pages + num_pages + 1 > TABLE_MAX_PAGES ||
+      height >= TABLE_MAX_HEIGHT) {
+    return EXECUTE_TABLE_FULL;
+  }
+
+  for (uint32_t i = 0; i < num_leaves; i++) {
+    page_nums[i] = get_unused_page_num(pager);
+    void *leaf = get_page(pager, page_nums[i]);
+    pager_mark_dirty(pager, page_nums[i]);
+    initialize_leaf_node(leaf);
+  }
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Appends a filled leaf from table_builder_open_leaves to the table under
+ * construction.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder.
+ * - page_num: The leaf. Its keys must be larger than every key added before.
+ *
+ * Does not return a value.
+ */
+void table_builder_add_leaf(TableBuilder *builder, uint32_t page_num) {
+  void *leaf = get_page(builder->table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(leaf);
+
+  if (builder->height == 0) {
+    builder->height = 1;
+    builder->nodes_per_level[0] = 0;
+  } else {
+    table_builder_push(builder, 1, builder->open_pages[0]);
+  }
+  builder->open_pages[0] = page_num;
+  builder->nodes_per_level[0]++;
+
+  if (num_cells > 0) {
+    builder->last_key = *leaf_node_key(leaf, num_cells - 1);
+  }
+  builder->num_rows += num_cells;
+}
+
+/*
+ * Links the remaining open nodes and installs the top node as the root.
+ *
+ * Parameters:
+ * - builder: A pointer to the TableBuilder.
+ *
+ * Each open node is handed to the level above, until a level is reached that
+ * only ever held one node. That node is copied onto the root page. The page it
+ * leaves behind is filled with the last page of the file, and the file is
+ * shortened by one page, so no page is wasted. The planner's statistics no
+ * longer describe the tree and are thrown away.
+ *
+ * The root stays locked until the page has been moved, so optimistic readers
+ * wait at the root rather than reach a node of the new tree before it is in
+ * place. The root keeps its own version counter.
+ *
+ * Does not return a value.
+ */
+void table_builder_finish(TableBuilder *builder) {
+  Table *table = builder->table;
+  Pager *pager = table->pager;
+  table_stats_invalidate(table);
+
+  if (builder->height == 0) {
+    return;
+  }
+
+  uint32_t level = 0;
+  while (!(level == builder->height - 1 &&
+           builder->nodes_per_level[level] == 1)) {
+    table_builder_push(builder, level + 1, builder->open_pages[level]);
+    level++;
+  }
+
+  uint32_t top_page_num = builder->open_pages[level];
+  void *root = get_page(pager, table->root_page_num);
+  uint32_t freelist_head = *node_parent(root);
+  pager_mark_dirty(pager, table->root_page_num);
+  node_lock(root);
+  uint32_t version = *node_version(root);
+  memcpy(root, get_page(pager, top_page_num), PAGE_SIZE);
+  *node_version(root) = version;
+  set_node_root(root, true);
+  *node_parent(root) = freelist_head;
+  if (get_node_type(root) == NODE_INTERNAL) {
+    internal_node_adopt_children(pager, table->root_page_num);
+  }
+
+  uint32_t last_page_num = pager->num_pages - 1;
+  if (top_page_num != last_page_num) {
+    btree_move_page(table, last_page_num, top_page_num);
+  }
+  pager_truncate(pager, last_page_num);
+  node_unlock(root);
+}
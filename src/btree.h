@@ -13,8 +13,32 @@ uint32_t *internal_node_right_child(void *node);
 uint32_t *internal_node_cell(void *node, uint32_t cell_num);
 uint32_t *internal_node_child(void *node, uint32_t child_num);
 uint32_t *internal_node_key(void *node, uint32_t key_num);
-uint32_t get_node_max_key(void *node);
+uint32_t internal_node_find_child(void *node, uint32_t key);
+void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key);
+void internal_node_adopt_children(Pager *pager, uint32_t page_num);
+void internal_node_insert(Table *table, uint32_t parent_page_num,
+                          uint32_t child_page_num);
+void internal_node_split_and_insert(Table *table, uint32_t page_num,
+                                    uint32_t child_page_num);
+uint32_t get_node_max_key(Pager *pager, void *node);
 bool is_node_root(void *node);
 void set_node_root(void *node, bool is_root);
+uint32_t *node_parent(void *node);
+uint32_t table_freelist_head(Table *table);
+uint32_t table_allocate_page(Table *table);
+void table_free_page(Table *table, uint32_t page_num);
+uint32_t table_last_leaf(Table *table);
+ExecuteResult table_bulk_insert(Table *table, Row *rows, uint32_t num_rows,
+                                uint32_t *num_inserted);
+void btree_move_page(Table *table, uint32_t from_page_num,
+                     uint32_t to_page_num);
+void table_builder_init(TableBuilder *builder, Table *table,
+                        uint32_t fill_percent);
+ExecuteResult table_builder_add(TableBuilder *builder, Row *row);
+ExecuteResult table_builder_open_leaves(TableBuilder *builder,
+                                        uint32_t num_leaves,
+                                        uint32_t *page_nums);
+void table_builder_add_leaf(TableBuilder *builder, uint32_t page_num);
+void table_builder_finish(TableBuilder *builder);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,42 @@
+#include "checksum.h"
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fills the lookup table for the reflected CRC-32 polynomial (0xEDB88320),
+ * the same checksum used by zlib and gzip.
+ */
+static void crc32_build_table() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (uint32_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+    }
+    crc32_table[i] = crc;
+  }
+}
+
+/*
+ * Updates a CRC-32 checksum with a block of bytes.
+ *
+ * Parameters:
+ * - crc: The checksum of the data so far, or 0 for the first block.
+ * - data: A pointer to the bytes to add.
+ * - length: The number of bytes to add.
+ *
+ * Feeding a stream through this function in pieces gives the same result as
+ * checksumming it in one call.
+ *
+ * Returns the updated checksum.
+ */
+uint32_t checksum_crc32(uint32_t crc, const void *data, size_t length) {
+  pthread_once(&crc32_table_once, crc32_build_table);
+
+  const uint8_t *bytes = data;
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
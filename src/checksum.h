@@ -0,0 +1,8 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "constants.h"
+
+uint32_t checksum_crc32(uint32_t crc, const void *data, size_t length);
+
+#endif
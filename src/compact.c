@@ -0,0 +1,232 @@
+#include "compact.h"
+#include "btree.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+
+/*
+ * Finds the position of a child within its parent.
+ *
+ * Returns the child index, with num_keys meaning the right child.
+ */
+static uint32_t internal_node_child_index(void *parent, uint32_t child_page_num) {
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (*internal_node_child(parent, i) == child_page_num) {
+      return i;
+    }
+  }
+  return num_keys;
+}
+
+/*
+ * Replaces a root that has a single leaf child with that leaf.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - leaf_page_num: The only child of the root.
+ *
+ * The leaf is copied onto the root page, keeping the freelist head and the
+ * version counter stored there, and its old page is freed. The caller must
+ * hold the locks of both nodes.
+ *
+ * Does not return a value.
+ */
+static void compact_collapse_root(Table *table, uint32_t leaf_page_num) {
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  uint32_t freelist_head = *node_parent(root);
+  uint32_t version = *node_version(root);
+
+  pager_mark_dirty(pager, table->root_page_num);
+  memcpy(root, get_page(pager, leaf_page_num), PAGE_SIZE);
+  *node_version(root) = version;
+  set_node_root(root, true);
+  *node_parent(root) = freelist_head;
+  table_free_page(table, leaf_page_num);
+}
+
+/*
+ * Repacks a run of sparse sibling leaves into as few leaves as possible.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - page_num: The first leaf of the run.
+ * - max_leaves: The most leaves the run may span.
+ *
+ * Starting at the given leaf, consecutive children of the same parent are
+ * collected while they are filled below COMPACT_FILL_PERCENT. Their cells
+ * are packed, in order, into full leaves at the front of the run. The leaves
+ * left empty are removed from the parent and go to the freelist. The key
+ * range covered by the parent does not change, so no other node needs
+ * updating. The parent and every leaf of the run are locked while they are
+ * rewritten, parent first as in table_find_for_update, so optimistic readers
+ * of any of them start over.
+ *
+ * Leaves only fall below half full after a split in this tree. So a pair of
+ * sparse leaves rarely fits into one, but three split leaves usually fit into
+ * two.
+ *
+ * Returns the number of pages freed.
+ */
+static uint32_t compact_leaf_run(Table *table, uint32_t page_num,
+                                 uint32_t max_leaves) {
+  Pager *pager = table->pager;
+  void *leaf = get_page(pager, page_num);
+  if (is_node_root(leaf)) {
+    return 0;
+  }
+
+  uint32_t parent_page_num = *node_parent(leaf);
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  uint32_t first = internal_node_child_index(parent, page_num);
+  uint32_t threshold = LEAF_NODE_MAX_CELLS * COMPACT_FILL_PERCENT / 100;
+
+  uint32_t run_length = 0;
+  uint32_t total_cells = 0;
+  while (first + run_length <= num_keys && run_length < max_leaves) {
+    void *sibling =
+        get_page(pager, *internal_node_child(parent, first + run_length));
+    uint32_t num_cells = *leaf_node_num_cells(sibling);
+    if (num_cells >= threshold) {
+      break;
+    }
+    total_cells += num_cells;
+    run_length++;
+  }
+
+  uint32_t needed =
+      (total_cells + LEAF_NODE_MAX_CELLS - 1) / LEAF_NODE_MAX_CELLS;
+  if (needed == 0) {
+    needed = 1;
+  }
+  if (run_length < 2 || needed >= run_length) {
+    return 0;
+  }
+
+  uint32_t run_pages[run_length];
+  node_lock(parent);
+  for (uint32_t i = 0; i < run_length; i++) {
+    run_pages[i] = *internal_node_child(parent, first + i);
+    node_lock(get_page(pager, run_pages[i]));
+  }
+
+  // Pull every cell of the run into one buffer, in key order
+  void *cells = malloc(total_cells * LEAF_NODE_CELL_SIZE);
+  uint32_t copied = 0;
+  for (uint32_t i = 0; i < run_length; i++) {
+    void *sibling = get_page(pager, run_pages[i]);
+    uint32_t num_cells = *leaf_node_num_cells(sibling);
+    memcpy(cells + copied * LEAF_NODE_CELL_SIZE, leaf_node_cell(sibling, 0),
+           num_cells * LEAF_NODE_CELL_SIZE);
+    copied += num_cells;
+  }
+
+  // Lay the cells out again over the first leaves of the run
+  uint32_t children[num_keys + 1];
+  uint32_t keys[num_keys + 1];
+  uint32_t num_children = 0;
+  for (uint32_t i = 0; i < first; i++) {
+    children[num_children] = *internal_node_child(parent, i);
+    keys[num_children++] = *internal_node_key(parent, i);
+  }
+  for (uint32_t i = 0; i < needed; i++) {
+    uint32_t start = i * LEAF_NODE_MAX_CELLS;
+    uint32_t count = total_cells - start < LEAF_NODE_MAX_CELLS
+                         ? total_cells - start
+                         : LEAF_NODE_MAX_CELLS;
+    void *node = get_page(pager, run_pages[i]);
+    pager_mark_dirty(pager, run_pages[i]);
+    memcpy(leaf_node_cell(node, 0), cells + start * LEAF_NODE_CELL_SIZE,
+           count * LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(node) = count;
+    children[num_children] = run_pages[i];
+    keys[num_children++] = *leaf_node_key(node, count - 1);
+  }
+  for (uint32_t i = first + run_length; i <= num_keys; i++) {
+    children[num_children] = *internal_node_child(parent, i);
+    keys[num_children++] = i < num_keys ? *internal_node_key(parent, i) : 0;
+  }
+  free(cells);
+
+  pager_mark_dirty(pager, parent_page_num);
+  *internal_node_num_keys(parent) = num_children - 1;
+  for (uint32_t i = 0; i + 1 < num_children; i++) {
+    *internal_node_child(parent, i) = children[i];
+    *internal_node_key(parent, i) = keys[i];
+  }
+  *internal_node_right_child(parent) = children[num_children - 1];
+
+  for (uint32_t i = needed; i < run_length; i++) {
+    table_free_page(table, run_pages[i]);
+  }
+
+  if (num_children == 1 && is_node_root(parent)) {
+    compact_collapse_root(table, children[0]);
+  }
+
+  for (uint32_t i = 0; i < run_length; i++) {
+    node_unlock(get_page(pager, run_pages[i]));
+  }
+  node_unlock(parent);
+  return run_length - needed;
+}
+
+/*
+ * Runs one increment of background compaction.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - max_pages: The page budget for this step. Each leaf looked at costs one
+ * page.
+ *
+ * Compaction walks the leaves in key order, resuming where the previous step
+ * stopped, and repacks runs of sparse sibling leaves. Freed pages go to the
+ * freelist, where the next split picks them up.
+ *
+ * Returns true when the walk has wrapped around past the last leaf.
+ */
+bool compact_step(Table *table, uint32_t max_pages) {
+  uint32_t pages_used = 0;
+
+  while (pages_used < max_pages) {
+    Cursor *cursor = table_find(table, table->compact_next_key);
+    uint32_t page_num = cursor->page_num;
+    cursor_close(cursor);
+
+    uint32_t budget = max_pages - pages_used;
+    if (budget > COMPACT_MAX_RUN) {
+      budget = COMPACT_MAX_RUN;
+    }
+    pages_used += budget;
+    table->compact_pages_freed += compact_leaf_run(table, page_num, budget);
+
+    void *leaf = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(leaf);
+    uint32_t max_key =
+        num_cells > 0 ? *leaf_node_key(leaf, num_cells - 1) : UINT32_MAX;
+    if (max_key == UINT32_MAX || page_num == table_last_leaf(table)) {
+      table->compact_next_key = 0;
+      return true;
+    }
+    table->compact_next_key = max_key + 1;
+  }
+
+  return false;
+}
+
+/*
+ * Runs compaction over the whole tree at once.
+ *
+ * Returns the number of pages freed.
+ */
+uint32_t compact_table(Table *table) {
+  uint32_t pages_freed_before = table->compact_pages_freed;
+
+  table->compact_next_key = 0;
+  while (!compact_step(table, COMPACT_PAGES_PER_STEP)) {
+  }
+
+  return table->compact_pages_freed - pages_freed_before;
+}
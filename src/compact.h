@@ -0,0 +1,13 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "constants.h"
+
+#define COMPACT_FILL_PERCENT 75
+#define COMPACT_MAX_RUN 8
+#define COMPACT_PAGES_PER_STEP 16
+
+bool compact_step(Table *table, uint32_t max_pages);
+uint32_t compact_table(Table *table);
+
+#endif
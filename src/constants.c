@@ -14,10 +14,17 @@ const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+// Pads the header so the version, which is read and written atomically, is
+// 4-byte aligned
+const uint32_t NODE_RESERVED_SIZE = 2;
+const uint32_t NODE_RESERVED_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+const uint32_t NODE_VERSION_SIZE = sizeof(uint32_t);
+const uint32_t NODE_VERSION_OFFSET = NODE_RESERVED_OFFSET + NODE_RESERVED_SIZE;
 const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE =
-    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+const uint32_t PARENT_POINTER_OFFSET = NODE_VERSION_OFFSET + NODE_VERSION_SIZE;
+const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE +
+                                        NODE_RESERVED_SIZE + NODE_VERSION_SIZE +
+                                        PARENT_POINTER_SIZE;
 
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
@@ -48,4 +55,8 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE =
-    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
\ No newline at end of file
+    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS =
+    PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_MAX_KEYS =
+    INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
\ No newline at end of file
@@ -1,27 +1,55 @@
 #ifndef CONSTANTS_H
 #define CONSTANTS_H
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef SQLITEDB_USDT
+#include <sys/sdt.h>
+#endif
 
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
 #define TABLE_MAX_PAGES 100
+#define TABLE_MAX_HEIGHT 8
+#define TRANSACTION_MAX_SAVEPOINTS 32
+#define SAVEPOINT_NAME_SIZE 32
+#define STATEMENT_MAX_PARAMS 3
+#define SERVER_MAX_WORKERS 64
+#define SERVER_INPUT_BUFFER_SIZE 4096
+#define SQLITEDB_ERRMSG_SIZE 512
+#define PAGER_STATS_SHARDS 16
+#define PAGER_LATENCY_BUCKETS 16
+#define SERVER_NUM_OPS 4
+#define SERVER_LATENCY_BUCKETS 20
+#define PLAN_MAX_NODES 2
+#define STATS_HISTOGRAM_BUCKETS 16
+#define PLAN_DETAIL_SIZE 320
+#define PLAN_TEXT_SIZE 448
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
 // Enums
-typedef enum {
-  META_COMMAND_SUCCESS,
-  META_COMMAND_UNRECOGNIZED_COMMAND
-} MetaCommandResult;
-
 typedef enum {
   PREPARE_SUCCESS,
   PREPARE_UNRECOGNIZED_STATEMENT,
@@ -30,16 +58,73 @@ typedef enum {
   PREPARE_NEGATIVE_ID,
 } PrepareResult;
 
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_UPDATE,
+  STATEMENT_BEGIN,
+  STATEMENT_COMMIT,
+  STATEMENT_ROLLBACK,
+  STATEMENT_SAVEPOINT,
+  STATEMENT_RELEASE,
+  STATEMENT_ROLLBACK_TO,
+  STATEMENT_ANALYZE
+} StatementType;
+
+typedef enum { NODE_INTERNAL, NODE_LEAF, NODE_FREE, NODE_META } NodeType;
+
+typedef enum { SCAN_ROWS, SCAN_COUNT, SCAN_SUM } ScanAggregate;
+
+typedef enum {
+  SCAN_COLUMN_NONE,
+  SCAN_COLUMN_ID,
+  SCAN_COLUMN_USERNAME,
+  SCAN_COLUMN_EMAIL
+} ScanColumn;
+
+typedef enum { EXPLAIN_NONE, EXPLAIN_PLAN, EXPLAIN_ANALYZE } ExplainMode;
+
+// The field of a Statement that a "?" word was parsed into
+typedef enum {
+  STATEMENT_PARAM_ID,
+  STATEMENT_PARAM_USERNAME,
+  STATEMENT_PARAM_EMAIL,
+  STATEMENT_PARAM_FILTER_ID,
+  STATEMENT_PARAM_FILTER_VALUE,
+  STATEMENT_PARAM_SAVEPOINT_NAME
+} StatementParam;
 
-typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
+// How a select reads the table
+typedef enum {
+  PLAN_PARALLEL_SCAN,
+  PLAN_CURSOR_SCAN,
+  PLAN_SEEK,
+  PLAN_RANGE_SCAN
+} PlanAccess;
 
 typedef enum {
   EXECUTE_SUCCESS,
   EXECUTE_TABLE_FULL,
-  EXECUTE_DUPLICATE_KEY
+  EXECUTE_DUPLICATE_KEY,
+  EXECUTE_NO_SUCH_KEY,
+  EXECUTE_TRANSACTION_ACTIVE,
+  EXECUTE_NO_TRANSACTION,
+  EXECUTE_NO_SUCH_SAVEPOINT,
+  EXECUTE_TOO_MANY_SAVEPOINTS,
+  EXECUTE_NOT_SUPPORTED,
+  // Failed for a reason the function wrote out for the caller
+  EXECUTE_ERROR
 } ExecuteResult;
 
+typedef enum {
+  PROFILE_PHASE_PARSE,
+  PROFILE_PHASE_DESCENT,
+  PROFILE_PHASE_IO,
+  PROFILE_PHASE_SERIALIZE,
+  PROFILE_PHASE_OUTPUT,
+  PROFILE_NUM_PHASES
+} ProfilePhase;
+
 // Structs
 typedef struct {
   uint32_t id;
@@ -48,36 +133,423 @@ typedef struct {
 } Row;
 
 typedef struct {
-  char *buffer;
-  size_t buffer_length;
-  ssize_t input_length;
-} InputBuffer;
+  uint64_t pages_read;
+  uint64_t pages_written;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  // Time spent waiting for reads, writes and syncs, whether or not phases
+  // are timed
+  uint64_t io_wait_ns;
+  uint64_t rows_examined;
+  // Time spent in each phase, less the time in phases nested inside it
+  uint64_t phase_ns[PROFILE_NUM_PHASES];
+} ProfileCounters;
+
+typedef struct {
+  uint32_t page_num;
+  uint32_t depth;
+  uint8_t *image;
+} UndoEntry;
+
+typedef struct PageVersion {
+  uint64_t version;
+  uint64_t older_version;
+  struct PageVersion *older;
+  uint8_t image[];
+} PageVersion;
+
+// Counters for the pager since it was opened. Each thread counts into one of
+// several copies, each on its own cache lines, so readers on different cores
+// do not contend on them.
+typedef struct {
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_evictions;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t fsyncs;
+  uint64_t wal_commits;
+  uint64_t wal_frames;
+  uint64_t wal_checkpoints;
+  // Page reads that took under 2^i microseconds and at least 2^(i-1); the
+  // last bucket also holds every slower read
+  uint64_t read_latency[PAGER_LATENCY_BUCKETS];
+  uint64_t read_ns;
+} __attribute__((aligned(64))) PagerStats;
 
 typedef struct {
+  char *filename;
   int file_descriptor;
   uint32_t file_length;
   uint32_t num_pages;
   void *pages[TABLE_MAX_PAGES];
+  bool dirty[TABLE_MAX_PAGES];
+  uint64_t write_counter;
+  uint64_t page_write_counters[TABLE_MAX_PAGES];
+  uint64_t commit_version;
+  uint32_t published_num_pages;
+  PageVersion *page_versions[TABLE_MAX_PAGES];
+  uint64_t page_version_stamps[TABLE_MAX_PAGES];
+  uint32_t versioned_pages[TABLE_MAX_PAGES];
+  uint32_t num_versioned_pages;
+  int wal_file_descriptor;
+  uint32_t wal_num_frames;
+  uint32_t wal_checksum;
+  bool wal_pending[TABLE_MAX_PAGES];
+  uint32_t wal_pending_pages[TABLE_MAX_PAGES];
+  uint32_t num_wal_pending;
+  uint32_t undo_depth;
+  uint32_t undo_depths[TABLE_MAX_PAGES];
+  UndoEntry *undo_log;
+  uint32_t undo_log_length;
+  uint32_t undo_log_capacity;
+  bool copy_on_write;
+  // The errno of the first read or write of the file or its log that failed,
+  // or 0, and what was being done, see pager_fail
+  int io_error;
+  const char *io_error_action;
+  PagerStats stats[PAGER_STATS_SHARDS];
 } Pager;
 
+typedef struct Backup Backup;
+typedef struct Snapshot Snapshot;
+
+typedef struct {
+  uint64_t txn_id;
+  uint32_t committed_root_page_num;
+  bool private_pages[TABLE_MAX_PAGES];
+  uint32_t free_pages[TABLE_MAX_PAGES];
+  uint32_t num_free_pages;
+  uint32_t replaced_pages[TABLE_MAX_PAGES];
+  uint32_t num_replaced_pages;
+  uint32_t pending_pages[TABLE_MAX_PAGES];
+  uint64_t pending_versions[TABLE_MAX_PAGES];
+  uint32_t num_pending_pages;
+} CopyOnWrite;
+
+// What the planner knows of a table, see table_stats_build. The row count and
+// the range of ids are kept up to date by inserts; the rest describe the
+// table as it was when they were built.
+typedef struct {
+  bool built;
+  uint64_t num_rows;
+  uint32_t min_id;
+  uint32_t max_id;
+  uint64_t distinct_usernames;
+  uint64_t distinct_emails;
+  // The largest id in each of num_buckets buckets of equally many rows
+  uint32_t histogram[STATS_HISTOGRAM_BUCKETS];
+  uint32_t num_buckets;
+  uint32_t height;
+  uint32_t num_leaves;
+  uint32_t num_internal_nodes;
+  uint64_t built_num_rows;
+  uint64_t num_inserted;
+} TableStats;
+
+// Rows inserted by the open transaction, which reach the table's statistics
+// only once it commits, see table_stats_add_rows
+typedef struct {
+  uint64_t num_rows;
+  uint32_t min_id;
+  uint32_t max_id;
+} PendingRows;
+
 typedef struct {
   uint32_t num_rows;
   uint32_t root_page_num;
   Pager *pager;
+  Backup *backup;
+  bool compact_enabled;
+  uint32_t compact_next_key;
+  uint32_t compact_pages_freed;
+  pthread_mutex_t writer_lock;
+  Snapshot *snapshots;
+  pthread_mutex_t snapshot_lock;
+  bool in_transaction;
+  pthread_t transaction_thread;
+  uint32_t transaction_num_pages;
+  char savepoint_names[TRANSACTION_MAX_SAVEPOINTS][SAVEPOINT_NAME_SIZE + 1];
+  uint32_t savepoint_num_pages[TRANSACTION_MAX_SAVEPOINTS];
+  PendingRows savepoint_pending_rows[TRANSACTION_MAX_SAVEPOINTS];
+  uint32_t num_savepoints;
+  PendingRows pending_rows;
+  // The statistics were built inside the transaction, from its own changes
+  bool stats_uncommitted;
+  CopyOnWrite *cow;
+  uint32_t published_root_page_num;
+  uint64_t num_splits;
+  TableStats stats;
+  pthread_mutex_t stats_lock;
+  // Threads reading without the writer_lock, see table_begin_read, and
+  // whether new ones are held off so the pager can be replaced
+  uint32_t num_readers;
+  bool draining;
 } Table;
 
+typedef struct {
+  uint32_t height;
+  uint32_t num_leaves;
+  uint32_t num_internal_nodes;
+  uint32_t num_pages;
+  uint32_t num_free_pages;
+  uint64_t num_rows;
+  uint64_t num_internal_keys;
+} TreeStats;
+
+
 typedef struct {
   Table *table;
   uint32_t page_num;
   uint32_t cell_num;
   bool end_of_table;
+  Snapshot *snapshot;
+  uint32_t locked_pages[TABLE_MAX_HEIGHT];
+  uint32_t num_locked;
 } Cursor;
 
+typedef struct {
+  ScanAggregate aggregate;
+  ScanColumn filter_column;
+  char filter_operator;
+  uint32_t filter_id;
+  char filter_value[COLUMN_EMAIL_SIZE + 1];
+} ScanQuery;
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  Row *rows;
+} ScanResult;
+
+// One operator of a plan. The actual figures are filled in by explain
+// analyze and include the operators below this one.
+typedef struct {
+  char detail[PLAN_DETAIL_SIZE];
+  uint32_t depth;
+  uint64_t estimated_rows;
+  uint64_t estimated_pages;
+  bool analyzed;
+  uint64_t rows;
+  uint64_t rows_examined;
+  uint64_t pages;
+  uint64_t elapsed_ns;
+} PlanNode;
+
+// The operators of a plan, top first, and the one that reads the table
+typedef struct {
+  PlanAccess access;
+  PlanNode nodes[PLAN_MAX_NODES];
+  uint32_t num_nodes;
+  uint32_t access_node;
+} Plan;
+
 typedef struct {
   StatementType type;
+  ExplainMode explain;
   Row row_to_insert;
+  char savepoint_name[SAVEPOINT_NAME_SIZE + 1];
+  ScanQuery query;
+  // The "?" words, in the order they appear
+  StatementParam params[STATEMENT_MAX_PARAMS];
+  uint32_t num_params;
 } Statement;
 
+struct Backup {
+  Table *table;
+  char *filename;
+  char *temp_filename;
+  int file_descriptor;
+  uint32_t next_page_num;
+  uint32_t pages_per_step;
+  uint32_t num_passes;
+  uint32_t pages_copied;
+  // The errno of the first failed write to the copy, or 0
+  int error;
+  uint64_t copied_write_counters[TABLE_MAX_PAGES];
+  bool copied[TABLE_MAX_PAGES];
+};
+
+struct Snapshot {
+  Table *table;
+  uint64_t version;
+  uint32_t root_page_num;
+  void *node_image;
+  void *leaf_image;
+  Snapshot *previous;
+  Snapshot *next;
+};
+
+typedef struct Connection {
+  int fd;
+  uint8_t input[SERVER_INPUT_BUFFER_SIZE];
+  uint32_t input_length;
+  uint8_t *output;
+  uint32_t output_length;
+  uint32_t output_capacity;
+  uint32_t output_sent;
+  bool busy;
+  bool closing;
+  // Scraping metrics over HTTP rather than running requests
+  bool metrics;
+  struct Connection *next;
+  struct Connection *previous_open;
+  struct Connection *next_open;
+} Connection;
+
+// Requests run by one server worker, by op code, with 0 for a malformed
+// request. Only the worker writes them.
+typedef struct {
+  // Requests that took under 2^i microseconds and at least 2^(i-1); the last
+  // bucket also holds every slower request
+  uint64_t latency[SERVER_NUM_OPS][SERVER_LATENCY_BUCKETS];
+  uint64_t latency_ns[SERVER_NUM_OPS];
+} __attribute__((aligned(64))) ServerStats;
+
+typedef struct {
+  FILE *file;
+  uint64_t threshold_ns;
+  // Entries written in the current second, and those left out once the
+  // limit was reached
+  uint64_t window_start_ns;
+  uint32_t window_count;
+  uint64_t num_suppressed;
+  pthread_mutex_t lock;
+} SlowLog;
+
+typedef struct Server Server;
+
+typedef struct {
+  Server *server;
+  pthread_t thread;
+  ServerStats stats;
+} ServerWorker;
+
+struct Server {
+  Table *table;
+  SlowLog *slow_log;
+  int epoll_fd;
+  int listen_fd;
+  int metrics_fd;
+  int event_fd;
+  int signal_fd;
+  char *socket_path;
+  char *metrics_socket_path;
+  ServerWorker workers[SERVER_MAX_WORKERS];
+  uint32_t num_workers;
+  pthread_mutex_t lock;
+  pthread_cond_t work_ready;
+  Connection *work_head;
+  Connection *work_tail;
+  Connection *done_head;
+  Connection *open_connections;
+  bool stopping;
+};
+
+typedef struct SqliteDb SqliteDb;
+typedef struct SqliteStmt SqliteStmt;
+typedef struct SqliteCursor SqliteCursor;
+typedef struct SqliteAsync SqliteAsync;
+
+struct SqliteDb {
+  Table *table;
+  char errmsg[SQLITEDB_ERRMSG_SIZE];
+  SlowLog slow_log;
+};
+
+struct SqliteStmt {
+  SqliteDb *db;
+  char *sql;
+  Statement statement;
+  bool bound[STATEMENT_MAX_PARAMS];
+  bool running;
+  Snapshot *snapshot;
+  Cursor *cursor;
+  ScanResult scan;
+  uint64_t scan_position;
+  Row row;
+  uint64_t aggregate;
+  uint32_t num_columns;
+  char column_text[24];
+  Plan plan;
+  char plan_text[PLAN_TEXT_SIZE];
+  // Taken when the statement starts, if the slow log is on
+  uint64_t start_ns;
+  ProfileCounters start_counters;
+  uint64_t rows_returned;
+};
+
+struct SqliteCursor {
+  SqliteDb *db;
+  Snapshot *snapshot;
+  Cursor *cursor;
+  Row row;
+  bool started;
+};
+
+typedef void (*AsyncCallback)(void *context, Row *row);
+
+typedef struct AsyncOp {
+  bool scan;
+  uint32_t key;
+  AsyncCallback callback;
+  void *context;
+  Snapshot *snapshot;
+  uint32_t page_num;
+  uint32_t depth;
+  void *images[TABLE_MAX_HEIGHT];
+  uint32_t child_indexes[TABLE_MAX_HEIGHT];
+  struct AsyncOp *next;
+} AsyncOp;
+
+typedef struct {
+  int fd;
+  // Counts completions, so an event loop can wait for them
+  int event_fd;
+  uint32_t num_entries;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  uint32_t *sq_tail;
+  uint32_t *sq_mask;
+  uint32_t *sq_array;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t *cq_mask;
+  struct io_uring_cqe *cqes;
+} AsyncRing;
+
+typedef struct {
+  Table *table;
+  AsyncRing ring;
+  uint32_t num_unsubmitted;
+  uint32_t num_in_flight;
+  uint32_t num_pending_ops;
+  AsyncOp *waiters[TABLE_MAX_PAGES];
+  void *reads[TABLE_MAX_PAGES];
+  uint32_t deferred_pages[TABLE_MAX_PAGES];
+  uint32_t deferred_head;
+  uint32_t num_deferred;
+} AsyncEngine;
+
+struct SqliteAsync {
+  SqliteDb *db;
+  AsyncEngine *engine;
+};
+
+typedef struct {
+  Table *table;
+  uint32_t leaf_capacity;
+  uint32_t internal_capacity;
+  uint32_t height;
+  uint32_t open_pages[TABLE_MAX_HEIGHT];
+  uint32_t nodes_per_level[TABLE_MAX_HEIGHT];
+  uint32_t last_key;
+  uint32_t num_rows;
+} TableBuilder;
+
 // Declarations
 extern const uint32_t PAGE_SIZE;
 extern const uint32_t ID_SIZE;
@@ -91,6 +563,10 @@ extern const uint32_t NODE_TYPE_SIZE;
 extern const uint32_t NODE_TYPE_OFFSET;
 extern const uint32_t IS_ROOT_SIZE;
 extern const uint32_t IS_ROOT_OFFSET;
+extern const uint32_t NODE_RESERVED_SIZE;
+extern const uint32_t NODE_RESERVED_OFFSET;
+extern const uint32_t NODE_VERSION_SIZE;
+extern const uint32_t NODE_VERSION_OFFSET;
 extern const uint32_t PARENT_POINTER_SIZE;
 extern const uint32_t PARENT_POINTER_OFFSET;
 extern const uint8_t COMMON_NODE_HEADER_SIZE;
@@ -114,5 +590,7 @@ extern const uint32_t INTERNAL_NODE_HEADER_SIZE;
 extern const uint32_t INTERNAL_NODE_KEY_SIZE;
 extern const uint32_t INTERNAL_NODE_CHILD_SIZE;
 extern const uint32_t INTERNAL_NODE_CELL_SIZE;
+extern const uint32_t INTERNAL_NODE_SPACE_FOR_CELLS;
+extern const uint32_t INTERNAL_NODE_MAX_KEYS;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,711 @@
+#include "cow.h"
+#include "btree.h"
+#include "checksum.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "table.h"
+
+/*
+ * Fills in a meta page.
+ *
+ * Parameters:
+ * - page: The page to fill in.
+ * - txn_id: The number of the commit the meta page describes.
+ * - root_page_num: The root of the tree as of that commit.
+ * - num_pages: The size of the database as of that commit.
+ *
+ * The checksum covers everything before it, so a meta page that was only
+ * partly written when the system went down is recognized as invalid.
+ *
+ * Does not return a value.
+ */
+static void cow_fill_meta(void *page, uint64_t txn_id, uint32_t root_page_num,
+                          uint32_t num_pages) {
+  memset(page, 0, PAGE_SIZE);
+  set_node_type(page, NODE_META);
+  memcpy(page + COW_MAGIC_OFFSET, COW_MAGIC, sizeof(COW_MAGIC));
+  memcpy(page + COW_TXN_ID_OFFSET, &txn_id, sizeof(txn_id));
+  memcpy(page + COW_ROOT_PAGE_NUM_OFFSET, &root_page_num,
+         sizeof(root_page_num));
+  memcpy(page + COW_NUM_PAGES_OFFSET, &num_pages, sizeof(num_pages));
+
+  uint32_t checksum = checksum_crc32(0, page, COW_CHECKSUM_OFFSET);
+  memcpy(page + COW_CHECKSUM_OFFSET, &checksum, sizeof(checksum));
+}
+
+/*
+ * Checks whether a page is a complete meta page.
+ *
+ * Returns true if it is.
+ */
+static bool cow_meta_valid(void *page) {
+  uint32_t checksum;
+  memcpy(&checksum, page + COW_CHECKSUM_OFFSET, sizeof(checksum));
+
+  return get_node_type(page) == NODE_META &&
+         memcmp(page + COW_MAGIC_OFFSET, COW_MAGIC, sizeof(COW_MAGIC)) == 0 &&
+         checksum_crc32(0, page, COW_CHECKSUM_OFFSET) == checksum;
+}
+
+/*
+ * Returns the commit number recorded in a meta page.
+ */
+static uint64_t cow_meta_txn_id(void *page) {
+  uint64_t txn_id;
+  memcpy(&txn_id, page + COW_TXN_ID_OFFSET, sizeof(txn_id));
+  return txn_id;
+}
+
+/*
+ * Waits until everything written to the database file is durable.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * If that fails, so does the pager, see pager_fail.
+ *
+ * Does not return a value.
+ */
+static void cow_sync(Pager *pager) {
+  if (pager->io_error == 0 &&
+      pager_fsync(pager, pager->file_descriptor, true) == -1) {
+    pager_fail(pager, "Error syncing db file", errno);
+  }
+}
+
+/*
+ * Creates an empty copy-on-write database.
+ *
+ * Parameters:
+ * - filename: The name of the database file.
+ * - error: Where to write why the file could not be formatted, at most
+ * SQLITEDB_ERRMSG_SIZE bytes.
+ *
+ * The file gets its two meta pages, the first of which points at an empty
+ * leaf as the root. A file that already has contents is left alone, so it
+ * keeps the mode it was created in.
+ *
+ * Returns false if the file could not be opened or written.
+ */
+bool cow_format(const char *filename, char *error) {
+  int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (fd == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s': %d", filename,
+             errno);
+    return false;
+  }
+  if (lseek(fd, 0, SEEK_END) != 0) {
+    close(fd);
+    return true;
+  }
+
+  uint32_t num_pages = COW_NUM_META_PAGES + 1;
+  void *pages = calloc(num_pages, PAGE_SIZE);
+  cow_fill_meta(pages, 0, COW_NUM_META_PAGES, num_pages);
+  void *root = pages + COW_NUM_META_PAGES * PAGE_SIZE;
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+
+  bool written = write(fd, pages, num_pages * PAGE_SIZE) ==
+                     num_pages * PAGE_SIZE &&
+                 fsync(fd) == 0;
+  if (!written) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error writing: %d", errno);
+  }
+  free(pages);
+  close(fd);
+  return written;
+}
+
+/*
+ * Checks whether a database file is in copy-on-write mode.
+ *
+ * Parameters:
+ * - file_descriptor: The open database file.
+ *
+ * Returns true if either of the first two pages is a valid meta page.
+ */
+bool cow_detect(int file_descriptor) {
+  void *page = malloc(PAGE_SIZE);
+  bool found = false;
+
+  for (uint32_t i = 0; i < COW_NUM_META_PAGES && !found; i++) {
+    found = pread(file_descriptor, page, PAGE_SIZE, (off_t)i * PAGE_SIZE) ==
+                PAGE_SIZE &&
+            cow_meta_valid(page);
+  }
+
+  free(page);
+  return found;
+}
+
+/*
+ * Marks every page of a subtree as reachable.
+ *
+ * Does not return a value.
+ */
+static void cow_mark_reachable(Pager *pager, uint32_t page_num,
+                               bool *reachable) {
+  reachable[page_num] = true;
+
+  void *node = get_page(pager, page_num);
+  if (get_node_type(node) != NODE_INTERNAL) {
+    return;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    cow_mark_reachable(pager, *internal_node_child(node, i), reachable);
+  }
+}
+
+/*
+ * Sets up a table opened from a copy-on-write database.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Of the two meta pages, the valid one with the higher commit number names
+ * the root and the size of the database. Anything a crashed commit appended
+ * past that size is ignored. Free pages are not recorded in the file; every
+ * page the tree cannot reach from the root is free, so they are found by
+ * walking the tree once.
+ *
+ * Does not return a value.
+ */
+void cow_open(Table *table) {
+  Pager *pager = table->pager;
+  CopyOnWrite *cow = malloc(sizeof(CopyOnWrite));
+
+  void *meta = NULL;
+  for (uint32_t i = 0; i < COW_NUM_META_PAGES; i++) {
+    void *page = get_page(pager, i);
+    if (cow_meta_valid(page) &&
+        (meta == NULL || cow_meta_txn_id(page) > cow_meta_txn_id(meta))) {
+      meta = page;
+    }
+  }
+
+  cow->txn_id = cow_meta_txn_id(meta);
+  memcpy(&table->root_page_num, meta + COW_ROOT_PAGE_NUM_OFFSET,
+         sizeof(table->root_page_num));
+  memcpy(&pager->num_pages, meta + COW_NUM_PAGES_OFFSET,
+         sizeof(pager->num_pages));
+  pager->published_num_pages = pager->num_pages;
+  cow->committed_root_page_num = table->root_page_num;
+  cow->num_free_pages = 0;
+  cow->num_replaced_pages = 0;
+  cow->num_pending_pages = 0;
+
+  bool *reachable = calloc(TABLE_MAX_PAGES, sizeof(bool));
+  cow_mark_reachable(pager, table->root_page_num, reachable);
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    cow->private_pages[i] = false;
+    if (i >= COW_NUM_META_PAGES && i < pager->num_pages && !reachable[i]) {
+      cow->free_pages[cow->num_free_pages++] = i;
+    }
+  }
+  free(reachable);
+
+  table->cow = cow;
+}
+
+/*
+ * Writes a node into a page nobody else can reach.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - image: The contents of the node.
+ *
+ * The page comes from the free pages if there are any, otherwise from the end
+ * of the file. A free page may still be under an optimistic reader that
+ * started before it was freed, so it is locked while it is overwritten and
+ * keeps its own version counter; that reader then starts over.
+ *
+ * Returns the page number the node was written to.
+ */
+static uint32_t cow_write_node(Table *table, void *image) {
+  Pager *pager = table->pager;
+  CopyOnWrite *cow = table->cow;
+  uint32_t page_num = cow->num_free_pages > 0
+                          ? cow->free_pages[--cow->num_free_pages]
+                          : get_unused_page_num(pager);
+
+  void *page = get_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+  node_lock(page);
+  uint32_t version = *node_version(page);
+  memcpy(page, image, PAGE_SIZE);
+  *node_version(page) = version;
+  node_unlock(page);
+
+  cow->private_pages[page_num] = true;
+  return page_num;
+}
+
+/*
+ * Takes a page out of the tree after a copy of it has replaced it.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - page_num: The page that was replaced.
+ *
+ * Optimistic readers still on the page are sent back to the root. A page
+ * written since the last commit was never seen by a snapshot or written to
+ * disk, so it is free straight away. A committed page is still part of the
+ * tree on disk and of every open snapshot, so it is only set aside; see
+ * cow_commit and cow_reclaim.
+ *
+ * Does not return a value.
+ */
+static void cow_release_page(Table *table, uint32_t page_num) {
+  Pager *pager = table->pager;
+  CopyOnWrite *cow = table->cow;
+
+  void *page = get_page(pager, page_num);
+  node_lock(page);
+  node_unlock(page);
+
+  if (cow->private_pages[page_num]) {
+    cow->private_pages[page_num] = false;
+    pager->dirty[page_num] = false;
+    cow->free_pages[cow->num_free_pages++] = page_num;
+  } else {
+    cow->replaced_pages[cow->num_replaced_pages++] = page_num;
+  }
+}
+
+/*
+ * Builds the copy of a leaf with one more row in it.
+ *
+ * Parameters:
+ * - leaf: The leaf to copy.
+ * - cell_num: Where the new row goes.
+ * - row: The row to insert; its id is the key.
+ * - left: Where to build the copy.
+ * - right: Where to build the upper half if the leaf has to split.
+ *
+ * The leaf itself is not touched.
+ *
+ * Returns true if the leaf split.
+ */
+static bool cow_leaf_insert(void *leaf, uint32_t cell_num, Row *row,
+                            void *left, void *right) {
+  uint32_t num_cells = *leaf_node_num_cells(leaf);
+
+  if (num_cells < LEAF_NODE_MAX_CELLS) {
+    memcpy(left, leaf, PAGE_SIZE);
+    memmove(leaf_node_cell(left, cell_num + 1), leaf_node_cell(left, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(left) = num_cells + 1;
+    *leaf_node_key(left, cell_num) = row->id;
+    serialize_row(row, leaf_node_value(left, cell_num));
+    return false;
+  }
+
+  initialize_leaf_node(left);
+  initialize_leaf_node(right);
+  for (uint32_t i = 0; i <= LEAF_NODE_MAX_CELLS; i++) {
+    void *destination_node = i < LEAF_NODE_LEFT_SPLIT_COUNT ? left : right;
+    uint32_t index_within_node = i < LEAF_NODE_LEFT_SPLIT_COUNT
+                                     ? i
+                                     : i - LEAF_NODE_LEFT_SPLIT_COUNT;
+    void *destination = leaf_node_cell(destination_node, index_within_node);
+
+    if (i == cell_num) {
+      *leaf_node_key(destination_node, index_within_node) = row->id;
+      serialize_row(row, leaf_node_value(destination_node, index_within_node));
+    } else if (i > cell_num) {
+      memcpy(destination, leaf_node_cell(leaf, i - 1), LEAF_NODE_CELL_SIZE);
+    } else {
+      memcpy(destination, leaf_node_cell(leaf, i), LEAF_NODE_CELL_SIZE);
+    }
+  }
+  *leaf_node_num_cells(left) = LEAF_NODE_LEFT_SPLIT_COUNT;
+  *leaf_node_num_cells(right) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+  return true;
+}
+
+/*
+ * Stores children and keys into an internal node.
+ *
+ * Parameters:
+ * - node: The internal node.
+ * - children: The children, num_keys + 1 of them; the last is the right child.
+ * - keys: The keys; key i is the largest key under child i.
+ * - num_keys: The number of keys.
+ *
+ * Does not return a value.
+ */
+static void cow_set_cells(void *node, uint32_t *children, uint32_t *keys,
+                          uint32_t num_keys) {
+  *internal_node_num_keys(node) = num_keys;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    *internal_node_cell(node, i) = children[i];
+    *internal_node_key(node, i) = keys[i];
+  }
+  *internal_node_right_child(node) = children[num_keys];
+}
+
+/*
+ * Builds the copy of an internal node after one of its children was copied.
+ *
+ * Parameters:
+ * - node: The internal node to copy.
+ * - child_index: Which child was copied.
+ * - left_child: The page of the copy.
+ * - child_split: Whether the child split into two.
+ * - left_max_key: If it split, the largest key of the lower half.
+ * - right_child: If it split, the page of the upper half.
+ * - left: Where to build the copy.
+ * - right: Where to build the upper half if the node has to split.
+ * - separator: Where to store the largest key of the lower half if it does.
+ *
+ * The node itself is not touched.
+ *
+ * Returns true if the node split.
+ */
+static bool cow_internal_insert(void *node, uint32_t child_index,
+                                uint32_t left_child, bool child_split,
+                                uint32_t left_max_key, uint32_t right_child,
+                                void *left, void *right, uint32_t *separator) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 2];
+  uint32_t keys[INTERNAL_NODE_MAX_KEYS + 1];
+
+  for (uint32_t i = 0; i < num_keys; i++) {
+    children[i] = *internal_node_cell(node, i);
+    keys[i] = *internal_node_key(node, i);
+  }
+  children[num_keys] = *internal_node_right_child(node);
+
+  children[child_index] = left_child;
+  if (child_split) {
+    // The upper half keeps the old child's largest key
+    for (uint32_t i = num_keys + 1; i > child_index + 1; i--) {
+      children[i] = children[i - 1];
+    }
+    for (uint32_t i = num_keys; i > child_index; i--) {
+      keys[i] = keys[i - 1];
+    }
+    children[child_index + 1] = right_child;
+    keys[child_index] = left_max_key;
+    num_keys++;
+  }
+
+  if (num_keys <= INTERNAL_NODE_MAX_KEYS) {
+    memcpy(left, node, PAGE_SIZE);
+    cow_set_cells(left, children, keys, num_keys);
+    return false;
+  }
+
+  uint32_t left_num_keys = num_keys / 2;
+  initialize_internal_node(left);
+  initialize_internal_node(right);
+  cow_set_cells(left, children, keys, left_num_keys);
+  cow_set_cells(right, children + left_num_keys + 1, keys + left_num_keys + 1,
+                num_keys - left_num_keys - 1);
+  *separator = keys[left_num_keys];
+  return true;
+}
+
+/*
+ * Descends a copy-on-write table to the leaf that holds, or would hold, a key.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - key: The key to find.
+ * - path: Where to store the internal nodes on the way down, root first.
+ * - child_indexes: Where to store which child was taken at each of them.
+ * - depth: Where to store the number of internal nodes.
+ *
+ * Returns the page number of the leaf.
+ */
+static uint32_t cow_find_leaf(Table *table, uint32_t key, uint32_t *path,
+                              uint32_t *child_indexes, uint32_t *depth) {
+  Pager *pager = table->pager;
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(pager, page_num);
+  *depth = 0;
+  while (get_node_type(node) == NODE_INTERNAL) {
+    path[*depth] = page_num;
+    child_indexes[*depth] = internal_node_find_child(node, key);
+    page_num = *internal_node_child(node, child_indexes[*depth]);
+    node = get_page(pager, page_num);
+    (*depth)++;
+  }
+  return page_num;
+}
+
+/*
+ * Writes the copy of a leaf and copies of every node above it, and makes the
+ * copy of the root the new root.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - path: The internal nodes above the leaf, root first, see cow_find_leaf.
+ * - child_indexes: Which child was taken at each of them.
+ * - depth: The number of internal nodes.
+ * - leaf_page_num: The leaf that was copied.
+ * - left: The copy of the leaf. Reused to build the copies above it.
+ * - right: The upper half of the copy if the leaf split. Reused likewise.
+ * - split: Whether the leaf split.
+ *
+ * Nodes split on the way up as needed, and the pages that were copied are
+ * released, see cow_release_page. Ends the write the caller started.
+ *
+ * Does not return a value.
+ */
+static void cow_write_path(Table *table, uint32_t *path,
+                           uint32_t *child_indexes, uint32_t depth,
+                           uint32_t leaf_page_num, uint8_t *left,
+                           uint8_t *right, bool split) {
+  Pager *pager = table->pager;
+  uint32_t left_page_num = cow_write_node(table, left);
+  uint32_t right_page_num = 0;
+  uint32_t left_max_key = 0;
+  if (split) {
+    __atomic_fetch_add(&table->num_splits, 1, __ATOMIC_RELAXED);
+    right_page_num = cow_write_node(table, right);
+    left_max_key = *leaf_node_key(left, LEAF_NODE_LEFT_SPLIT_COUNT - 1);
+  }
+
+  for (uint32_t level = depth; level > 0; level--) {
+    void *parent = get_page(pager, path[level - 1]);
+    uint32_t separator;
+    split = cow_internal_insert(parent, child_indexes[level - 1], left_page_num,
+                                split, left_max_key, right_page_num, left,
+                                right, &separator);
+    left_page_num = cow_write_node(table, left);
+    if (split) {
+      __atomic_fetch_add(&table->num_splits, 1, __ATOMIC_RELAXED);
+      right_page_num = cow_write_node(table, right);
+      left_max_key = separator;
+    }
+  }
+
+  if (split) {
+    initialize_internal_node(left);
+    set_node_root(left, true);
+    *internal_node_num_keys(left) = 1;
+    *internal_node_cell(left, 0) = left_page_num;
+    *internal_node_key(left, 0) = left_max_key;
+    *internal_node_right_child(left) = right_page_num;
+    left_page_num = cow_write_node(table, left);
+  }
+
+  __atomic_store_n(&table->root_page_num, left_page_num, __ATOMIC_RELEASE);
+  for (uint32_t level = 0; level < depth; level++) {
+    cow_release_page(table, path[level]);
+  }
+  cow_release_page(table, leaf_page_num);
+
+  table_end_write(table);
+}
+
+/*
+ * Inserts a row into a copy-on-write table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - row: The row to insert; its id is the key.
+ *
+ * No page of the tree is modified. The leaf and every node above it are
+ * copied into fresh pages with the change applied, splitting on the way up
+ * as needed, and the copy of the root becomes the new root. The pages that
+ * were copied are released, see cow_release_page. The new tree is written to
+ * disk and published by table_end_write, see cow_commit.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_DUPLICATE_KEY if the key is already in the
+ * table, or EXECUTE_TABLE_FULL if the copies could need more pages than the
+ * pager can hold.
+ */
+ExecuteResult cow_insert(Table *table, Row *row) {
+  Pager *pager = table->pager;
+  uint32_t path[TABLE_MAX_HEIGHT];
+  uint32_t child_indexes[TABLE_MAX_HEIGHT];
+  uint32_t depth;
+
+  table_begin_write(table);
+
+  uint32_t page_num = cow_find_leaf(table, row->id, path, child_indexes,
+                                    &depth);
+  void *node = get_page(pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t cell_num = leaf_node_find_cell(node, num_cells, row->id);
+  if (cell_num < num_cells && *leaf_node_key(node, cell_num) == row->id) {
+    table_end_write(table);
+    return EXECUTE_DUPLICATE_KEY;
+  }
+
+  // Every level may split in two, plus a new root
+  if (table->cow->num_free_pages + TABLE_MAX_PAGES - pager->num_pages <
+      2 * (depth + 1) + 1) {
+    table_end_write(table);
+    return EXECUTE_TABLE_FULL;
+  }
+
+  uint8_t left[PAGE_SIZE];
+  uint8_t right[PAGE_SIZE];
+  bool split = cow_leaf_insert(node, cell_num, row, left, right);
+  cow_write_path(table, path, child_indexes, depth, page_num, left, right,
+                 split);
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Replaces the row stored under an existing key of a copy-on-write table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - row: The new row; its id is the key.
+ *
+ * As with cow_insert, the leaf and every node above it are copied with the
+ * change applied, though nothing splits.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_NO_SUCH_KEY if the key is not in the
+ * table, or EXECUTE_TABLE_FULL if the pager cannot hold the copies.
+ */
+ExecuteResult cow_update(Table *table, Row *row) {
+  Pager *pager = table->pager;
+  uint32_t path[TABLE_MAX_HEIGHT];
+  uint32_t child_indexes[TABLE_MAX_HEIGHT];
+  uint32_t depth;
+
+  table_begin_write(table);
+
+  uint32_t page_num = cow_find_leaf(table, row->id, path, child_indexes,
+                                    &depth);
+  void *node = get_page(pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t cell_num = leaf_node_find_cell(node, num_cells, row->id);
+  if (cell_num >= num_cells || *leaf_node_key(node, cell_num) != row->id) {
+    table_end_write(table);
+    return EXECUTE_NO_SUCH_KEY;
+  }
+
+  if (table->cow->num_free_pages + TABLE_MAX_PAGES - pager->num_pages <
+      depth + 1) {
+    table_end_write(table);
+    return EXECUTE_TABLE_FULL;
+  }
+
+  uint8_t left[PAGE_SIZE];
+  uint8_t right[PAGE_SIZE];
+  memcpy(left, node, PAGE_SIZE);
+  serialize_row(row, leaf_node_value(left, cell_num));
+  cow_write_path(table, path, child_indexes, depth, page_num, left, right,
+                 false);
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Makes the current tree durable by switching the meta page over to it.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Called by table_end_write. The pages written since the last commit are
+ * written out and synced first. Only then is the meta page for the commit
+ * written, to the slot the previous commit did not use, and synced. Until
+ * that single page write completes, the other meta page still describes the
+ * previous tree, none of whose pages were overwritten, so a crash at any
+ * point leaves one of the two trees intact and no log is needed.
+ *
+ * The pages this commit replaced are set aside until no snapshot can read
+ * them any more, see cow_reclaim.
+ *
+ * If a write or sync fails, so does the pager, see pager_fail, and the meta
+ * page is not switched, leaving the previous commit in place.
+ *
+ * Does not return a value.
+ */
+void cow_commit(Table *table) {
+  Pager *pager = table->pager;
+  CopyOnWrite *cow = table->cow;
+  if (table->root_page_num == cow->committed_root_page_num) {
+    return;
+  }
+
+  for (uint32_t i = COW_NUM_META_PAGES; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL && pager->dirty[i]) {
+      pager_flush(pager, i);
+    }
+    cow->private_pages[i] = false;
+  }
+  cow_sync(pager);
+  if (pager->io_error != 0) {
+    return;
+  }
+
+  cow->txn_id++;
+  uint32_t meta_page_num = cow->txn_id % COW_NUM_META_PAGES;
+  void *meta = get_page(pager, meta_page_num);
+  pager_mark_dirty(pager, meta_page_num);
+  cow_fill_meta(meta, cow->txn_id, table->root_page_num, pager->num_pages);
+  pager_flush(pager, meta_page_num);
+  cow_sync(pager);
+
+  cow->committed_root_page_num = table->root_page_num;
+  uint64_t version = pager->commit_version + 1;
+  for (uint32_t i = 0; i < cow->num_replaced_pages; i++) {
+    cow->pending_pages[cow->num_pending_pages] = cow->replaced_pages[i];
+    cow->pending_versions[cow->num_pending_pages++] = version;
+  }
+  cow->num_replaced_pages = 0;
+}
+
+/*
+ * Frees the replaced pages that no snapshot can read any more.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - oldest_version: The version of the oldest open snapshot, or the latest
+ * published version if there is none.
+ *
+ * A page replaced by the commit published as version v is only reachable
+ * from the trees of earlier versions.
+ *
+ * Does not return a value.
+ */
+void cow_reclaim(Table *table, uint64_t oldest_version) {
+  CopyOnWrite *cow = table->cow;
+
+  uint32_t i = 0;
+  while (i < cow->num_pending_pages) {
+    if (cow->pending_versions[i] <= oldest_version) {
+      cow->free_pages[cow->num_free_pages++] = cow->pending_pages[i];
+      cow->num_pending_pages--;
+      cow->pending_pages[i] = cow->pending_pages[cow->num_pending_pages];
+      cow->pending_versions[i] = cow->pending_versions[cow->num_pending_pages];
+    } else {
+      i++;
+    }
+  }
+}
+
+/*
+ * Throws away everything written since the last commit.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * The committed tree was never modified, so going back to its root is all it
+ * takes. The pages written since are freed.
+ *
+ * Does not return a value.
+ */
+void cow_rollback(Table *table) {
+  Pager *pager = table->pager;
+  CopyOnWrite *cow = table->cow;
+
+  __atomic_store_n(&table->root_page_num, cow->committed_root_page_num,
+                   __ATOMIC_RELEASE);
+  for (uint32_t i = COW_NUM_META_PAGES; i < pager->num_pages; i++) {
+    if (cow->private_pages[i]) {
+      cow_release_page(table, i);
+    }
+  }
+  cow->num_replaced_pages = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef COW_H
+#define COW_H
+
+#include "constants.h"
+
+#define COW_MAGIC "SQLTCOW"
+#define COW_MAGIC_OFFSET 16
+#define COW_TXN_ID_OFFSET 24
+#define COW_ROOT_PAGE_NUM_OFFSET 32
+#define COW_NUM_PAGES_OFFSET 36
+#define COW_CHECKSUM_OFFSET 40
+#define COW_NUM_META_PAGES 2
+
+bool cow_format(const char *filename, char *error);
+bool cow_detect(int file_descriptor);
+void cow_open(Table *table);
+ExecuteResult cow_insert(Table *table, Row *row);
+ExecuteResult cow_update(Table *table, Row *row);
+void cow_commit(Table *table);
+void cow_reclaim(Table *table, uint64_t oldest_version);
+void cow_rollback(Table *table);
+
+#endif
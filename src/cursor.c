@@ -1,6 +1,11 @@
 #include "cursor.h"
+#include "btree.h"
 #include "node.h"
 #include "pager.h"
+#include "profile.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "table.h"
 
 /*
  * Initializes a cursor to the start of the table.
@@ -8,23 +13,51 @@
  * Parameters:
  * - table: A pointer to the Table structure.
  *
- * Allocates memory for a new Cursor, sets it to the start of the table.
- * Checks if the table is empty, and set end_of_table to true if it is.
+ * Positions a new Cursor on the first cell of the leftmost leaf by searching
+ * for the smallest possible key. Checks if the table is empty, and sets
+ * end_of_table to true if it is.
  * Returns a pointer to the newly created Cursor.
  */
 Cursor *table_start(Table *table) {
-  Cursor *cursor = malloc(sizeof(Cursor));
-  cursor->table = table;
-  cursor->page_num = table->root_page_num;
-  cursor->cell_num = 0;
+  Cursor *cursor = table_find(table, 0);
 
-  void *root_node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(root_node);
+  void *node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
   cursor->end_of_table = (num_cells == 0);
 
   return cursor;
 }
 
+/*
+ * Binary searches the cells of a leaf node for a key.
+ *
+ * Parameters:
+ * - node: A pointer to the leaf node.
+ * - num_cells: The number of cells in the node, as read by the caller.
+ * - key: The key to find.
+ *
+ * Returns the index of the key if it is in the node, otherwise the index
+ * where it should be inserted.
+ */
+uint32_t leaf_node_find_cell(void *node, uint32_t num_cells, uint32_t key) {
+  uint32_t min_index = 0;
+  uint32_t one_past_max_index = num_cells;
+  while (one_past_max_index != min_index) {
+    uint32_t index = (min_index + one_past_max_index) / 2;
+    uint32_t key_at_index = *leaf_node_key(node, index);
+    if (key == key_at_index) {
+      return index;
+    }
+    if (key < key_at_index) {
+      one_past_max_index = index;
+    } else {
+      min_index = index + 1;
+    }
+  }
+
+  return min_index;
+}
+
 /*
  * Finds the position of a key in a leaf node of a table.
  *
@@ -33,11 +66,10 @@ Cursor *table_start(Table *table) {
  * - page_num: The page number of the leaf node.
  * - key: The key to find.
  *
- * The function performs a binary search in the leaf node for the given key.
- * It initializes a new Cursor and sets its 'table' and 'page_num' fields.
- * If the key is found, it sets the 'cell_num' field of the cursor to the index
- * of the key. If the key is not found, it sets 'cell_num' to the index where
- * the key should be inserted.
+ * The function initializes a new Cursor, holding no locks, and sets its
+ * 'table' and 'page_num' fields. If the key is found, it sets the 'cell_num'
+ * field of the cursor to the index of the key. If the key is not found, it
+ * sets 'cell_num' to the index where the key should be inserted.
  *
  * Returns a pointer to the newly created Cursor.
  */
@@ -48,26 +80,106 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
   Cursor *cursor = malloc(sizeof(Cursor));
   cursor->table = table;
   cursor->page_num = page_num;
+  cursor->cell_num = leaf_node_find_cell(node, num_cells, key);
+  cursor->end_of_table = false;
+  cursor->snapshot = NULL;
+  cursor->num_locked = 0;
+  return cursor;
+}
 
-  // Binary search
+/*
+ * Picks the child of an internal node that covers a key.
+ *
+ * Parameters:
+ * - node: A pointer to the internal node.
+ * - num_keys: The number of keys in the node, as read by the caller.
+ * - key: The key to find.
+ *
+ * Unlike internal_node_find_child and internal_node_child, this never reads
+ * the key count itself, so a node that changes underneath an optimistic
+ * reader cannot send it past the end of the node.
+ *
+ * Returns the page number of the child.
+ */
+static uint32_t internal_node_search(void *node, uint32_t num_keys,
+                                     uint32_t key) {
   uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *leaf_node_key(node, index);
-    if (key == key_at_index) {
-      cursor->cell_num = index;
-      return cursor;
-    }
-    if (key < key_at_index) {
-      one_past_max_index = index;
+  uint32_t max_index = num_keys;
+  while (min_index != max_index) {
+    uint32_t index = (min_index + max_index) / 2;
+    if (*internal_node_key(node, index) >= key) {
+      max_index = index;
     } else {
       min_index = index + 1;
     }
   }
 
-  cursor->cell_num = min_index;
-  return cursor;
+  if (min_index == num_keys) {
+    return *internal_node_right_child(node);
+  }
+  return *(uint32_t *)internal_node_cell(node, min_index);
+}
+
+/*
+ * Finds the leaf that covers a key without taking any locks.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - key: The key to find.
+ * - leaf_version: Where to store the version the leaf had when it was reached.
+ *
+ * This is optimistic lock coupling. Each node's version is read before the
+ * node and validated after it, and a node is only trusted once the version
+ * of its parent has been validated again after reading the child's. If a
+ * writer changed anything on the way, the descent starts over from the root.
+ * Nothing is written to the nodes, so readers on different cores never
+ * contend.
+ *
+ * Returns the page number of the leaf. The caller must validate the leaf
+ * against leaf_version after reading from it.
+ */
+static uint32_t table_find_leaf(Table *table, uint32_t key,
+                                uint32_t *leaf_version) {
+  Pager *pager = table->pager;
+  profile_begin(PROFILE_PHASE_DESCENT);
+
+restart:;
+  uint32_t page_num = __atomic_load_n(&table->root_page_num, __ATOMIC_ACQUIRE);
+  void *node = get_page(pager, page_num);
+  uint32_t version = node_read_version(node);
+  // A copy-on-write commit may have moved the root, and freed the old one
+  if (__atomic_load_n(&table->root_page_num, __ATOMIC_ACQUIRE) != page_num) {
+    goto restart;
+  }
+
+  while (true) {
+    NodeType type = get_node_type(node);
+    if (!node_validate(node, version)) {
+      goto restart;
+    }
+    if (type == NODE_LEAF) {
+      break;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_num = internal_node_search(node, num_keys, key);
+    if (!node_validate(node, version)) {
+      goto restart;
+    }
+    void *child = get_page(pager, child_num);
+    uint32_t child_version = node_read_version(child);
+    if (!node_validate(node, version)) {
+      goto restart;
+    }
+
+    page_num = child_num;
+    node = child;
+    version = child_version;
+  }
+
+  profile_end();
+  *leaf_version = version;
+  return page_num;
 }
 
 /*
@@ -77,46 +189,213 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
  * - table: A pointer to the Table structure.
  * - key: The key to find.
  *
- * The function retrieves the root node of the table and checks its type.
- * If the root node is a leaf node, it calls leaf_node_find to find the key.
- * If the root node is an internal node, it searches the internal nodes.
- * TODO : searching in internal nodes is not yet implemented
+ * The function descends from the root with optimistic lock coupling and
+ * retries until it has searched a leaf that no writer touched meanwhile. The
+ * cursor holds no locks, so for another thread's writes its position is only
+ * a snapshot; threads that read alongside a writer should use table_get.
  *
  * Returns a pointer to a Cursor that points to the key if it's found, or where
  * it should be inserted if not.
  */
 Cursor *table_find(Table *table, uint32_t key) {
-  uint32_t root_page_num = table->root_page_num;
-  void *root_node = get_page(table->pager, root_page_num);
+  while (true) {
+    uint32_t version;
+    uint32_t page_num = table_find_leaf(table, key, &version);
+    Cursor *cursor = leaf_node_find(table, page_num, key);
+    if (node_validate(get_page(table->pager, page_num), version)) {
+      return cursor;
+    }
+    free(cursor);
+  }
+}
 
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    printf("Need to implement searching an internal node\n");
-    exit(EXIT_FAILURE);
+/*
+ * Checks whether a node can take one more entry without splitting.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * A split of a child only reaches up into its parent when the child is full.
+ *
+ * Returns true if inserting into the node cannot split it.
+ */
+static bool node_is_safe(void *node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return *leaf_node_num_cells(node) < LEAF_NODE_MAX_CELLS;
   }
+  return *internal_node_num_keys(node) < INTERNAL_NODE_MAX_KEYS;
 }
 
 /*
- * Advances a cursor to the next cell in the table.
+ * Finds the position a writer should insert a key at, and locks the nodes the
+ * insert will modify.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - key: The key to be inserted.
+ *
+ * Writers must hold the table's writer_lock, so nothing changes the tree
+ * while this descends and no validation is needed. The leaf is locked, along
+ * with every ancestor that a split of the leaf would reach: the path is
+ * locked up to, but not above, the lowest node that still has room. Readers
+ * of other nodes carry on undisturbed. The locks are released by
+ * cursor_close once the insert is done.
+ *
+ * Returns a pointer to a Cursor at the insert position.
+ */
+Cursor *table_find_for_update(Table *table, uint32_t key) {
+  Pager *pager = table->pager;
+  uint32_t path[TABLE_MAX_HEIGHT];
+  uint32_t depth = 0;
+  profile_begin(PROFILE_PHASE_DESCENT);
+
+  uint32_t page_num = table->root_page_num;
+  void *node = get_page(pager, page_num);
+  path[depth++] = page_num;
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t child_index = internal_node_find_child(node, key);
+    page_num = *internal_node_child(node, child_index);
+    node = get_page(pager, page_num);
+    path[depth++] = page_num;
+  }
+  profile_end();
+
+  uint32_t first = depth - 1;
+  while (first > 0 && !node_is_safe(get_page(pager, path[first]))) {
+    first--;
+  }
+
+  Cursor *cursor = leaf_node_find(table, page_num, key);
+  for (uint32_t i = first; i < depth; i++) {
+    node_lock(get_page(pager, path[i]));
+    cursor->locked_pages[cursor->num_locked++] = path[i];
+  }
+  return cursor;
+}
+
+/*
+ * Looks up a single row by key.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - key: The key to look up.
+ * - row: Where to store the row if it is found.
+ *
+ * The row is copied out of its leaf and kept only if the leaf's version still
+ * validates afterwards, so this is safe to call from any number of threads at
+ * once, alongside a writer.
+ *
+ * Returns true if the key was found.
+ */
+bool table_get(Table *table, uint32_t key, Row *row) {
+  uint8_t value[LEAF_NODE_VALUE_SIZE];
+
+  table_begin_read(table);
+  while (true) {
+    uint32_t version;
+    uint32_t page_num = table_find_leaf(table, key, &version);
+    void *node = get_page(table->pager, page_num);
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (!node_validate(node, version)) {
+      continue;
+    }
+
+    uint32_t cell_num = leaf_node_find_cell(node, num_cells, key);
+    bool found = cell_num < num_cells && *leaf_node_key(node, cell_num) == key;
+    if (found) {
+      memcpy(value, leaf_node_value(node, cell_num), LEAF_NODE_VALUE_SIZE);
+    }
+    if (!node_validate(node, version)) {
+      continue;
+    }
+
+    table_end_read(table);
+    if (found) {
+      deserialize_row(value, row);
+    }
+    return found;
+  }
+}
+
+/*
+ * Closes a cursor, unlocking any nodes it locked and freeing it.
+ *
+ * Parameters:
+ * - cursor: A pointer to the Cursor structure.
+ *
+ * Does not return a value.
+ */
+void cursor_close(Cursor *cursor) {
+  for (uint32_t i = 0; i < cursor->num_locked; i++) {
+    node_unlock(get_page(cursor->table->pager, cursor->locked_pages[i]));
+  }
+  free(cursor);
+}
+
+/*
+ * Returns the leaf a cursor is on.
  *
  * Parameters:
  * - cursor: A pointer to the Cursor structure.
  *
- * Increments the 'cell_num' field of the cursor.
- * If the cursor is at the end of the table, it sets 'end_of_table' to true.
+ * A cursor opened on a snapshot reads the copy of the leaf held by the
+ * snapshot; any other cursor reads the cached page.
  *
- * Note: This function currently only handles tables that fit within a single
- * page. It would need to be modified to handle tables that span multiple pages.
+ * Returns a pointer to the leaf node.
+ */
+static void *cursor_node(Cursor *cursor) {
+  if (cursor->snapshot != NULL) {
+    return cursor->snapshot->leaf_image;
+  }
+  return get_page(cursor->table->pager, cursor->page_num);
+}
+
+/*
+ * Advances a cursor to the next cell in the table.
+ *
+ * Parameters:
+ * - cursor: A pointer to the Cursor structure.
+ *
+ * Increments the 'cell_num' field of the cursor. When the cursor runs off the
+ * end of its leaf, the next leaf is located by searching the tree for the key
+ * just after the last key of the current leaf. Leaves do not store a sibling
+ * pointer, so this costs one descent per leaf, which only touches internal
+ * nodes that are already cached.
+ * If there is no next leaf, it sets 'end_of_table' to true.
  */
 void cursor_advance(Cursor *cursor) {
   uint32_t page_num = cursor->page_num;
-  void *node = get_page(cursor->table->pager, page_num);
+  void *node = cursor_node(cursor);
+  uint32_t num_cells = *leaf_node_num_cells(node);
 
   cursor->cell_num += 1;
-  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
+  if (cursor->cell_num < num_cells) {
+    return;
+  }
+
+  if (is_node_root(node) || num_cells == 0) {
     cursor->end_of_table = true;
+    return;
   }
+
+  uint32_t last_key = *leaf_node_key(node, num_cells - 1);
+  if (last_key == UINT32_MAX) {
+    cursor->end_of_table = true;
+    return;
+  }
+
+  Cursor *next = cursor->snapshot != NULL
+                     ? snapshot_find(cursor->snapshot, last_key + 1)
+                     : table_find(cursor->table, last_key + 1);
+  if (next->page_num == page_num ||
+      next->cell_num >= *leaf_node_num_cells(cursor_node(next))) {
+    cursor->end_of_table = true;
+  } else {
+    cursor->page_num = next->page_num;
+    cursor->cell_num = next->cell_num;
+  }
+  free(next);
 }
 
 /*
@@ -125,15 +404,38 @@ void cursor_advance(Cursor *cursor) {
  * Parameters:
  * - cursor: A pointer to the Cursor structure.
  *
- * The function retrieves the page that the cursor is on by calling get_page.
- * It then calls leaf_node_value to get a pointer to the value of the cell that
- * the cursor is pointing to.
+ * The function retrieves the leaf that the cursor is on by calling
+ * cursor_node. It then calls leaf_node_value to get a pointer to the value of
+ * the cell that the cursor is pointing to.
  *
  * Returns a pointer to the value at the cursor's current position.
  */
 void *cursor_value(Cursor *cursor) {
-  uint32_t page_num = cursor->page_num;
-  void *page = get_page(cursor->table->pager, page_num);
+  return leaf_node_value(cursor_node(cursor), cursor->cell_num);
+}
 
-  return leaf_node_value(page, cursor->cell_num);
+/*
+ * Positions a cursor on the first key at or after a key.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - snapshot: The snapshot to read at, or NULL to read the table itself.
+ * - key: The key to start from.
+ *
+ * The leaf that covers the key may hold only smaller keys, in which case the
+ * cursor moves on to the next leaf, or to the end of the table.
+ *
+ * Returns a pointer to the new Cursor.
+ */
+Cursor *cursor_seek(Table *table, Snapshot *snapshot, uint32_t key) {
+  Cursor *cursor =
+      snapshot != NULL ? snapshot_find(snapshot, key) : table_find(table, key);
+  uint32_t num_cells = *leaf_node_num_cells(cursor_node(cursor));
+  if (num_cells == 0) {
+    cursor->end_of_table = true;
+  } else if (cursor->cell_num >= num_cells) {
+    cursor->cell_num = num_cells - 1;
+    cursor_advance(cursor);
+  }
+  return cursor;
 }
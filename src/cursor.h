@@ -4,9 +4,14 @@
 #include "constants.h"
 
 Cursor *table_start(Table *table);
+uint32_t leaf_node_find_cell(void *node, uint32_t num_cells, uint32_t key);
 Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
 Cursor *table_find(Table *table, uint32_t key);
+Cursor *table_find_for_update(Table *table, uint32_t key);
+bool table_get(Table *table, uint32_t key, Row *row);
+void cursor_close(Cursor *cursor);
 void cursor_advance(Cursor *cursor);
 void *cursor_value(Cursor *cursor);
+Cursor *cursor_seek(Table *table, Snapshot *snapshot, uint32_t key);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,366 @@
+#include "dump.h"
+#include "btree.h"
+#include "checksum.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "snapshot.h"
+
+/*
+ * Dump file layout. All integers are stored in the host's byte order.
+ *
+ *   header:  magic (8 bytes) | version (uint32) | reserved (uint32)
+ *   body:    one record per row, in ascending id order
+ *   trailer: row count (uint64) | CRC-32 of the body (uint32)
+ *
+ * A record is the id (uint32), the username length (uint8), the username
+ * bytes, the email length (uint8) and the email bytes. Strings are stored
+ * without padding, so a record is usually a small fraction of ROW_SIZE.
+ */
+
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t length;
+  uint32_t crc;
+  bool failed;
+} DumpWriter;
+
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t length;
+  size_t position;
+  off_t remaining;
+  uint32_t crc;
+  bool failed;
+} DumpReader;
+
+/*
+ * Writes out everything buffered so far.
+ */
+static void dump_flush(DumpWriter *writer) {
+  size_t written = 0;
+  while (written < writer->length && !writer->failed) {
+    ssize_t result =
+        write(writer->fd, writer->buffer + written, writer->length - written);
+    if (result == -1) {
+      writer->failed = true;
+    } else {
+      written += result;
+    }
+  }
+  writer->length = 0;
+}
+
+/*
+ * Buffers bytes for writing, flushing whenever the buffer is full, so the
+ * file is written in DUMP_BUFFER_SIZE pieces.
+ */
+static void dump_write(DumpWriter *writer, const void *data, size_t length) {
+  if (writer->length + length > DUMP_BUFFER_SIZE) {
+    dump_flush(writer);
+  }
+  memcpy(writer->buffer + writer->length, data, length);
+  writer->length += length;
+}
+
+/*
+ * Copies the next bytes of the body out of the read buffer, refilling it from
+ * the file in DUMP_BUFFER_SIZE pieces. The bytes are added to the checksum.
+ *
+ * Returns false if the body ends first.
+ */
+static bool dump_read(DumpReader *reader, void *destination, size_t length) {
+  if (reader->position + length > reader->length) {
+    size_t leftover = reader->length - reader->position;
+    memmove(reader->buffer, reader->buffer + reader->position, leftover);
+    reader->length = leftover;
+    reader->position = 0;
+
+    while (reader->length < DUMP_BUFFER_SIZE && reader->remaining > 0) {
+      size_t wanted = DUMP_BUFFER_SIZE - reader->length;
+      if ((off_t)wanted > reader->remaining) {
+        wanted = reader->remaining;
+      }
+      ssize_t bytes_read =
+          read(reader->fd, reader->buffer + reader->length, wanted);
+      if (bytes_read <= 0) {
+        reader->failed = true;
+        return false;
+      }
+      reader->length += bytes_read;
+      reader->remaining -= bytes_read;
+    }
+
+    if (length > reader->length) {
+      return false;
+    }
+  }
+
+  memcpy(destination, reader->buffer + reader->position, length);
+  reader->crc = checksum_crc32(reader->crc, destination, length);
+  reader->position += length;
+  return true;
+}
+
+/*
+ * Decodes the next record of the body.
+ *
+ * Returns false at the end of the body. A truncated or invalid record also
+ * returns false and marks the reader as failed.
+ */
+static bool dump_read_row(DumpReader *reader, Row *row) {
+  if (reader->position == reader->length && reader->remaining == 0) {
+    return false;
+  }
+
+  uint8_t username_length, email_length;
+  if (!dump_read(reader, &row->id, sizeof(row->id)) ||
+      !dump_read(reader, &username_length, sizeof(username_length)) ||
+      username_length > COLUMN_USERNAME_SIZE ||
+      !dump_read(reader, row->username, username_length) ||
+      !dump_read(reader, &email_length, sizeof(email_length)) ||
+      !dump_read(reader, row->email, email_length)) {
+    reader->failed = true;
+    return false;
+  }
+  row->username[username_length] = 0;
+  row->email[email_length] = 0;
+
+  return true;
+}
+
+/*
+ * Opens a dump file and checks its header.
+ *
+ * Parameters:
+ * - reader: The reader to set up. Its buffer must already be allocated.
+ * - filename: The dump file.
+ * - num_rows: Set to the row count recorded in the trailer.
+ * - crc: Set to the checksum recorded in the trailer.
+ * - error: Set to why the file cannot be used, see restore_table.
+ *
+ * Leaves the reader positioned at the start of the body.
+ *
+ * Returns false if the file cannot be used.
+ */
+static bool dump_open(DumpReader *reader, const char *filename,
+                      uint64_t *num_rows, uint32_t *crc, char *error) {
+  reader->fd = open(filename, O_RDONLY);
+  if (reader->fd == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s'.", filename);
+    return false;
+  }
+
+  char header[DUMP_HEADER_SIZE];
+  char trailer[DUMP_TRAILER_SIZE];
+  uint32_t version;
+  off_t file_size = lseek(reader->fd, 0, SEEK_END);
+
+  if (file_size < DUMP_HEADER_SIZE + DUMP_TRAILER_SIZE ||
+      pread(reader->fd, header, DUMP_HEADER_SIZE, 0) != DUMP_HEADER_SIZE ||
+      pread(reader->fd, trailer, DUMP_TRAILER_SIZE,
+            file_size - DUMP_TRAILER_SIZE) != DUMP_TRAILER_SIZE ||
+      memcmp(header, DUMP_MAGIC, 8) != 0) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error: '%s' is not a dump file.",
+             filename);
+    close(reader->fd);
+    return false;
+  }
+
+  memcpy(&version, header + 8, sizeof(version));
+  if (version != DUMP_VERSION) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE,
+             "Error: Unsupported dump version %d.", version);
+    close(reader->fd);
+    return false;
+  }
+
+  memcpy(num_rows, trailer, sizeof(uint64_t));
+  memcpy(crc, trailer + sizeof(uint64_t), sizeof(uint32_t));
+
+  lseek(reader->fd, DUMP_HEADER_SIZE, SEEK_SET);
+  reader->length = 0;
+  reader->position = 0;
+  reader->remaining = file_size - DUMP_HEADER_SIZE - DUMP_TRAILER_SIZE;
+  reader->crc = 0;
+  reader->failed = false;
+  return true;
+}
+
+/*
+ * Writes every row of the table to a dump file.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - filename: The file to create or overwrite.
+ * - num_rows: Set to the number of rows written.
+ * - error: Set to why the dump failed, up to SQLITEDB_ERRMSG_SIZE bytes, when
+ * it returns EXECUTE_ERROR.
+ *
+ * Leaves are visited in key order and their rows are encoded into a large
+ * buffer that is written out whenever it fills. The file is synced before
+ * the command reports success.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_ERROR if the file could not be written.
+ */
+ExecuteResult dump_table(Table *table, const char *filename,
+                         uint64_t *num_rows, char *error) {
+  DumpWriter writer;
+  writer.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+  if (writer.fd == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s'.", filename);
+    return EXECUTE_ERROR;
+  }
+  writer.buffer = malloc(DUMP_BUFFER_SIZE);
+  writer.length = 0;
+  writer.crc = 0;
+  writer.failed = false;
+
+  char header[DUMP_HEADER_SIZE] = {0};
+  uint32_t version = DUMP_VERSION;
+  memcpy(header, DUMP_MAGIC, 8);
+  memcpy(header + 8, &version, sizeof(version));
+  dump_write(&writer, header, DUMP_HEADER_SIZE);
+
+  *num_rows = 0;
+  char record[sizeof(uint32_t) + 2 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE];
+  Row row;
+  Snapshot *snapshot = snapshot_open(table);
+  Cursor *cursor = snapshot_start(snapshot);
+  while (!(cursor->end_of_table)) {
+    deserialize_row(cursor_value(cursor), &row);
+    uint8_t username_length = strnlen(row.username, COLUMN_USERNAME_SIZE);
+    uint8_t email_length = strnlen(row.email, COLUMN_EMAIL_SIZE);
+
+    size_t length = 0;
+    memcpy(record, &row.id, sizeof(row.id));
+    length += sizeof(row.id);
+    record[length++] = username_length;
+    memcpy(record + length, row.username, username_length);
+    length += username_length;
+    record[length++] = email_length;
+    memcpy(record + length, row.email, email_length);
+    length += email_length;
+
+    writer.crc = checksum_crc32(writer.crc, record, length);
+    dump_write(&writer, record, length);
+    (*num_rows)++;
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  snapshot_close(snapshot);
+
+  char trailer[DUMP_TRAILER_SIZE];
+  memcpy(trailer, num_rows, sizeof(uint64_t));
+  memcpy(trailer + sizeof(uint64_t), &writer.crc, sizeof(writer.crc));
+  dump_write(&writer, trailer, DUMP_TRAILER_SIZE);
+  dump_flush(&writer);
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  if (writer.failed || fsync(writer.fd) == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error writing dump: %d", errno);
+    result = EXECUTE_ERROR;
+  }
+
+  close(writer.fd);
+  free(writer.buffer);
+  return result;
+}
+
+/*
+ * Loads a dump file into an empty table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure. It must not contain any rows.
+ * - filename: The dump file written by dump_table.
+ * - num_rows: Set to the number of rows restored.
+ * - error: Set to why the restore failed, up to SQLITEDB_ERRMSG_SIZE bytes,
+ * when it returns EXECUTE_ERROR.
+ *
+ * The file is read twice. The first pass checks every record, the ordering of
+ * the ids, the row count and the checksum, so a damaged file leaves the table
+ * untouched. The second pass feeds the rows to a TableBuilder, which writes
+ * full leaves and internal nodes bottom-up without searching or splitting.
+ * If the rows do not all fit, or the second pass does not read back what the
+ * first one checked, the rows loaded so far are left in the table for the
+ * caller to undo, see transaction_begin_atomic.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_TABLE_FULL if the rows did not all fit, or
+ * EXECUTE_ERROR if the table is not empty or the file cannot be restored.
+ */
+ExecuteResult restore_table(Table *table, const char *filename,
+                            uint64_t *num_rows, char *error) {
+  *num_rows = 0;
+  void *root = get_page(table->pager, table->root_page_num);
+  if (get_node_type(root) != NODE_LEAF || *leaf_node_num_cells(root) != 0) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error: Table is not empty.");
+    return EXECUTE_ERROR;
+  }
+
+  DumpReader reader;
+  uint64_t expected_rows;
+  uint32_t expected_crc;
+  reader.buffer = malloc(DUMP_BUFFER_SIZE);
+  if (!dump_open(&reader, filename, &expected_rows, &expected_crc, error)) {
+    free(reader.buffer);
+    return EXECUTE_ERROR;
+  }
+
+  Row row;
+  uint64_t num_checked = 0;
+  bool ordered = true;
+  uint32_t last_id = 0;
+  while (dump_read_row(&reader, &row)) {
+    if (num_checked > 0 && row.id <= last_id) {
+      ordered = false;
+    }
+    last_id = row.id;
+    num_checked++;
+  }
+
+  if (reader.failed || !ordered || num_checked != expected_rows ||
+      reader.crc != expected_crc) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error: '%s' is corrupt.", filename);
+    close(reader.fd);
+    free(reader.buffer);
+    return EXECUTE_ERROR;
+  }
+
+  // The file may have been replaced since the first pass
+  close(reader.fd);
+  uint64_t reopened_rows;
+  uint32_t reopened_crc;
+  if (!dump_open(&reader, filename, &reopened_rows, &reopened_crc, error)) {
+    free(reader.buffer);
+    return EXECUTE_ERROR;
+  }
+
+  TableBuilder builder;
+  ExecuteResult result = EXECUTE_SUCCESS;
+  table_builder_init(&builder, table, 100);
+  if (reopened_rows != expected_rows || reopened_crc != expected_crc) {
+    result = EXECUTE_ERROR;
+  }
+  while (result == EXECUTE_SUCCESS && dump_read_row(&reader, &row)) {
+    result = table_builder_add(&builder, &row);
+  }
+  table_builder_finish(&builder);
+
+  if (result == EXECUTE_SUCCESS &&
+      (reader.failed || builder.num_rows != expected_rows ||
+       reader.crc != expected_crc)) {
+    result = EXECUTE_ERROR;
+  }
+  if (result == EXECUTE_ERROR) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE,
+             "Error: '%s' changed while it was being read.", filename);
+  }
+  *num_rows = builder.num_rows;
+
+  close(reader.fd);
+  free(reader.buffer);
+  return result;
+}
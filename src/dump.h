@@ -0,0 +1,17 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "constants.h"
+
+#define DUMP_MAGIC "SQLTDUMP"
+#define DUMP_VERSION 1
+#define DUMP_HEADER_SIZE 16
+#define DUMP_TRAILER_SIZE 12
+#define DUMP_BUFFER_SIZE (1 << 20)
+
+ExecuteResult dump_table(Table *table, const char *filename,
+                         uint64_t *num_rows, char *error);
+ExecuteResult restore_table(Table *table, const char *filename,
+                            uint64_t *num_rows, char *error);
+
+#endif
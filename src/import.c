@@ -0,0 +1,660 @@
+#include "import.h"
+#include "btree.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "stats.h"
+
+typedef struct {
+  uint32_t id;
+  uint32_t index;
+} ImportKey;
+
+typedef struct {
+  const char *start;
+  const char *end;
+  char delimiter;
+  bool may_have_header;
+  Row *rows;
+  ImportKey *keys;
+  uint32_t num_rows;
+  uint32_t capacity;
+  PrepareResult error;
+  const char *error_line;
+} ImportChunk;
+
+typedef struct {
+  ImportChunk *chunks;
+  uint32_t num_chunks;
+  uint32_t starts[IMPORT_MAX_THREADS];
+  uint32_t ends[IMPORT_MAX_THREADS];
+  Row **rows;
+  uint32_t num_rows;
+  uint32_t first_row;
+  void **leaves;
+  uint32_t leaf_capacity;
+} ImportRange;
+
+/*
+ * Parses an id field.
+ *
+ * Parameters:
+ * - start: A pointer to the first character of the field.
+ * - end: A pointer one past the last character of the field.
+ * - id: Set to the parsed value on success.
+ *
+ * Accepts an optional leading minus sign so that negative ids can be reported
+ * the same way the insert statement reports them.
+ *
+ * Returns PREPARE_SUCCESS, PREPARE_NEGATIVE_ID or PREPARE_SYNTAX_ERROR.
+ */
+static PrepareResult parse_id(const char *start, const char *end,
+                              uint32_t *id) {
+  bool negative = false;
+  if (start < end && *start == '-') {
+    negative = true;
+    start++;
+  }
+  if (start == end) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  uint64_t value = 0;
+  for (const char *c = start; c < end; c++) {
+    if (*c < '0' || *c > '9') {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    value = value * 10 + (*c - '0');
+    if (value > UINT32_MAX) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+
+  if (negative && value != 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+  *id = value;
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * Parses one line of delimited text into a row.
+ *
+ * Parameters:
+ * - start: A pointer to the first character of the line.
+ * - end: A pointer to the line's terminating newline (or the end of the file).
+ * - delimiter: The field separator.
+ * - row: The row to fill in.
+ *
+ * A line holds exactly three fields: id, username and email. Delimiters are
+ * located with memchr, which the C library implements with vector
+ * instructions, so long fields are skipped many bytes at a time. Fields are
+ * taken verbatim; quoting is not supported.
+ *
+ * Returns the same results as prepare_insert.
+ */
+static PrepareResult parse_line(const char *start, const char *end,
+                                char delimiter, Row *row) {
+  if (end > start && end[-1] == '\r') {
+    end--;
+  }
+
+  const char *id_end = memchr(start, delimiter, end - start);
+  if (id_end == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  const char *username = id_end + 1;
+  const char *username_end = memchr(username, delimiter, end - username);
+  if (username_end == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  const char *email = username_end + 1;
+  if (memchr(email, delimiter, end - email) != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  size_t username_length = username_end - username;
+  size_t email_length = end - email;
+  if (username_length == 0 || email_length == 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  PrepareResult result = parse_id(start, id_end, &row->id);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+  if (username_length > COLUMN_USERNAME_SIZE ||
+      email_length > COLUMN_EMAIL_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+
+  memcpy(row->username, username, username_length);
+  row->username[username_length] = 0;
+  memcpy(row->email, email, email_length);
+  row->email[email_length] = 0;
+
+  return PREPARE_SUCCESS;
+}
+
+static int compare_import_keys(const void *a, const void *b) {
+  uint32_t left = ((const ImportKey *)a)->id;
+  uint32_t right = ((const ImportKey *)b)->id;
+  return (left > right) - (left < right);
+}
+
+/*
+ * Parses every line of a chunk and sorts the result by id.
+ *
+ * Parameters:
+ * - arg: A pointer to the ImportChunk to work on.
+ *
+ * Runs on a worker thread. Rows are appended to the chunk's own arrays, so
+ * workers never share memory. Sorting happens on small (id, index) pairs
+ * rather than on the rows themselves. Parsing stops at the first bad line,
+ * which is recorded in the chunk.
+ *
+ * Returns NULL.
+ */
+static void *import_chunk(void *arg) {
+  ImportChunk *chunk = arg;
+  const char *line = chunk->start;
+
+  while (line < chunk->end) {
+    const char *line_end = memchr(line, '\n', chunk->end - line);
+    if (line_end == NULL) {
+      line_end = chunk->end;
+    }
+
+    if (line_end == line || (line_end == line + 1 && *line == '\r')) {
+      line = line_end + 1;
+      continue;
+    }
+
+    if (chunk->num_rows == chunk->capacity) {
+      chunk->capacity = chunk->capacity * 2 + 64;
+      chunk->rows = realloc(chunk->rows, chunk->capacity * sizeof(Row));
+      chunk->keys = realloc(chunk->keys, chunk->capacity * sizeof(ImportKey));
+    }
+
+    Row *row = &chunk->rows[chunk->num_rows];
+    PrepareResult result = parse_line(line, line_end, chunk->delimiter, row);
+    if (result == PREPARE_SYNTAX_ERROR && chunk->may_have_header &&
+        line == chunk->start && (*line < '0' || *line > '9')) {
+      // Column names on the first line of the file
+      line = line_end + 1;
+      continue;
+    }
+    if (result != PREPARE_SUCCESS) {
+      chunk->error = result;
+      chunk->error_line = line;
+      break;
+    }
+
+    chunk->keys[chunk->num_rows].id = row->id;
+    chunk->keys[chunk->num_rows].index = chunk->num_rows;
+    chunk->num_rows++;
+    line = line_end + 1;
+  }
+
+  qsort(chunk->keys, chunk->num_rows, sizeof(ImportKey), compare_import_keys);
+  return NULL;
+}
+
+/*
+ * Decides how many worker threads to use for a file.
+ *
+ * Parameters:
+ * - file_size: The size of the file in bytes.
+ *
+ * Uses one thread per online CPU, but never gives a thread less than
+ * IMPORT_MIN_CHUNK_SIZE bytes, so small files are parsed on one thread.
+ *
+ * Returns the number of chunks to split the file into.
+ */
+static uint32_t import_num_chunks(size_t file_size) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t num_chunks = num_cpus > 0 ? num_cpus : 1;
+
+  if (num_chunks > IMPORT_MAX_THREADS) {
+    num_chunks = IMPORT_MAX_THREADS;
+  }
+  if (file_size / IMPORT_MIN_CHUNK_SIZE < num_chunks) {
+    num_chunks = file_size / IMPORT_MIN_CHUNK_SIZE;
+  }
+  return num_chunks > 0 ? num_chunks : 1;
+}
+
+/*
+ * Counts the line number of a position in the file, starting from 1.
+ */
+static uint32_t import_line_number(const char *data, const char *position) {
+  uint32_t line_number = 1;
+  const char *c = data;
+  while ((c = memchr(c, '\n', position - c)) != NULL) {
+    line_number++;
+    c++;
+  }
+  return line_number;
+}
+
+/*
+ * Merges the sorted chunks and feeds them to the table in batches.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - chunks: The parsed chunks, each sorted by id.
+ * - num_chunks: The number of chunks.
+ * - num_inserted: Set to the number of rows inserted.
+ * - num_duplicates: Set to the number of rows skipped because their id was
+ * already used, either earlier in the file or in the table.
+ *
+ * Returns the result of the last bulk insert.
+ */
+static ExecuteResult import_merge(Table *table, ImportChunk *chunks,
+                                  uint32_t num_chunks, uint32_t *num_inserted,
+                                  uint32_t *num_duplicates) {
+  uint32_t heads[IMPORT_MAX_THREADS] = {0};
+  Row *batch = malloc(IMPORT_BATCH_ROWS * sizeof(Row));
+  uint32_t batch_size = 0;
+  uint32_t num_rows = 0;
+  bool have_last_id = false;
+  uint32_t last_id = 0;
+  ExecuteResult result = EXECUTE_SUCCESS;
+
+  *num_inserted = 0;
+  *num_duplicates = 0;
+
+  while (result == EXECUTE_SUCCESS) {
+    ImportChunk *next = NULL;
+    for (uint32_t i = 0; i < num_chunks; i++) {
+      if (heads[i] < chunks[i].num_rows &&
+          (next == NULL ||
+           chunks[i].keys[heads[i]].id < next->keys[heads[next - chunks]].id)) {
+        next = &chunks[i];
+      }
+    }
+
+    if (next == NULL || batch_size == IMPORT_BATCH_ROWS) {
+      uint32_t batch_inserted;
+      result = table_bulk_insert(table, batch, batch_size, &batch_inserted);
+      if (batch_inserted > 0) {
+        table_stats_add_rows(table, batch_inserted, batch[0].id,
+                             batch[batch_size - 1].id);
+      }
+      *num_inserted += batch_inserted;
+      num_rows += batch_size;
+      batch_size = 0;
+      if (next == NULL) {
+        break;
+      }
+    }
+
+    ImportKey *key = &next->keys[heads[next - chunks]++];
+    if (have_last_id && key->id == last_id) {
+      *num_duplicates += 1;
+      continue;
+    }
+    have_last_id = true;
+    last_id = key->id;
+    batch[batch_size++] = next->rows[key->index];
+  }
+
+  // Rows that were handed to the table but already existed there
+  if (result == EXECUTE_SUCCESS) {
+    *num_duplicates += num_rows - *num_inserted;
+  }
+
+  free(batch);
+  return result;
+}
+
+/*
+ * Returns the index of the first key in a sorted chunk that is not below a
+ * given id.
+ */
+static uint32_t import_lower_bound(ImportChunk *chunk, uint32_t id) {
+  uint32_t low = 0;
+  uint32_t high = chunk->num_rows;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (chunk->keys[middle].id < id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/*
+ * Merges one key range of every chunk, dropping repeated ids.
+ *
+ * Parameters:
+ * - arg: A pointer to the ImportRange to work on.
+ *
+ * Ties go to the earliest chunk, so the row kept for a repeated id is the
+ * first one in the file, as with import_merge.
+ */
+static void *import_merge_range(void *arg) {
+  ImportRange *range = arg;
+  uint32_t heads[IMPORT_MAX_THREADS];
+  uint32_t capacity = 0;
+  for (uint32_t i = 0; i < range->num_chunks; i++) {
+    heads[i] = range->starts[i];
+    capacity += range->ends[i] - range->starts[i];
+  }
+  range->rows = malloc(capacity * sizeof(Row *));
+  range->num_rows = 0;
+
+  while (true) {
+    ImportKey *next = NULL;
+    uint32_t next_chunk = 0;
+    for (uint32_t i = 0; i < range->num_chunks; i++) {
+      if (heads[i] < range->ends[i] &&
+          (next == NULL || range->chunks[i].keys[heads[i]].id < next->id)) {
+        next = &range->chunks[i].keys[heads[i]];
+        next_chunk = i;
+      }
+    }
+    if (next == NULL) {
+      break;
+    }
+    heads[next_chunk]++;
+
+    if (range->num_rows > 0 &&
+        range->rows[range->num_rows - 1]->id == next->id) {
+      continue;
+    }
+    range->rows[range->num_rows++] =
+        &range->chunks[next_chunk].rows[next->index];
+  }
+
+  return NULL;
+}
+
+/*
+ * Writes the rows of one key range into their cells of the new leaves.
+ *
+ * Parameters:
+ * - arg: A pointer to the ImportRange to work on.
+ *
+ * Rows land at their position in the whole table, so a leaf that straddles
+ * two ranges is written by two threads, each into its own cells.
+ */
+static void *import_fill_range(void *arg) {
+  ImportRange *range = arg;
+  for (uint32_t i = 0; i < range->num_rows; i++) {
+    uint32_t position = range->first_row + i;
+    void *leaf = range->leaves[position / range->leaf_capacity];
+    uint32_t cell_num = position % range->leaf_capacity;
+    *leaf_node_key(leaf, cell_num) = range->rows[i]->id;
+    serialize_row(range->rows[i], leaf_node_value(leaf, cell_num));
+  }
+  return NULL;
+}
+
+/*
+ * Runs a function on every range, each on its own thread.
+ *
+ * Does not return a value.
+ */
+static void import_run_ranges(void *(*function)(void *), ImportRange *ranges,
+                              uint32_t num_ranges) {
+  pthread_t threads[IMPORT_MAX_THREADS];
+  for (uint32_t i = 1; i < num_ranges; i++) {
+    pthread_create(&threads[i], NULL, function, &ranges[i]);
+  }
+  function(&ranges[0]);
+  for (uint32_t i = 1; i < num_ranges; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+/*
+ * Splits the key space into one range per chunk, of about equal size.
+ *
+ * Parameters:
+ * - chunks: The parsed chunks, each sorted by id.
+ * - num_chunks: The number of chunks.
+ * - ranges: Set to the bounds of each range within every chunk.
+ *
+ * The splitting ids are picked from evenly spaced samples of every chunk. A
+ * given id always falls in one range, so repeated ids meet in one merge.
+ *
+ * Does not return a value.
+ */
+static void import_split_ranges(ImportChunk *chunks, uint32_t num_chunks,
+                                ImportRange *ranges) {
+  ImportKey samples[IMPORT_MAX_THREADS * IMPORT_SAMPLES_PER_CHUNK];
+  uint32_t num_samples = 0;
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    for (uint32_t j = 0; j < IMPORT_SAMPLES_PER_CHUNK && chunks[i].num_rows > 0;
+         j++) {
+      uint64_t index =
+          (uint64_t)chunks[i].num_rows * j / IMPORT_SAMPLES_PER_CHUNK;
+      samples[num_samples++].id = chunks[i].keys[index].id;
+    }
+  }
+  qsort(samples, num_samples, sizeof(ImportKey), compare_import_keys);
+
+  for (uint32_t r = 0; r < num_chunks; r++) {
+    ImportRange *range = &ranges[r];
+    memset(range, 0, sizeof(ImportRange));
+    range->chunks = chunks;
+    range->num_chunks = num_chunks;
+    for (uint32_t i = 0; i < num_chunks; i++) {
+      range->starts[i] = r == 0 ? 0 : ranges[r - 1].ends[i];
+      if (r + 1 == num_chunks || num_samples == 0) {
+        range->ends[i] = chunks[i].num_rows;
+      } else {
+        uint32_t split = samples[num_samples * (r + 1) / num_chunks].id;
+        range->ends[i] = import_lower_bound(&chunks[i], split);
+      }
+    }
+  }
+}
+
+/*
+ * Builds an empty table straight from the sorted chunks, in parallel.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure. Its root must be an empty leaf.
+ * - chunks: The parsed chunks, each sorted by id.
+ * - num_chunks: The number of chunks.
+ * - num_inserted: Set to the number of rows inserted.
+ * - num_duplicates: Set to the number of rows skipped because their id was
+ * used earlier in the file.
+ *
+ * The key space is split into one range per chunk (see import_split_ranges),
+ * and each range is merged out of all chunks on its own thread. Once the
+ * ranges know how many rows they hold, the exact number of full leaves is
+ * allocated and every range fills its share of them on its own thread again.
+ * Only then are the leaves linked up and the internal levels built above them,
+ * which touches one page per leaf.
+ *
+ * Returns false, having changed nothing, if the rows would not fit; the
+ * caller then inserts as many as do.
+ */
+static bool import_build(Table *table, ImportChunk *chunks, uint32_t num_chunks,
+                         uint32_t *num_inserted, uint32_t *num_duplicates) {
+  ImportRange ranges[IMPORT_MAX_THREADS];
+  import_split_ranges(chunks, num_chunks, ranges);
+  import_run_ranges(import_merge_range, ranges, num_chunks);
+
+  uint32_t num_rows = 0;
+  uint32_t num_parsed = 0;
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    ranges[i].first_row = num_rows;
+    num_rows += ranges[i].num_rows;
+    num_parsed += chunks[i].num_rows;
+  }
+
+  TableBuilder builder;
+  table_builder_init(&builder, table, 100);
+  uint32_t num_leaves =
+      (num_rows + builder.leaf_capacity - 1) / builder.leaf_capacity;
+  uint32_t *page_nums = malloc(num_leaves * sizeof(uint32_t));
+  void **leaves = malloc(num_leaves * sizeof(void *));
+  bool fits = table_builder_open_leaves(&builder, num_leaves, page_nums) ==
+              EXECUTE_SUCCESS;
+
+  if (fits) {
+    for (uint32_t i = 0; i < num_leaves; i++) {
+      leaves[i] = get_page(table->pager, page_nums[i]);
+    }
+    for (uint32_t i = 0; i < num_chunks; i++) {
+      ranges[i].leaves = leaves;
+      ranges[i].leaf_capacity = builder.leaf_capacity;
+    }
+    import_run_ranges(import_fill_range, ranges, num_chunks);
+
+    for (uint32_t i = 0; i < num_leaves; i++) {
+      uint32_t first_row = i * builder.leaf_capacity;
+      uint32_t num_cells = num_rows - first_row < builder.leaf_capacity
+                               ? num_rows - first_row
+                               : builder.leaf_capacity;
+      *leaf_node_num_cells(leaves[i]) = num_cells;
+      table_builder_add_leaf(&builder, page_nums[i]);
+    }
+    table_builder_finish(&builder);
+
+    *num_inserted = num_rows;
+    *num_duplicates = num_parsed - num_rows;
+  }
+
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    free(ranges[i].rows);
+  }
+  free(page_nums);
+  free(leaves);
+  return fits;
+}
+
+/*
+ * Imports rows from a delimited text file.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - filename: The file to import, one "id,username,email" row per line.
+ * - delimiter: The field separator (',' for csv, '\t' for tsv).
+ * - num_inserted: Set to the number of rows inserted.
+ * - num_duplicates: Set to the number of rows skipped because their key was
+ * already in the table.
+ * - error: Set to why the import failed, up to SQLITEDB_ERRMSG_SIZE bytes,
+ * when it returns EXECUTE_ERROR.
+ *
+ * The file is mapped into memory and split into chunks at newline boundaries.
+ * Each chunk is parsed and sorted by its own thread. An empty table is then
+ * built from the sorted chunks in parallel, see import_build. Otherwise the
+ * chunks are merged and handed to table_bulk_insert in batches, which appends
+ * rows past the current maximum key straight into full leaves.
+ *
+ * Nothing is inserted if any line fails to parse. A first line whose id is
+ * not a number is treated as a header and skipped. If the rows do not all
+ * fit, the ones that did are left in the table for the caller to undo, see
+ * transaction_begin_atomic.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_TABLE_FULL if the rows did not all fit, or
+ * EXECUTE_ERROR if the file could not be read or a line could not be parsed.
+ */
+ExecuteResult import_file(Table *table, const char *filename, char delimiter,
+                          uint32_t *num_inserted, uint32_t *num_duplicates,
+                          char *error) {
+  *num_inserted = 0;
+  *num_duplicates = 0;
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s'.", filename);
+    return EXECUTE_ERROR;
+  }
+
+  off_t file_size = lseek(fd, 0, SEEK_END);
+  if (file_size <= 0) {
+    close(fd);
+    return EXECUTE_SUCCESS;
+  }
+
+  char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error mapping file: %d", errno);
+    return EXECUTE_ERROR;
+  }
+  madvise(data, file_size, MADV_SEQUENTIAL);
+
+  uint32_t num_chunks = import_num_chunks(file_size);
+  ImportChunk chunks[IMPORT_MAX_THREADS];
+  pthread_t threads[IMPORT_MAX_THREADS];
+  const char *end = data + file_size;
+  const char *start = data;
+
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    const char *chunk_end = end;
+    if (i + 1 < num_chunks) {
+      chunk_end = data + file_size / num_chunks * (i + 1);
+      if (chunk_end < start) {
+        chunk_end = start;
+      }
+      const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = newline ? newline + 1 : end;
+    }
+
+    memset(&chunks[i], 0, sizeof(ImportChunk));
+    chunks[i].start = start;
+    chunks[i].end = chunk_end;
+    chunks[i].delimiter = delimiter;
+    chunks[i].may_have_header = (i == 0);
+    chunks[i].error = PREPARE_SUCCESS;
+    start = chunk_end;
+  }
+
+  for (uint32_t i = 1; i < num_chunks; i++) {
+    pthread_create(&threads[i], NULL, import_chunk, &chunks[i]);
+  }
+  import_chunk(&chunks[0]);
+  for (uint32_t i = 1; i < num_chunks; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  ImportChunk *failed = NULL;
+  for (uint32_t i = 0; i < num_chunks && failed == NULL; i++) {
+    if (chunks[i].error != PREPARE_SUCCESS) {
+      failed = &chunks[i];
+    }
+  }
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  if (failed != NULL) {
+    const char *reason;
+    switch (failed->error) {
+    case (PREPARE_NEGATIVE_ID):
+      reason = "ID must be positive.";
+      break;
+    case (PREPARE_STRING_TOO_LONG):
+      reason = "String is too long.";
+      break;
+    default:
+      reason = "Syntax error. Could not parse row.";
+      break;
+    }
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error on line %d: %s",
+             import_line_number(data, failed->error_line), reason);
+    result = EXECUTE_ERROR;
+  } else {
+    void *root = get_page(table->pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF &&
+                 *leaf_node_num_cells(root) == 0;
+    if (!empty || !import_build(table, chunks, num_chunks, num_inserted,
+                                num_duplicates)) {
+      result = import_merge(table, chunks, num_chunks, num_inserted,
+                            num_duplicates);
+    }
+  }
+
+  for (uint32_t i = 0; i < num_chunks; i++) {
+    free(chunks[i].rows);
+    free(chunks[i].keys);
+  }
+  munmap(data, file_size);
+  return result;
+}
@@ -0,0 +1,15 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "constants.h"
+
+#define IMPORT_MAX_THREADS 16
+#define IMPORT_MIN_CHUNK_SIZE (64 * 1024)
+#define IMPORT_BATCH_ROWS 4096
+#define IMPORT_SAMPLES_PER_CHUNK 64
+
+ExecuteResult import_file(Table *table, const char *filename, char delimiter,
+                          uint32_t *num_inserted, uint32_t *num_duplicates,
+                          char *error);
+
+#endif
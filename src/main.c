@@ -1,9 +1,25 @@
-#include "btree.h"
-#include "constants.h"
-#include "cursor.h"
-#include "node.h"
-#include "pager.h"
-#include "serialize.h"
+#include "sqlitedb.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef struct {
+  char *buffer;
+  size_t buffer_length;
+  ssize_t input_length;
+} InputBuffer;
+
+typedef enum {
+  META_COMMAND_SUCCESS,
+  META_COMMAND_UNRECOGNIZED_COMMAND
+} MetaCommandResult;
+
+// Whether to print the time and page counts of every statement
+bool timer_enabled = false;
 
 // InputBuffer related functions
 InputBuffer *new_input_buffer() {
@@ -33,226 +49,328 @@ void close_input_buffer(InputBuffer *input_buffer) {
   free(input_buffer);
 }
 
-// Table related functions
-Table *db_open(const char *filename) {
-  Pager *pager = pager_open(filename);
-
-  Table *table = malloc(sizeof(Table));
-  table->pager = pager;
-  table->root_page_num = 0;
-
-  if (pager->num_pages == 0) {
-    void *root_node = get_page(pager, 0);
-    initialize_leaf_node(root_node);
-    set_node_root(root_node, true);
+// Print functions
+void print_row(SqliteStmt *stmt) {
+  sqlitedb_profile_begin(SQLITEDB_PHASE_OUTPUT);
+  if (sqlitedb_stmt_isexplain(stmt)) {
+    printf("%s\n", sqlitedb_column_text(stmt, 0));
+    sqlitedb_profile_end();
+    return;
+  }
+  printf("(");
+  for (int i = 0; i < sqlitedb_column_count(stmt); i++) {
+    printf(i == 0 ? "%s" : ", %s", sqlitedb_column_text(stmt, i));
   }
+  printf(")\n");
+  sqlitedb_profile_end();
+}
 
-  return table;
+uint64_t clock_ns(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
 }
 
-void db_close(Table *table) {
-  Pager *pager = table->pager;
+void print_timer(const SqliteProfile *profile, uint64_t real_ns,
+                 uint64_t cpu_ns) {
+  printf("Run Time: real %.6f cpu %.6f\n", real_ns / 1e9, cpu_ns / 1e9);
+  printf("Pages: read %lu written %lu cache hits %lu misses %lu\n",
+         (unsigned long)profile->pages_read,
+         (unsigned long)profile->pages_written,
+         (unsigned long)profile->cache_hits,
+         (unsigned long)profile->cache_misses);
+}
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
+void print_stats(SqliteDb *db) {
+  SqliteStats stats;
+  sqlitedb_stats(db, &stats);
+
+  printf("Pager:\n");
+  printf("  cache hits: %lu\n", (unsigned long)stats.cache_hits);
+  printf("  cache misses: %lu\n", (unsigned long)stats.cache_misses);
+  printf("  cache evictions: %lu\n", (unsigned long)stats.cache_evictions);
+  printf("  cached pages: %u\n", stats.cached_pages);
+  printf("  bytes read: %lu\n", (unsigned long)stats.bytes_read);
+  printf("  bytes written: %lu\n", (unsigned long)stats.bytes_written);
+  printf("  fsyncs: %lu\n", (unsigned long)stats.fsyncs);
+  printf("  read latency:\n");
+  for (int i = 0; i < SQLITEDB_LATENCY_BUCKETS; i++) {
+    if (stats.read_latency[i] == 0) {
       continue;
     }
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
-  }
-
-  int result = close(pager->file_descriptor);
-  if (result == -1) {
-    printf("Error closing db file.\n");
-    exit(EXIT_FAILURE);
-  }
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void *page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
+    if (i == SQLITEDB_LATENCY_BUCKETS - 1) {
+      printf("    >= %dus: %lu\n", 1 << (i - 1),
+             (unsigned long)stats.read_latency[i]);
+    } else {
+      printf("    < %dus: %lu\n", 1 << i,
+             (unsigned long)stats.read_latency[i]);
     }
   }
-  free(pager);
-  free(table);
-}
-
-// Print functions
-void print_constants() {
-  printf("ROW_SIZE: %d\n", ROW_SIZE);
-  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
-}
-
-void indent(uint32_t level) {
-  for (uint32_t i = 0; i < level; i++) {
-    printf("  ");
-  }
+  printf("Tree:\n");
+  printf("  height: %u\n", stats.tree_height);
+  printf("  rows: %lu\n", (unsigned long)stats.rows);
+  printf("  pages: %u\n", stats.pages);
+  printf("  leaf pages: %u\n", stats.leaf_pages);
+  printf("  internal pages: %u\n", stats.internal_pages);
+  printf("  free pages: %u\n", stats.free_pages);
+  printf("  leaf fill: %.1f%%\n", 100 * stats.leaf_fill);
+  printf("  internal fill: %.1f%%\n", 100 * stats.internal_fill);
+  printf("  splits: %lu\n", (unsigned long)stats.splits);
 }
 
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
-  void* node = get_page(pager, page_num);
-  uint32_t num_keys, child;
-
-  switch (get_node_type(node)) {
-    case (NODE_LEAF):
-      num_keys = *leaf_node_num_cells(node);
-      indent(indentation_level);
-      printf("- leaf (size %d)\n", num_keys);
-      for (uint32_t i = 0; i < num_keys; i++) {
-        indent(indentation_level + 1);
-        printf("- %d\n", *leaf_node_key(node, i));
-      }
-      break;
-    case (NODE_INTERNAL):
-      num_keys = *internal_node_num_keys(node);
-      indent(indentation_level);
-      printf("- internal (size %d)\n", num_keys);
-      for (uint32_t i = 0; i < num_keys; i++) {
-        child = *internal_node_child(node, i);
-        print_tree(pager, child, indentation_level + 1);
-
-        indent(indentation_level + 1);
-        printf("- key %d\n", *internal_node_key(node, i));
-      }
-      child = *internal_node_right_child(node);
-      print_tree(pager, child, indentation_level + 1);
-      break;
+void print_profile(const SqliteProfile *profile, uint64_t real_ns) {
+  static const char *phase_names[SQLITEDB_PHASES] = {
+      "parse", "descent", "page I/O", "serialize", "output"};
+
+  // Scan workers add their own time, so the phases can outrun the clock
+  uint64_t phases_ns = 0;
+  printf("Profile:\n");
+  for (uint32_t i = 0; i < SQLITEDB_PHASES; i++) {
+    uint64_t phase_ns = profile->phase_ns[i];
+    phases_ns += phase_ns;
+    printf("  %-10s %.6f %5.1f%%\n", phase_names[i], phase_ns / 1e9,
+           real_ns > 0 ? 100.0 * phase_ns / real_ns : 0.0);
   }
+  uint64_t other_ns = real_ns > phases_ns ? real_ns - phases_ns : 0;
+  printf("  %-10s %.6f %5.1f%%\n", "other", other_ns / 1e9,
+         real_ns > 0 ? 100.0 * other_ns / real_ns : 0.0);
 }
 
-void print_row(Row *row) {
-  printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+void print_prompt() {
+  printf("db > ");
+  // A program driving the REPL through a pipe waits for the prompt
+  fflush(stdout);
 }
 
-void print_prompt() { printf("db > "); }
-
 // Statement related functions
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
-  if (strcmp(input_buffer->buffer, ".exit") == 0) {
-    db_close(table);
-    exit(EXIT_SUCCESS);
-  } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-    printf("Tree:\n");
-    print_tree(table->pager, 0, 0);
+MetaCommandResult do_import(InputBuffer *input_buffer, SqliteDb *db) {
+  strtok(input_buffer->buffer, " ");
+  char *filename = strtok(NULL, " ");
+  char *format = strtok(NULL, " ");
+
+  if (filename == NULL) {
+    printf("Usage: .import <file> [csv|tsv]\n");
     return META_COMMAND_SUCCESS;
-  } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-    printf("Constants:\n");
-    print_constants();
+  }
+
+  char delimiter = ',';
+  if (format == NULL) {
+    size_t length = strlen(filename);
+    if (length >= 4 && strcmp(filename + length - 4, ".tsv") == 0) {
+      delimiter = '\t';
+    }
+  } else if (strcmp(format, "tsv") == 0) {
+    delimiter = '\t';
+  } else if (strcmp(format, "csv") != 0) {
+    printf("Unknown import format '%s'.\n", format);
     return META_COMMAND_SUCCESS;
+  }
+
+  uint64_t num_rows, num_skipped;
+  if (sqlitedb_import(db, filename, delimiter, &num_rows, &num_skipped) !=
+      SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+  } else if (num_skipped > 0) {
+    printf("Imported %lu rows (%lu duplicate keys skipped).\n",
+           (unsigned long)num_rows, (unsigned long)num_skipped);
   } else {
-    return META_COMMAND_UNRECOGNIZED_COMMAND;
+    printf("Imported %lu rows.\n", (unsigned long)num_rows);
   }
+  return META_COMMAND_SUCCESS;
 }
 
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement) {
-  statement->type = STATEMENT_INSERT;
-
-  char *keyword = strtok(input_buffer->buffer, " ");
-  char *id_string = strtok(NULL, " ");
-  char *username = strtok(NULL, " ");
-  char *email = strtok(NULL, " ");
+MetaCommandResult do_backup(InputBuffer *input_buffer, SqliteDb *db) {
+  strtok(input_buffer->buffer, " ");
+  char *filename = strtok(NULL, " ");
+  char *pages = strtok(NULL, " ");
 
-  if (id_string == NULL || username == NULL || email == NULL) {
-    return PREPARE_SYNTAX_ERROR;
-  }
-
-  int id = atoi(id_string);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID;
-  }
-  if (strlen(username) > COLUMN_USERNAME_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
+  // 0 leaves the number of pages per step to the engine
+  int pages_per_step = pages == NULL ? 0 : atoi(pages);
+  if (filename == NULL || (pages != NULL && pages_per_step < 1)) {
+    printf("Usage: .backup <file> [pages per step]\n");
+    return META_COMMAND_SUCCESS;
   }
-  if (strlen(email) > COLUMN_EMAIL_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
+  if (sqlitedb_backup(db, filename, pages_per_step) != SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
   }
-
-  statement->row_to_insert.id = id;
-  strcpy(statement->row_to_insert.username, username);
-  strcpy(statement->row_to_insert.email, email);
-
-  return PREPARE_SUCCESS;
+  return META_COMMAND_SUCCESS;
 }
 
-PrepareResult prepare_statement(InputBuffer *input_buffer,
-                                Statement *statement) {
-  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-    return prepare_insert(input_buffer, statement);
-  }
-  if (strcmp(input_buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+MetaCommandResult do_vacuum(SqliteDb *db, int fill_percent) {
+  uint32_t old_num_pages, new_num_pages;
+  if (sqlitedb_vacuum(db, fill_percent, &old_num_pages, &new_num_pages) !=
+      SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+  } else {
+    printf("Vacuumed %u pages into %u.\n", old_num_pages, new_num_pages);
   }
-
-  return PREPARE_UNRECOGNIZED_STATEMENT;
+  return META_COMMAND_SUCCESS;
 }
 
-ExecuteResult execute_insert(Statement *statement, Table *table) {
-  void *node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = (*leaf_node_num_cells(node));
-
-  Row *row_to_insert = &(statement->row_to_insert);
-  uint32_t key_to_insert = row_to_insert->id;
-  Cursor *cursor = table_find(table, key_to_insert);
+MetaCommandResult do_slow_log(InputBuffer *input_buffer, SqliteDb *db) {
+  strtok(input_buffer->buffer, " ");
+  char *filename = strtok(NULL, " ");
+  char *threshold = strtok(NULL, " ");
 
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
-      return EXECUTE_DUPLICATE_KEY;
-    }
+  if (filename != NULL && strcmp(filename, "off") == 0 && threshold == NULL) {
+    sqlitedb_slow_log(db, NULL, 0);
+    return META_COMMAND_SUCCESS;
   }
-
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-  return EXECUTE_SUCCESS;
+  char *end = NULL;
+  double threshold_ms = threshold == NULL ? -1 : strtod(threshold, &end);
+  if (filename == NULL || threshold_ms < 0 || *end != '\0') {
+    printf("Usage: .slowlog <file> <milliseconds> | .slowlog off\n");
+    return META_COMMAND_SUCCESS;
+  }
+  if (sqlitedb_slow_log(db, filename, (int64_t)(threshold_ms * 1000)) !=
+      SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+  }
+  return META_COMMAND_SUCCESS;
 }
 
-ExecuteResult execute_select(Statement *statement, Table *table) {
-  Cursor *cursor = table_start(table);
-
-  Row row;
-
-  while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    print_row(&row);
-    cursor_advance(cursor);
+void print_result(SqliteDb *db, int result) {
+  if (result != SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
   }
-
-  free(cursor);
-
-  return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement *statement, Table *table) {
-  switch (statement->type) {
-  case STATEMENT_INSERT:
-    return execute_insert(statement, table);
-  case STATEMENT_SELECT:
-    return execute_select(statement, table);
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, SqliteDb *db) {
+  if (strcmp(input_buffer->buffer, ".exit") == 0) {
+    sqlitedb_close(db);
+    exit(EXIT_SUCCESS);
+  } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+    sqlitedb_print_tree(db);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    print_stats(db);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".timer on") == 0) {
+    timer_enabled = true;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".timer off") == 0) {
+    timer_enabled = false;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".profile on") == 0) {
+    sqlitedb_profile_enable(true);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".profile off") == 0) {
+    sqlitedb_profile_enable(false);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".slowlog ", 9) == 0) {
+    return do_slow_log(input_buffer, db);
+  } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+    sqlitedb_print_constants();
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+    return do_import(input_buffer, db);
+  } else if (strncmp(input_buffer->buffer, ".dump ", 6) == 0) {
+    uint64_t num_rows;
+    if (sqlitedb_dump(db, input_buffer->buffer + 6, &num_rows) != SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
+    } else {
+      printf("Dumped %lu rows.\n", (unsigned long)num_rows);
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".restore ", 9) == 0) {
+    uint64_t num_rows;
+    if (sqlitedb_restore(db, input_buffer->buffer + 9, &num_rows) !=
+        SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
+    } else {
+      printf("Restored %lu rows.\n", (unsigned long)num_rows);
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".backup ", 8) == 0) {
+    return do_backup(input_buffer, db);
+  } else if (strcmp(input_buffer->buffer, ".compact") == 0) {
+    uint32_t pages_freed;
+    if (sqlitedb_compact(db, &pages_freed) != SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
+    } else {
+      printf("Freed %u pages.\n", pages_freed);
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".compact on") == 0) {
+    print_result(db, sqlitedb_auto_compact(db, true));
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".compact off") == 0) {
+    print_result(db, sqlitedb_auto_compact(db, false));
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".vacuum") == 0) {
+    return do_vacuum(db, 0);
+  } else if (strncmp(input_buffer->buffer, ".vacuum ", 8) == 0) {
+    int fill_percent = atoi(input_buffer->buffer + 8);
+    // 0 would ask for the default fill factor
+    return do_vacuum(db, fill_percent > 0 ? fill_percent : -1);
+  } else {
+    return META_COMMAND_UNRECOGNIZED_COMMAND;
   }
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  // With --cow, a new database is created in copy-on-write mode
+  bool cow = false;
+  char *server_address = NULL;
+  char *metrics_address = NULL;
+  char *slow_log_filename = NULL;
+  double slow_log_threshold_ms = 0;
+  char *filename = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--cow") == 0) {
+      cow = true;
+    } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+      server_address = argv[++i];
+    } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+      metrics_address = argv[++i];
+    } else if (strcmp(argv[i], "--slowlog") == 0 && i + 2 < argc) {
+      slow_log_filename = argv[++i];
+      slow_log_threshold_ms = strtod(argv[++i], NULL);
+    } else {
+      filename = argv[i];
+    }
+  }
+  if (filename == NULL) {
     printf("Must supply a database filename.\n");
     exit(EXIT_FAILURE);
   }
+  SqliteDb *db;
+  if (sqlitedb_open_v2(filename, cow ? SQLITEDB_OPEN_COPY_ON_WRITE : 0, &db) !=
+      SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+    exit(EXIT_FAILURE);
+  }
+  if (slow_log_filename != NULL &&
+      sqlitedb_slow_log(db, slow_log_filename,
+                        (int64_t)(slow_log_threshold_ms * 1000)) !=
+          SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+    exit(EXIT_FAILURE);
+  }
 
-  char *filename = argv[1];
-  Table *table = db_open(filename);
+  if (server_address != NULL) {
+    int result = sqlitedb_serve(db, server_address, metrics_address);
+    if (result != SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
+    }
+    sqlitedb_close(db);
+    exit(result == SQLITEDB_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
 
   InputBuffer *input_buffer = new_input_buffer();
   while (true) {
+    uint32_t backup_pages;
+    int idle_result = sqlitedb_idle(db, &backup_pages);
+    if (idle_result == SQLITEDB_DONE) {
+      printf("Backup complete: %u pages copied.\n", backup_pages);
+    } else if (idle_result != SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
+    }
     print_prompt();
     read_input(input_buffer);
 
     if (input_buffer->buffer[0] == '.') {
-      switch (do_meta_command(input_buffer, table)) {
+      switch (do_meta_command(input_buffer, db)) {
       case (META_COMMAND_SUCCESS):
         continue;
       case (META_COMMAND_UNRECOGNIZED_COMMAND):
@@ -261,34 +379,37 @@ int main(int argc, char *argv[]) {
       }
     }
 
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-    case (PREPARE_SUCCESS):
-      break;
-    case (PREPARE_NEGATIVE_ID):
-      printf("ID must be positive.\n");
-      continue;
-    case (PREPARE_STRING_TOO_LONG):
-      printf("String is too long.\n");
-      continue;
-    case (PREPARE_SYNTAX_ERROR):
-      printf("Syntax error. Could not parse statement.\n");
-      continue;
-    case (PREPARE_UNRECOGNIZED_STATEMENT):
-      printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
+    // The clocks are only read here, around the whole statement
+    sqlitedb_profile_reset();
+    uint64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+    uint64_t start_cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    SqliteStmt *stmt;
+    if (sqlitedb_prepare(db, input_buffer->buffer, &stmt) != SQLITEDB_OK) {
+      printf("%s\n", sqlitedb_errmsg(db));
       continue;
     }
 
-    switch (execute_statement(&statement, table)) {
-    case (EXECUTE_SUCCESS):
+    int result;
+    while ((result = sqlitedb_step(stmt)) == SQLITEDB_ROW) {
+      print_row(stmt);
+    }
+    if (result == SQLITEDB_DONE) {
       printf("Executed.\n");
-      break;
-    case (EXECUTE_DUPLICATE_KEY):
-      printf("Error: Duplicate key.\n");
-      break;
-    case (EXECUTE_TABLE_FULL):
-      printf("Error: Table full.\n");
-      break;
+    } else {
+      printf("%s\n", sqlitedb_errmsg(db));
+    }
+    sqlitedb_finalize(stmt);
+
+    uint64_t real_ns = clock_ns(CLOCK_MONOTONIC) - start_ns;
+    uint64_t cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - start_cpu_ns;
+    SqliteProfile profile;
+    sqlitedb_profile(&profile);
+    if (timer_enabled) {
+      print_timer(&profile, real_ns, cpu_ns);
+    }
+    if (sqlitedb_profile_enabled()) {
+      print_profile(&profile, real_ns);
     }
   }
 }
\ No newline at end of file
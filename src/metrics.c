@@ -0,0 +1,189 @@
+#include "metrics.h"
+#include "pager.h"
+#include "stats.h"
+#include "table.h"
+
+/*
+ * Writes the metadata of a metric family.
+ *
+ * Parameters:
+ * - out: Where to write.
+ * - name: The name of the family.
+ * - type: counter, gauge or histogram.
+ * - unit: The unit the name ends in, or NULL if it has none.
+ * - help: What the metric measures.
+ *
+ * Does not return a value.
+ */
+static void metrics_family(FILE *out, const char *name, const char *type,
+                           const char *unit, const char *help) {
+  fprintf(out, "# TYPE %s %s\n", name, type);
+  if (unit != NULL) {
+    fprintf(out, "# UNIT %s %s\n", name, unit);
+  }
+  fprintf(out, "# HELP %s %s\n", name, help);
+}
+
+/*
+ * Writes a counter that has a single value.
+ */
+static void metrics_counter(FILE *out, const char *name, const char *unit,
+                            const char *help, uint64_t value) {
+  metrics_family(out, name, "counter", unit, help);
+  fprintf(out, "%s_total %lu\n", name, (unsigned long)value);
+}
+
+/*
+ * Writes a gauge that has a single value.
+ */
+static void metrics_gauge(FILE *out, const char *name, const char *unit,
+                          const char *help, double value) {
+  metrics_family(out, name, "gauge", unit, help);
+  fprintf(out, "%s %.17g\n", name, value);
+}
+
+/*
+ * Writes the samples of one histogram, in seconds.
+ *
+ * Parameters:
+ * - out: Where to write.
+ * - name: The name of the family.
+ * - labels: Labels to put before le on every sample, such as op="get", or an
+ * empty string.
+ * - buckets: The counts per bucket, as filled in by profile_latency_bucket.
+ * - num_buckets: The number of buckets.
+ * - sum_ns: The total of every duration counted, in nanoseconds.
+ *
+ * OpenMetrics buckets are cumulative, so each one also counts everything in
+ * the buckets below it. The last bucket is unbounded.
+ *
+ * Does not return a value.
+ */
+static void metrics_histogram(FILE *out, const char *name, const char *labels,
+                              uint64_t *buckets, uint32_t num_buckets,
+                              uint64_t sum_ns) {
+  const char *separator = labels[0] != '\0' ? "," : "";
+  uint64_t count = 0;
+  for (uint32_t i = 0; i < num_buckets; i++) {
+    count += buckets[i];
+    if (i < num_buckets - 1) {
+      fprintf(out, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, separator,
+              (double)(1UL << i) / 1e6, (unsigned long)count);
+    } else {
+      fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels,
+              separator, (unsigned long)count);
+    }
+  }
+  const char *braces_open = labels[0] != '\0' ? "{" : "";
+  const char *braces_close = labels[0] != '\0' ? "}" : "";
+  fprintf(out, "%s_count%s%s%s %lu\n", name, braces_open, labels,
+          braces_close, (unsigned long)count);
+  fprintf(out, "%s_sum%s%s%s %.9f\n", name, braces_open, labels,
+          braces_close, sum_ns / 1e9);
+}
+
+/*
+ * Writes the engine's metrics in the OpenMetrics text format.
+ *
+ * Parameters:
+ * - out: Where to write.
+ * - table: A pointer to the Table structure.
+ * - requests: The request counts and latencies of a server, summed over its
+ * workers, or NULL if there is no server.
+ *
+ * The pager's counters are kept per thread and only added up here, see
+ * pager_stats, so scraping adds nothing to the cost of a page lookup. The
+ * tree is walked at a snapshot for its shape.
+ *
+ * Does not return a value.
+ */
+void metrics_write(FILE *out, Table *table, ServerStats *requests) {
+  PagerStats pager;
+  table_begin_read(table);
+  uint32_t num_cached = pager_stats(table->pager, &pager);
+  uint32_t wal_num_frames =
+      __atomic_load_n(&table->pager->wal_num_frames, __ATOMIC_RELAXED);
+  table_end_read(table);
+  TreeStats tree;
+  tree_stats(table, &tree);
+
+  metrics_counter(out, "sqlitedb_cache_hits", NULL,
+                  "Page lookups found in the page cache.", pager.cache_hits);
+  metrics_counter(out, "sqlitedb_cache_misses", NULL,
+                  "Page lookups that had to load the page.",
+                  pager.cache_misses);
+  metrics_counter(out, "sqlitedb_cache_evictions", NULL,
+                  "Cached pages dropped when the database shrank.",
+                  pager.cache_evictions);
+  metrics_gauge(out, "sqlitedb_cached_pages", NULL,
+                "Pages held in the page cache.", num_cached);
+  metrics_counter(out, "sqlitedb_read_bytes", "bytes",
+                  "Bytes of pages read from the database file.",
+                  pager.bytes_read);
+  metrics_counter(out, "sqlitedb_written_bytes", "bytes",
+                  "Bytes written to the database file and its log.",
+                  pager.bytes_written);
+  metrics_counter(out, "sqlitedb_fsyncs", NULL,
+                  "Waits for the database file or its log to be durable.",
+                  pager.fsyncs);
+  metrics_family(out, "sqlitedb_page_read_seconds", "histogram", "seconds",
+                 "Time to read a page from the database file.");
+  metrics_histogram(out, "sqlitedb_page_read_seconds", "", pager.read_latency,
+                    PAGER_LATENCY_BUCKETS, pager.read_ns);
+
+  metrics_counter(out, "sqlitedb_wal_commits", NULL,
+                  "Commits appended to the write-ahead log.",
+                  pager.wal_commits);
+  metrics_counter(out, "sqlitedb_wal_frames", NULL,
+                  "Pages appended to the write-ahead log.", pager.wal_frames);
+  metrics_counter(out, "sqlitedb_wal_checkpoints", NULL,
+                  "Checkpoints of the write-ahead log into the database file.",
+                  pager.wal_checkpoints);
+  metrics_gauge(out, "sqlitedb_wal_pending_frames", NULL,
+                "Pages in the write-ahead log waiting for a checkpoint.",
+                wal_num_frames);
+
+  metrics_gauge(out, "sqlitedb_rows", NULL, "Rows in the table.",
+                tree.num_rows);
+  metrics_gauge(out, "sqlitedb_tree_height", NULL,
+                "Levels in the B-tree, counting the leaves.", tree.height);
+  metrics_gauge(out, "sqlitedb_pages", NULL, "Pages in the database.",
+                tree.num_pages);
+  metrics_gauge(out, "sqlitedb_leaf_pages", NULL, "Leaf nodes in the B-tree.",
+                tree.num_leaves);
+  metrics_gauge(out, "sqlitedb_internal_pages", NULL,
+                "Internal nodes in the B-tree.", tree.num_internal_nodes);
+  metrics_gauge(out, "sqlitedb_free_pages", NULL,
+                "Pages in the database that hold no part of the B-tree.",
+                tree.num_free_pages);
+  metrics_gauge(out, "sqlitedb_leaf_fill_ratio", "ratio",
+                "Fraction of the cells in leaf nodes that are in use.",
+                (double)tree.num_rows /
+                    ((uint64_t)tree.num_leaves * LEAF_NODE_MAX_CELLS));
+  metrics_gauge(out, "sqlitedb_internal_fill_ratio", "ratio",
+                "Fraction of the keys in internal nodes that are in use.",
+                tree.num_internal_nodes > 0
+                    ? (double)tree.num_internal_keys /
+                          ((uint64_t)tree.num_internal_nodes *
+                           INTERNAL_NODE_MAX_KEYS)
+                    : 0.0);
+  metrics_counter(out, "sqlitedb_splits", NULL,
+                  "Nodes split since the database was opened.",
+                  __atomic_load_n(&table->num_splits, __ATOMIC_RELAXED));
+
+  if (requests != NULL) {
+    static const char *op_names[SERVER_NUM_OPS] = {"malformed", "insert",
+                                                   "get", "select"};
+    metrics_family(out, "sqlitedb_request_seconds", "histogram", "seconds",
+                   "Time to run a server request, by op.");
+    for (uint32_t i = 0; i < SERVER_NUM_OPS; i++) {
+      char labels[32];
+      snprintf(labels, sizeof(labels), "op=\"%s\"", op_names[i]);
+      metrics_histogram(out, "sqlitedb_request_seconds", labels,
+                        requests->latency[i], SERVER_LATENCY_BUCKETS,
+                        requests->latency_ns[i]);
+    }
+  }
+
+  fprintf(out, "# EOF\n");
+}
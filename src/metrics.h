@@ -0,0 +1,11 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "constants.h"
+
+#define METRICS_CONTENT_TYPE                                                   \
+  "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+void metrics_write(FILE *out, Table *table, ServerStats *requests);
+
+#endif
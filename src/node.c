@@ -101,4 +101,95 @@ NodeType get_node_type(void *node) {
 void set_node_type(void *node, NodeType type) {
   uint8_t value = type;
   *((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
-}
\ No newline at end of file
+}
+/*
+ * Returns a pointer to the version counter of a node.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * The version is a sequence counter used for optimistic lock coupling. It is
+ * odd while a writer holds the node locked, and every lock/unlock pair moves
+ * it forward by two.
+ *
+ * Returns a pointer to the version of the node.
+ */
+uint32_t *node_version(void *node) { return node + NODE_VERSION_OFFSET; }
+
+/*
+ * Starts an optimistic read of a node.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * Waits until the node is not locked by a writer. Reading the version does
+ * not write to the node, so any number of readers can do this at once without
+ * passing the cache line between cores.
+ *
+ * Returns the version to hand to node_validate once the read is done.
+ */
+uint32_t node_read_version(void *node) {
+  uint32_t spins = 0;
+  while (true) {
+    uint32_t version = __atomic_load_n(node_version(node), __ATOMIC_ACQUIRE);
+    if ((version & 1) == 0) {
+      return version;
+    }
+    if (++spins == NODE_SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+  }
+}
+
+/*
+ * Checks that a node has not changed since an optimistic read started.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ * - version: The version returned by node_read_version.
+ *
+ * Everything read from the node in between may have been torn by a writer, so
+ * it must not be trusted until this returns true.
+ *
+ * Returns true if the node is unchanged.
+ */
+bool node_validate(void *node, uint32_t version) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(node_version(node), __ATOMIC_RELAXED) == version;
+}
+
+/*
+ * Locks a node for writing.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * Makes the version odd, which makes readers wait and fails the validation of
+ * any read that is still in progress.
+ *
+ * Does not return a value.
+ */
+void node_lock(void *node) {
+  while (true) {
+    uint32_t version = node_read_version(node);
+    if (__atomic_compare_exchange_n(node_version(node), &version, version + 1,
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      return;
+    }
+  }
+}
+
+/*
+ * Unlocks a node locked with node_lock, publishing the changes made to it.
+ *
+ * Parameters:
+ * - node: A pointer to the node.
+ *
+ * Does not return a value.
+ */
+void node_unlock(void *node) {
+  __atomic_fetch_add(node_version(node), 1, __ATOMIC_RELEASE);
+}
@@ -3,6 +3,8 @@
 
 #include "constants.h"
 
+#define NODE_SPINS_BEFORE_YIELD 64
+
 uint32_t *leaf_node_num_cells(void *node);
 void *leaf_node_cell(void *node, uint32_t cell_num);
 uint32_t *leaf_node_key(void *node, uint32_t cell_num);
@@ -11,4 +13,10 @@ void *leaf_node_value(void *node, uint32_t cell_num);
 NodeType get_node_type(void *node);
 void set_node_type(void *node, NodeType type);
 
+uint32_t *node_version(void *node);
+uint32_t node_read_version(void *node);
+bool node_validate(void *node, uint32_t version);
+void node_lock(void *node);
+void node_unlock(void *node);
+
 #endif
\ No newline at end of file
@@ -1,4 +1,37 @@
 #include "pager.h"
+#include "btree.h"
+#include "cow.h"
+#include "profile.h"
+#include "trace.h"
+#include "wal.h"
+
+// The copy of the pager's counters each thread counts into, picked on first
+// use; PAGER_STATS_SHARDS until then
+static __thread uint32_t pager_stats_shard = PAGER_STATS_SHARDS;
+static uint32_t pager_next_stats_shard;
+
+/*
+ * Returns the calling thread's copy of a pager's counters.
+ *
+ * Threads take the copies in turn, so up to PAGER_STATS_SHARDS threads
+ * count without sharing a cache line. Beyond that, threads share copies,
+ * which is why the counters are still added to atomically.
+ */
+PagerStats *pager_thread_stats(Pager *pager) {
+  if (pager_stats_shard == PAGER_STATS_SHARDS) {
+    pager_stats_shard = __atomic_fetch_add(&pager_next_stats_shard, 1,
+                                           __ATOMIC_RELAXED) %
+                        PAGER_STATS_SHARDS;
+  }
+  return &pager->stats[pager_stats_shard];
+}
+
+/*
+ * Adds to one of the calling thread's counters, see pager_thread_stats.
+ */
+void pager_count(uint64_t *counter, uint64_t amount) {
+  __atomic_fetch_add(counter, amount, __ATOMIC_RELAXED);
+}
 
 /*
  * Retrieves a page from the pager.
@@ -13,10 +46,24 @@
  * If the requested page is not in the pager's cache (i.e., it's a cache miss),
  * the function allocates memory for the page and checks if the page exists in
  * the file. If it does, the function reads the page from the file into the
- * newly allocated memory.
+ * newly allocated memory. A page past the end of the file or of the database
+ * starts out zeroed, which also gives it a clean node version. A page that
+ * cannot be read fails the pager, see pager_fail, and is stood in for by an
+ * empty leaf, so whoever asked for it still gets a node to walk.
+ *
+ * The function then publishes the page in the pager's cache and updates the
+ * number of pages in the pager if necessary.
  *
- * The function then stores a pointer to the page in the pager's cache and
- * updates the number of pages in the pager if necessary.
+ * Safe to call from several threads at once. The page table is a plain array
+ * indexed by page number, so a slot never has to be searched for or rehashed.
+ * Two threads that miss on the same page both read it, and a compare-and-swap
+ * on the slot decides whose copy is kept; the other is freed. Readers only
+ * ever ask for pages that already exist, so only the single writer grows
+ * num_pages.
+ *
+ * Every lookup counts as a cache hit or miss, both for the pager and for the
+ * calling thread's statement (see profile.c). So does a miss that reads the
+ * file, along with how long the read took.
  *
  * Returns a pointer to the requested page.
  */
@@ -27,33 +74,66 @@ void *get_page(Pager *pager, uint32_t page_num) {
     exit(EXIT_FAILURE);
   }
 
-  if (pager->pages[page_num] == NULL) {
+  void *cached = __atomic_load_n(&pager->pages[page_num], __ATOMIC_ACQUIRE);
+  if (cached == NULL) {
     // Cache miss. Allocate memory and load from file.
+    profile_counters.cache_misses++;
+    pager_count(&pager_thread_stats(pager)->cache_misses, 1);
+    TRACE_PROBE1(page__miss, page_num);
     void *page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+    uint32_t file_length =
+        __atomic_load_n(&pager->file_length, __ATOMIC_ACQUIRE);
+    uint32_t num_pages = file_length / PAGE_SIZE;
 
     // We might save a partial page at the end of the file
-    if (pager->file_length % PAGE_SIZE) {
+    if (file_length % PAGE_SIZE) {
       num_pages += 1;
     }
 
-    if (page_num < num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+    // Past the end of the database, the file may still hold truncated pages
+    if (page_num >= num_pages || page_num >= pager->num_pages) {
+      memset(page, 0, PAGE_SIZE);
+    } else {
+      profile_counters.pages_read++;
+      profile_begin(PROFILE_PHASE_IO);
+      uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+      ssize_t bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE,
+                                 (off_t)page_num * PAGE_SIZE);
+      uint64_t elapsed_ns = profile_clock(CLOCK_MONOTONIC) - start_ns;
+      profile_end();
       if (bytes_read == -1) {
-        printf("Error reading file: %d\n", errno);
-        exit(EXIT_FAILURE);
+        pager_fail(pager, "Error reading file", errno);
+        memset(page, 0, PAGE_SIZE);
+        initialize_leaf_node(page);
+        bytes_read = 0;
       }
+
+      PagerStats *stats = pager_thread_stats(pager);
+      uint32_t bucket = profile_latency_bucket(elapsed_ns, PAGER_LATENCY_BUCKETS);
+      pager_count(&stats->bytes_read, bytes_read);
+      pager_count(&stats->read_latency[bucket], 1);
+      pager_count(&stats->read_ns, elapsed_ns);
+      profile_counters.io_wait_ns += elapsed_ns;
+      TRACE_PROBE2(page__read, page_num, elapsed_ns);
     }
 
-    pager->pages[page_num] = page;
+    if (__atomic_compare_exchange_n(&pager->pages[page_num], &cached, page,
+                                    false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      cached = page;
+    } else {
+      free(page);
+    }
 
     if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+      __atomic_store_n(&pager->num_pages, page_num + 1, __ATOMIC_RELEASE);
     }
+  } else {
+    profile_counters.cache_hits++;
+    pager_count(&pager_thread_stats(pager)->cache_hits, 1);
   }
 
-  return pager->pages[page_num];
+  return cached;
 }
 
 /*
@@ -61,22 +141,29 @@ void *get_page(Pager *pager, uint32_t page_num) {
  *
  * Parameters:
  * - filename: The name of the file to be opened.
+ * - error: Where to write why the pager could not be opened, at most
+ * SQLITEDB_ERRMSG_SIZE bytes.
  *
  * The function opens the file in read/write mode, creating it if it doesn't
- * exist. It then seeks to the end of the file to determine its length.
+ * exist, and opens its write-ahead log, which first brings the file up to
+ * date with any transactions committed to the log but not yet copied back.
+ * Copy-on-write databases have no log.
+ * It then seeks to the end of the file to determine its length.
  *
  * A new Pager structure is allocated and its fields are initialized with the
  * file descriptor, the file length, and the number of pages in the file
  * (calculated as the file length divided by the page size).
  *
- * If the file length is not a whole number of pages, the function prints an
- * error message and exits, as this indicates a corrupt file.
+ * If the file length is not a whole number of pages, the file is corrupt and
+ * the pager is not opened. Neither is it if the file or its log cannot be
+ * opened, or recovering from the log fails.
  *
- * The function then initializes each page in the pager's cache to NULL.
+ * The function then initializes each page in the pager's cache to NULL and
+ * marks every page clean.
  *
- * Returns a pointer to the new Pager structure.
+ * Returns a pointer to the new Pager structure, or NULL.
  */
-Pager *pager_open(const char *filename) {
+Pager *pager_open(const char *filename, char *error) {
   int fd = open(filename,
                 O_RDWR |     // Read/Write mode
                     O_CREAT, // Create file if it does not exist
@@ -85,25 +172,65 @@ Pager *pager_open(const char *filename) {
   );
 
   if (fd == -1) {
-    printf("Unable to open file\n");
-    exit(EXIT_FAILURE);
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to open '%s': %d", filename,
+             errno);
+    return NULL;
   }
 
-  off_t file_length = lseek(fd, 0, SEEK_END);
-
-  Pager *pager = malloc(sizeof(Pager));
+  // Each copy of the counters starts on a cache line of its own
+  Pager *pager = aligned_alloc(64, sizeof(Pager));
+  memset(pager->stats, 0, sizeof(pager->stats));
+  pager->filename = strdup(filename);
   pager->file_descriptor = fd;
+  pager->io_error = 0;
+  pager->io_error_action = NULL;
+  // A copy-on-write database never overwrites what it needs to recover
+  pager->copy_on_write = cow_detect(fd);
+  if (pager->copy_on_write) {
+    pager->wal_file_descriptor = -1;
+    pager->num_wal_pending = 0;
+  } else {
+    wal_open(pager, filename);
+  }
+
+  off_t file_length = lseek(fd, 0, SEEK_END);
   pager->file_length = file_length;
   pager->num_pages = (file_length / PAGE_SIZE);
 
-  if (file_length % PAGE_SIZE != 0) {
-    printf("Db file is not a whole number of pages. Corrupt file.\n");
-    exit(EXIT_FAILURE);
+  bool failed = pager_failed(pager, error);
+  if (!failed && file_length % PAGE_SIZE != 0) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE,
+             "Db file is not a whole number of pages. Corrupt file.");
+    failed = true;
+  }
+  if (failed) {
+    // A log that could not be recovered from stays for the next open
+    if (pager->wal_file_descriptor != -1) {
+      close(pager->wal_file_descriptor);
+    }
+    close(fd);
+    free(pager->filename);
+    free(pager);
+    return NULL;
   }
 
   for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
     pager->pages[i] = NULL;
+    pager->dirty[i] = false;
+    pager->page_write_counters[i] = 0;
+    pager->page_versions[i] = NULL;
+    pager->page_version_stamps[i] = 0;
+    pager->wal_pending[i] = false;
+    pager->undo_depths[i] = 0;
   }
+  pager->write_counter = 0;
+  pager->commit_version = 0;
+  pager->published_num_pages = pager->num_pages;
+  pager->num_versioned_pages = 0;
+  pager->undo_depth = 0;
+  pager->undo_log = NULL;
+  pager->undo_log_length = 0;
+  pager->undo_log_capacity = 0;
 
   return pager;
 }
@@ -118,12 +245,10 @@ Pager *pager_open(const char *filename) {
  * The function first checks if the specified page is in the pager's cache. If
  * it's not, the function prints an error message and exits.
  *
- * The function then seeks to the correct position in the file for the specified
- * page. If the seek operation fails, the function prints an error message and
- * exits.
- *
- * The function then writes the page from the pager's cache to the file.
- * If the write operation fails, the function prints an error message and exits.
+ * The function then writes the page from the pager's cache to its position in
+ * the file. If the write operation fails, the pager fails, see pager_fail.
+ * Otherwise the page is marked clean. Once the pager has failed, nothing is
+ * written and the page stays dirty.
  *
  * Does not return a value.
  */
@@ -132,25 +257,416 @@ void pager_flush(Pager *pager, uint32_t page_num) {
     printf("Tried to flush null page\n");
     exit(EXIT_FAILURE);
   }
+  if (pager->io_error != 0) {
+    return;
+  }
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+  profile_counters.pages_written++;
+  TRACE_PROBE1(page__flush, page_num);
+  profile_begin(PROFILE_PHASE_IO);
+  uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+  ssize_t bytes_written = pwrite(pager->file_descriptor, pager->pages[page_num],
+                                 PAGE_SIZE, (off_t)page_num * PAGE_SIZE);
+  profile_counters.io_wait_ns += profile_clock(CLOCK_MONOTONIC) - start_ns;
+  profile_end();
+  pager_count(&pager_thread_stats(pager)->bytes_written, PAGE_SIZE);
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
-    exit(EXIT_FAILURE);
+  if (bytes_written == -1) {
+    pager_fail(pager, "Error writing", errno);
+    return;
   }
 
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+  pager->dirty[page_num] = false;
+  if ((page_num + 1) * PAGE_SIZE > pager->file_length) {
+    __atomic_store_n(&pager->file_length, (page_num + 1) * PAGE_SIZE,
+                     __ATOMIC_RELEASE);
+  }
+}
 
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
-    exit(EXIT_FAILURE);
+/*
+ * Records that a page is about to be modified.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - page_num: The number of the page that will be written to.
+ *
+ * Must be called before the contents of a cached page are changed. The page
+ * is marked dirty so that it is written back at the next checkpoint, it is
+ * queued for the next commit to the write-ahead log, and it is stamped with a
+ * new value of the pager's write counter. Anything that
+ * copies pages, such as an online backup, compares these stamps to find the
+ * pages that changed since it last looked.
+ *
+ * The first time a page is touched by a write that has not been published
+ * yet, a copy of it is pushed onto the page's version chain. Snapshot readers
+ * read that copy instead of the page, which lets the writer carry on without
+ * waiting for them. Pages added since the last publish cannot be reached from
+ * any snapshot and are not copied.
+ *
+ * Inside a transaction, the page is also copied to the undo log the first
+ * time it changes at the current savepoint depth, so that a rollback can put
+ * it back.
+ *
+ * In copy-on-write mode only the dirty flag and the stamp apply: pages are
+ * only ever written there while neither the file on disk nor a snapshot
+ * still needs their old contents.
+ *
+ * Does not return a value.
+ */
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+  pager->dirty[page_num] = true;
+  pager->page_write_counters[page_num] = ++pager->write_counter;
+
+  if (pager->copy_on_write) {
+    return;
   }
+
+  if (!pager->wal_pending[page_num]) {
+    pager->wal_pending[page_num] = true;
+    pager->wal_pending_pages[pager->num_wal_pending++] = page_num;
+  }
+
+  if (pager->undo_depths[page_num] < pager->undo_depth) {
+    if (pager->undo_log_length == pager->undo_log_capacity) {
+      pager->undo_log_capacity = pager->undo_log_capacity * 2 + 16;
+      pager->undo_log = realloc(pager->undo_log, pager->undo_log_capacity *
+                                                     sizeof(UndoEntry));
+    }
+    UndoEntry *entry = &pager->undo_log[pager->undo_log_length++];
+    entry->page_num = page_num;
+    entry->depth = pager->undo_depth;
+    entry->image = malloc(PAGE_SIZE);
+    memcpy(entry->image, get_page(pager, page_num), PAGE_SIZE);
+    pager->undo_depths[page_num] = pager->undo_depth;
+  }
+
+  uint64_t version = pager->commit_version + 1;
+  uint64_t stamp = pager->page_version_stamps[page_num];
+  if (stamp == version || page_num >= pager->published_num_pages) {
+    return;
+  }
+
+  PageVersion *older = pager->page_versions[page_num];
+  PageVersion *entry = malloc(sizeof(PageVersion) + PAGE_SIZE);
+  entry->version = version;
+  entry->older_version = stamp;
+  entry->older = older;
+  memcpy(entry->image, get_page(pager, page_num), PAGE_SIZE);
+  if (older == NULL) {
+    pager->versioned_pages[pager->num_versioned_pages++] = page_num;
+  }
+
+  // Readers check the stamp before and after copying a page, so it must be
+  // visible before any change to the page is.
+  __atomic_store_n(&pager->page_versions[page_num], entry, __ATOMIC_RELEASE);
+  __atomic_store_n(&pager->page_version_stamps[page_num], version,
+                   __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
 /*
-Until we start recycling free pages, new pages will always
-go onto the end of the database file
+ * Publishes everything written since the previous publish as a new version.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * Snapshots opened from now on see the changes. Must be called by the writer
+ * once the pages it changed are consistent again.
+ *
+ * Returns the new version.
+ */
+uint64_t pager_publish(Pager *pager) {
+  pager->published_num_pages = pager->num_pages;
+  __atomic_store_n(&pager->commit_version, pager->commit_version + 1,
+                   __ATOMIC_RELEASE);
+  return pager->commit_version;
+}
+
+/*
+ * Copies a page as it was when a version was published.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - page_num: The number of the page to read.
+ * - version: The published version to read the page at.
+ * - destination: Where to copy the page to.
+ *
+ * Version chains are ordered newest first, and each entry holds the page as
+ * it was before the write that created it. So the image wanted is the oldest
+ * entry made by a write after the version. If there is none, the page has not
+ * changed since, and it is copied from the cache. The stamp of the page is
+ * checked again after that copy, and the copy is retried if a write started
+ * on the page meanwhile.
+ *
+ * Does not return a value.
+ */
+void pager_read_version(Pager *pager, uint32_t page_num, uint64_t version,
+                        void *destination) {
+  while (true) {
+    uint64_t stamp =
+        __atomic_load_n(&pager->page_version_stamps[page_num], __ATOMIC_ACQUIRE);
+    if (stamp > version) {
+      PageVersion *entry =
+          __atomic_load_n(&pager->page_versions[page_num], __ATOMIC_ACQUIRE);
+      while (entry->older_version > version) {
+        entry = entry->older;
+      }
+      memcpy(destination, entry->image, PAGE_SIZE);
+      return;
+    }
+
+    memcpy(destination, get_page(pager, page_num), PAGE_SIZE);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&pager->page_version_stamps[page_num],
+                        __ATOMIC_RELAXED) == stamp) {
+      return;
+    }
+  }
+}
+
+/*
+ * Frees the old page versions that no snapshot can read any more.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - oldest_version: The version of the oldest open snapshot, or the latest
+ * published version if there is none.
+ *
+ * A snapshot only reads entries made by writes after its own version, and
+ * never looks past them, so everything at or below oldest_version can go.
+ * Must be called by the writer.
+ *
+ * Does not return a value.
+ */
+void pager_reclaim_versions(Pager *pager, uint64_t oldest_version) {
+  uint32_t i = 0;
+  while (i < pager->num_versioned_pages) {
+    uint32_t page_num = pager->versioned_pages[i];
+    PageVersion *newer = NULL;
+    PageVersion *entry = pager->page_versions[page_num];
+    while (entry != NULL && entry->version > oldest_version) {
+      newer = entry;
+      entry = entry->older;
+    }
+
+    if (newer == NULL) {
+      __atomic_store_n(&pager->page_versions[page_num], NULL, __ATOMIC_RELEASE);
+    } else {
+      newer->older = NULL;
+    }
+    while (entry != NULL) {
+      PageVersion *older = entry->older;
+      free(entry);
+      entry = older;
+    }
+
+    if (newer == NULL) {
+      pager->versioned_pages[i] =
+          pager->versioned_pages[--pager->num_versioned_pages];
+    } else {
+      i++;
+    }
+  }
+}
+
+/*
+Returns the page just past the end of the database file. Pages
+freed by the B-tree are recycled through the table's freelist
+(see table_allocate_page) before this is used.
 */
-uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
\ No newline at end of file
+uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
+
+/*
+ * Shrinks the database to a number of pages.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - num_pages: The number of pages to keep.
+ *
+ * Cached pages past the new end are discarded without being written, and
+ * counted as evictions; the cache holds every page of the database, so
+ * nothing is evicted otherwise. The
+ * file itself keeps its length until the next checkpoint, since the pages
+ * past the new end still belong to the last commit until the shrink is
+ * committed too.
+ *
+ * Does not return a value.
+ */
+void pager_truncate(Pager *pager, uint32_t num_pages) {
+  for (uint32_t i = num_pages; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL) {
+      pager_count(&pager_thread_stats(pager)->cache_evictions, 1);
+    }
+    free(pager->pages[i]);
+    pager->pages[i] = NULL;
+    pager->dirty[i] = false;
+  }
+  pager->num_pages = num_pages;
+}
+
+/*
+ * Writes every dirty page to the database file and waits until the file is
+ * durable on disk.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * If either fails, so does the pager, see pager_fail; callers check with
+ * pager_failed before relying on the file.
+ *
+ * Does not return a value.
+ */
+void pager_sync(Pager *pager) {
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    if (pager->pages[i] != NULL && pager->dirty[i]) {
+      pager_flush(pager, i);
+    }
+  }
+
+  if (pager->io_error == 0 &&
+      pager_fsync(pager, pager->file_descriptor, false) == -1) {
+    pager_fail(pager, "Error syncing db file", errno);
+  }
+}
+
+/*
+ * Records that a read or write of the pager's files failed.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - action: What was being done, such as "Error writing", for the message.
+ * - error_number: The errno of the failure, or 0 if the call set none.
+ *
+ * Only the first failure is kept. From then on the pager writes nothing, so
+ * the file and its log stay as the last good commit left them for the next
+ * open to recover from, and the API turns every statement away, see
+ * pager_failed. May be called from any thread.
+ *
+ * Does not return a value.
+ */
+void pager_fail(Pager *pager, const char *action, int error_number) {
+  const char *expected = NULL;
+  if (__atomic_compare_exchange_n(&pager->io_error_action, &expected, action,
+                                  false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&pager->io_error, error_number != 0 ? error_number : EIO,
+                     __ATOMIC_RELEASE);
+  }
+}
+
+/*
+ * Checks whether a pager has failed, see pager_fail.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - error: Where to write the message for the failure, at most
+ * SQLITEDB_ERRMSG_SIZE bytes. Left alone if the pager has not failed.
+ *
+ * Returns true if the pager has failed.
+ */
+bool pager_failed(Pager *pager, char *error) {
+  int error_number = __atomic_load_n(&pager->io_error, __ATOMIC_ACQUIRE);
+  if (error_number == 0) {
+    return false;
+  }
+  snprintf(error, SQLITEDB_ERRMSG_SIZE, "%s: %d", pager->io_error_action,
+           error_number);
+  return true;
+}
+
+/*
+ * Waits until a file of the pager's is durable, and counts the wait.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - file_descriptor: The database file or its write-ahead log.
+ * - data_only: Whether fdatasync is enough, because the file's size and
+ * other metadata need not be durable.
+ *
+ * Returns the result of the fsync or fdatasync.
+ */
+int pager_fsync(Pager *pager, int file_descriptor, bool data_only) {
+  profile_begin(PROFILE_PHASE_IO);
+  uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+  int result = data_only ? fdatasync(file_descriptor) : fsync(file_descriptor);
+  profile_counters.io_wait_ns += profile_clock(CLOCK_MONOTONIC) - start_ns;
+  profile_end();
+  pager_count(&pager_thread_stats(pager)->fsyncs, 1);
+  return result;
+}
+
+/*
+ * Adds up the copies of a pager's counters.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - total: Set to the sum of the counters of every thread.
+ *
+ * The copies are read while other threads may still be counting into them,
+ * so the total is only as exact as a count taken at one instant can be.
+ *
+ * Returns the number of pages in the cache.
+ */
+uint32_t pager_stats(Pager *pager, PagerStats *total) {
+  memset(total, 0, sizeof(PagerStats));
+  for (uint32_t i = 0; i < PAGER_STATS_SHARDS; i++) {
+    PagerStats *stats = &pager->stats[i];
+    total->cache_hits += __atomic_load_n(&stats->cache_hits, __ATOMIC_RELAXED);
+    total->cache_misses +=
+        __atomic_load_n(&stats->cache_misses, __ATOMIC_RELAXED);
+    total->cache_evictions +=
+        __atomic_load_n(&stats->cache_evictions, __ATOMIC_RELAXED);
+    total->bytes_read += __atomic_load_n(&stats->bytes_read, __ATOMIC_RELAXED);
+    total->bytes_written +=
+        __atomic_load_n(&stats->bytes_written, __ATOMIC_RELAXED);
+    total->fsyncs += __atomic_load_n(&stats->fsyncs, __ATOMIC_RELAXED);
+    total->wal_commits += __atomic_load_n(&stats->wal_commits, __ATOMIC_RELAXED);
+    total->wal_frames += __atomic_load_n(&stats->wal_frames, __ATOMIC_RELAXED);
+    total->wal_checkpoints +=
+        __atomic_load_n(&stats->wal_checkpoints, __ATOMIC_RELAXED);
+    total->read_ns += __atomic_load_n(&stats->read_ns, __ATOMIC_RELAXED);
+    for (uint32_t j = 0; j < PAGER_LATENCY_BUCKETS; j++) {
+      total->read_latency[j] +=
+          __atomic_load_n(&stats->read_latency[j], __ATOMIC_RELAXED);
+    }
+  }
+
+  uint32_t num_cached = 0;
+  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+    if (__atomic_load_n(&pager->pages[i], __ATOMIC_RELAXED) != NULL) {
+      num_cached++;
+    }
+  }
+  return num_cached;
+}
+
+/*
+ * Closes a pager.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * The write-ahead log is checkpointed into the database file and removed,
+ * unless the database is in copy-on-write mode, where every commit is already
+ * in the file. Then the file is closed and all memory held by the pager, including the
+ * cached pages, is released. A failed pager keeps its log, see wal_close.
+ * An error closing the file itself is ignored: every commit is durable by
+ * then, in the file or in the log.
+ *
+ * Does not return a value.
+ */
+void pager_close(Pager *pager) {
+  if (!pager->copy_on_write) {
+    wal_close(pager);
+  }
+
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    free(pager->pages[i]);
+    pager->pages[i] = NULL;
+  }
+  pager_reclaim_versions(pager, UINT64_MAX);
+  free(pager->undo_log);
+
+  close(pager->file_descriptor);
+  free(pager->filename);
+  free(pager);
+}
@@ -4,8 +4,22 @@
 #include "constants.h"
 
 void *get_page(Pager *pager, uint32_t page_num);
-Pager *pager_open(const char *filename);
+Pager *pager_open(const char *filename, char *error);
 void pager_flush(Pager *pager, uint32_t page_num);
 uint32_t get_unused_page_num(Pager* pager);
+void pager_truncate(Pager *pager, uint32_t num_pages);
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+uint64_t pager_publish(Pager *pager);
+void pager_read_version(Pager *pager, uint32_t page_num, uint64_t version,
+                        void *destination);
+void pager_reclaim_versions(Pager *pager, uint64_t oldest_version);
+void pager_sync(Pager *pager);
+int pager_fsync(Pager *pager, int file_descriptor, bool data_only);
+PagerStats *pager_thread_stats(Pager *pager);
+void pager_count(uint64_t *counter, uint64_t amount);
+uint32_t pager_stats(Pager *pager, PagerStats *total);
+void pager_fail(Pager *pager, const char *action, int error_number);
+bool pager_failed(Pager *pager, char *error);
+void pager_close(Pager *pager);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,368 @@
+#include "plan.h"
+#include "node.h"
+#include "profile.h"
+#include "scan.h"
+#include "stats.h"
+
+typedef struct {
+  PlanAccess access;
+  uint64_t rows;
+  uint64_t pages;
+} PlanEstimate;
+
+/*
+ * Estimates the rows of a table that pass a select's filter.
+ *
+ * Parameters:
+ * - stats: The table's statistics.
+ * - query: What the select filters on.
+ *
+ * Ranges of ids are read off the histogram, and an id is unique. Equality on
+ * the other columns is estimated from their distinct counts, and a range on
+ * them is taken to pass a third of the rows, since there is no histogram of
+ * them.
+ *
+ * Returns the estimate.
+ */
+static uint64_t plan_estimate_rows(const TableStats *stats, ScanQuery *query) {
+  double fraction = 1;
+  switch (query->filter_column) {
+  case SCAN_COLUMN_NONE:
+    break;
+  case SCAN_COLUMN_ID:
+    if (query->filter_operator == '=') {
+      return stats->num_rows > 0 && query->filter_id >= stats->min_id &&
+             query->filter_id <= stats->max_id;
+    }
+    fraction = query->filter_operator == '<'
+                   ? table_stats_fraction_below(stats, query->filter_id)
+                   : 1 - table_stats_fraction_below(stats,
+                                                    query->filter_id + 1);
+    break;
+  case SCAN_COLUMN_USERNAME:
+  case SCAN_COLUMN_EMAIL: {
+    uint64_t num_distinct = query->filter_column == SCAN_COLUMN_USERNAME
+                                ? stats->distinct_usernames
+                                : stats->distinct_emails;
+    if (query->filter_operator != '=') {
+      fraction = 1.0 / 3;
+    } else if (num_distinct > 0) {
+      fraction = 1.0 / num_distinct;
+    }
+    break;
+  }
+  }
+  return (uint64_t)(fraction * stats->num_rows + 0.5);
+}
+
+/*
+ * Chooses how a select reads the table, by the estimated cost of each way
+ * that can answer it.
+ *
+ * Parameters:
+ * - stats: The table's statistics.
+ * - query: What the select filters on and computes.
+ * - estimate: Set to the chosen access path, the rows it is expected to
+ * produce, and the pages it is expected to read.
+ *
+ * An id equal to a key is a seek. A range of ids can be read by a cursor
+ * from the first key in the range to the last, on one thread, or by the
+ * parallel scan, which reads every page but shares them out among its
+ * workers. Costs are counted in uncached page reads on the longest-running
+ * thread, plus PLAN_WORKER_COST for every worker handed to the scan pool, and
+ * the range scan wins ties. It reads only the leaves holding the range, so a
+ * selective range never loses to the scan; the scan only wins a range that
+ * covers a large part of a big table. Filters on the other columns and aggregates of the
+ * whole table need every row, and take the parallel scan. Plain rows are
+ * read by a cursor in key order, one per step, so the first row is returned
+ * without reading the rest.
+ *
+ * Does not return a value.
+ */
+static void plan_choose(const TableStats *stats, ScanQuery *query,
+                        PlanEstimate *estimate) {
+  uint64_t rows_per_leaf = stats->num_leaves > 0
+                               ? stats->built_num_rows / stats->num_leaves
+                               : 0;
+  if (rows_per_leaf == 0) {
+    rows_per_leaf = LEAF_NODE_MAX_CELLS;
+  }
+  // The tree grows with the rows inserted since the statistics were built
+  uint64_t num_leaves =
+      stats->built_num_rows > 0
+          ? (stats->num_leaves * stats->num_rows + stats->built_num_rows - 1) /
+                stats->built_num_rows
+          : (stats->num_rows + rows_per_leaf - 1) / rows_per_leaf;
+  if (num_leaves == 0) {
+    num_leaves = 1;
+  }
+  uint64_t scan_pages = num_leaves + stats->num_internal_nodes;
+  uint64_t descent_pages = stats->height > 0 ? stats->height - 1 : 0;
+
+  estimate->rows = plan_estimate_rows(stats, query);
+  estimate->pages = scan_pages;
+  if (query->filter_column != SCAN_COLUMN_ID) {
+    estimate->access =
+        query->aggregate == SCAN_ROWS && query->filter_column == SCAN_COLUMN_NONE
+            ? PLAN_CURSOR_SCAN
+            : PLAN_PARALLEL_SCAN;
+    return;
+  }
+  if (query->filter_operator == '=') {
+    estimate->access = PLAN_SEEK;
+    estimate->pages = descent_pages + 1;
+    return;
+  }
+
+  uint64_t range_leaves = (estimate->rows + rows_per_leaf - 1) / rows_per_leaf;
+  if (range_leaves == 0) {
+    range_leaves = 1;
+  }
+  // A cursor finds each next leaf by descending from the root again, but the
+  // internal nodes it passes through stay cached, so only the first descent
+  // is costed
+  uint64_t range_pages = range_leaves * (descent_pages + 1);
+  uint64_t range_cost = descent_pages + range_leaves;
+  uint64_t num_workers = scan_max_workers();
+  if (num_workers > num_leaves) {
+    num_workers = num_leaves;
+  }
+  uint64_t scan_cost = (scan_pages + num_workers - 1) / num_workers +
+                       PLAN_WORKER_COST * (num_workers - 1);
+  if (range_cost <= scan_cost) {
+    estimate->access = PLAN_RANGE_SCAN;
+    estimate->pages = range_pages;
+  } else {
+    estimate->access = PLAN_PARALLEL_SCAN;
+  }
+}
+
+/*
+ * Chooses how a select reads the table, see plan_choose.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - query: What the select filters on and computes.
+ *
+ * Only a filter on the id leaves a choice to make, so only then are the
+ * table's statistics consulted, and built if there are none.
+ *
+ * Returns the access path.
+ */
+PlanAccess plan_access(Table *table, ScanQuery *query) {
+  TableStats stats;
+  if (query->filter_column == SCAN_COLUMN_ID) {
+    table_stats_get(table, &stats);
+  } else {
+    memset(&stats, 0, sizeof(TableStats));
+  }
+
+  PlanEstimate estimate;
+  plan_choose(&stats, query, &estimate);
+  return estimate.access;
+}
+
+/*
+ * Adds an operator to a plan.
+ *
+ * Parameters:
+ * - plan: A pointer to the Plan structure.
+ * - depth: How far below the top operator it is.
+ * - estimated_rows: The rows it is expected to produce.
+ * - estimated_pages: The pages it is expected to read, or 0 if it reads
+ * none.
+ * - format: The operator's description, as for printf.
+ *
+ * Returns the new operator.
+ */
+static PlanNode *plan_add(Plan *plan, uint32_t depth, uint64_t estimated_rows,
+                          uint64_t estimated_pages, const char *format, ...) {
+  PlanNode *node = &plan->nodes[plan->num_nodes++];
+  memset(node, 0, sizeof(PlanNode));
+  node->depth = depth;
+  node->estimated_rows = estimated_rows;
+  node->estimated_pages = estimated_pages;
+
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(node->detail, sizeof(node->detail), format, arguments);
+  va_end(arguments);
+  return node;
+}
+
+/*
+ * Describes what a parallel scan does in its workers rather than in the
+ * operators above it.
+ *
+ * Parameters:
+ * - query: What the select filters on and computes.
+ * - text: Set to the description, empty if nothing is pushed down.
+ * - size: The size of text.
+ *
+ * Does not return a value.
+ */
+static void plan_pushdown(ScanQuery *query, char *text, size_t size) {
+  static const char *column_names[] = {"", "id", "username", "email"};
+
+  if (query->filter_column == SCAN_COLUMN_ID) {
+    snprintf(text, size, ", filter id %c %u on keys", query->filter_operator,
+             query->filter_id);
+  } else if (query->filter_column != SCAN_COLUMN_NONE) {
+    snprintf(text, size, ", filter %s %c %s on rows",
+             column_names[query->filter_column], query->filter_operator,
+             query->filter_value);
+  } else if (query->aggregate == SCAN_COUNT) {
+    snprintf(text, size, ", counting cells");
+  } else if (query->aggregate == SCAN_SUM) {
+    snprintf(text, size, ", summing keys");
+  } else {
+    text[0] = '\0';
+  }
+}
+
+/*
+ * Works out the plan of a statement, for explain.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - statement: The statement, which is not run.
+ * - plan: Set to the statement's operators, top first.
+ *
+ * Selects are planned by plan_choose, with the same statistics they run
+ * with. Inserts and updates seek the key with table_find, and analyze reads
+ * every page. Statements that do not touch the table have a single operator
+ * that reads nothing.
+ *
+ * Does not return a value.
+ */
+void plan_explain(Table *table, Statement *statement, Plan *plan) {
+  static const char *aggregate_names[] = {"", "count(*)", "sum(id)"};
+
+  plan->num_nodes = 0;
+  plan->access_node = 0;
+  TableStats stats;
+  table_stats_get(table, &stats);
+  uint64_t num_pages = stats.num_leaves + stats.num_internal_nodes;
+
+  switch (statement->type) {
+  case STATEMENT_SELECT: {
+    ScanQuery *query = &statement->query;
+    PlanEstimate estimate;
+    plan_choose(&stats, query, &estimate);
+    plan->access = estimate.access;
+    uint32_t depth = 0;
+    if (query->aggregate != SCAN_ROWS) {
+      plan_add(plan, depth++, 1, 0, "AGGREGATE %s",
+               aggregate_names[query->aggregate]);
+    }
+    plan->access_node = plan->num_nodes;
+
+    switch (estimate.access) {
+    case PLAN_CURSOR_SCAN:
+      plan_add(plan, depth, estimate.rows, estimate.pages,
+               "SCAN table in key order");
+      break;
+    case PLAN_SEEK:
+      plan_add(plan, depth, estimate.rows, estimate.pages,
+               "SEEK table_find id = %u", query->filter_id);
+      break;
+    case PLAN_RANGE_SCAN:
+      plan_add(plan, depth, estimate.rows, estimate.pages,
+               "RANGE SCAN table id %c %u", query->filter_operator,
+               query->filter_id);
+      break;
+    case PLAN_PARALLEL_SCAN: {
+      char pushdown[PLAN_DETAIL_SIZE];
+      plan_pushdown(query, pushdown, sizeof(pushdown));
+      plan_add(plan, depth, estimate.rows, estimate.pages,
+               "PARALLEL SCAN table on up to %u %s%s", scan_max_workers(),
+               scan_max_workers() == 1 ? "worker" : "workers", pushdown);
+      break;
+    }
+    }
+    break;
+  }
+  case STATEMENT_INSERT:
+  case STATEMENT_UPDATE:
+    plan_add(plan, 0, 1, stats.height, "%s, SEEK table_find id = %u",
+             statement->type == STATEMENT_INSERT ? "INSERT" : "UPDATE",
+             statement->row_to_insert.id);
+    break;
+  case STATEMENT_ANALYZE:
+    plan_add(plan, 0, stats.num_rows, num_pages, "ANALYZE table");
+    break;
+  case STATEMENT_BEGIN:
+    plan_add(plan, 0, 0, 0, "BEGIN");
+    break;
+  case STATEMENT_COMMIT:
+    plan_add(plan, 0, 0, 0, "COMMIT");
+    break;
+  case STATEMENT_ROLLBACK:
+    plan_add(plan, 0, 0, 0, "ROLLBACK");
+    break;
+  case STATEMENT_SAVEPOINT:
+    plan_add(plan, 0, 0, 0, "SAVEPOINT %s", statement->savepoint_name);
+    break;
+  case STATEMENT_RELEASE:
+    plan_add(plan, 0, 0, 0, "RELEASE %s", statement->savepoint_name);
+    break;
+  case STATEMENT_ROLLBACK_TO:
+    plan_add(plan, 0, 0, 0, "ROLLBACK TO %s", statement->savepoint_name);
+    break;
+  }
+}
+
+/*
+ * Records what an operator actually did.
+ *
+ * Parameters:
+ * - node: The operator.
+ * - start: The calling thread's counters when the operator started.
+ * - start_ns: The monotonic clock when the operator started.
+ * - rows: The rows the operator produced.
+ *
+ * Does not return a value.
+ */
+void plan_measure(PlanNode *node, const ProfileCounters *start,
+                  uint64_t start_ns, uint64_t rows) {
+  node->analyzed = true;
+  node->rows = rows;
+  node->rows_examined = profile_counters.rows_examined - start->rows_examined;
+  node->pages = profile_counters.cache_hits + profile_counters.cache_misses -
+                start->cache_hits - start->cache_misses;
+  node->elapsed_ns = profile_clock(CLOCK_MONOTONIC) - start_ns;
+}
+
+/*
+ * Writes an operator as one line of explain's output, indented by its depth.
+ *
+ * Parameters:
+ * - node: The operator.
+ * - text: Set to the line.
+ * - size: The size of text.
+ *
+ * Does not return a value.
+ */
+void plan_format(PlanNode *node, char *text, size_t size) {
+  int length =
+      snprintf(text, size, "%*s%s", (int)node->depth * 2, "", node->detail);
+
+  if (node->estimated_pages == 0 && !node->analyzed) {
+    return;
+  }
+  length += snprintf(text + length, size - length, " (");
+  if (node->estimated_pages > 0) {
+    length += snprintf(text + length, size - length,
+                       "est. rows=%lu pages=%lu%s",
+                       (unsigned long)node->estimated_rows,
+                       (unsigned long)node->estimated_pages,
+                       node->analyzed ? "; " : "");
+  }
+  if (node->analyzed) {
+    length += snprintf(text + length, size - length,
+             "actual rows=%lu examined=%lu pages=%lu time=%.3f ms",
+             (unsigned long)node->rows, (unsigned long)node->rows_examined,
+             (unsigned long)node->pages, node->elapsed_ns / 1e6);
+  }
+  snprintf(text + length, size - length, ")");
+}
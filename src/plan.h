@@ -0,0 +1,16 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include "constants.h"
+
+// Handing a scan worker to a pool thread, and merging what it found, costs
+// about as much as reading this many pages
+#define PLAN_WORKER_COST 2
+
+PlanAccess plan_access(Table *table, ScanQuery *query);
+void plan_explain(Table *table, Statement *statement, Plan *plan);
+void plan_measure(PlanNode *node, const ProfileCounters *start,
+                  uint64_t start_ns, uint64_t rows);
+void plan_format(PlanNode *node, char *text, size_t size);
+
+#endif
@@ -0,0 +1,187 @@
+#include "profile.h"
+
+typedef struct {
+  ProfilePhase phase;
+  uint64_t start_ns;
+  uint64_t nested_ns;
+} ProfileFrame;
+
+// Each thread counts its own work, so counting never contends
+__thread ProfileCounters profile_counters;
+static __thread ProfileFrame profile_frames[PROFILE_MAX_DEPTH];
+static __thread uint32_t profile_depth;
+static __thread uint32_t profile_overflow;
+static bool profile_enabled;
+
+/*
+ * Reads a clock.
+ *
+ * Parameters:
+ * - clock: The clock to read, such as CLOCK_MONOTONIC for wall time or
+ * CLOCK_PROCESS_CPUTIME_ID for the CPU time of every thread in the process.
+ *
+ * Returns the time in nanoseconds.
+ */
+uint64_t profile_clock(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Turns timing of phases on or off for every thread.
+ *
+ * Parameters:
+ * - enabled: Whether profile_begin and profile_end read the clock.
+ *
+ * The page counters are always kept; they cost an increment of a thread-local
+ * counter. Timing phases costs two reads of the clock per phase, so it is off
+ * unless asked for. Must only change between statements, while no phase is
+ * open.
+ *
+ * Does not return a value.
+ */
+void profile_set_enabled(bool enabled) {
+  __atomic_store_n(&profile_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns true if phases are being timed.
+ */
+bool profile_is_enabled(void) {
+  return __atomic_load_n(&profile_enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Zeroes the calling thread's counters, at the start of a statement.
+ *
+ * Does not return a value.
+ */
+void profile_reset(void) {
+  memset(&profile_counters, 0, sizeof(profile_counters));
+  profile_depth = 0;
+  profile_overflow = 0;
+}
+
+/*
+ * Starts timing a phase on the calling thread.
+ *
+ * Parameters:
+ * - phase: The phase being entered.
+ *
+ * Phases nest: a page read during a descent is counted as page I/O and not as
+ * descent, so the phases of a statement add up to no more than its time on
+ * each thread. Every call must be matched by a call to profile_end.
+ *
+ * Does not return a value.
+ */
+void profile_begin(ProfilePhase phase) {
+  if (!profile_is_enabled()) {
+    return;
+  }
+  if (profile_depth == PROFILE_MAX_DEPTH) {
+    profile_overflow++;
+    return;
+  }
+
+  ProfileFrame *frame = &profile_frames[profile_depth++];
+  frame->phase = phase;
+  frame->nested_ns = 0;
+  frame->start_ns = profile_clock(CLOCK_MONOTONIC);
+}
+
+/*
+ * Stops timing the phase most recently begun on the calling thread.
+ *
+ * The time since it began, less the time in the phases nested inside it, is
+ * added to the phase, and the whole of it to the phase it is nested in.
+ *
+ * Does not return a value.
+ */
+void profile_end(void) {
+  if (!profile_is_enabled()) {
+    return;
+  }
+  if (profile_overflow > 0) {
+    profile_overflow--;
+    return;
+  }
+  if (profile_depth == 0) {
+    return;
+  }
+
+  uint64_t end_ns = profile_clock(CLOCK_MONOTONIC);
+  ProfileFrame *frame = &profile_frames[--profile_depth];
+  uint64_t elapsed_ns = end_ns - frame->start_ns;
+  profile_counters.phase_ns[frame->phase] += elapsed_ns - frame->nested_ns;
+  if (profile_depth > 0) {
+    profile_frames[profile_depth - 1].nested_ns += elapsed_ns;
+  }
+}
+
+/*
+ * Subtracts one set of counters from another.
+ *
+ * Parameters:
+ * - total: The counters to subtract from.
+ * - counters: The counters to subtract, such as those a statement started
+ * with, leaving what the statement did.
+ *
+ * Does not return a value.
+ */
+void profile_subtract(ProfileCounters *total, const ProfileCounters *counters) {
+  total->pages_read -= counters->pages_read;
+  total->pages_written -= counters->pages_written;
+  total->cache_hits -= counters->cache_hits;
+  total->cache_misses -= counters->cache_misses;
+  total->io_wait_ns -= counters->io_wait_ns;
+  total->rows_examined -= counters->rows_examined;
+  for (uint32_t i = 0; i < PROFILE_NUM_PHASES; i++) {
+    total->phase_ns[i] -= counters->phase_ns[i];
+  }
+}
+
+/*
+ * Adds one set of counters to another.
+ *
+ * Parameters:
+ * - total: The counters to add to.
+ * - counters: The counters to add, such as those a scan worker thread kept
+ * before it exited.
+ *
+ * Does not return a value.
+ */
+void profile_add(ProfileCounters *total, const ProfileCounters *counters) {
+  total->pages_read += counters->pages_read;
+  total->pages_written += counters->pages_written;
+  total->cache_hits += counters->cache_hits;
+  total->cache_misses += counters->cache_misses;
+  total->io_wait_ns += counters->io_wait_ns;
+  total->rows_examined += counters->rows_examined;
+  for (uint32_t i = 0; i < PROFILE_NUM_PHASES; i++) {
+    total->phase_ns[i] += counters->phase_ns[i];
+  }
+}
+
+/*
+ * Picks the bucket of a latency histogram that a duration falls in.
+ *
+ * Parameters:
+ * - elapsed_ns: The duration in nanoseconds.
+ * - num_buckets: The number of buckets in the histogram.
+ *
+ * Bucket 0 holds durations under a microsecond, and bucket i those under 2^i
+ * microseconds and at least 2^(i-1). The last bucket also holds everything
+ * longer.
+ *
+ * Returns the index of the bucket.
+ */
+uint32_t profile_latency_bucket(uint64_t elapsed_ns, uint32_t num_buckets) {
+  uint64_t elapsed_us = elapsed_ns / 1000;
+  uint32_t bucket = 0;
+  while (elapsed_us > 0 && bucket < num_buckets - 1) {
+    elapsed_us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
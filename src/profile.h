@@ -0,0 +1,22 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "constants.h"
+
+// Deepest nesting of phases that is timed; deeper phases are counted in
+// their parent
+#define PROFILE_MAX_DEPTH 8
+
+extern __thread ProfileCounters profile_counters;
+
+uint64_t profile_clock(clockid_t clock);
+void profile_set_enabled(bool enabled);
+bool profile_is_enabled(void);
+void profile_reset(void);
+void profile_begin(ProfilePhase phase);
+void profile_end(void);
+void profile_add(ProfileCounters *total, const ProfileCounters *counters);
+void profile_subtract(ProfileCounters *total, const ProfileCounters *counters);
+uint32_t profile_latency_bucket(uint64_t elapsed_ns, uint32_t num_buckets);
+
+#endif
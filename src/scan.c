@@ -0,0 +1,525 @@
+#include "scan.h"
+#include "btree.h"
+#include "node.h"
+#include "pager.h"
+#include "profile.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "table.h"
+
+typedef struct {
+  uint32_t page_num;
+  Row *rows;
+  uint32_t num_rows;
+  uint32_t capacity;
+} ScanMorsel;
+
+typedef struct Scan Scan;
+
+typedef struct {
+  Scan *scan;
+  // The morsels still to run, as next << 32 | end
+  uint64_t range;
+  uint64_t count;
+  uint64_t sum;
+  void *images[TABLE_MAX_HEIGHT];
+  // What a worker on its own thread counted, for the calling thread
+  ProfileCounters counters;
+} ScanWorker;
+
+struct Scan {
+  Table *table;
+  Snapshot *snapshot;
+  ScanQuery *query;
+  ScanMorsel *morsels;
+  uint32_t num_morsels;
+  ScanWorker workers[SCAN_MAX_WORKERS];
+  uint32_t num_workers;
+  // The next worker for a pool thread to run, and how many pool threads are
+  // running one, both guarded by the pool's lock
+  uint32_t next_worker;
+  uint32_t num_running;
+  Scan *next;
+};
+
+// Threads that run the workers of every scan in the process, after the first
+// worker, which runs on the thread that started the scan. They are started
+// by the first parallel scan and live as long as the process.
+typedef struct {
+  pthread_once_t once;
+  pthread_mutex_t lock;
+  // Signalled when a scan is posted, and when a pool thread leaves one
+  pthread_cond_t posted;
+  pthread_cond_t left;
+  // The scans that still have workers for the pool to run, newest first
+  Scan *scans;
+} ScanPool;
+
+static ScanPool scan_pool = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .posted = PTHREAD_COND_INITIALIZER,
+    .left = PTHREAD_COND_INITIALIZER,
+    .scans = NULL,
+};
+
+/*
+ * Copies a page out as the scan sees it.
+ *
+ * Parameters:
+ * - scan: A pointer to the Scan structure.
+ * - page_num: The page to read.
+ * - destination: Where to copy it.
+ *
+ * Outside a transaction the page is read at the scan's snapshot. Inside one,
+ * the thread that owns the transaction is waiting for the scan and holds the
+ * writer lock, so the cached pages cannot change underneath the workers.
+ *
+ * Does not return a value.
+ */
+static void scan_read_page(Scan *scan, uint32_t page_num, void *destination) {
+  Pager *pager = scan->table->pager;
+  if (scan->snapshot != NULL) {
+    pager_read_version(pager, page_num, scan->snapshot->version, destination);
+  } else {
+    memcpy(destination, get_page(pager, page_num), PAGE_SIZE);
+  }
+}
+
+/*
+ * Returns true if a row passes the query's filter.
+ *
+ * Parameters:
+ * - query: A pointer to the ScanQuery structure.
+ * - node: The leaf holding the row.
+ * - cell_num: The cell of the row.
+ *
+ * Filtering on the id reads the key alone; the row is only deserialized for
+ * the other columns.
+ */
+static bool scan_matches(ScanQuery *query, void *node, uint32_t cell_num) {
+  int comparison;
+  if (query->filter_column == SCAN_COLUMN_ID) {
+    uint32_t key = *leaf_node_key(node, cell_num);
+    comparison = key < query->filter_id ? -1 : key > query->filter_id;
+  } else {
+    Row row;
+    deserialize_row(leaf_node_value(node, cell_num), &row);
+    char *value = query->filter_column == SCAN_COLUMN_USERNAME ? row.username
+                                                                : row.email;
+    comparison = strcmp(value, query->filter_value);
+  }
+
+  switch (query->filter_operator) {
+  case '<':
+    return comparison < 0;
+  case '>':
+    return comparison > 0;
+  default:
+    return comparison == 0;
+  }
+}
+
+/*
+ * Adds the rows of a leaf to a worker's aggregate, or to its morsel's rows.
+ *
+ * Parameters:
+ * - worker: A pointer to the ScanWorker structure.
+ * - morsel: The morsel the leaf belongs to.
+ * - node: The leaf.
+ *
+ * Does not return a value.
+ */
+static void scan_leaf(ScanWorker *worker, ScanMorsel *morsel, void *node) {
+  ScanQuery *query = worker->scan->query;
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  profile_counters.rows_examined += num_cells;
+
+  if (query->aggregate == SCAN_COUNT &&
+      query->filter_column == SCAN_COLUMN_NONE) {
+    worker->count += num_cells;
+    return;
+  }
+
+  for (uint32_t i = 0; i < num_cells; i++) {
+    if (query->filter_column != SCAN_COLUMN_NONE &&
+        !scan_matches(query, node, i)) {
+      continue;
+    }
+    worker->count++;
+
+    if (query->aggregate == SCAN_SUM) {
+      worker->sum += *leaf_node_key(node, i);
+    } else if (query->aggregate == SCAN_ROWS) {
+      if (morsel->num_rows == morsel->capacity) {
+        morsel->capacity = morsel->capacity * 2 + 16;
+        morsel->rows = realloc(morsel->rows, morsel->capacity * sizeof(Row));
+      }
+      deserialize_row(leaf_node_value(node, i),
+                      &morsel->rows[morsel->num_rows++]);
+    }
+  }
+}
+
+/*
+ * Scans a subtree in key order.
+ *
+ * Parameters:
+ * - worker: A pointer to the ScanWorker structure.
+ * - morsel: The morsel the subtree belongs to.
+ * - page_num: The root of the subtree.
+ * - depth: The depth of the subtree's root below the morsel, which picks the
+ * worker's image to read it into.
+ *
+ * Does not return a value.
+ */
+static void scan_node(ScanWorker *worker, ScanMorsel *morsel,
+                      uint32_t page_num, uint32_t depth) {
+  void *node = worker->images[depth];
+  scan_read_page(worker->scan, page_num, node);
+
+  if (get_node_type(node) == NODE_LEAF) {
+    scan_leaf(worker, morsel, node);
+    return;
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    scan_node(worker, morsel, *internal_node_child(node, i), depth + 1);
+  }
+  scan_node(worker, morsel, *internal_node_right_child(node), depth + 1);
+}
+
+/*
+ * Takes the next morsel from a worker's own range.
+ *
+ * Returns the index of the morsel, or -1 if the range is used up.
+ */
+static int64_t scan_take(ScanWorker *worker) {
+  uint64_t range = __atomic_load_n(&worker->range, __ATOMIC_ACQUIRE);
+  while (true) {
+    uint32_t next = range >> 32;
+    uint32_t end = (uint32_t)range;
+    if (next >= end) {
+      return -1;
+    }
+    uint64_t taken = ((uint64_t)(next + 1) << 32) | end;
+    if (__atomic_compare_exchange_n(&worker->range, &range, taken, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return next;
+    }
+  }
+}
+
+/*
+ * Steals the back half of another worker's remaining range.
+ *
+ * Parameters:
+ * - worker: The worker that ran out of morsels.
+ *
+ * The victim keeps taking from the front of its range while the thief takes
+ * from the back, and both only ever change the range with a compare-and-swap,
+ * so each morsel is handed out exactly once. The first stolen morsel is
+ * returned and the rest become the thief's own range, which other thieves may
+ * in turn steal from.
+ *
+ * Returns the index of a morsel, or -1 if every range is used up.
+ */
+static int64_t scan_steal(ScanWorker *worker) {
+  Scan *scan = worker->scan;
+  uint32_t self = worker - scan->workers;
+
+  for (uint32_t i = 1; i < scan->num_workers; i++) {
+    ScanWorker *victim = &scan->workers[(self + i) % scan->num_workers];
+    uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+    while (true) {
+      uint32_t next = range >> 32;
+      uint32_t end = (uint32_t)range;
+      if (next >= end) {
+        break;
+      }
+      uint32_t middle = next + (end - next) / 2;
+      uint64_t kept = ((uint64_t)next << 32) | middle;
+      if (__atomic_compare_exchange_n(&victim->range, &range, kept, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&worker->range,
+                         ((uint64_t)(middle + 1) << 32) | end,
+                         __ATOMIC_RELEASE);
+        return middle;
+      }
+    }
+  }
+  return -1;
+}
+
+/*
+ * Runs morsels until there are none left to take or steal.
+ */
+static void *scan_worker_main(void *argument) {
+  ScanWorker *worker = argument;
+  Scan *scan = worker->scan;
+
+  while (true) {
+    int64_t index = scan_take(worker);
+    if (index == -1) {
+      index = scan_steal(worker);
+    }
+    if (index == -1) {
+      break;
+    }
+    ScanMorsel *morsel = &scan->morsels[index];
+    scan_node(worker, morsel, morsel->page_num, 0);
+  }
+
+  return NULL;
+}
+
+/*
+ * Takes a scan off the pool's list, if it is still on it. The caller holds
+ * the pool's lock.
+ */
+static void scan_pool_unlink(Scan *scan) {
+  for (Scan **link = &scan_pool.scans; *link != NULL; link = &(*link)->next) {
+    if (*link == scan) {
+      *link = scan->next;
+      return;
+    }
+  }
+}
+
+/*
+ * Runs the workers of posted scans, one at a time, for as long as the
+ * process lives. Each worker starts from zeroed counters, and what it counted
+ * is kept for the thread that started the scan.
+ */
+static void *scan_pool_main(void *argument) {
+  (void)argument;
+  pthread_mutex_lock(&scan_pool.lock);
+  while (true) {
+    Scan *scan = scan_pool.scans;
+    if (scan == NULL) {
+      pthread_cond_wait(&scan_pool.posted, &scan_pool.lock);
+      continue;
+    }
+    ScanWorker *worker = &scan->workers[scan->next_worker++];
+    if (scan->next_worker == scan->num_workers) {
+      scan_pool_unlink(scan);
+    }
+    scan->num_running++;
+    pthread_mutex_unlock(&scan_pool.lock);
+
+    profile_reset();
+    scan_worker_main(worker);
+    worker->counters = profile_counters;
+
+    pthread_mutex_lock(&scan_pool.lock);
+    scan->num_running--;
+    pthread_cond_broadcast(&scan_pool.left);
+  }
+  return NULL;
+}
+
+/*
+ * Starts one pool thread for every worker a scan can have beyond the first.
+ */
+static void scan_pool_start(void) {
+  uint32_t num_threads = scan_max_workers() - 1;
+  for (uint32_t i = 0; i < num_threads; i++) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, scan_pool_main, NULL);
+    pthread_detach(thread);
+  }
+}
+
+/*
+ * Hands a scan's workers, after the first, to the pool.
+ */
+static void scan_pool_post(Scan *scan) {
+  pthread_once(&scan_pool.once, scan_pool_start);
+  pthread_mutex_lock(&scan_pool.lock);
+  scan->next_worker = 1;
+  scan->next = scan_pool.scans;
+  scan_pool.scans = scan;
+  pthread_cond_broadcast(&scan_pool.posted);
+  pthread_mutex_unlock(&scan_pool.lock);
+}
+
+/*
+ * Waits until no pool thread is running a worker of a scan. Workers the pool
+ * has not picked up by then are never run, which loses nothing: their
+ * morsels have been stolen by the workers that did run.
+ */
+static void scan_pool_wait(Scan *scan) {
+  pthread_mutex_lock(&scan_pool.lock);
+  scan_pool_unlink(scan);
+  while (scan->num_running > 0) {
+    pthread_cond_wait(&scan_pool.left, &scan_pool.lock);
+  }
+  pthread_mutex_unlock(&scan_pool.lock);
+}
+
+/*
+ * Splits the tree into morsels at internal node separators.
+ *
+ * Parameters:
+ * - scan: A pointer to the Scan structure.
+ * - root_page_num: The root as the scan sees it.
+ * - target: The number of morsels to aim for.
+ *
+ * Starting from the root, each level of the tree replaces the one above it
+ * until there are at least target subtrees or the level is made of leaves.
+ * The morsels are the subtrees of that level, in key order. Only the internal
+ * nodes above them are read here; the workers read everything below.
+ *
+ * Does not return a value.
+ */
+static void scan_partition(Scan *scan, uint32_t root_page_num,
+                           uint32_t target) {
+  uint32_t *level = malloc(sizeof(uint32_t));
+  uint32_t level_size = 1;
+  level[0] = root_page_num;
+  void *node = malloc(PAGE_SIZE);
+
+  while (level_size < target) {
+    scan_read_page(scan, level[0], node);
+    if (get_node_type(node) == NODE_LEAF) {
+      break;
+    }
+
+    uint32_t *children = NULL;
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i < level_size; i++) {
+      scan_read_page(scan, level[i], node);
+      uint32_t num_keys = *internal_node_num_keys(node);
+      children =
+          realloc(children, (num_children + num_keys + 1) * sizeof(uint32_t));
+      for (uint32_t j = 0; j < num_keys; j++) {
+        children[num_children++] = *internal_node_child(node, j);
+      }
+      children[num_children++] = *internal_node_right_child(node);
+    }
+    free(level);
+    level = children;
+    level_size = num_children;
+  }
+  free(node);
+
+  scan->morsels = calloc(level_size, sizeof(ScanMorsel));
+  scan->num_morsels = level_size;
+  for (uint32_t i = 0; i < level_size; i++) {
+    scan->morsels[i].page_num = level[i];
+  }
+  free(level);
+}
+
+/*
+ * Returns the number of workers a scan of a large table runs on: one per
+ * online CPU, up to SCAN_MAX_WORKERS.
+ */
+uint32_t scan_max_workers(void) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t num_workers = num_cpus > 0 ? num_cpus : 1;
+  return num_workers < SCAN_MAX_WORKERS ? num_workers : SCAN_MAX_WORKERS;
+}
+
+/*
+ * Runs a filtered or aggregate scan of the whole table on several threads.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - query: What to filter on and what to compute.
+ * - result: Set to the number of matching rows, the sum of their ids for
+ * SCAN_SUM, and the rows themselves in key order for SCAN_ROWS. The caller
+ * frees result->rows.
+ *
+ * The tree is cut into morsels (see scan_partition), which are dealt out in
+ * even contiguous ranges, one per worker. A worker that finishes its range
+ * steals half of what another has left (see scan_steal), so a worker held up
+ * by a dense or cold part of the tree does not hold up the scan. Each worker
+ * keeps its own count and sum and each morsel its own rows, so the workers
+ * share nothing but the ranges until they are merged at the end. The calling
+ * thread runs the first worker, and small tables are scanned on it alone.
+ * The others run on the long-lived threads of the scan pool, so a scan only
+ * wakes threads rather than creating them. When the pool is busy with other
+ * scans, the workers that do run steal the ranges of those that do not.
+ * What the other workers counted is added to the calling thread's counters.
+ *
+ * Outside a transaction the scan reads one snapshot, so it sees a single
+ * version of the table however the writer changes it meanwhile. Inside one,
+ * it sees the transaction's own changes.
+ *
+ * Does not return a value.
+ */
+void scan_run(Table *table, ScanQuery *query, ScanResult *result) {
+  Scan *scan = calloc(1, sizeof(Scan));
+  scan->table = table;
+  scan->query = query;
+
+  uint32_t root_page_num = table->root_page_num;
+  if (!table_in_transaction(table)) {
+    scan->snapshot = snapshot_open(table);
+    root_page_num = scan->snapshot->root_page_num;
+  }
+
+  uint32_t num_workers = scan_max_workers();
+  scan_partition(scan, root_page_num, num_workers * SCAN_MORSELS_PER_WORKER);
+  if (num_workers > scan->num_morsels) {
+    num_workers = scan->num_morsels;
+  }
+  scan->num_workers = num_workers;
+
+  for (uint32_t i = 0; i < num_workers; i++) {
+    ScanWorker *worker = &scan->workers[i];
+    worker->scan = scan;
+    uint64_t start = (uint64_t)scan->num_morsels * i / num_workers;
+    uint64_t end = (uint64_t)scan->num_morsels * (i + 1) / num_workers;
+    worker->range = (start << 32) | end;
+    for (uint32_t j = 0; j < TABLE_MAX_HEIGHT; j++) {
+      worker->images[j] = malloc(PAGE_SIZE);
+    }
+  }
+  if (num_workers > 1) {
+    scan_pool_post(scan);
+  }
+  scan_worker_main(&scan->workers[0]);
+  if (num_workers > 1) {
+    scan_pool_wait(scan);
+  }
+
+  result->count = 0;
+  result->sum = 0;
+  for (uint32_t i = 0; i < num_workers; i++) {
+    ScanWorker *worker = &scan->workers[i];
+    if (i > 0) {
+      profile_add(&profile_counters, &worker->counters);
+    }
+    result->count += worker->count;
+    result->sum += worker->sum;
+    for (uint32_t j = 0; j < TABLE_MAX_HEIGHT; j++) {
+      free(worker->images[j]);
+    }
+  }
+
+  result->rows = NULL;
+  if (query->aggregate == SCAN_ROWS) {
+    result->rows = malloc(result->count * sizeof(Row));
+    uint64_t num_rows = 0;
+    for (uint32_t i = 0; i < scan->num_morsels; i++) {
+      ScanMorsel *morsel = &scan->morsels[i];
+      if (morsel->num_rows > 0) {
+        memcpy(result->rows + num_rows, morsel->rows,
+               morsel->num_rows * sizeof(Row));
+        num_rows += morsel->num_rows;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < scan->num_morsels; i++) {
+    free(scan->morsels[i].rows);
+  }
+  free(scan->morsels);
+
+  if (scan->snapshot != NULL) {
+    snapshot_close(scan->snapshot);
+  }
+  free(scan);
+}
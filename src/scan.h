@@ -0,0 +1,12 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "constants.h"
+
+#define SCAN_MAX_WORKERS 64
+#define SCAN_MORSELS_PER_WORKER 8
+
+uint32_t scan_max_workers(void);
+void scan_run(Table *table, ScanQuery *query, ScanResult *result);
+
+#endif
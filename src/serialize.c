@@ -1,4 +1,5 @@
 #include "serialize.h"
+#include "profile.h"
 
 /*
  * Serializes a row into a block of memory.
@@ -16,9 +17,11 @@
  * Does not return a value.
  */
 void serialize_row(Row *source, void *destination) {
+  profile_begin(PROFILE_PHASE_SERIALIZE);
   memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
   strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
   strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+  profile_end();
 }
 
 /*
@@ -38,7 +41,9 @@ void serialize_row(Row *source, void *destination) {
  * Does not return a value.
  */
 void deserialize_row(void *source, Row *destination) {
+  profile_begin(PROFILE_PHASE_SERIALIZE);
   memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
   memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
   memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+  profile_end();
 }
\ No newline at end of file
@@ -0,0 +1,836 @@
+#include "server.h"
+#include "cursor.h"
+#include "metrics.h"
+#include "profile.h"
+#include "serialize.h"
+#include "slowlog.h"
+#include "snapshot.h"
+#include "table.h"
+
+/*
+ * Opens the socket the server listens on.
+ *
+ * Parameters:
+ * - address: A path for a Unix domain socket if it contains a '/', otherwise
+ * a TCP port on the loopback interface.
+ * - socket_path: Set to a copy of the path of a Unix domain socket, to remove
+ * when the server stops, or to NULL.
+ * - error: Where to write why the socket could not be opened, at most
+ * SQLITEDB_ERRMSG_SIZE bytes.
+ *
+ * Returns the listening socket, which does not block, or -1.
+ */
+static int server_listen(const char *address, char **socket_path,
+                         char *error) {
+  int fd;
+  int result;
+
+  *socket_path = NULL;
+  if (strchr(address, '/') != NULL) {
+    struct sockaddr_un unix_address = {0};
+    if (strlen(address) >= sizeof(unix_address.sun_path)) {
+      snprintf(error, SQLITEDB_ERRMSG_SIZE, "Socket path is too long.");
+      return -1;
+    }
+    unix_address.sun_family = AF_UNIX;
+    strcpy(unix_address.sun_path, address);
+    unlink(address);
+    *socket_path = strdup(address);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    result = bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address));
+  } else {
+    int port = atoi(address);
+    if (port < 1 || port > 65535) {
+      snprintf(error, SQLITEDB_ERRMSG_SIZE,
+               "Port must be between 1 and 65535.");
+      return -1;
+    }
+    struct sockaddr_in inet_address = {0};
+    inet_address.sin_family = AF_INET;
+    inet_address.sin_port = htons(port);
+    inet_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    result = bind(fd, (struct sockaddr *)&inet_address, sizeof(inet_address));
+  }
+
+  if (fd == -1 || result == -1 || listen(fd, SERVER_BACKLOG) == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Unable to listen on %s: %d",
+             address, errno);
+    if (fd != -1) {
+      close(fd);
+    }
+    free(*socket_path);
+    *socket_path = NULL;
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Appends bytes to a connection's pending response.
+ *
+ * Does not return a value.
+ */
+static void server_append(Connection *connection, const void *data,
+                          uint32_t length) {
+  if (connection->output_length + length > connection->output_capacity) {
+    while (connection->output_length + length > connection->output_capacity) {
+      connection->output_capacity = connection->output_capacity * 2 + 256;
+    }
+    connection->output =
+        realloc(connection->output, connection->output_capacity);
+  }
+  memcpy(connection->output + connection->output_length, data, length);
+  connection->output_length += length;
+}
+
+/*
+ * Appends an integer in network byte order.
+ *
+ * Does not return a value.
+ */
+static void server_append_u32(Connection *connection, uint32_t value) {
+  uint32_t encoded = htonl(value);
+  server_append(connection, &encoded, sizeof(encoded));
+}
+
+/*
+ * Appends a row as its id, then each string as a length byte followed by the
+ * characters.
+ *
+ * Does not return a value.
+ */
+static void server_append_row(Connection *connection, Row *row) {
+  server_append_u32(connection, row->id);
+
+  uint8_t length = strlen(row->username);
+  server_append(connection, &length, 1);
+  server_append(connection, row->username, length);
+
+  length = strlen(row->email);
+  server_append(connection, &length, 1);
+  server_append(connection, row->email, length);
+}
+
+/*
+ * Decodes the row of an insert request.
+ *
+ * Parameters:
+ * - body: The request after its op code.
+ * - length: The length of the request after its op code.
+ * - row: Where to store the row.
+ *
+ * Returns true if the request is a well-formed row and nothing else.
+ */
+static bool server_parse_row(uint8_t *body, uint32_t length, Row *row) {
+  if (length < sizeof(uint32_t) + 1) {
+    return false;
+  }
+  uint32_t id;
+  memcpy(&id, body, sizeof(id));
+  row->id = ntohl(id);
+  uint32_t offset = sizeof(id);
+
+  uint32_t username_length = body[offset++];
+  if (username_length > COLUMN_USERNAME_SIZE ||
+      offset + username_length + 1 > length) {
+    return false;
+  }
+  memcpy(row->username, body + offset, username_length);
+  row->username[username_length] = '\0';
+  offset += username_length;
+
+  uint32_t email_length = body[offset++];
+  if (email_length > COLUMN_EMAIL_SIZE ||
+      offset + email_length != length) {
+    return false;
+  }
+  memcpy(row->email, body + offset, email_length);
+  row->email[email_length] = '\0';
+
+  return true;
+}
+
+/*
+ * Returns the length of the first request buffered on a connection, counting
+ * its header, or 0 if it has not fully arrived yet.
+ */
+static uint32_t server_request_length(Connection *connection) {
+  if (connection->input_length < SERVER_FRAME_HEADER_SIZE) {
+    return 0;
+  }
+  uint32_t length;
+  memcpy(&length, connection->input, sizeof(length));
+  length = SERVER_FRAME_HEADER_SIZE + ntohl(length);
+  return connection->input_length >= length ? length : 0;
+}
+
+/*
+ * Executes the first request buffered on a connection and builds its
+ * response.
+ *
+ * Parameters:
+ * - server: A pointer to the Server structure.
+ * - connection: The connection, which the calling worker has to itself.
+ * - text: Set to the statement the request stands for, for the slow log, or
+ * NULL. Must hold SERVER_REQUEST_TEXT_SIZE bytes.
+ * - num_rows: Set to the number of rows in the response.
+ *
+ * Every request and response is a frame: its length as a 32-bit integer in
+ * network byte order, then that many bytes. A request starts with an op code,
+ * a response with a status:
+ * - SERVER_OP_INSERT, followed by a row, answers with just a status.
+ * - SERVER_OP_GET, followed by a 32-bit id, answers with the row if found.
+ * - SERVER_OP_SELECT answers with a 32-bit row count, then the rows, as of a
+ * snapshot taken when the request runs.
+ * Rows are encoded as by server_append_row.
+ *
+ * Returns the op code of the request, or 0 if it was malformed.
+ */
+static uint8_t server_execute(Server *server, Connection *connection,
+                              char *text, uint64_t *num_rows) {
+  Table *table = server->table;
+  uint32_t frame_length = server_request_length(connection);
+  uint8_t *body = connection->input + SERVER_FRAME_HEADER_SIZE;
+  uint32_t length = frame_length - SERVER_FRAME_HEADER_SIZE;
+  uint8_t status = SERVER_STATUS_BAD_REQUEST;
+  Row row;
+
+  connection->output_length = 0;
+  connection->output_sent = 0;
+  server_append_u32(connection, 0);
+  server_append(connection, &status, 1);
+  *num_rows = 0;
+  if (text != NULL) {
+    text[0] = '\0';
+  }
+
+  uint8_t op = length > 0 ? body[0] : 0;
+  if (op == SERVER_OP_INSERT && server_parse_row(body + 1, length - 1, &row)) {
+    if (text != NULL) {
+      snprintf(text, SERVER_REQUEST_TEXT_SIZE, "insert %u %s %s", row.id,
+               row.username, row.email);
+    }
+    switch (table_insert(table, &row)) {
+    case EXECUTE_SUCCESS:
+      status = SERVER_STATUS_OK;
+      break;
+    case EXECUTE_DUPLICATE_KEY:
+      status = SERVER_STATUS_DUPLICATE_KEY;
+      break;
+    case EXECUTE_TABLE_FULL:
+      status = SERVER_STATUS_TABLE_FULL;
+      break;
+    default:
+      break;
+    }
+  } else if (op == SERVER_OP_GET && length == 1 + sizeof(uint32_t)) {
+    uint32_t id;
+    memcpy(&id, body + 1, sizeof(id));
+    id = ntohl(id);
+    if (text != NULL) {
+      snprintf(text, SERVER_REQUEST_TEXT_SIZE, "select where id = %u", id);
+    }
+    if (table_get(table, id, &row)) {
+      status = SERVER_STATUS_OK;
+      server_append_row(connection, &row);
+      *num_rows = 1;
+    } else {
+      status = SERVER_STATUS_NOT_FOUND;
+    }
+  } else if (op == SERVER_OP_SELECT && length == 1) {
+    if (text != NULL) {
+      strcpy(text, "select");
+    }
+    status = SERVER_STATUS_OK;
+    uint32_t count_offset = connection->output_length;
+    uint32_t count = 0;
+    server_append_u32(connection, 0);
+
+    Snapshot *snapshot = snapshot_open(table);
+    Cursor *cursor = snapshot_start(snapshot);
+    while (!(cursor->end_of_table)) {
+      deserialize_row(cursor_value(cursor), &row);
+      server_append_row(connection, &row);
+      count++;
+      cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    snapshot_close(snapshot);
+
+    *num_rows = count;
+    count = htonl(count);
+    memcpy(connection->output + count_offset, &count, sizeof(count));
+  }
+
+  connection->output[SERVER_FRAME_HEADER_SIZE] = status;
+  uint32_t response_length =
+      htonl(connection->output_length - SERVER_FRAME_HEADER_SIZE);
+  memcpy(connection->output, &response_length, sizeof(response_length));
+
+  connection->input_length -= frame_length;
+  memmove(connection->input, connection->input + frame_length,
+          connection->input_length);
+  return status == SERVER_STATUS_BAD_REQUEST ? 0 : op;
+}
+
+/*
+ * Replaces a connection's pending output with an HTTP response.
+ *
+ * Parameters:
+ * - connection: The connection.
+ * - status: The status line's code and reason, such as "200 OK".
+ * - content_type: The type of the body.
+ * - body: The body, of body_length bytes.
+ *
+ * The connection is closed once the response is out, see server_write.
+ *
+ * Does not return a value.
+ */
+static void server_append_http(Connection *connection, const char *status,
+                               const char *content_type, const char *body,
+                               size_t body_length) {
+  char header[256];
+  int header_length = snprintf(header, sizeof(header),
+                               "HTTP/1.1 %s\r\n"
+                               "Content-Type: %s\r\n"
+                               "Content-Length: %lu\r\n"
+                               "Connection: close\r\n\r\n",
+                               status, content_type, (unsigned long)body_length);
+  connection->output_length = 0;
+  connection->output_sent = 0;
+  server_append(connection, header, header_length);
+  server_append(connection, body, body_length);
+}
+
+/*
+ * Builds the response to a scrape of the engine's metrics, see
+ * metrics_write.
+ *
+ * Parameters:
+ * - server: A pointer to the Server structure.
+ * - connection: The scraping connection, which the calling worker has to
+ * itself.
+ *
+ * Writing the metrics walks the tree, so it runs on a worker like a request
+ * rather than holding up the event loop.
+ *
+ * Does not return a value.
+ */
+static void server_execute_metrics(Server *server, Connection *connection) {
+  ServerStats requests = {0};
+  for (uint32_t i = 0; i < server->num_workers; i++) {
+    ServerStats *stats = &server->workers[i].stats;
+    for (uint32_t op = 0; op < SERVER_NUM_OPS; op++) {
+      for (uint32_t j = 0; j < SERVER_LATENCY_BUCKETS; j++) {
+        requests.latency[op][j] +=
+            __atomic_load_n(&stats->latency[op][j], __ATOMIC_RELAXED);
+      }
+      requests.latency_ns[op] +=
+          __atomic_load_n(&stats->latency_ns[op], __ATOMIC_RELAXED);
+    }
+  }
+
+  char *body = NULL;
+  size_t body_length = 0;
+  FILE *out = open_memstream(&body, &body_length);
+  metrics_write(out, server->table, &requests);
+  fclose(out);
+  server_append_http(connection, "200 OK", METRICS_CONTENT_TYPE, body,
+                     body_length);
+  free(body);
+}
+
+/*
+ * Adds to one of a worker's own counters.
+ *
+ * Only the worker writes its counters, so no atomic add is needed; the
+ * atomic store only keeps a scrape that reads them at the same time from
+ * seeing a torn value.
+ */
+static void server_count(uint64_t *counter, uint64_t amount) {
+  __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
+
+/*
+ * Queues a connection whose response is ready back to the event loop, and
+ * wakes the loop through the server's eventfd.
+ *
+ * Must be called with the server's lock held.
+ *
+ * Does not return a value.
+ */
+static void server_finish(Server *server, Connection *connection) {
+  connection->next = server->done_head;
+  server->done_head = connection;
+  uint64_t one = 1;
+  write(server->event_fd, &one, sizeof(one));
+}
+
+/*
+ * Runs requests handed over by the event loop until the server stops.
+ *
+ * Scrapes of the metrics are handed over the same way. Each finished
+ * connection is queued back to the event loop to send the response. The time
+ * each request took is counted in the worker's own stats, and slow requests
+ * are logged like slow statements.
+ */
+static void *server_worker_main(void *argument) {
+  ServerWorker *worker = argument;
+  Server *server = worker->server;
+
+  pthread_mutex_lock(&server->lock);
+  while (true) {
+    while (server->work_head == NULL && !server->stopping) {
+      pthread_cond_wait(&server->work_ready, &server->lock);
+    }
+    Connection *connection = server->work_head;
+    if (connection == NULL) {
+      break;
+    }
+    server->work_head = connection->next;
+    if (server->work_head == NULL) {
+      server->work_tail = NULL;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (connection->metrics) {
+      server_execute_metrics(server, connection);
+      pthread_mutex_lock(&server->lock);
+      server_finish(server, connection);
+      continue;
+    }
+
+    // The counters are only copied when the request may be logged
+    bool logging = slow_log_enabled(server->slow_log);
+    ProfileCounters counters;
+    char text[SERVER_REQUEST_TEXT_SIZE];
+    uint64_t num_rows;
+    if (logging) {
+      counters = profile_counters;
+    }
+
+    uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+    uint8_t op = server_execute(server, connection, logging ? text : NULL,
+                                &num_rows);
+    uint64_t elapsed_ns = profile_clock(CLOCK_MONOTONIC) - start_ns;
+    uint32_t bucket =
+        profile_latency_bucket(elapsed_ns, SERVER_LATENCY_BUCKETS);
+    server_count(&worker->stats.latency[op][bucket], 1);
+    server_count(&worker->stats.latency_ns[op], elapsed_ns);
+    if (logging) {
+      ProfileCounters start = counters;
+      counters = profile_counters;
+      profile_subtract(&counters, &start);
+      slow_log_record(server->slow_log, text, elapsed_ns, &counters, num_rows);
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server_finish(server, connection);
+  }
+  pthread_mutex_unlock(&server->lock);
+
+  return NULL;
+}
+
+/*
+ * Changes the events the event loop waits for on a connection.
+ *
+ * Does not return a value.
+ */
+static void server_watch(Server *server, Connection *connection,
+                         uint32_t events) {
+  struct epoll_event event = {0};
+  event.events = events;
+  event.data.ptr = connection;
+  epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+/*
+ * Hands the first buffered request of a connection to a worker.
+ *
+ * A connection has at most one request with the workers at a time, so its
+ * responses go out in the order of its requests. It is not read from
+ * meanwhile.
+ *
+ * Does not return a value.
+ */
+static void server_dispatch(Server *server, Connection *connection) {
+  connection->busy = true;
+  server_watch(server, connection, 0);
+
+  pthread_mutex_lock(&server->lock);
+  connection->next = NULL;
+  if (server->work_tail == NULL) {
+    server->work_head = connection;
+  } else {
+    server->work_tail->next = connection;
+  }
+  server->work_tail = connection;
+  pthread_cond_signal(&server->work_ready);
+  pthread_mutex_unlock(&server->lock);
+}
+
+/*
+ * Closes a connection and frees it.
+ *
+ * Must not be called while a worker has the connection.
+ *
+ * Does not return a value.
+ */
+static void server_close(Server *server, Connection *connection) {
+  if (connection->previous_open != NULL) {
+    connection->previous_open->next_open = connection->next_open;
+  } else {
+    server->open_connections = connection->next_open;
+  }
+  if (connection->next_open != NULL) {
+    connection->next_open->previous_open = connection->previous_open;
+  }
+
+  close(connection->fd);
+  free(connection->output);
+  free(connection);
+}
+
+/*
+ * Sends as much of a connection's response as the socket takes.
+ *
+ * Once the response is out, the next pipelined request is dispatched if it
+ * has already arrived, and otherwise the connection is read from again.
+ *
+ * Does not return a value.
+ */
+static void server_write(Server *server, Connection *connection) {
+  while (connection->output_sent < connection->output_length) {
+    ssize_t bytes_sent =
+        send(connection->fd, connection->output + connection->output_sent,
+             connection->output_length - connection->output_sent,
+             MSG_NOSIGNAL);
+    if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      server_watch(server, connection, EPOLLOUT);
+      return;
+    }
+    if (bytes_sent <= 0) {
+      server_close(server, connection);
+      return;
+    }
+    connection->output_sent += bytes_sent;
+  }
+
+  if (connection->metrics) {
+    server_close(server, connection);
+    return;
+  }
+  connection->busy = false;
+  if (server_request_length(connection) > 0) {
+    server_dispatch(server, connection);
+  } else {
+    server_watch(server, connection, EPOLLIN | EPOLLRDHUP);
+  }
+}
+
+/*
+ * Answers an HTTP request for the metrics, once its headers have arrived.
+ *
+ * GET /metrics is handed to a worker, see server_execute_metrics, and
+ * anything else is answered at once with a 404. Either way the connection is
+ * closed once the response is out.
+ *
+ * Does not return a value.
+ */
+static void server_respond_metrics(Server *server, Connection *connection) {
+  // Whatever follows the request is ignored
+  if (connection->output_length > 0) {
+    return;
+  }
+  // A scraper sends nothing after the headers until it has the response
+  uint32_t length = connection->input_length;
+  if (length < 4 ||
+      memcmp(connection->input + length - 4, "\r\n\r\n", 4) != 0) {
+    if (length == SERVER_INPUT_BUFFER_SIZE) {
+      server_close(server, connection);
+    }
+    return;
+  }
+
+  if (length >= 13 &&
+      (memcmp(connection->input, "GET /metrics ", 13) == 0 ||
+       memcmp(connection->input, "GET /metrics?", 13) == 0)) {
+    server_dispatch(server, connection);
+    return;
+  }
+  const char body[] = "Not found\n";
+  server_append_http(connection, "404 Not Found", "text/plain; charset=utf-8",
+                     body, sizeof(body) - 1);
+  server_write(server, connection);
+}
+
+/*
+ * Reads whatever a client has sent, and dispatches the first request once it
+ * has fully arrived.
+ *
+ * Does not return a value.
+ */
+static void server_read(Server *server, Connection *connection) {
+  while (connection->input_length < SERVER_INPUT_BUFFER_SIZE) {
+    ssize_t bytes_read =
+        recv(connection->fd, connection->input + connection->input_length,
+             SERVER_INPUT_BUFFER_SIZE - connection->input_length, 0);
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (bytes_read <= 0) {
+      server_close(server, connection);
+      return;
+    }
+    connection->input_length += bytes_read;
+  }
+
+  if (connection->metrics) {
+    server_respond_metrics(server, connection);
+    return;
+  }
+  if (connection->input_length >= SERVER_FRAME_HEADER_SIZE) {
+    uint32_t length;
+    memcpy(&length, connection->input, sizeof(length));
+    if (ntohl(length) > SERVER_MAX_FRAME_SIZE) {
+      server_close(server, connection);
+      return;
+    }
+  }
+  if (server_request_length(connection) > 0) {
+    server_dispatch(server, connection);
+  }
+}
+
+/*
+ * Accepts every pending connection on a listening socket.
+ *
+ * Parameters:
+ * - server: A pointer to the Server structure.
+ * - listen_fd: The socket for requests, or the one for metrics.
+ * - metrics: Whether the connections are scraping metrics.
+ *
+ * Does not return a value.
+ */
+static void server_accept(Server *server, int listen_fd, bool metrics) {
+  while (true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+      return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Connection *connection = calloc(1, sizeof(Connection));
+    connection->fd = fd;
+    connection->metrics = metrics;
+    connection->next_open = server->open_connections;
+    if (server->open_connections != NULL) {
+      server->open_connections->previous_open = connection;
+    }
+    server->open_connections = connection;
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = connection;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+/*
+ * Sends the responses the workers have finished.
+ *
+ * Does not return a value.
+ */
+static void server_complete(Server *server) {
+  uint64_t count;
+  read(server->event_fd, &count, sizeof(count));
+
+  pthread_mutex_lock(&server->lock);
+  Connection *connection = server->done_head;
+  server->done_head = NULL;
+  pthread_mutex_unlock(&server->lock);
+
+  while (connection != NULL) {
+    Connection *next = connection->next;
+    if (connection->closing) {
+      server_close(server, connection);
+    } else {
+      server_write(server, connection);
+    }
+    connection = next;
+  }
+}
+
+/*
+ * Serves the table to clients over a socket until interrupted.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - slow_log: Where requests that ran for too long are logged.
+ * - address: A Unix domain socket path, or a TCP port on the loopback
+ * interface, see server_listen.
+ * - metrics_address: Where to serve metrics over HTTP, in the same form, or
+ * NULL for nowhere.
+ * - error: Where to write why the server could not start, at most
+ * SQLITEDB_ERRMSG_SIZE bytes.
+ *
+ * One thread runs an epoll event loop that accepts connections, reads
+ * requests and sends responses without ever blocking. Requests are executed
+ * by a pool of one worker per CPU, all against the one table, so every
+ * client shares the page cache and nobody pays for opening the database.
+ * Inserts serialize on the table's writer lock; gets and selects read
+ * without locks, see table_get and snapshot_open. The wire format is
+ * described at server_execute. Scrapes of the metrics are run by the same
+ * workers, see server_respond_metrics.
+ *
+ * SIGINT or SIGTERM stops the server once the requests already handed to
+ * workers are done. The caller closes the table.
+ *
+ * Returns EXECUTE_SUCCESS once the server has stopped, or EXECUTE_ERROR if
+ * it could not listen on an address.
+ */
+ExecuteResult server_run(Table *table, SlowLog *slow_log, const char *address,
+                         const char *metrics_address, char *error) {
+  char *socket_path;
+  int listen_fd = server_listen(address, &socket_path, error);
+  if (listen_fd == -1) {
+    return EXECUTE_ERROR;
+  }
+  char *metrics_socket_path = NULL;
+  int metrics_fd = -1;
+  if (metrics_address != NULL) {
+    metrics_fd = server_listen(metrics_address, &metrics_socket_path, error);
+    if (metrics_fd == -1) {
+      close(listen_fd);
+      if (socket_path != NULL) {
+        unlink(socket_path);
+        free(socket_path);
+      }
+      return EXECUTE_ERROR;
+    }
+  }
+
+  // Each worker's stats start on a cache line of their own
+  Server *server = aligned_alloc(64, sizeof(Server));
+  memset(server, 0, sizeof(Server));
+  server->table = table;
+  server->slow_log = slow_log;
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->work_ready, NULL);
+
+  // Blocked in every thread, so they only ever arrive through the signalfd
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  server->listen_fd = listen_fd;
+  server->socket_path = socket_path;
+  server->metrics_fd = metrics_fd;
+  server->metrics_socket_path = metrics_socket_path;
+  server->event_fd = eventfd(0, EFD_NONBLOCK);
+  server->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK);
+  server->epoll_fd = epoll_create1(0);
+
+  // Connections are told apart from these by their data.ptr
+  int *fds[] = {&server->listen_fd, &server->metrics_fd, &server->event_fd,
+                &server->signal_fd};
+  for (uint32_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (*fds[i] == -1) {
+      continue;
+    }
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = fds[i];
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, *fds[i], &event);
+  }
+
+  long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_workers < 1) {
+    num_workers = 1;
+  } else if (num_workers > SERVER_MAX_WORKERS) {
+    num_workers = SERVER_MAX_WORKERS;
+  }
+  server->num_workers = num_workers;
+  for (uint32_t i = 0; i < server->num_workers; i++) {
+    ServerWorker *worker = &server->workers[i];
+    worker->server = server;
+    pthread_create(&worker->thread, NULL, server_worker_main, worker);
+  }
+
+  printf("Listening on %s\n", address);
+  if (metrics_address != NULL) {
+    printf("Serving metrics on %s\n", metrics_address);
+  }
+  fflush(stdout);
+
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  bool running = true;
+  while (running) {
+    int num_events = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    bool completed = false;
+    for (int i = 0; i < num_events; i++) {
+      Connection *connection = events[i].data.ptr;
+      if (events[i].data.ptr == &server->listen_fd) {
+        server_accept(server, server->listen_fd, false);
+      } else if (events[i].data.ptr == &server->metrics_fd) {
+        server_accept(server, server->metrics_fd, true);
+      } else if (events[i].data.ptr == &server->event_fd) {
+        completed = true;
+      } else if (events[i].data.ptr == &server->signal_fd) {
+        running = false;
+      } else if (connection->busy) {
+        // Only a hang-up is reported while a worker has the connection
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+        connection->closing = true;
+      } else if (events[i].events & EPOLLOUT) {
+        server_write(server, connection);
+      } else {
+        server_read(server, connection);
+      }
+    }
+
+    // Sending may close connections, which must not have events left to handle
+    if (completed) {
+      server_complete(server);
+    }
+  }
+
+  pthread_mutex_lock(&server->lock);
+  server->stopping = true;
+  pthread_cond_broadcast(&server->work_ready);
+  pthread_mutex_unlock(&server->lock);
+  for (uint32_t i = 0; i < server->num_workers; i++) {
+    pthread_join(server->workers[i].thread, NULL);
+  }
+
+  while (server->open_connections != NULL) {
+    server_close(server, server->open_connections);
+  }
+  close(server->epoll_fd);
+  close(server->signal_fd);
+  close(server->event_fd);
+  close(server->listen_fd);
+  if (server->socket_path != NULL) {
+    unlink(server->socket_path);
+    free(server->socket_path);
+  }
+  if (server->metrics_fd != -1) {
+    close(server->metrics_fd);
+  }
+  if (server->metrics_socket_path != NULL) {
+    unlink(server->metrics_socket_path);
+    free(server->metrics_socket_path);
+  }
+  pthread_mutex_destroy(&server->lock);
+  pthread_cond_destroy(&server->work_ready);
+  free(server);
+  return EXECUTE_SUCCESS;
+}
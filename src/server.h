@@ -0,0 +1,26 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "constants.h"
+
+#define SERVER_BACKLOG 128
+#define SERVER_MAX_EVENTS 64
+#define SERVER_FRAME_HEADER_SIZE 4
+#define SERVER_MAX_FRAME_SIZE 1024
+// Room for the statement a request stands for, in the slow log
+#define SERVER_REQUEST_TEXT_SIZE (64 + COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE)
+
+#define SERVER_OP_INSERT 1
+#define SERVER_OP_GET 2
+#define SERVER_OP_SELECT 3
+
+#define SERVER_STATUS_OK 0
+#define SERVER_STATUS_DUPLICATE_KEY 1
+#define SERVER_STATUS_TABLE_FULL 2
+#define SERVER_STATUS_NOT_FOUND 3
+#define SERVER_STATUS_BAD_REQUEST 4
+
+ExecuteResult server_run(Table *table, SlowLog *slow_log, const char *address,
+                         const char *metrics_address, char *error);
+
+#endif
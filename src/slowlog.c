@@ -0,0 +1,141 @@
+#include "slowlog.h"
+#include "profile.h"
+
+/*
+ * Initializes a slow log that is off.
+ *
+ * Does not return a value.
+ */
+void slow_log_init(SlowLog *log) {
+  memset(log, 0, sizeof(SlowLog));
+  pthread_mutex_init(&log->lock, NULL);
+}
+
+/*
+ * Starts logging slow statements to a file, in place of any earlier file.
+ *
+ * Parameters:
+ * - log: A pointer to the SlowLog structure.
+ * - filename: The file to append to, created if it does not exist.
+ * - threshold_ns: Statements that take at least this long are logged.
+ *
+ * Returns false, leaving the log as it was, if the file cannot be opened.
+ */
+bool slow_log_open(SlowLog *log, const char *filename, uint64_t threshold_ns) {
+  FILE *file = fopen(filename, "a");
+  if (file == NULL) {
+    return false;
+  }
+
+  pthread_mutex_lock(&log->lock);
+  if (log->file != NULL) {
+    fclose(log->file);
+  }
+  __atomic_store_n(&log->threshold_ns, threshold_ns, __ATOMIC_RELAXED);
+  log->window_count = 0;
+  log->num_suppressed = 0;
+  __atomic_store_n(&log->file, file, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&log->lock);
+  return true;
+}
+
+/*
+ * Stops logging slow statements and closes the file.
+ *
+ * Does not return a value.
+ */
+void slow_log_close(SlowLog *log) {
+  pthread_mutex_lock(&log->lock);
+  if (log->file != NULL) {
+    fclose(log->file);
+    __atomic_store_n(&log->file, NULL, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&log->lock);
+}
+
+/*
+ * Returns true if slow statements are being logged, so that statements only
+ * read the clock and their counters when they may be logged.
+ */
+bool slow_log_enabled(SlowLog *log) {
+  return __atomic_load_n(&log->file, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/*
+ * Logs a statement if it took at least the threshold.
+ *
+ * Parameters:
+ * - log: A pointer to the SlowLog structure.
+ * - sql: The text of the statement.
+ * - elapsed_ns: How long the statement ran.
+ * - counters: What the statement did, see ProfileCounters.
+ * - rows_returned: The rows the statement returned.
+ *
+ * Each entry is one line of key=value pairs, so the log can be grepped and
+ * sorted. Pages are every page the statement looked up, and rows examined
+ * every row it read from a leaf; a statement that examines far more rows than
+ * it returns is a scan that should have been a lookup.
+ *
+ * At most SLOW_LOG_MAX_PER_SECOND entries are written in any second, so a
+ * storm of slow statements cannot make itself worse by flooding the disk.
+ * The next entry written says how many were left out.
+ *
+ * Statements under the threshold return without taking the lock, so the log
+ * costs concurrent statements nothing until one of them is slow.
+ *
+ * Does not return a value.
+ */
+void slow_log_record(SlowLog *log, const char *sql, uint64_t elapsed_ns,
+                     const ProfileCounters *counters, uint64_t rows_returned) {
+  if (!slow_log_enabled(log) ||
+      elapsed_ns < __atomic_load_n(&log->threshold_ns, __ATOMIC_RELAXED)) {
+    return;
+  }
+
+  pthread_mutex_lock(&log->lock);
+  // The log may have been closed, or reopened with another threshold, since
+  if (log->file == NULL || elapsed_ns < log->threshold_ns) {
+    pthread_mutex_unlock(&log->lock);
+    return;
+  }
+
+  uint64_t now_ns = profile_clock(CLOCK_MONOTONIC);
+  if (now_ns - log->window_start_ns >= 1000000000) {
+    log->window_start_ns = now_ns;
+    log->window_count = 0;
+  }
+  if (log->window_count == SLOW_LOG_MAX_PER_SECOND) {
+    log->num_suppressed++;
+    pthread_mutex_unlock(&log->lock);
+    return;
+  }
+  log->window_count++;
+
+  char timestamp[32];
+  time_t now = time(NULL);
+  struct tm utc;
+  gmtime_r(&now, &utc);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+  fprintf(log->file,
+          "%s duration_ms=%.3f pages=%lu cache_misses=%lu io_wait_ms=%.3f "
+          "rows_examined=%lu rows_returned=%lu",
+          timestamp, elapsed_ns / 1e6,
+          (unsigned long)(counters->cache_hits + counters->cache_misses),
+          (unsigned long)counters->cache_misses, counters->io_wait_ns / 1e6,
+          (unsigned long)counters->rows_examined, (unsigned long)rows_returned);
+  if (log->num_suppressed > 0) {
+    fprintf(log->file, " suppressed=%lu", (unsigned long)log->num_suppressed);
+    log->num_suppressed = 0;
+  }
+  fprintf(log->file, " sql=\"");
+  for (const char *c = sql; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', log->file);
+    }
+    fputc(*c, log->file);
+  }
+  fprintf(log->file, "\"\n");
+  fflush(log->file);
+  pthread_mutex_unlock(&log->lock);
+}
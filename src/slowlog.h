@@ -0,0 +1,15 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include "constants.h"
+
+#define SLOW_LOG_MAX_PER_SECOND 10
+
+void slow_log_init(SlowLog *log);
+bool slow_log_open(SlowLog *log, const char *filename, uint64_t threshold_ns);
+void slow_log_close(SlowLog *log);
+bool slow_log_enabled(SlowLog *log);
+void slow_log_record(SlowLog *log, const char *sql, uint64_t elapsed_ns,
+                     const ProfileCounters *counters, uint64_t rows_returned);
+
+#endif
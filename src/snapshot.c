@@ -0,0 +1,159 @@
+#include "snapshot.h"
+#include "btree.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+#include "profile.h"
+#include "table.h"
+
+/*
+ * Opens a snapshot of the table as of the latest published version.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * The snapshot is registered with the table, so page versions it may still
+ * read are not reclaimed until it is closed. Reading through it never waits
+ * for the writer, and the writer never waits for it.
+ *
+ * Returns a pointer to the new Snapshot.
+ */
+Snapshot *snapshot_open(Table *table) {
+  table_begin_read(table);
+  Snapshot *snapshot = malloc(sizeof(Snapshot));
+  snapshot->table = table;
+  snapshot->node_image = malloc(PAGE_SIZE);
+  snapshot->leaf_image = malloc(PAGE_SIZE);
+  snapshot->previous = NULL;
+
+  pthread_mutex_lock(&table->snapshot_lock);
+  snapshot->version =
+      __atomic_load_n(&table->pager->commit_version, __ATOMIC_ACQUIRE);
+  snapshot->root_page_num = table->published_root_page_num;
+  snapshot->next = table->snapshots;
+  if (table->snapshots != NULL) {
+    table->snapshots->previous = snapshot;
+  }
+  table->snapshots = snapshot;
+  pthread_mutex_unlock(&table->snapshot_lock);
+
+  return snapshot;
+}
+
+/*
+ * Closes a snapshot, letting the writer reclaim the versions it was holding.
+ *
+ * Parameters:
+ * - snapshot: A pointer to the Snapshot structure.
+ *
+ * Does not return a value.
+ */
+void snapshot_close(Snapshot *snapshot) {
+  Table *table = snapshot->table;
+
+  pthread_mutex_lock(&table->snapshot_lock);
+  if (snapshot->previous != NULL) {
+    snapshot->previous->next = snapshot->next;
+  } else {
+    table->snapshots = snapshot->next;
+  }
+  if (snapshot->next != NULL) {
+    snapshot->next->previous = snapshot->previous;
+  }
+  pthread_mutex_unlock(&table->snapshot_lock);
+
+  free(snapshot->node_image);
+  free(snapshot->leaf_image);
+  free(snapshot);
+  table_end_read(table);
+}
+
+/*
+ * Publishes the writer's changes and reclaims page versions nobody can see.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Called by the writer, with the writer_lock held, at the end of every write.
+ * The oldest open snapshot is found under the same lock that snapshot_open
+ * registers under, so a snapshot that opens meanwhile already sees the new
+ * version and needs none of the versions being freed. The root is published
+ * along with the version, since in copy-on-write mode every commit has a new
+ * one.
+ *
+ * Returns the version of the oldest open snapshot, or the new version if
+ * there is none.
+ */
+uint64_t snapshot_publish(Table *table) {
+  pthread_mutex_lock(&table->snapshot_lock);
+  uint64_t oldest_version = pager_publish(table->pager);
+  table->published_root_page_num = table->root_page_num;
+  for (Snapshot *snapshot = table->snapshots; snapshot != NULL;
+       snapshot = snapshot->next) {
+    if (snapshot->version < oldest_version) {
+      oldest_version = snapshot->version;
+    }
+  }
+  pthread_mutex_unlock(&table->snapshot_lock);
+
+  pager_reclaim_versions(table->pager, oldest_version);
+  return oldest_version;
+}
+
+/*
+ * Finds a key in the table as it was when the snapshot was opened.
+ *
+ * Parameters:
+ * - snapshot: A pointer to the Snapshot structure.
+ * - key: The key to find.
+ *
+ * Each node on the way down is copied out at the snapshot's version, so the
+ * descent sees one consistent tree however the writer changes it meanwhile.
+ * The leaf stays in the snapshot's leaf image, where the returned cursor reads
+ * rows from. A snapshot therefore has one cursor in use at a time.
+ *
+ * Returns a pointer to a Cursor on the key, or where it would be inserted.
+ */
+Cursor *snapshot_find(Snapshot *snapshot, uint32_t key) {
+  Table *table = snapshot->table;
+  uint32_t page_num = snapshot->root_page_num;
+  profile_begin(PROFILE_PHASE_DESCENT);
+  pager_read_version(table->pager, page_num, snapshot->version,
+                     snapshot->node_image);
+
+  while (get_node_type(snapshot->node_image) == NODE_INTERNAL) {
+    uint32_t child_index = internal_node_find_child(snapshot->node_image, key);
+    page_num = *internal_node_child(snapshot->node_image, child_index);
+    pager_read_version(table->pager, page_num, snapshot->version,
+                       snapshot->node_image);
+  }
+  profile_end();
+
+  void *leaf = snapshot->node_image;
+  snapshot->node_image = snapshot->leaf_image;
+  snapshot->leaf_image = leaf;
+
+  Cursor *cursor = malloc(sizeof(Cursor));
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->cell_num =
+      leaf_node_find_cell(leaf, *leaf_node_num_cells(leaf), key);
+  cursor->end_of_table = false;
+  cursor->snapshot = snapshot;
+  cursor->num_locked = 0;
+  return cursor;
+}
+
+/*
+ * Initializes a cursor to the start of the table as seen by a snapshot.
+ *
+ * Parameters:
+ * - snapshot: A pointer to the Snapshot structure.
+ *
+ * Returns a pointer to the new Cursor.
+ */
+Cursor *snapshot_start(Snapshot *snapshot) {
+  Cursor *cursor = snapshot_find(snapshot, 0);
+  cursor->end_of_table = (*leaf_node_num_cells(snapshot->leaf_image) == 0);
+  return cursor;
+}
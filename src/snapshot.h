@@ -0,0 +1,12 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "constants.h"
+
+Snapshot *snapshot_open(Table *table);
+void snapshot_close(Snapshot *snapshot);
+uint64_t snapshot_publish(Table *table);
+Cursor *snapshot_find(Snapshot *snapshot, uint32_t key);
+Cursor *snapshot_start(Snapshot *snapshot);
+
+#endif
@@ -0,0 +1,1470 @@
+#include "sqlitedb.h"
+#include "async.h"
+#include "backup.h"
+#include "btree.h"
+#include "compact.h"
+#include "constants.h"
+#include "cow.h"
+#include "cursor.h"
+#include "dump.h"
+#include "import.h"
+#include "node.h"
+#include "pager.h"
+#include "plan.h"
+#include "profile.h"
+#include "scan.h"
+#include "serialize.h"
+#include "server.h"
+#include "slowlog.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "statement.h"
+#include "table.h"
+#include "trace.h"
+#include "transaction.h"
+#include "vacuum.h"
+
+/*
+ * Records the message for an error on a database.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - code: The result code to return.
+ * - format: A printf format for the message, followed by its arguments.
+ *
+ * Returns code, so callers can return the result of this directly.
+ */
+static int sqlitedb_error(SqliteDb *db, int code, const char *format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(db->errmsg, SQLITEDB_ERRMSG_SIZE, format, arguments);
+  va_end(arguments);
+  return code;
+}
+
+/*
+ * Turns the outcome of parsing into a result code and message.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - result: The outcome of prepare_statement.
+ * - text: The statement as prepare_statement left it.
+ *
+ * Returns SQLITEDB_OK or the error code.
+ */
+static int sqlitedb_prepare_error(SqliteDb *db, PrepareResult result,
+                                  const char *text) {
+  switch (result) {
+  case PREPARE_SUCCESS:
+    return SQLITEDB_OK;
+  case PREPARE_NEGATIVE_ID:
+    return sqlitedb_error(db, SQLITEDB_NEGATIVE_ID, "ID must be positive.");
+  case PREPARE_STRING_TOO_LONG:
+    return sqlitedb_error(db, SQLITEDB_STRING_TOO_LONG, "String is too long.");
+  case PREPARE_SYNTAX_ERROR:
+    return sqlitedb_error(db, SQLITEDB_SYNTAX_ERROR,
+                          "Syntax error. Could not parse statement.");
+  case PREPARE_UNRECOGNIZED_STATEMENT:
+    return sqlitedb_error(db, SQLITEDB_UNRECOGNIZED_STATEMENT,
+                          "Unrecognized keyword at start of '%s'.", text);
+  }
+  return SQLITEDB_ERROR;
+}
+
+/*
+ * Turns the outcome of running a statement into a result code and message.
+ *
+ * Returns SQLITEDB_DONE on success, or the error code.
+ */
+static int sqlitedb_execute_error(SqliteDb *db, ExecuteResult result) {
+  switch (result) {
+  case EXECUTE_SUCCESS:
+    return SQLITEDB_DONE;
+  case EXECUTE_DUPLICATE_KEY:
+    return sqlitedb_error(db, SQLITEDB_DUPLICATE_KEY, "Error: Duplicate key.");
+  case EXECUTE_NO_SUCH_KEY:
+    return sqlitedb_error(db, SQLITEDB_NO_SUCH_KEY, "Error: No such key.");
+  case EXECUTE_TABLE_FULL:
+    return sqlitedb_error(db, SQLITEDB_TABLE_FULL, "Error: Table full.");
+  case EXECUTE_TRANSACTION_ACTIVE:
+    return sqlitedb_error(db, SQLITEDB_TRANSACTION_ACTIVE,
+                          "Error: A transaction is already active.");
+  case EXECUTE_NO_TRANSACTION:
+    return sqlitedb_error(db, SQLITEDB_NO_TRANSACTION,
+                          "Error: No transaction is active.");
+  case EXECUTE_NO_SUCH_SAVEPOINT:
+    return sqlitedb_error(db, SQLITEDB_NO_SUCH_SAVEPOINT,
+                          "Error: No such savepoint.");
+  case EXECUTE_TOO_MANY_SAVEPOINTS:
+    return sqlitedb_error(db, SQLITEDB_TOO_MANY_SAVEPOINTS,
+                          "Error: Too many savepoints.");
+  case EXECUTE_NOT_SUPPORTED:
+    return sqlitedb_error(db, SQLITEDB_NOT_SUPPORTED,
+                          "Error: Not supported in copy-on-write mode.");
+  case EXECUTE_ERROR:
+    // The function that failed wrote its message into db->errmsg
+    return SQLITEDB_ERROR;
+  }
+  return SQLITEDB_ERROR;
+}
+
+/*
+ * Checks whether reading or writing the database has failed, see pager_fail.
+ * A failed database turns every statement away until it is closed; the next
+ * open recovers the last commit that made it to disk.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - code: What to return if it has not.
+ *
+ * Returns code, or SQLITEDB_IOERR with the failure as the message.
+ */
+static int sqlitedb_check_io(SqliteDb *db, int code) {
+  if (pager_failed(db->table->pager, db->errmsg)) {
+    return SQLITEDB_IOERR;
+  }
+  return code;
+}
+
+/*
+ * Returns a version string for the library, the same as SQLITEDB_VERSION in
+ * the header it was built with.
+ */
+const char *sqlitedb_version(void) { return SQLITEDB_VERSION; }
+
+/*
+ * Opens a database file, creating it if it does not exist.
+ *
+ * Parameters:
+ * - filename: The database file.
+ * - db: Set to the new database handle.
+ *
+ * A handle may be shared by several threads: writes serialize on the table's
+ * writer lock and reads run from snapshots. A transaction belongs to the
+ * thread that began it.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_ERROR if the file cannot be opened.
+ */
+int sqlitedb_open(const char *filename, SqliteDb **db) {
+  return sqlitedb_open_v2(filename, 0, db);
+}
+
+/*
+ * Opens a database file like sqlitedb_open, with flags.
+ *
+ * Parameters:
+ * - filename: The database file.
+ * - flags: SQLITEDB_OPEN_COPY_ON_WRITE creates a new database in
+ * copy-on-write mode, see cow_format. An existing database keeps the mode it
+ * was created in.
+ * - db: Set to the new database handle.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_ERROR if the file cannot be opened, is
+ * corrupt, or cannot be recovered.
+ */
+int sqlitedb_open_v2(const char *filename, int flags, SqliteDb **db) {
+  *db = calloc(1, sizeof(SqliteDb));
+
+  int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (fd == -1) {
+    return sqlitedb_error(*db, SQLITEDB_ERROR, "Unable to open '%s': %d",
+                          filename, errno);
+  }
+  close(fd);
+
+  slow_log_init(&(*db)->slow_log);
+  if ((flags & SQLITEDB_OPEN_COPY_ON_WRITE) &&
+      !cow_format(filename, (*db)->errmsg)) {
+    return SQLITEDB_ERROR;
+  }
+  (*db)->table = db_open(filename, (*db)->errmsg);
+  if ((*db)->table == NULL) {
+    return SQLITEDB_ERROR;
+  }
+  return SQLITEDB_OK;
+}
+
+/*
+ * Closes a database, writing back every change. Statements and cursors on it
+ * must be finalized and closed first.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_close(SqliteDb *db) {
+  if (db->table != NULL) {
+    db_close(db->table);
+  }
+  slow_log_close(&db->slow_log);
+  pthread_mutex_destroy(&db->slow_log.lock);
+  free(db);
+}
+
+/*
+ * Returns the message for the most recent error on a database.
+ */
+const char *sqlitedb_errmsg(SqliteDb *db) { return db->errmsg; }
+
+/*
+ * Logs statements that run for longer than a threshold.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - filename: The file to append entries to, or NULL to stop logging.
+ * - threshold_us: Statements that take at least this many microseconds are
+ *   logged; 0 logs every statement.
+ *
+ * Each entry gives the statement's text, how long it took, the pages it
+ * looked up and how many missed the cache, the time it waited on I/O, and
+ * the rows it examined against the rows it returned. Only the work done on
+ * the thread stepping the statement and its scan workers is counted. Requests
+ * served by sqlitedb_serve are logged as the statements they stand for, such
+ * as "select where id = 5" for a get.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_ERROR if the file cannot be opened.
+ */
+int sqlitedb_slow_log(SqliteDb *db, const char *filename,
+                      int64_t threshold_us) {
+  if (filename == NULL) {
+    slow_log_close(&db->slow_log);
+    return SQLITEDB_OK;
+  }
+  if (threshold_us < 0) {
+    return sqlitedb_error(db, SQLITEDB_ERROR, "Invalid slow log threshold");
+  }
+  if (!slow_log_open(&db->slow_log, filename, threshold_us * 1000)) {
+    return sqlitedb_error(db, SQLITEDB_ERROR, "Unable to open '%s': %d",
+                          filename, errno);
+  }
+  return SQLITEDB_OK;
+}
+
+_Static_assert(SQLITEDB_LATENCY_BUCKETS == PAGER_LATENCY_BUCKETS,
+               "The public latency histogram must match the pager's");
+
+/*
+ * Gathers statistics on the page cache and the shape of the tree.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - stats: Set to the statistics.
+ *
+ * The tree is walked from the root, reading every node, so this is meant for
+ * occasional inspection rather than for every statement. It is safe to call
+ * alongside other threads using the database.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_stats(SqliteDb *db, SqliteStats *stats) {
+  Table *table = db->table;
+  memset(stats, 0, sizeof(SqliteStats));
+
+  PagerStats pager_total;
+  TreeStats tree;
+  tree_stats(table, &tree);
+  table_begin_read(table);
+  stats->cached_pages = pager_stats(table->pager, &pager_total);
+  table_end_read(table);
+
+  stats->cache_hits = pager_total.cache_hits;
+  stats->cache_misses = pager_total.cache_misses;
+  stats->cache_evictions = pager_total.cache_evictions;
+  stats->bytes_read = pager_total.bytes_read;
+  stats->bytes_written = pager_total.bytes_written;
+  stats->fsyncs = pager_total.fsyncs;
+  memcpy(stats->read_latency, pager_total.read_latency,
+         sizeof(stats->read_latency));
+
+  stats->pages = tree.num_pages;
+  stats->free_pages = tree.num_free_pages;
+  stats->tree_height = tree.height;
+  stats->leaf_pages = tree.num_leaves;
+  stats->internal_pages = tree.num_internal_nodes;
+  stats->rows = tree.num_rows;
+  stats->leaf_fill =
+      (double)tree.num_rows / ((uint64_t)tree.num_leaves * LEAF_NODE_MAX_CELLS);
+  if (tree.num_internal_nodes > 0) {
+    stats->internal_fill =
+        (double)tree.num_internal_keys /
+        ((uint64_t)tree.num_internal_nodes * INTERNAL_NODE_MAX_KEYS);
+  }
+  stats->splits = __atomic_load_n(&table->num_splits, __ATOMIC_RELAXED);
+  return SQLITEDB_OK;
+}
+
+/*
+ * Prepares a statement.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - sql: The statement, in the same language as the REPL. Any value may be a
+ * "?" word, to be bound later, numbered from 1.
+ * - stmt: Set to the new statement, or NULL on error.
+ *
+ * The statement is parsed once, here. Values bound later are written
+ * straight into the parsed statement.
+ *
+ * Returns SQLITEDB_OK or the error code.
+ */
+int sqlitedb_prepare(SqliteDb *db, const char *sql, SqliteStmt **stmt) {
+  profile_begin(PROFILE_PHASE_PARSE);
+  SqliteStmt *new_stmt = calloc(1, sizeof(SqliteStmt));
+  new_stmt->db = db;
+  new_stmt->sql = strdup(sql);
+
+  char *text = strdup(sql);
+  PrepareResult parsed = prepare_statement(text, &new_stmt->statement);
+  int result = sqlitedb_prepare_error(db, parsed, text);
+  free(text);
+  if (result != SQLITEDB_OK) {
+    sqlitedb_finalize(new_stmt);
+    new_stmt = NULL;
+  }
+  *stmt = new_stmt;
+  profile_end();
+  return result;
+}
+
+/*
+ * Binds a value to a parameter, writing it into the field of the statement
+ * the "?" was parsed into.
+ *
+ * Parameters:
+ * - stmt: A pointer to the SqliteStmt structure.
+ * - index: The 1-based index of the parameter.
+ * - number: The value, if text is NULL.
+ * - text: The value as text, or NULL.
+ *
+ * The value is checked as the parser would have checked it in place of the
+ * "?".
+ *
+ * Returns SQLITEDB_OK, SQLITEDB_RANGE for a parameter the statement does not
+ * have, SQLITEDB_MISUSE if the statement is running, or the parser's error
+ * code for a value it would have rejected.
+ */
+static int sqlitedb_bind(SqliteStmt *stmt, int index, int64_t number,
+                         const char *text) {
+  Statement *statement = &stmt->statement;
+  if (index < 1 || (uint32_t)index > statement->num_params) {
+    return sqlitedb_error(stmt->db, SQLITEDB_RANGE,
+                          "No parameter %d.", index);
+  }
+  if (stmt->running) {
+    return sqlitedb_error(stmt->db, SQLITEDB_MISUSE,
+                          "Statement is running; reset it first.");
+  }
+
+  StatementParam param = statement->params[index - 1];
+  if (param == STATEMENT_PARAM_ID || param == STATEMENT_PARAM_FILTER_ID) {
+    int64_t id = text != NULL ? atoi(text) : number;
+    if (id < 0) {
+      return sqlitedb_error(stmt->db, SQLITEDB_NEGATIVE_ID,
+                            "ID must be positive.");
+    }
+    if (id > UINT32_MAX) {
+      return sqlitedb_error(stmt->db, SQLITEDB_RANGE, "ID is too large.");
+    }
+    if (param == STATEMENT_PARAM_ID) {
+      statement->row_to_insert.id = id;
+    } else {
+      statement->query.filter_id = id;
+    }
+    stmt->bound[index - 1] = true;
+    return SQLITEDB_OK;
+  }
+
+  char number_text[24];
+  if (text == NULL) {
+    snprintf(number_text, sizeof(number_text), "%lld", (long long)number);
+    text = number_text;
+  }
+  char *field;
+  size_t max_length;
+  switch (param) {
+  case STATEMENT_PARAM_USERNAME:
+    field = statement->row_to_insert.username;
+    max_length = COLUMN_USERNAME_SIZE;
+    break;
+  case STATEMENT_PARAM_EMAIL:
+    field = statement->row_to_insert.email;
+    max_length = COLUMN_EMAIL_SIZE;
+    break;
+  case STATEMENT_PARAM_FILTER_VALUE:
+    field = statement->query.filter_value;
+    max_length = COLUMN_EMAIL_SIZE;
+    break;
+  default:
+    field = statement->savepoint_name;
+    max_length = SAVEPOINT_NAME_SIZE;
+    break;
+  }
+  if (strlen(text) > max_length) {
+    return sqlitedb_error(stmt->db, SQLITEDB_STRING_TOO_LONG,
+                          "String is too long.");
+  }
+  strcpy(field, text);
+  stmt->bound[index - 1] = true;
+  return SQLITEDB_OK;
+}
+
+/*
+ * Binds an integer to the parameter at a 1-based index.
+ *
+ * Returns SQLITEDB_OK or the error code.
+ */
+int sqlitedb_bind_int(SqliteStmt *stmt, int index, int64_t value) {
+  return sqlitedb_bind(stmt, index, value, NULL);
+}
+
+/*
+ * Binds a string to the parameter at a 1-based index. The string is copied.
+ *
+ * Returns SQLITEDB_OK, SQLITEDB_RANGE if the string is empty or has a space
+ * in it, which no value can, or another error code.
+ */
+int sqlitedb_bind_text(SqliteStmt *stmt, int index, const char *value) {
+  if (value[0] == '\0' || strchr(value, ' ') != NULL) {
+    return sqlitedb_error(stmt->db, SQLITEDB_RANGE,
+                          "Values cannot be empty or contain spaces.");
+  }
+  return sqlitedb_bind(stmt, index, 0, value);
+}
+
+/*
+ * Reads the row under a select's cursor.
+ *
+ * Parameters:
+ * - stmt: A pointer to the SqliteStmt structure.
+ * - advance: Whether to move the cursor to the next row first.
+ *
+ * A seek or a range scan starts at the first key that can pass the filter
+ * on the id, and the keys come in order, so the first key that fails it ends
+ * the select.
+ *
+ * Returns true if there is a row, now in stmt->row.
+ */
+static bool sqlitedb_cursor_row(SqliteStmt *stmt, bool advance) {
+  ScanQuery *query = &stmt->statement.query;
+  if (advance) {
+    cursor_advance(stmt->cursor);
+  }
+  if (stmt->cursor->end_of_table) {
+    return false;
+  }
+  deserialize_row(cursor_value(stmt->cursor), &stmt->row);
+  profile_counters.rows_examined++;
+
+  if (query->filter_column != SCAN_COLUMN_ID) {
+    return true;
+  }
+  switch (query->filter_operator) {
+  case '<':
+    return stmt->row.id < query->filter_id;
+  case '>':
+    return stmt->row.id > query->filter_id;
+  default:
+    return stmt->row.id == query->filter_id;
+  }
+}
+
+/*
+ * Starts running a select, on the access path chosen by plan_access.
+ *
+ * A parallel scan computes the filter and the aggregate up front. Otherwise
+ * the select keeps a cursor, on a snapshot or, inside a transaction, on the
+ * table itself: from the first row for a plain select, or from the first key
+ * in the range for a seek or a range scan. Rows are read one per step, and
+ * an aggregate is computed from the cursor up front.
+ *
+ * Does not return a value.
+ */
+static void sqlitedb_start_select(SqliteStmt *stmt) {
+  Table *table = stmt->db->table;
+  ScanQuery *query = &stmt->statement.query;
+  stmt->scan_position = 0;
+  stmt->num_columns = query->aggregate == SCAN_ROWS ? 3 : 1;
+
+  PlanAccess access = plan_access(table, query);
+  if (access == PLAN_PARALLEL_SCAN) {
+    scan_run(table, query, &stmt->scan);
+    stmt->aggregate =
+        query->aggregate == SCAN_SUM ? stmt->scan.sum : stmt->scan.count;
+    return;
+  }
+
+  uint32_t start_key = 0;
+  if (access != PLAN_CURSOR_SCAN && query->filter_operator != '<') {
+    start_key = query->filter_operator == '>' ? query->filter_id + 1
+                                              : query->filter_id;
+  }
+  if (!table_in_transaction(table)) {
+    stmt->snapshot = snapshot_open(table);
+  }
+  stmt->cursor = cursor_seek(table, stmt->snapshot, start_key);
+
+  if (query->aggregate != SCAN_ROWS) {
+    stmt->scan.count = 0;
+    stmt->scan.sum = 0;
+    for (bool found = sqlitedb_cursor_row(stmt, false); found;
+         found = sqlitedb_cursor_row(stmt, true)) {
+      stmt->scan.count++;
+      stmt->scan.sum += stmt->row.id;
+    }
+    stmt->aggregate =
+        query->aggregate == SCAN_SUM ? stmt->scan.sum : stmt->scan.count;
+  }
+}
+
+/*
+ * Moves a running select to its next row.
+ *
+ * Returns true if there is one, now in stmt->row or stmt->aggregate.
+ */
+static bool sqlitedb_next_row(SqliteStmt *stmt) {
+  ScanQuery *query = &stmt->statement.query;
+  uint64_t position = stmt->scan_position++;
+
+  if (query->aggregate != SCAN_ROWS) {
+    return position == 0;
+  }
+  if (stmt->cursor == NULL) {
+    if (position >= stmt->scan.count) {
+      return false;
+    }
+    stmt->row = stmt->scan.rows[position];
+    return true;
+  }
+  return sqlitedb_cursor_row(stmt, position > 0);
+}
+
+/*
+ * Ends a run of a statement, logging it if it was slow.
+ *
+ * Parameters:
+ * - stmt: A pointer to the SqliteStmt structure.
+ * - code: What the statement's last step returns.
+ *
+ * Returns code.
+ */
+static int sqlitedb_finish(SqliteStmt *stmt, int code) {
+  TRACE_PROBE2(statement__done, stmt->sql, code);
+  if (stmt->start_ns == 0) {
+    return code;
+  }
+
+  uint64_t elapsed_ns = profile_clock(CLOCK_MONOTONIC) - stmt->start_ns;
+  ProfileCounters delta = profile_counters;
+  profile_subtract(&delta, &stmt->start_counters);
+  slow_log_record(&stmt->db->slow_log, stmt->sql, elapsed_ns, &delta,
+                  stmt->rows_returned);
+  stmt->start_ns = 0;
+  return code;
+}
+
+/*
+ * Runs a statement, or starts running a select.
+ *
+ * Returns the outcome; stmt->running is set for a select that has rows to
+ * return.
+ */
+static ExecuteResult sqlitedb_execute(SqliteStmt *stmt) {
+  Statement *statement = &stmt->statement;
+  Table *table = stmt->db->table;
+  ExecuteResult result = EXECUTE_SUCCESS;
+  switch (statement->type) {
+  case STATEMENT_SELECT:
+    stmt->running = true;
+    sqlitedb_start_select(stmt);
+    break;
+  case STATEMENT_INSERT:
+    result = table_insert(table, &statement->row_to_insert);
+    break;
+  case STATEMENT_UPDATE:
+    result = table_update(table, &statement->row_to_insert);
+    break;
+  case STATEMENT_BEGIN:
+    result = transaction_begin(table);
+    break;
+  case STATEMENT_COMMIT:
+    result = transaction_commit(table);
+    break;
+  case STATEMENT_ROLLBACK:
+    result = transaction_rollback(table);
+    break;
+  case STATEMENT_SAVEPOINT:
+    result = transaction_savepoint(table, statement->savepoint_name);
+    break;
+  case STATEMENT_RELEASE:
+    result = transaction_release(table, statement->savepoint_name);
+    break;
+  case STATEMENT_ROLLBACK_TO:
+    result = transaction_rollback_to(table, statement->savepoint_name);
+    break;
+  case STATEMENT_ANALYZE:
+    table_stats_build(table, UINT32_MAX);
+    break;
+  }
+  return result;
+}
+
+/*
+ * Works out the plan of an explain statement and, for explain analyze, runs
+ * the statement, discarding its rows, to record what each operator did.
+ *
+ * Parameters:
+ * - stmt: A pointer to the SqliteStmt structure.
+ *
+ * The access operator under an aggregate is measured on its own, since it
+ * reads everything before the aggregate is returned. Every other
+ * operator is measured over the whole run. The operators are then returned
+ * as rows of one text column.
+ *
+ * Returns the outcome of running the statement, or EXECUTE_SUCCESS for a
+ * plain explain, which does not run it.
+ */
+static ExecuteResult sqlitedb_explain(SqliteStmt *stmt) {
+  Plan *plan = &stmt->plan;
+  plan_explain(stmt->db->table, &stmt->statement, plan);
+
+  if (stmt->statement.explain == EXPLAIN_ANALYZE) {
+    ProfileCounters start = profile_counters;
+    uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+    ExecuteResult result = sqlitedb_execute(stmt);
+    uint64_t num_rows = 0;
+    if (result == EXECUTE_SUCCESS &&
+        (stmt->statement.type == STATEMENT_INSERT ||
+         stmt->statement.type == STATEMENT_UPDATE)) {
+      num_rows = 1;
+    }
+    if (stmt->running) {
+      if (plan->access_node > 0) {
+        plan_measure(&plan->nodes[plan->access_node], &start, start_ns,
+                     stmt->scan.count);
+      }
+      while (sqlitedb_next_row(stmt)) {
+        num_rows++;
+      }
+      sqlitedb_reset(stmt);
+    }
+    plan_measure(&plan->nodes[0], &start, start_ns, num_rows);
+    if (result != EXECUTE_SUCCESS) {
+      return result;
+    }
+  }
+
+  stmt->running = true;
+  stmt->num_columns = 1;
+  stmt->scan_position = 0;
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Runs a statement to its next row.
+ *
+ * Parameters:
+ * - stmt: A pointer to the SqliteStmt structure.
+ *
+ * A select returns SQLITEDB_ROW for every row, readable with the column
+ * functions until the next step, then SQLITEDB_DONE. Any other statement
+ * runs entirely in one step. Explain returns a row for each operator of the
+ * plan; explain analyze runs the statement first. Stepping a statement again
+ * after it is done runs it again.
+ *
+ * Returns SQLITEDB_ROW, SQLITEDB_DONE, or the error code. Once reading or
+ * writing the database has failed, every step returns SQLITEDB_IOERR.
+ */
+int sqlitedb_step(SqliteStmt *stmt) {
+  if (!stmt->running) {
+    TRACE_PROBE1(statement__start, stmt->sql);
+    stmt->start_ns = 0;
+    stmt->rows_returned = 0;
+    if (slow_log_enabled(&stmt->db->slow_log)) {
+      stmt->start_ns = profile_clock(CLOCK_MONOTONIC);
+      stmt->start_counters = profile_counters;
+    }
+    int code = sqlitedb_check_io(stmt->db, SQLITEDB_OK);
+    if (code != SQLITEDB_OK) {
+      return sqlitedb_finish(stmt, code);
+    }
+    for (uint32_t i = 0; i < stmt->statement.num_params; i++) {
+      if (!stmt->bound[i]) {
+        return sqlitedb_finish(
+            stmt, sqlitedb_error(stmt->db, SQLITEDB_MISUSE,
+                                 "Parameter %d is not bound.", i + 1));
+      }
+    }
+
+    ExecuteResult result = stmt->statement.explain == EXPLAIN_NONE
+                               ? sqlitedb_execute(stmt)
+                               : sqlitedb_explain(stmt);
+    if (!stmt->running) {
+      return sqlitedb_finish(
+          stmt, sqlitedb_check_io(stmt->db,
+                                  sqlitedb_execute_error(stmt->db, result)));
+    }
+  }
+
+  bool found = stmt->statement.explain == EXPLAIN_NONE
+                   ? sqlitedb_next_row(stmt)
+                   : stmt->scan_position++ < stmt->plan.num_nodes;
+  if (found) {
+    stmt->rows_returned++;
+    return SQLITEDB_ROW;
+  }
+  sqlitedb_reset(stmt);
+  return sqlitedb_finish(stmt, sqlitedb_check_io(stmt->db, SQLITEDB_DONE));
+}
+
+/*
+ * Returns 1 if a statement is an explain, 2 if it is an explain analyze, and
+ * 0 otherwise.
+ */
+int sqlitedb_stmt_isexplain(SqliteStmt *stmt) {
+  return stmt->statement.explain;
+}
+
+/*
+ * Returns the number of columns in the current row: 3 for rows, 1 for an
+ * aggregate or an operator of an explained plan, and 0 if there is no current
+ * row.
+ */
+int sqlitedb_column_count(SqliteStmt *stmt) {
+  return stmt->running ? stmt->num_columns : 0;
+}
+
+/*
+ * Returns the type of a column of the current row, or 0 if there is no such
+ * column.
+ */
+int sqlitedb_column_type(SqliteStmt *stmt, int column) {
+  if (column < 0 || column >= sqlitedb_column_count(stmt)) {
+    return 0;
+  }
+  if (stmt->statement.explain != EXPLAIN_NONE) {
+    return SQLITEDB_TEXT;
+  }
+  return column == 0 ? SQLITEDB_INTEGER : SQLITEDB_TEXT;
+}
+
+/*
+ * Returns an integer column of the current row, or 0 for any other column.
+ */
+int64_t sqlitedb_column_int(SqliteStmt *stmt, int column) {
+  if (sqlitedb_column_type(stmt, column) != SQLITEDB_INTEGER) {
+    return 0;
+  }
+  if (stmt->num_columns == 1) {
+    return stmt->aggregate;
+  }
+  return stmt->row.id;
+}
+
+/*
+ * Returns a column of the current row as text, or NULL if there is no such
+ * column. The text stays valid until the next step.
+ */
+const char *sqlitedb_column_text(SqliteStmt *stmt, int column) {
+  switch (sqlitedb_column_type(stmt, column)) {
+  case SQLITEDB_INTEGER:
+    snprintf(stmt->column_text, sizeof(stmt->column_text), "%lld",
+             (long long)sqlitedb_column_int(stmt, column));
+    return stmt->column_text;
+  case SQLITEDB_TEXT:
+    if (stmt->statement.explain != EXPLAIN_NONE) {
+      plan_format(&stmt->plan.nodes[stmt->scan_position - 1], stmt->plan_text,
+                  sizeof(stmt->plan_text));
+      return stmt->plan_text;
+    }
+    return column == 1 ? stmt->row.username : stmt->row.email;
+  default:
+    return NULL;
+  }
+}
+
+/*
+ * Stops a running statement, so the next step runs it from the start. Bound
+ * values are kept.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_reset(SqliteStmt *stmt) {
+  if (stmt->cursor != NULL) {
+    cursor_close(stmt->cursor);
+    stmt->cursor = NULL;
+  }
+  if (stmt->snapshot != NULL) {
+    snapshot_close(stmt->snapshot);
+    stmt->snapshot = NULL;
+  }
+  free(stmt->scan.rows);
+  stmt->scan.rows = NULL;
+  stmt->running = false;
+  return SQLITEDB_OK;
+}
+
+/*
+ * Frees a statement.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_finalize(SqliteStmt *stmt) {
+  if (stmt == NULL) {
+    return;
+  }
+  sqlitedb_reset(stmt);
+  free(stmt->sql);
+  free(stmt);
+}
+
+/*
+ * Opens a cursor on the rows from a key onwards.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - key: The first key to return, if it exists; otherwise the next one up.
+ * - cursor: Set to the new cursor.
+ *
+ * The cursor reads a snapshot, or the table itself inside a transaction of
+ * the calling thread. Its first row comes from the first call to
+ * sqlitedb_cursor_next.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_cursor_open(SqliteDb *db, uint32_t key, SqliteCursor **cursor) {
+  SqliteCursor *new_cursor = calloc(1, sizeof(SqliteCursor));
+  Table *table = db->table;
+  new_cursor->db = db;
+
+  void *leaf;
+  if (table_in_transaction(table)) {
+    new_cursor->cursor = table_find(table, key);
+    leaf = get_page(table->pager, new_cursor->cursor->page_num);
+  } else {
+    new_cursor->snapshot = snapshot_open(table);
+    new_cursor->cursor = snapshot_find(new_cursor->snapshot, key);
+    leaf = new_cursor->snapshot->leaf_image;
+  }
+
+  // The key may be past the last one of its leaf, so start in the next leaf
+  Cursor *position = new_cursor->cursor;
+  uint32_t num_cells = *leaf_node_num_cells(leaf);
+  if (num_cells == 0) {
+    position->end_of_table = true;
+  } else if (position->cell_num >= num_cells) {
+    position->cell_num = num_cells - 1;
+    cursor_advance(position);
+  }
+
+  *cursor = new_cursor;
+  return SQLITEDB_OK;
+}
+
+/*
+ * Moves a cursor to its next row.
+ *
+ * Returns SQLITEDB_ROW, readable with the cursor's column functions, or
+ * SQLITEDB_DONE.
+ */
+int sqlitedb_cursor_next(SqliteCursor *cursor) {
+  if (cursor->started) {
+    cursor_advance(cursor->cursor);
+  }
+  cursor->started = true;
+  if (cursor->cursor->end_of_table) {
+    return SQLITEDB_DONE;
+  }
+  deserialize_row(cursor_value(cursor->cursor), &cursor->row);
+  return SQLITEDB_ROW;
+}
+
+/*
+ * Returns the id of the cursor's current row.
+ */
+uint32_t sqlitedb_cursor_id(SqliteCursor *cursor) { return cursor->row.id; }
+
+/*
+ * Returns the username of the cursor's current row.
+ */
+const char *sqlitedb_cursor_username(SqliteCursor *cursor) {
+  return cursor->row.username;
+}
+
+/*
+ * Returns the email of the cursor's current row.
+ */
+const char *sqlitedb_cursor_email(SqliteCursor *cursor) {
+  return cursor->row.email;
+}
+
+/*
+ * Closes a cursor.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_cursor_close(SqliteCursor *cursor) {
+  cursor_close(cursor->cursor);
+  if (cursor->snapshot != NULL) {
+    snapshot_close(cursor->snapshot);
+  }
+  free(cursor);
+}
+
+// What an async operation reports its rows to
+typedef struct {
+  SqliteAsyncCallback callback;
+  void *context;
+  bool scan;
+} SqliteAsyncOp;
+
+/*
+ * Passes a row found by an async operation on to the caller's callback, and
+ * frees the operation after its last row: the only one for a lookup, or the
+ * NULL that ends a scan.
+ *
+ * Does not return a value.
+ */
+static void sqlitedb_async_row(void *context, Row *row) {
+  SqliteAsyncOp *op = context;
+  if (row == NULL) {
+    op->callback(op->context, NULL);
+    free(op);
+    return;
+  }
+
+  SqliteRow public_row = {row->id, row->username, row->email};
+  op->callback(op->context, &public_row);
+  if (!op->scan) {
+    free(op);
+  }
+}
+
+/*
+ * Opens a handle for lookups and scans that do not block on disk.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - async: Set to the new handle.
+ *
+ * A handle belongs to the one thread that calls it, typically the thread of
+ * an event loop, and reads pages through an io_uring where the kernel offers
+ * one. Other threads may keep using the database meanwhile.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_async_open(SqliteDb *db, SqliteAsync **async) {
+  SqliteAsync *new_async = malloc(sizeof(SqliteAsync));
+  new_async->db = db;
+  new_async->engine = async_open(db->table);
+  *async = new_async;
+  return SQLITEDB_OK;
+}
+
+/*
+ * Returns a descriptor that becomes readable when page reads have completed,
+ * for the caller's event loop to watch. Returns -1 if pages are read
+ * synchronously, in which case every operation completes before the call
+ * that starts it returns.
+ */
+int sqlitedb_async_fd(SqliteAsync *async) { return async_fd(async->engine); }
+
+/*
+ * Starts an operation that reports to a callback.
+ *
+ * Does not return a value.
+ */
+static void sqlitedb_async_start(SqliteAsync *async, bool scan, uint32_t key,
+                                 SqliteAsyncCallback callback, void *context) {
+  SqliteAsyncOp *op = malloc(sizeof(SqliteAsyncOp));
+  op->callback = callback;
+  op->context = context;
+  op->scan = scan;
+  if (scan) {
+    async_scan(async->engine, sqlitedb_async_row, op);
+  } else {
+    async_get(async->engine, key, sqlitedb_async_row, op);
+  }
+}
+
+/*
+ * Looks up a key.
+ *
+ * Parameters:
+ * - async: A pointer to the SqliteAsync structure.
+ * - key: The key to find.
+ * - callback: Called once, with the row, or with NULL if there is no such key.
+ * - context: Passed to the callback.
+ *
+ * If every page on the way is cached, the callback runs before this returns.
+ * Otherwise the lookup waits for its pages and is completed by
+ * sqlitedb_async_poll.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_async_get(SqliteAsync *async, uint32_t key,
+                       SqliteAsyncCallback callback, void *context) {
+  sqlitedb_async_start(async, false, key, callback, context);
+  return SQLITEDB_OK;
+}
+
+/*
+ * Scans the whole table at a snapshot taken now.
+ *
+ * Parameters:
+ * - async: A pointer to the SqliteAsync structure.
+ * - callback: Called with each row in key order, then once with NULL.
+ * - context: Passed to the callback.
+ *
+ * Waits for pages like sqlitedb_async_get.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_async_scan(SqliteAsync *async, SqliteAsyncCallback callback,
+                        void *context) {
+  sqlitedb_async_start(async, true, 0, callback, context);
+  return SQLITEDB_OK;
+}
+
+/*
+ * Sends the page reads started since the last call, and continues the
+ * operations whose pages have arrived, running their callbacks.
+ *
+ * Parameters:
+ * - async: A pointer to the SqliteAsync structure.
+ * - wait: Whether to block until at least one read completes, if any are in
+ * flight.
+ *
+ * Returns the number of operations that have not completed yet.
+ */
+int sqlitedb_async_poll(SqliteAsync *async, int wait) {
+  return async_poll(async->engine, wait);
+}
+
+/*
+ * Completes every pending operation, running their callbacks, and closes
+ * the handle.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_async_close(SqliteAsync *async) {
+  async_close(async->engine);
+  free(async);
+}
+
+_Static_assert(SQLITEDB_PHASES == PROFILE_NUM_PHASES,
+               "The public phases must match the profiler's");
+
+/*
+ * Turns timing of the phases of statements on or off, for every thread.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_profile_enable(int enabled) { profile_set_enabled(enabled); }
+
+/*
+ * Returns whether the phases of statements are being timed.
+ */
+int sqlitedb_profile_enabled(void) { return profile_is_enabled(); }
+
+/*
+ * Zeroes the calling thread's profile, before the statements it is to
+ * cover.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_profile_reset(void) { profile_reset(); }
+
+/*
+ * Starts timing a phase of the program's own, such as SQLITEDB_PHASE_OUTPUT,
+ * on the calling thread. Every call must be matched by a call to
+ * sqlitedb_profile_end.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_profile_begin(int phase) { profile_begin(phase); }
+
+/*
+ * Stops timing the phase started last on the calling thread.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_profile_end(void) { profile_end(); }
+
+/*
+ * Fills in the calling thread's profile.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_profile(SqliteProfile *profile) {
+  profile->pages_read = profile_counters.pages_read;
+  profile->pages_written = profile_counters.pages_written;
+  profile->cache_hits = profile_counters.cache_hits;
+  profile->cache_misses = profile_counters.cache_misses;
+  profile->io_wait_ns = profile_counters.io_wait_ns;
+  profile->rows_examined = profile_counters.rows_examined;
+  memcpy(profile->phase_ns, profile_counters.phase_ns,
+         sizeof(profile->phase_ns));
+}
+
+/*
+ * Refuses a command that rewrites pages in place, which a copy-on-write
+ * database never does.
+ *
+ * Returns SQLITEDB_NOT_SUPPORTED if the database is in copy-on-write mode,
+ * SQLITEDB_IOERR if it has failed, see sqlitedb_check_io, or SQLITEDB_OK.
+ */
+static int sqlitedb_check_in_place(SqliteDb *db) {
+  if (db->table->cow != NULL) {
+    return sqlitedb_execute_error(db, EXECUTE_NOT_SUPPORTED);
+  }
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Starts a bulk load that must leave no rows behind if it fails, see
+ * transaction_begin_atomic.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - nested: Set to whether the load runs inside the caller's transaction.
+ *
+ * Returns SQLITEDB_OK, or the error if no savepoint can be made.
+ */
+static int sqlitedb_begin_load(SqliteDb *db, bool *nested) {
+  ExecuteResult result = transaction_begin_atomic(db->table, nested);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_execute_error(db, result);
+  }
+  return SQLITEDB_OK;
+}
+
+/*
+ * Imports rows from a delimited text file, see import_file.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - filename: The file to read.
+ * - delimiter: The character between fields, such as ',' or '\t'.
+ * - num_rows: Set to the number of rows imported.
+ * - num_skipped: Set to the number of rows skipped because their id was
+ * already in the table.
+ *
+ * An import that fails partway is undone, so the table keeps none of its
+ * rows.
+ *
+ * Returns SQLITEDB_OK, SQLITEDB_TABLE_FULL if the rows do not fit,
+ * SQLITEDB_NOT_SUPPORTED in copy-on-write mode, or SQLITEDB_ERROR if the
+ * file cannot be read or parsed.
+ */
+int sqlitedb_import(SqliteDb *db, const char *filename, char delimiter,
+                    uint64_t *num_rows, uint64_t *num_skipped) {
+  *num_rows = 0;
+  *num_skipped = 0;
+  int code = sqlitedb_check_in_place(db);
+  bool nested;
+  if (code == SQLITEDB_OK) {
+    code = sqlitedb_begin_load(db, &nested);
+  }
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  uint32_t num_inserted, num_duplicates;
+  ExecuteResult result = import_file(db->table, filename, delimiter,
+                                     &num_inserted, &num_duplicates,
+                                     db->errmsg);
+  transaction_end_atomic(db->table, nested, result == EXECUTE_SUCCESS);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_check_io(db, sqlitedb_execute_error(db, result));
+  }
+  *num_rows = num_inserted;
+  *num_skipped = num_duplicates;
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Writes every row to a checksummed dump file, see dump_table.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - filename: The file to create or overwrite.
+ * - num_rows: Set to the number of rows written.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_ERROR if the file cannot be written.
+ */
+int sqlitedb_dump(SqliteDb *db, const char *filename, uint64_t *num_rows) {
+  *num_rows = 0;
+  int code = sqlitedb_check_io(db, SQLITEDB_OK);
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  ExecuteResult result = dump_table(db->table, filename, num_rows, db->errmsg);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_check_io(db, sqlitedb_execute_error(db, result));
+  }
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Replaces the table with the rows of a dump file, see restore_table. A
+ * restore that fails partway is undone, leaving the table empty.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - filename: The dump file.
+ * - num_rows: Set to the number of rows restored.
+ *
+ * Returns SQLITEDB_OK, SQLITEDB_TABLE_FULL if the rows do not fit,
+ * SQLITEDB_NOT_SUPPORTED in copy-on-write mode, or SQLITEDB_ERROR if the
+ * table is not empty or the file cannot be restored.
+ */
+int sqlitedb_restore(SqliteDb *db, const char *filename, uint64_t *num_rows) {
+  *num_rows = 0;
+  int code = sqlitedb_check_in_place(db);
+  bool nested;
+  if (code == SQLITEDB_OK) {
+    code = sqlitedb_begin_load(db, &nested);
+  }
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  uint64_t num_restored;
+  ExecuteResult result =
+      restore_table(db->table, filename, &num_restored, db->errmsg);
+  transaction_end_atomic(db->table, nested, result == EXECUTE_SUCCESS);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_check_io(db, sqlitedb_execute_error(db, result));
+  }
+  *num_rows = num_restored;
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Starts an online backup, see backup_start. It advances with every call to
+ * sqlitedb_idle.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - filename: Where the backup should be written.
+ * - pages_per_step: The most pages to copy per call to sqlitedb_idle, or 0
+ * for BACKUP_PAGES_PER_STEP.
+ *
+ * sqlitedb_idle reports when the backup is complete.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_ERROR if a backup is already running or
+ * the backup file cannot be created.
+ */
+int sqlitedb_backup(SqliteDb *db, const char *filename,
+                    uint32_t pages_per_step) {
+  int code = sqlitedb_check_io(db, SQLITEDB_OK);
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  ExecuteResult result = backup_start(
+      db->table, filename,
+      pages_per_step > 0 ? pages_per_step : BACKUP_PAGES_PER_STEP, db->errmsg);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_check_io(db, sqlitedb_execute_error(db, result));
+  }
+  return SQLITEDB_OK;
+}
+
+/*
+ * Compacts the whole tree at once, see compact_table.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - pages_freed: Set to the number of pages freed.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_NOT_SUPPORTED in copy-on-write mode.
+ */
+int sqlitedb_compact(SqliteDb *db, uint32_t *pages_freed) {
+  *pages_freed = 0;
+  int code = sqlitedb_check_in_place(db);
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  table_begin_write(db->table);
+  *pages_freed = compact_table(db->table);
+  table_end_write(db->table);
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Turns incremental compaction on or off. While it is on, every call to
+ * sqlitedb_idle compacts a few more pages.
+ *
+ * Returns SQLITEDB_OK, or SQLITEDB_NOT_SUPPORTED in copy-on-write mode.
+ */
+int sqlitedb_auto_compact(SqliteDb *db, int enabled) {
+  int code = sqlitedb_check_in_place(db);
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  db->table->compact_enabled = enabled;
+  return SQLITEDB_OK;
+}
+
+/*
+ * Rebuilds the tree in key order and shrinks the file, see vacuum_table.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - fill_percent: How full to pack the leaves, from 1 to 100, or 0 for
+ * VACUUM_FILL_PERCENT.
+ * - old_num_pages: Set to the number of pages before the vacuum.
+ * - new_num_pages: Set to the number of pages after it.
+ *
+ * A running backup is completed first; if that fails, so does the vacuum.
+ *
+ * Returns SQLITEDB_OK, SQLITEDB_NOT_SUPPORTED in copy-on-write mode,
+ * SQLITEDB_RANGE for a fill factor out of range, SQLITEDB_TABLE_FULL if the
+ * rows do not fit at that fill factor, or SQLITEDB_ERROR. The database is
+ * left as it was unless the vacuum succeeds.
+ */
+int sqlitedb_vacuum(SqliteDb *db, int fill_percent, uint32_t *old_num_pages,
+                    uint32_t *new_num_pages) {
+  *old_num_pages = 0;
+  *new_num_pages = 0;
+  int code = sqlitedb_check_in_place(db);
+  if (code != SQLITEDB_OK) {
+    return code;
+  }
+  if (fill_percent < 0 || fill_percent > 100) {
+    return sqlitedb_error(db, SQLITEDB_RANGE,
+                          "Fill factor must be between 1 and 100.");
+  }
+  table_begin_write(db->table);
+  ExecuteResult result = vacuum_table(
+      db->table, fill_percent > 0 ? fill_percent : VACUUM_FILL_PERCENT,
+      old_num_pages, new_num_pages, db->errmsg);
+  table_end_write(db->table);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_check_io(db, sqlitedb_execute_error(db, result));
+  }
+  return sqlitedb_check_io(db, SQLITEDB_OK);
+}
+
+/*
+ * Does the work a database spreads out between statements: a step of a
+ * running backup, and of incremental compaction if it is on. A program
+ * calls this whenever it is between statements, as the REPL does before
+ * every prompt.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - backup_pages: Set to the number of pages a backup copied in all, when
+ * this call completed it. May be NULL.
+ *
+ * Returns SQLITEDB_DONE if this call completed a backup, SQLITEDB_ERROR if
+ * it completed one that failed, SQLITEDB_IOERR if reading or writing the
+ * database failed during the call, and SQLITEDB_OK otherwise.
+ */
+int sqlitedb_idle(SqliteDb *db, uint32_t *backup_pages) {
+  Table *table = db->table;
+  int code = SQLITEDB_OK;
+  // A database that already failed is reported by the statements it turns
+  // away, not before every prompt
+  if (sqlitedb_check_io(db, SQLITEDB_OK) != SQLITEDB_OK) {
+    return SQLITEDB_OK;
+  }
+  // A backup must not copy pages a rollback could still take back
+  if (!table->in_transaction) {
+    uint32_t pages_copied;
+    ExecuteResult result = backup_step(table, &pages_copied, db->errmsg);
+    if (result != EXECUTE_SUCCESS) {
+      code = sqlitedb_execute_error(db, result);
+    } else if (pages_copied > 0) {
+      code = SQLITEDB_DONE;
+      if (backup_pages != NULL) {
+        *backup_pages = pages_copied;
+      }
+    }
+  }
+  if (table->compact_enabled) {
+    table_begin_write(table);
+    compact_step(table, COMPACT_PAGES_PER_STEP);
+    table_end_write(table);
+  }
+  return sqlitedb_check_io(db, code);
+}
+
+/*
+ * Serves the database over a socket until SIGINT or SIGTERM, see
+ * server_run.
+ *
+ * Parameters:
+ * - db: A pointer to the SqliteDb structure.
+ * - address: A Unix domain socket path, or a TCP port on the loopback
+ * interface.
+ * - metrics_address: Where to serve metrics over HTTP, in the same form, or
+ * NULL for nowhere.
+ *
+ * Returns SQLITEDB_OK once the server has stopped, or SQLITEDB_ERROR if it
+ * could not listen on an address.
+ */
+int sqlitedb_serve(SqliteDb *db, const char *address,
+                   const char *metrics_address) {
+  ExecuteResult result = server_run(db->table, &db->slow_log, address,
+                                    metrics_address, db->errmsg);
+  if (result != EXECUTE_SUCCESS) {
+    return sqlitedb_execute_error(db, result);
+  }
+  return SQLITEDB_OK;
+}
+
+/*
+ * Prints a subtree, one line per node and key, indented by depth.
+ *
+ * Does not return a value.
+ */
+static void sqlitedb_print_node(Pager *pager, uint32_t page_num,
+                                uint32_t depth) {
+  void *node = get_page(pager, page_num);
+  uint32_t num_keys;
+
+  switch (get_node_type(node)) {
+  case NODE_LEAF:
+    num_keys = *leaf_node_num_cells(node);
+    printf("%*s- leaf (size %d)\n", depth * 2, "", num_keys);
+    for (uint32_t i = 0; i < num_keys; i++) {
+      printf("%*s- %d\n", (depth + 1) * 2, "", *leaf_node_key(node, i));
+    }
+    break;
+  case NODE_INTERNAL:
+    num_keys = *internal_node_num_keys(node);
+    printf("%*s- internal (size %d)\n", depth * 2, "", num_keys);
+    for (uint32_t i = 0; i < num_keys; i++) {
+      sqlitedb_print_node(pager, *internal_node_child(node, i), depth + 1);
+      printf("%*s- key %d\n", (depth + 1) * 2, "",
+             *internal_node_key(node, i));
+    }
+    sqlitedb_print_node(pager, *internal_node_right_child(node), depth + 1);
+    break;
+  default:
+    break;
+  }
+}
+
+/*
+ * Prints the tree, for debugging.
+ *
+ * Returns SQLITEDB_OK.
+ */
+int sqlitedb_print_tree(SqliteDb *db) {
+  printf("Tree:\n");
+  sqlitedb_print_node(db->table->pager, db->table->root_page_num, 0);
+  return SQLITEDB_OK;
+}
+
+/*
+ * Prints the sizes that lay out rows and leaves, for debugging.
+ *
+ * Does not return a value.
+ */
+void sqlitedb_print_constants(void) {
+  printf("Constants:\n");
+  printf("ROW_SIZE: %d\n", ROW_SIZE);
+  printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+}
@@ -0,0 +1,203 @@
+#ifndef SQLITEDB_H
+#define SQLITEDB_H
+
+/*
+ * The public interface of libsqlitedb. This is the only header an embedding
+ * program needs, and it does not expose the engine's own types, so programs
+ * built against it keep working as the engine changes.
+ *
+ * A statement is prepared once, may use "?" in place of any value, and is run
+ * by calling sqlitedb_step until it returns SQLITEDB_DONE or an error. Every
+ * row of a select is returned by one step, as SQLITEDB_ROW.
+ *
+ * Lookups and scans can also run without blocking on disk, for a program
+ * with an event loop: they are started on an async handle, which reads the
+ * pages they need in the background. The loop watches sqlitedb_async_fd and
+ * calls sqlitedb_async_poll when it is readable, and each operation hands its
+ * rows to a callback as they are found.
+ *
+ * The maintenance functions, from sqlitedb_import to sqlitedb_serve, are the
+ * REPL's dot commands. Like every other function, they return an error code
+ * and leave its message for sqlitedb_errmsg when they fail, and hand back
+ * what they did through their out-parameters; printing is left to the
+ * program. Only sqlitedb_print_tree and sqlitedb_print_constants, which
+ * exist to print, write to standard output.
+ *
+ * Once a read or write of the database file fails, steps and maintenance
+ * functions return SQLITEDB_IOERR until the database is closed. Nothing more
+ * is written to it, so the next open finds the last commit that made it to
+ * disk.
+ */
+
+#include <stdint.h>
+
+#define SQLITEDB_VERSION "1.0.0"
+
+#define SQLITEDB_API __attribute__((visibility("default")))
+
+// Result codes
+#define SQLITEDB_OK 0
+#define SQLITEDB_ERROR 1
+#define SQLITEDB_MISUSE 2
+#define SQLITEDB_RANGE 3
+#define SQLITEDB_UNRECOGNIZED_STATEMENT 4
+#define SQLITEDB_SYNTAX_ERROR 5
+#define SQLITEDB_STRING_TOO_LONG 6
+#define SQLITEDB_NEGATIVE_ID 7
+#define SQLITEDB_DUPLICATE_KEY 8
+#define SQLITEDB_TABLE_FULL 9
+#define SQLITEDB_TRANSACTION_ACTIVE 10
+#define SQLITEDB_NO_TRANSACTION 11
+#define SQLITEDB_NO_SUCH_SAVEPOINT 12
+#define SQLITEDB_TOO_MANY_SAVEPOINTS 13
+#define SQLITEDB_NOT_SUPPORTED 14
+#define SQLITEDB_NO_SUCH_KEY 15
+#define SQLITEDB_IOERR 16
+#define SQLITEDB_ROW 100
+#define SQLITEDB_DONE 101
+
+// Column types
+#define SQLITEDB_INTEGER 1
+#define SQLITEDB_TEXT 3
+
+// Flags for sqlitedb_open_v2
+#define SQLITEDB_OPEN_COPY_ON_WRITE 1
+
+// Phases of a statement, see SqliteProfile. The engine times all but the
+// last, which is for the program to time its own handling of the rows.
+#define SQLITEDB_PHASE_PARSE 0
+#define SQLITEDB_PHASE_DESCENT 1
+#define SQLITEDB_PHASE_IO 2
+#define SQLITEDB_PHASE_SERIALIZE 3
+#define SQLITEDB_PHASE_OUTPUT 4
+#define SQLITEDB_PHASES 5
+
+#define SQLITEDB_LATENCY_BUCKETS 16
+
+typedef struct SqliteDb SqliteDb;
+typedef struct SqliteStmt SqliteStmt;
+typedef struct SqliteCursor SqliteCursor;
+typedef struct SqliteAsync SqliteAsync;
+
+// A row handed to an async callback. The strings are only valid until the
+// callback returns.
+typedef struct {
+  uint32_t id;
+  const char *username;
+  const char *email;
+} SqliteRow;
+
+typedef void (*SqliteAsyncCallback)(void *context, const SqliteRow *row);
+
+// Statistics for a database, filled in by sqlitedb_stats. The page cache
+// counters and the split count run from when the database was opened.
+typedef struct {
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_evictions;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t fsyncs;
+  // Page reads that took under 2^i microseconds and at least 2^(i-1); the
+  // last bucket also holds every slower read
+  uint64_t read_latency[SQLITEDB_LATENCY_BUCKETS];
+  uint32_t cached_pages;
+  uint32_t pages;
+  uint32_t free_pages;
+  uint32_t tree_height;
+  uint32_t leaf_pages;
+  uint32_t internal_pages;
+  uint64_t rows;
+  // The fraction of the cells in leaves, and of the keys in internal nodes,
+  // that are in use
+  double leaf_fill;
+  double internal_fill;
+  uint64_t splits;
+} SqliteStats;
+
+// The work of the calling thread since sqlitedb_profile_reset, filled in by
+// sqlitedb_profile. The scan workers of its statements are included.
+typedef struct {
+  uint64_t pages_read;
+  uint64_t pages_written;
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t io_wait_ns;
+  uint64_t rows_examined;
+  // Time spent in each phase, measured only while profiling is enabled
+  uint64_t phase_ns[SQLITEDB_PHASES];
+} SqliteProfile;
+
+SQLITEDB_API const char *sqlitedb_version(void);
+
+SQLITEDB_API int sqlitedb_open(const char *filename, SqliteDb **db);
+SQLITEDB_API int sqlitedb_open_v2(const char *filename, int flags,
+                                  SqliteDb **db);
+SQLITEDB_API void sqlitedb_close(SqliteDb *db);
+SQLITEDB_API const char *sqlitedb_errmsg(SqliteDb *db);
+SQLITEDB_API int sqlitedb_stats(SqliteDb *db, SqliteStats *stats);
+SQLITEDB_API int sqlitedb_slow_log(SqliteDb *db, const char *filename,
+                                   int64_t threshold_us);
+
+SQLITEDB_API int sqlitedb_prepare(SqliteDb *db, const char *sql,
+                                  SqliteStmt **stmt);
+SQLITEDB_API int sqlitedb_bind_int(SqliteStmt *stmt, int index,
+                                   int64_t value);
+SQLITEDB_API int sqlitedb_bind_text(SqliteStmt *stmt, int index,
+                                    const char *value);
+SQLITEDB_API int sqlitedb_step(SqliteStmt *stmt);
+SQLITEDB_API int sqlitedb_stmt_isexplain(SqliteStmt *stmt);
+SQLITEDB_API int sqlitedb_column_count(SqliteStmt *stmt);
+SQLITEDB_API int sqlitedb_column_type(SqliteStmt *stmt, int column);
+SQLITEDB_API int64_t sqlitedb_column_int(SqliteStmt *stmt, int column);
+SQLITEDB_API const char *sqlitedb_column_text(SqliteStmt *stmt, int column);
+SQLITEDB_API int sqlitedb_reset(SqliteStmt *stmt);
+SQLITEDB_API void sqlitedb_finalize(SqliteStmt *stmt);
+
+SQLITEDB_API int sqlitedb_cursor_open(SqliteDb *db, uint32_t key,
+                                      SqliteCursor **cursor);
+SQLITEDB_API int sqlitedb_cursor_next(SqliteCursor *cursor);
+SQLITEDB_API uint32_t sqlitedb_cursor_id(SqliteCursor *cursor);
+SQLITEDB_API const char *sqlitedb_cursor_username(SqliteCursor *cursor);
+SQLITEDB_API const char *sqlitedb_cursor_email(SqliteCursor *cursor);
+SQLITEDB_API void sqlitedb_cursor_close(SqliteCursor *cursor);
+
+SQLITEDB_API int sqlitedb_async_open(SqliteDb *db, SqliteAsync **async);
+SQLITEDB_API int sqlitedb_async_fd(SqliteAsync *async);
+SQLITEDB_API int sqlitedb_async_get(SqliteAsync *async, uint32_t key,
+                                    SqliteAsyncCallback callback,
+                                    void *context);
+SQLITEDB_API int sqlitedb_async_scan(SqliteAsync *async,
+                                     SqliteAsyncCallback callback,
+                                     void *context);
+SQLITEDB_API int sqlitedb_async_poll(SqliteAsync *async, int wait);
+SQLITEDB_API void sqlitedb_async_close(SqliteAsync *async);
+
+SQLITEDB_API void sqlitedb_profile_enable(int enabled);
+SQLITEDB_API int sqlitedb_profile_enabled(void);
+SQLITEDB_API void sqlitedb_profile_reset(void);
+SQLITEDB_API void sqlitedb_profile_begin(int phase);
+SQLITEDB_API void sqlitedb_profile_end(void);
+SQLITEDB_API void sqlitedb_profile(SqliteProfile *profile);
+
+SQLITEDB_API int sqlitedb_import(SqliteDb *db, const char *filename,
+                                 char delimiter, uint64_t *num_rows,
+                                 uint64_t *num_skipped);
+SQLITEDB_API int sqlitedb_dump(SqliteDb *db, const char *filename,
+                               uint64_t *num_rows);
+SQLITEDB_API int sqlitedb_restore(SqliteDb *db, const char *filename,
+                                  uint64_t *num_rows);
+SQLITEDB_API int sqlitedb_backup(SqliteDb *db, const char *filename,
+                                 uint32_t pages_per_step);
+SQLITEDB_API int sqlitedb_compact(SqliteDb *db, uint32_t *pages_freed);
+SQLITEDB_API int sqlitedb_auto_compact(SqliteDb *db, int enabled);
+SQLITEDB_API int sqlitedb_vacuum(SqliteDb *db, int fill_percent,
+                                 uint32_t *old_num_pages,
+                                 uint32_t *new_num_pages);
+SQLITEDB_API int sqlitedb_idle(SqliteDb *db, uint32_t *backup_pages);
+SQLITEDB_API int sqlitedb_serve(SqliteDb *db, const char *address,
+                                const char *metrics_address);
+SQLITEDB_API int sqlitedb_print_tree(SqliteDb *db);
+SQLITEDB_API void sqlitedb_print_constants(void);
+
+#endif
@@ -0,0 +1,250 @@
+#include "statement.h"
+
+/*
+ * Notes a value word that is a "?", so a value bound to it later can be
+ * written straight into the field it was parsed into.
+ *
+ * The word itself is parsed as usual, so it stands in for the value until
+ * one is bound.
+ *
+ * Does not return a value.
+ */
+static void prepare_param(Statement *statement, const char *word,
+                          StatementParam param) {
+  if (strcmp(word, "?") == 0) {
+    statement->params[statement->num_params++] = param;
+  }
+}
+
+/*
+ * Parses "insert <id> <username> <email>", or the same with update.
+ *
+ * Returns the outcome of parsing.
+ */
+static PrepareResult prepare_row(char *text, Statement *statement,
+                                 StatementType type) {
+  statement->type = type;
+
+  char *position;
+  strtok_r(text, " ", &position);
+  char *id_string = strtok_r(NULL, " ", &position);
+  char *username = strtok_r(NULL, " ", &position);
+  char *email = strtok_r(NULL, " ", &position);
+
+  if (id_string == NULL || username == NULL || email == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  prepare_param(statement, id_string, STATEMENT_PARAM_ID);
+  prepare_param(statement, username, STATEMENT_PARAM_USERNAME);
+  prepare_param(statement, email, STATEMENT_PARAM_EMAIL);
+
+  int id = atoi(id_string);
+  if (id < 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+  if (strlen(username) > COLUMN_USERNAME_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  if (strlen(email) > COLUMN_EMAIL_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+
+  statement->row_to_insert.id = id;
+  strcpy(statement->row_to_insert.username, username);
+  strcpy(statement->row_to_insert.email, email);
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * Stores the name of a savepoint, which must be the last word of the
+ * statement. position is the strtok_r state of the words after it.
+ *
+ * Returns the outcome of parsing.
+ */
+static PrepareResult prepare_savepoint_name(char *name, char **position,
+                                            Statement *statement) {
+  if (name == NULL || strtok_r(NULL, " ", position) != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(name) > SAVEPOINT_NAME_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  prepare_param(statement, name, STATEMENT_PARAM_SAVEPOINT_NAME);
+
+  strcpy(statement->savepoint_name, name);
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * Parses begin, commit, rollback, savepoint, release and rollback to.
+ *
+ * Returns the outcome of parsing.
+ */
+static PrepareResult prepare_transaction(char *text, Statement *statement) {
+  char *position;
+  char *keyword = strtok_r(text, " ", &position);
+  char *argument = strtok_r(NULL, " ", &position);
+
+  if (strcmp(keyword, "savepoint") == 0) {
+    statement->type = STATEMENT_SAVEPOINT;
+    return prepare_savepoint_name(argument, &position, statement);
+  }
+  if (strcmp(keyword, "release") == 0) {
+    statement->type = STATEMENT_RELEASE;
+    return prepare_savepoint_name(argument, &position, statement);
+  }
+  if (strcmp(keyword, "rollback") == 0 && argument != NULL) {
+    if (strcmp(argument, "to") != 0) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->type = STATEMENT_ROLLBACK_TO;
+    return prepare_savepoint_name(strtok_r(NULL, " ", &position), &position,
+                                  statement);
+  }
+
+  if (argument != NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strcmp(keyword, "begin") == 0) {
+    statement->type = STATEMENT_BEGIN;
+  } else if (strcmp(keyword, "commit") == 0) {
+    statement->type = STATEMENT_COMMIT;
+  } else if (strcmp(keyword, "rollback") == 0) {
+    statement->type = STATEMENT_ROLLBACK;
+  } else {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * Parses "select [count(*)|sum(id)] [where <column> <=|<|> <value>]".
+ *
+ * Returns the outcome of parsing.
+ */
+static PrepareResult prepare_select(char *text, Statement *statement) {
+  statement->type = STATEMENT_SELECT;
+  ScanQuery *query = &statement->query;
+  query->aggregate = SCAN_ROWS;
+  query->filter_column = SCAN_COLUMN_NONE;
+
+  char *position;
+  char *keyword = strtok_r(text, " ", &position);
+  if (strcmp(keyword, "select") != 0) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  char *token = strtok_r(NULL, " ", &position);
+  if (token != NULL && strcmp(token, "count(*)") == 0) {
+    query->aggregate = SCAN_COUNT;
+    token = strtok_r(NULL, " ", &position);
+  } else if (token != NULL && strcmp(token, "sum(id)") == 0) {
+    query->aggregate = SCAN_SUM;
+    token = strtok_r(NULL, " ", &position);
+  }
+  if (token == NULL) {
+    return PREPARE_SUCCESS;
+  }
+
+  char *column = strtok_r(NULL, " ", &position);
+  char *comparison = strtok_r(NULL, " ", &position);
+  char *value = strtok_r(NULL, " ", &position);
+  if (strcmp(token, "where") != 0 || value == NULL ||
+      strtok_r(NULL, " ", &position) != NULL || strlen(comparison) != 1 ||
+      strchr("=<>", comparison[0]) == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  query->filter_operator = comparison[0];
+
+  if (strcmp(column, "id") == 0) {
+    int id = atoi(value);
+    if (id < 0) {
+      return PREPARE_NEGATIVE_ID;
+    }
+    query->filter_column = SCAN_COLUMN_ID;
+    query->filter_id = id;
+    prepare_param(statement, value, STATEMENT_PARAM_FILTER_ID);
+    return PREPARE_SUCCESS;
+  }
+
+  if (strcmp(column, "username") == 0) {
+    query->filter_column = SCAN_COLUMN_USERNAME;
+  } else if (strcmp(column, "email") == 0) {
+    query->filter_column = SCAN_COLUMN_EMAIL;
+  } else {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (strlen(value) > COLUMN_EMAIL_SIZE) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  strcpy(query->filter_value, value);
+  prepare_param(statement, value, STATEMENT_PARAM_FILTER_VALUE);
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * Parses "explain <statement>" or "explain analyze <statement>".
+ *
+ * Returns the outcome of parsing.
+ */
+static PrepareResult prepare_explain(char *text, Statement *statement) {
+  ExplainMode explain = EXPLAIN_PLAN;
+  text += strlen("explain ");
+  if (strncmp(text, "analyze ", 8) == 0) {
+    explain = EXPLAIN_ANALYZE;
+    text += strlen("analyze ");
+  }
+  if (strncmp(text, "explain", 7) == 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  PrepareResult result = prepare_statement(text, statement);
+  statement->explain = explain;
+  return result;
+}
+
+/*
+ * Parses a statement.
+ *
+ * Parameters:
+ * - text: The statement. It is split into words in place.
+ * - statement: Where to store the parsed statement.
+ *
+ * Safe to call from several threads at once. Each "?" value word is recorded
+ * in statement->params, see prepare_param.
+ *
+ * Returns PREPARE_SUCCESS, or why the statement could not be parsed.
+ */
+PrepareResult prepare_statement(char *text, Statement *statement) {
+  statement->explain = EXPLAIN_NONE;
+  statement->num_params = 0;
+  if (strncmp(text, "explain ", 8) == 0) {
+    return prepare_explain(text, statement);
+  }
+  if (strncmp(text, "insert", 6) == 0) {
+    return prepare_row(text, statement, STATEMENT_INSERT);
+  }
+  if (strncmp(text, "update", 6) == 0) {
+    return prepare_row(text, statement, STATEMENT_UPDATE);
+  }
+  if (strncmp(text, "select", 6) == 0) {
+    return prepare_select(text, statement);
+  }
+  if (strcmp(text, "analyze") == 0) {
+    statement->type = STATEMENT_ANALYZE;
+    return PREPARE_SUCCESS;
+  }
+  if (strncmp(text, "begin", 5) == 0 ||
+      strncmp(text, "commit", 6) == 0 ||
+      strncmp(text, "rollback", 8) == 0 ||
+      strncmp(text, "savepoint", 9) == 0 ||
+      strncmp(text, "release", 7) == 0) {
+    return prepare_transaction(text, statement);
+  }
+
+  return PREPARE_UNRECOGNIZED_STATEMENT;
+}
@@ -0,0 +1,8 @@
+#ifndef STATEMENT_H
+#define STATEMENT_H
+
+#include "constants.h"
+
+PrepareResult prepare_statement(char *text, Statement *statement);
+
+#endif
@@ -0,0 +1,454 @@
+#include "stats.h"
+#include "btree.h"
+#include "cow.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "table.h"
+
+/*
+ * Copies out a page at a snapshot, or as cached if snapshot is NULL.
+ *
+ * Does not return a value.
+ */
+static void stats_read_page(Table *table, Snapshot *snapshot,
+                            uint32_t page_num, void *destination) {
+  if (snapshot != NULL) {
+    pager_read_version(table->pager, page_num, snapshot->version, destination);
+  } else {
+    memcpy(destination, get_page(table->pager, page_num), PAGE_SIZE);
+  }
+}
+
+/*
+ * Adds a node and everything below it to the tree's statistics.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - snapshot: The snapshot to read the node at, or NULL to read the cached
+ * page.
+ * - page_num: The node's page.
+ * - depth: The node's depth, 0 for the root.
+ * - images: One page-sized buffer per level, to copy the nodes into.
+ * - stats: The statistics to add to.
+ *
+ * Does not return a value.
+ */
+static void tree_stats_node(Table *table, Snapshot *snapshot,
+                            uint32_t page_num, uint32_t depth, void **images,
+                            TreeStats *stats) {
+  void *node = images[depth];
+  stats_read_page(table, snapshot, page_num, node);
+
+  if (depth + 1 > stats->height) {
+    stats->height = depth + 1;
+  }
+  if (get_node_type(node) == NODE_LEAF) {
+    stats->num_leaves++;
+    stats->num_rows += *leaf_node_num_cells(node);
+    return;
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(node);
+  stats->num_internal_nodes++;
+  stats->num_internal_keys += num_keys;
+  // The copy is overwritten by the children, so their page numbers go first
+  uint32_t children[INTERNAL_NODE_MAX_KEYS + 1];
+  for (uint32_t i = 0; i < num_keys; i++) {
+    children[i] = *internal_node_child(node, i);
+  }
+  children[num_keys] = *internal_node_right_child(node);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    tree_stats_node(table, snapshot, children[i], depth + 1, images, stats);
+  }
+}
+
+/*
+ * Measures the shape of the tree.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - stats: Set to the height of the tree, its number of leaves and internal
+ * nodes and the rows and keys they hold, and the number of pages in the file
+ * that are not part of the tree.
+ *
+ * Every node is visited. Outside a transaction the tree is read at a
+ * snapshot, so this is safe alongside a writer; inside one it is read as the
+ * transaction has left it. Fill factors follow from the counts, against
+ * LEAF_NODE_MAX_CELLS and INTERNAL_NODE_MAX_KEYS.
+ *
+ * Does not return a value.
+ */
+void tree_stats(Table *table, TreeStats *stats) {
+  memset(stats, 0, sizeof(TreeStats));
+
+  Snapshot *snapshot = NULL;
+  uint32_t root_page_num = table->root_page_num;
+  if (!table_in_transaction(table)) {
+    snapshot = snapshot_open(table);
+    root_page_num = snapshot->root_page_num;
+  }
+  stats->num_pages = __atomic_load_n(&table->pager->num_pages, __ATOMIC_ACQUIRE);
+
+  void *images[TABLE_MAX_HEIGHT];
+  for (uint32_t i = 0; i < TABLE_MAX_HEIGHT; i++) {
+    images[i] = malloc(PAGE_SIZE);
+  }
+  tree_stats_node(table, snapshot, root_page_num, 0, images, stats);
+  for (uint32_t i = 0; i < TABLE_MAX_HEIGHT; i++) {
+    free(images[i]);
+  }
+  if (snapshot != NULL) {
+    snapshot_close(snapshot);
+  }
+
+  // Free pages are on the freelist or, in copy-on-write mode, waiting to be
+  // reused; either way they hold no part of the tree
+  uint32_t num_used = stats->num_leaves + stats->num_internal_nodes +
+                      (table->cow != NULL ? COW_NUM_META_PAGES : 0);
+  stats->num_free_pages =
+      stats->num_pages > num_used ? stats->num_pages - num_used : 0;
+}
+
+/*
+ * Orders rows by username, for counting distinct usernames.
+ */
+static int stats_compare_usernames(const void *a, const void *b) {
+  return strcmp(((const Row *)a)->username, ((const Row *)b)->username);
+}
+
+/*
+ * Orders rows by email, for counting distinct emails.
+ */
+static int stats_compare_emails(const void *a, const void *b) {
+  return strcmp(((const Row *)a)->email, ((const Row *)b)->email);
+}
+
+/*
+ * Estimates the number of distinct values of a column from a sample.
+ *
+ * Parameters:
+ * - rows: The sampled rows.
+ * - num_sampled: The number of sampled rows.
+ * - num_rows: The number of rows in the table.
+ * - compare: Orders rows by the column. The rows are sorted with it.
+ *
+ * This is the Duj1 estimator of Haas and Stokes: values seen once in the
+ * sample are taken to stand for many more in the table, values seen more
+ * than once to have been seen already. When the sample is the whole table it
+ * is the exact count.
+ *
+ * Returns the estimate.
+ */
+static uint64_t stats_distinct(Row *rows, uint32_t num_sampled,
+                               uint64_t num_rows,
+                               int (*compare)(const void *, const void *)) {
+  if (num_sampled == 0) {
+    return 0;
+  }
+  qsort(rows, num_sampled, sizeof(Row), compare);
+
+  uint64_t num_distinct = 0;
+  uint64_t num_singletons = 0;
+  for (uint32_t i = 0; i < num_sampled;) {
+    uint32_t j = i + 1;
+    while (j < num_sampled && compare(&rows[i], &rows[j]) == 0) {
+      j++;
+    }
+    num_distinct++;
+    num_singletons += j - i == 1;
+    i = j;
+  }
+
+  double n = num_sampled;
+  double estimate =
+      n * num_distinct /
+      (n - num_singletons + num_singletons * n / (double)num_rows);
+  return estimate > num_rows ? num_rows : (uint64_t)(estimate + 0.5);
+}
+
+/*
+ * Builds the planner's statistics for a table, from all of its leaves or
+ * from a sample of them.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - max_leaves: The most leaves to read; UINT32_MAX reads them all, which is
+ * what analyze does.
+ *
+ * Every internal node is read to find the leaves, which are then sampled at
+ * even intervals, always including the first and the last so that the range
+ * of ids is exact. The row count is scaled up from the sample, the histogram
+ * is cut from the sampled ids, which come out in key order, and the distinct
+ * counts are estimated by stats_distinct. Like tree_stats, the tree is read
+ * at a snapshot outside a transaction. Inside one, the statistics include
+ * the rows it has inserted so far, and are thrown away if it rolls back.
+ *
+ * Does not return a value.
+ */
+void table_stats_build(Table *table, uint32_t max_leaves) {
+  TableStats stats;
+  memset(&stats, 0, sizeof(TableStats));
+
+  Snapshot *snapshot = NULL;
+  uint32_t root_page_num = table->root_page_num;
+  if (!table_in_transaction(table)) {
+    snapshot = snapshot_open(table);
+    root_page_num = snapshot->root_page_num;
+  }
+  void *node = malloc(PAGE_SIZE);
+
+  // One level of the tree at a time, down to the leaves
+  uint32_t *level = malloc(sizeof(uint32_t));
+  uint32_t level_size = 1;
+  level[0] = root_page_num;
+  while (true) {
+    stats_read_page(table, snapshot, level[0], node);
+    stats.height++;
+    if (get_node_type(node) == NODE_LEAF) {
+      break;
+    }
+
+    uint32_t *children = NULL;
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i < level_size; i++) {
+      stats_read_page(table, snapshot, level[i], node);
+      uint32_t num_keys = *internal_node_num_keys(node);
+      children =
+          realloc(children, (num_children + num_keys + 1) * sizeof(uint32_t));
+      for (uint32_t j = 0; j < num_keys; j++) {
+        children[num_children++] = *internal_node_child(node, j);
+      }
+      children[num_children++] = *internal_node_right_child(node);
+    }
+    stats.num_internal_nodes += level_size;
+    free(level);
+    level = children;
+    level_size = num_children;
+  }
+  stats.num_leaves = level_size;
+
+  uint32_t num_chosen = level_size < max_leaves ? level_size : max_leaves;
+  if (num_chosen < 2) {
+    num_chosen = level_size;
+  }
+  Row *rows = malloc((uint64_t)num_chosen * LEAF_NODE_MAX_CELLS * sizeof(Row));
+  uint32_t *ids = malloc((uint64_t)num_chosen * LEAF_NODE_MAX_CELLS *
+                         sizeof(uint32_t));
+  uint32_t num_sampled = 0;
+  for (uint32_t i = 0; i < num_chosen; i++) {
+    uint32_t leaf = num_chosen == level_size
+                        ? i
+                        : (uint64_t)i * (level_size - 1) / (num_chosen - 1);
+    stats_read_page(table, snapshot, level[leaf], node);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t j = 0; j < num_cells; j++) {
+      deserialize_row(leaf_node_value(node, j), &rows[num_sampled]);
+      ids[num_sampled++] = *leaf_node_key(node, j);
+    }
+  }
+  free(level);
+  free(node);
+  if (snapshot != NULL) {
+    snapshot_close(snapshot);
+  }
+
+  stats.built = true;
+  stats.num_rows =
+      num_chosen == 0 ? 0
+                      : (uint64_t)num_sampled * stats.num_leaves / num_chosen;
+  if (num_sampled > 0) {
+    stats.min_id = ids[0];
+    stats.max_id = ids[num_sampled - 1];
+    stats.num_buckets = num_sampled < STATS_HISTOGRAM_BUCKETS
+                            ? num_sampled
+                            : STATS_HISTOGRAM_BUCKETS;
+    for (uint32_t i = 0; i < stats.num_buckets; i++) {
+      stats.histogram[i] =
+          ids[(uint64_t)(i + 1) * num_sampled / stats.num_buckets - 1];
+    }
+  }
+  stats.distinct_usernames = stats_distinct(rows, num_sampled, stats.num_rows,
+                                            stats_compare_usernames);
+  stats.distinct_emails = stats_distinct(rows, num_sampled, stats.num_rows,
+                                         stats_compare_emails);
+  stats.built_num_rows = stats.num_rows;
+  free(rows);
+  free(ids);
+
+  pthread_mutex_lock(&table->stats_lock);
+  table->stats = stats;
+  if (snapshot == NULL) {
+    table->stats_uncommitted = true;
+    memset(&table->pending_rows, 0, sizeof(PendingRows));
+  }
+  pthread_mutex_unlock(&table->stats_lock);
+}
+
+/*
+ * Copies out the planner's statistics for a table, first building them from
+ * a sample if there are none or if more than STATS_RESAMPLE_PERCENT of the
+ * rows have been inserted since they were built.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - stats: Set to the statistics.
+ *
+ * Does not return a value.
+ */
+void table_stats_get(Table *table, TableStats *stats) {
+  pthread_mutex_lock(&table->stats_lock);
+  bool stale = !table->stats.built ||
+               table->stats.num_inserted * 100 >
+                   table->stats.built_num_rows * STATS_RESAMPLE_PERCENT;
+  pthread_mutex_unlock(&table->stats_lock);
+
+  if (stale) {
+    table_stats_build(table, STATS_SAMPLE_LEAVES);
+  }
+  pthread_mutex_lock(&table->stats_lock);
+  *stats = table->stats;
+  pthread_mutex_unlock(&table->stats_lock);
+}
+
+/*
+ * Keeps the row count and the range of ids up to date after rows are
+ * inserted.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - num_rows: The number of rows inserted.
+ * - min_id: The smallest id inserted.
+ * - max_id: The largest id inserted.
+ *
+ * Rows inserted inside a transaction are set aside in table->pending_rows
+ * until it commits, so a rollback leaves the statistics as they were.
+ *
+ * Does not return a value.
+ */
+void table_stats_add_rows(Table *table, uint64_t num_rows, uint32_t min_id,
+                          uint32_t max_id) {
+  if (table_in_transaction(table)) {
+    PendingRows *pending = &table->pending_rows;
+    if (pending->num_rows == 0 || min_id < pending->min_id) {
+      pending->min_id = min_id;
+    }
+    if (pending->num_rows == 0 || max_id > pending->max_id) {
+      pending->max_id = max_id;
+    }
+    pending->num_rows += num_rows;
+    return;
+  }
+
+  pthread_mutex_lock(&table->stats_lock);
+  TableStats *stats = &table->stats;
+  if (stats->built) {
+    if (stats->num_rows == 0 || min_id < stats->min_id) {
+      stats->min_id = min_id;
+    }
+    if (stats->num_rows == 0 || max_id > stats->max_id) {
+      stats->max_id = max_id;
+    }
+    stats->num_rows += num_rows;
+    stats->num_inserted += num_rows;
+  }
+  pthread_mutex_unlock(&table->stats_lock);
+}
+
+/*
+ * Adds the rows a transaction inserted to the statistics, once it has
+ * committed.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - inserted: The rows set aside while the transaction ran, see
+ * table_stats_add_rows.
+ *
+ * Does not return a value.
+ */
+void table_stats_commit(Table *table, const PendingRows *inserted) {
+  if (inserted->num_rows > 0) {
+    table_stats_add_rows(table, inserted->num_rows, inserted->min_id,
+                         inserted->max_id);
+  }
+}
+
+/*
+ * Forgets the rows set aside since a savepoint, as the transaction rolls back
+ * to it.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - savepoint: The index of the savepoint, or -1 for the whole transaction.
+ *
+ * Statistics built inside the transaction may count the rows being rolled
+ * back, so they are thrown away.
+ *
+ * Does not return a value.
+ */
+void table_stats_rollback(Table *table, int savepoint) {
+  if (table->stats_uncommitted) {
+    table_stats_invalidate(table);
+  }
+  if (savepoint == -1) {
+    memset(&table->pending_rows, 0, sizeof(PendingRows));
+  } else {
+    table->pending_rows = table->savepoint_pending_rows[savepoint];
+  }
+}
+
+/*
+ * Throws away the planner's statistics for a table whose tree was rebuilt,
+ * so they are built again when next needed.
+ *
+ * Does not return a value.
+ */
+void table_stats_invalidate(Table *table) {
+  pthread_mutex_lock(&table->stats_lock);
+  table->stats.built = false;
+  pthread_mutex_unlock(&table->stats_lock);
+}
+
+/*
+ * Estimates the fraction of a table's rows whose id is below a key.
+ *
+ * Parameters:
+ * - stats: The table's statistics.
+ * - key: The key.
+ *
+ * Each bucket of the histogram holds an equal share of the rows, spread
+ * evenly between the bucket below's largest id and its own; the first bucket
+ * starts at the smallest id. Ids inserted beyond the histogram since it was
+ * built count as one more bucket running up to the largest id.
+ *
+ * Returns a fraction from 0 to 1.
+ */
+double table_stats_fraction_below(const TableStats *stats, uint32_t key) {
+  if (stats->num_rows == 0 || stats->num_buckets == 0 || key <= stats->min_id) {
+    return 0;
+  }
+  if (key > stats->max_id) {
+    return 1;
+  }
+
+  // The share of the rows in the histogram
+  double histogram_share =
+      stats->built_num_rows >= stats->num_rows
+          ? 1
+          : (double)stats->built_num_rows / stats->num_rows;
+  double bucket_share = histogram_share / stats->num_buckets;
+  double low = (double)stats->min_id - 1;
+  for (uint32_t i = 0; i < stats->num_buckets; i++) {
+    double high = stats->histogram[i];
+    if (key <= high) {
+      double below = high > low ? (key - 1 - low) / (high - low) : 0;
+      return bucket_share * (i + (below > 0 ? below : 0));
+    }
+    low = high;
+  }
+
+  double high = stats->max_id;
+  double below = high > low ? (key - 1 - low) / (high - low) : 1;
+  return histogram_share + (1 - histogram_share) * below;
+}
@@ -0,0 +1,21 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "constants.h"
+
+// Leaves read to build the planner's statistics when analyze has not been run
+#define STATS_SAMPLE_LEAVES 32
+// The statistics are built again once this many more rows have been inserted
+#define STATS_RESAMPLE_PERCENT 20
+
+void tree_stats(Table *table, TreeStats *stats);
+void table_stats_build(Table *table, uint32_t max_leaves);
+void table_stats_get(Table *table, TableStats *stats);
+void table_stats_add_rows(Table *table, uint64_t num_rows, uint32_t min_id,
+                          uint32_t max_id);
+void table_stats_commit(Table *table, const PendingRows *inserted);
+void table_stats_rollback(Table *table, int savepoint);
+void table_stats_invalidate(Table *table);
+double table_stats_fraction_below(const TableStats *stats, uint32_t key);
+
+#endif
@@ -0,0 +1,311 @@
+#include "table.h"
+#include "backup.h"
+#include "btree.h"
+#include "cow.h"
+#include "cursor.h"
+#include "node.h"
+#include "pager.h"
+#include "serialize.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "transaction.h"
+#include "wal.h"
+
+/*
+ * Opens a database file as a table.
+ *
+ * Parameters:
+ * - filename: The name of the database file.
+ * - error: Where to write why the file could not be opened, at most
+ * SQLITEDB_ERRMSG_SIZE bytes.
+ *
+ * An empty file is given a root page that is an empty leaf. A copy-on-write
+ * database, see cow_format, finds its root through its meta pages instead.
+ *
+ * Returns a pointer to the new Table structure, or NULL, see pager_open.
+ */
+Table *db_open(const char *filename, char *error) {
+  Pager *pager = pager_open(filename, error);
+  if (pager == NULL) {
+    return NULL;
+  }
+
+  Table *table = malloc(sizeof(Table));
+  table->pager = pager;
+  table->root_page_num = 0;
+  table->backup = NULL;
+  table->compact_enabled = false;
+  table->compact_next_key = 0;
+  table->compact_pages_freed = 0;
+  pthread_mutex_init(&table->writer_lock, NULL);
+  table->snapshots = NULL;
+  pthread_mutex_init(&table->snapshot_lock, NULL);
+  memset(&table->stats, 0, sizeof(TableStats));
+  pthread_mutex_init(&table->stats_lock, NULL);
+  table->in_transaction = false;
+  table->num_savepoints = 0;
+  memset(&table->pending_rows, 0, sizeof(PendingRows));
+  table->stats_uncommitted = false;
+  table->num_readers = 0;
+  table->draining = false;
+  table->cow = NULL;
+  table->num_splits = 0;
+
+  if (pager->copy_on_write) {
+    cow_open(table);
+  } else if (pager->num_pages == 0) {
+    void *root_node = get_page(pager, 0);
+    pager_mark_dirty(pager, 0);
+    initialize_leaf_node(root_node);
+    set_node_root(root_node, true);
+    *node_parent(root_node) = 0;
+  }
+  table->published_root_page_num = table->root_page_num;
+
+  return table;
+}
+
+/*
+ * Closes a table, finishing any running backup and writing back every dirty
+ * page.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * A transaction that is still open is rolled back first. A backup that fails
+ * to finish leaves its destination as it was; there is no one left to tell.
+ *
+ * Does not return a value.
+ */
+void db_close(Table *table) {
+  if (table->in_transaction) {
+    transaction_rollback(table);
+  }
+  char error[SQLITEDB_ERRMSG_SIZE];
+  backup_finish(table, error);
+  pager_close(table->pager);
+  pthread_mutex_destroy(&table->writer_lock);
+  pthread_mutex_destroy(&table->snapshot_lock);
+  pthread_mutex_destroy(&table->stats_lock);
+  free(table->cow);
+  free(table);
+}
+
+/*
+ * Checks whether the calling thread has a transaction open on the table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Returns true if it does, false otherwise.
+ */
+bool table_in_transaction(Table *table) {
+  return table->in_transaction &&
+         pthread_equal(table->transaction_thread, pthread_self());
+}
+
+/*
+ * Registers a thread that reads the table without the writer_lock, such as
+ * table_get or an open snapshot.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Costs an atomic add, unless the pager is being replaced, see
+ * table_drain_readers, in which case the reader waits until it has been.
+ *
+ * Does not return a value.
+ */
+void table_begin_read(Table *table) {
+  while (true) {
+    __atomic_add_fetch(&table->num_readers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&table->draining, __ATOMIC_SEQ_CST)) {
+      return;
+    }
+    __atomic_sub_fetch(&table->num_readers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&table->draining, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+  }
+}
+
+/*
+ * Ends a read started with table_begin_read.
+ *
+ * Does not return a value.
+ */
+void table_end_read(Table *table) {
+  __atomic_sub_fetch(&table->num_readers, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Waits until no thread reads the table, and holds off new readers until
+ * table_resume_readers.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Must be called by the writer, with the writer_lock held, and never by a
+ * thread that has a snapshot or cursor of its own open. Meanwhile the writer
+ * may replace anything readers reach through the table, such as its pager.
+ *
+ * Does not return a value.
+ */
+void table_drain_readers(Table *table) {
+  __atomic_store_n(&table->draining, true, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&table->num_readers, __ATOMIC_SEQ_CST) > 0) {
+    sched_yield();
+  }
+}
+
+/*
+ * Lets readers held off by table_drain_readers carry on.
+ *
+ * Does not return a value.
+ */
+void table_resume_readers(Table *table) {
+  __atomic_store_n(&table->draining, false, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts a write to the table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Waits for any other writer, or another thread's transaction, to finish.
+ * Snapshot readers are not waited for. Inside the calling thread's own
+ * transaction, the write simply becomes part of it.
+ *
+ * Does not return a value.
+ */
+void table_begin_write(Table *table) {
+  if (table_in_transaction(table)) {
+    return;
+  }
+  pthread_mutex_lock(&table->writer_lock);
+}
+
+/*
+ * Ends a write started with table_begin_write, committing it to the
+ * write-ahead log, or the meta page in copy-on-write mode, and publishing its
+ * changes to snapshots opened from now on.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Inside a transaction nothing happens until the transaction commits.
+ *
+ * Does not return a value.
+ */
+void table_end_write(Table *table) {
+  if (table_in_transaction(table)) {
+    return;
+  }
+  if (table->cow != NULL) {
+    cow_commit(table);
+  } else {
+    wal_commit(table->pager);
+  }
+  uint64_t oldest_version = snapshot_publish(table);
+  if (table->cow != NULL) {
+    cow_reclaim(table, oldest_version);
+  }
+  pthread_mutex_unlock(&table->writer_lock);
+}
+
+/*
+ * Inserts a row into the table.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - row: The row to insert; its id is the key.
+ *
+ * The insert is a write of its own, so callers on any thread may use it, and
+ * it is durable and visible to snapshots as soon as it returns, unless the
+ * calling thread has a transaction open. Readers are held up only on the
+ * nodes the insert locks, see table_find_for_update. Copy-on-write tables
+ * lock nothing readers can reach, see cow_insert.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_DUPLICATE_KEY if the key is already in the
+ * table, or EXECUTE_TABLE_FULL if a split could need more pages than the pager
+ * can hold.
+ */
+ExecuteResult table_insert(Table *table, Row *row) {
+  if (table->cow != NULL) {
+    ExecuteResult result = cow_insert(table, row);
+    if (result == EXECUTE_SUCCESS) {
+      table_stats_add_rows(table, 1, row->id, row->id);
+    }
+    return result;
+  }
+
+  table_begin_write(table);
+  Cursor *cursor = table_find_for_update(table, row->id);
+
+  void *node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  if (cursor->cell_num < num_cells) {
+    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+    if (key_at_index == row->id) {
+      cursor_close(cursor);
+      table_end_write(table);
+      return EXECUTE_DUPLICATE_KEY;
+    }
+  }
+
+  // A split may need a new page on every level, plus a new root
+  if (table->pager->num_pages + TABLE_MAX_HEIGHT + 1 > TABLE_MAX_PAGES) {
+    cursor_close(cursor);
+    table_end_write(table);
+    return EXECUTE_TABLE_FULL;
+  }
+
+  leaf_node_insert(cursor, row->id, row);
+  cursor_close(cursor);
+  table_end_write(table);
+  table_stats_add_rows(table, 1, row->id, row->id);
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Replaces the row stored under an existing key.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - row: The new row; its id is the key.
+ *
+ * Like table_insert, the update is a write of its own. The tree keeps its
+ * shape, so only the leaf is locked, and only while the row is overwritten.
+ * Copy-on-write tables copy the path instead, see cow_update.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_NO_SUCH_KEY if the key is not in the
+ * table.
+ */
+ExecuteResult table_update(Table *table, Row *row) {
+  if (table->cow != NULL) {
+    return cow_update(table, row);
+  }
+
+  table_begin_write(table);
+  Cursor *cursor = table_find(table, row->id);
+  void *node = get_page(table->pager, cursor->page_num);
+
+  if (cursor->cell_num >= *leaf_node_num_cells(node) ||
+      *leaf_node_key(node, cursor->cell_num) != row->id) {
+    cursor_close(cursor);
+    table_end_write(table);
+    return EXECUTE_NO_SUCH_KEY;
+  }
+
+  pager_mark_dirty(table->pager, cursor->page_num);
+  node_lock(node);
+  serialize_row(row, leaf_node_value(node, cursor->cell_num));
+  node_unlock(node);
+  cursor_close(cursor);
+  table_end_write(table);
+
+  return EXECUTE_SUCCESS;
+}
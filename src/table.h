@@ -0,0 +1,18 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include "constants.h"
+
+Table *db_open(const char *filename, char *error);
+void db_close(Table *table);
+bool table_in_transaction(Table *table);
+void table_begin_read(Table *table);
+void table_end_read(Table *table);
+void table_drain_readers(Table *table);
+void table_resume_readers(Table *table);
+void table_begin_write(Table *table);
+void table_end_write(Table *table);
+ExecuteResult table_insert(Table *table, Row *row);
+ExecuteResult table_update(Table *table, Row *row);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "constants.h"
+
+/*
+ * Static tracepoints, for perf, bpftrace and other USDT consumers. Building
+ * with USDT=1 compiles each one to a single nop plus a note in the binary
+ * saying where it is and where its arguments live, so a probe costs nothing
+ * until something attaches to it. Otherwise the probes compile to nothing and
+ * their arguments are not evaluated.
+ *
+ * Probes of the provider sqlitedb:
+ * - page__miss(page_num): get_page did not find the page in the cache.
+ * - page__read(page_num, elapsed_ns): a miss read the page from the file.
+ * - page__flush(page_num): pager_flush wrote a page to the file.
+ * - leaf__split(page_num, new_page_num, key): leaf_node_split_and_insert
+ * split a full leaf to take key.
+ * - internal__split(page_num, new_page_num): internal_node_split_and_insert
+ * split a full internal node.
+ * - new__root(root_page_num, left_page_num, right_page_num): create_new_root
+ * grew the tree by a level; the old root was copied to left_page_num.
+ * Copy-on-write databases split nodes on their own path and fire neither.
+ * - statement__start(sql): a statement started running.
+ * - statement__done(sql, result): it finished, with a SQLITEDB_ result code.
+ *
+ * For example, to see which pages a slow statement read:
+ *   bpftrace -e 'usdt:./main:sqlitedb:page__read { @[arg0] = hist(arg1); }'
+ */
+#ifdef SQLITEDB_USDT
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(sqlitedb, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(sqlitedb, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(sqlitedb, name, a, b, c)
+#else
+#define TRACE_PROBE1(name, a) ((void)sizeof(a))
+#define TRACE_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define TRACE_PROBE3(name, a, b, c)                                            \
+  ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
+
+#endif
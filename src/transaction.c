@@ -0,0 +1,332 @@
+#include "transaction.h"
+#include "cow.h"
+#include "node.h"
+#include "pager.h"
+#include "stats.h"
+#include "table.h"
+
+/*
+ * Puts a page back the way an undo log entry recorded it.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ * - entry: The undo log entry to apply.
+ *
+ * The node is locked while it is overwritten, and keeps its own version
+ * counter rather than the one in the saved image, so optimistic readers see
+ * the restore as just another write.
+ *
+ * Does not return a value.
+ */
+static void transaction_restore_page(Pager *pager, UndoEntry *entry) {
+  void *page = get_page(pager, entry->page_num);
+
+  node_lock(page);
+  uint32_t version = *node_version(page);
+  memcpy(page, entry->image, PAGE_SIZE);
+  *node_version(page) = version;
+  node_unlock(page);
+
+  pager->dirty[entry->page_num] = true;
+  pager->page_write_counters[entry->page_num] = ++pager->write_counter;
+}
+
+/*
+ * Undoes every change made at or below a savepoint depth.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - depth: The depth to roll back to. The transaction itself is depth 1, and
+ * each savepoint adds one.
+ * - num_pages: The number of pages the database had when that depth began.
+ *
+ * Entries are applied newest first, so a page changed at several depths ends
+ * up as it was before the oldest of those changes. Pages added since are
+ * dropped.
+ *
+ * Does not return a value.
+ */
+static void transaction_undo(Table *table, uint32_t depth, uint32_t num_pages) {
+  Pager *pager = table->pager;
+
+  while (pager->undo_log_length > 0 &&
+         pager->undo_log[pager->undo_log_length - 1].depth >= depth) {
+    UndoEntry *entry = &pager->undo_log[--pager->undo_log_length];
+    if (entry->page_num < num_pages) {
+      transaction_restore_page(pager, entry);
+    }
+    pager->undo_depths[entry->page_num] = 0;
+    free(entry->image);
+  }
+
+  if (pager->num_pages > num_pages) {
+    pager_truncate(pager, num_pages);
+  }
+}
+
+/*
+ * Ends the transaction, dropping its undo log.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Does not return a value.
+ */
+static void transaction_end(Table *table) {
+  Pager *pager = table->pager;
+
+  for (uint32_t i = 0; i < pager->undo_log_length; i++) {
+    pager->undo_depths[pager->undo_log[i].page_num] = 0;
+    free(pager->undo_log[i].image);
+  }
+  pager->undo_log_length = 0;
+  pager->undo_depth = 0;
+
+  table->num_savepoints = 0;
+  memset(&table->pending_rows, 0, sizeof(PendingRows));
+  table->stats_uncommitted = false;
+  table->in_transaction = false;
+}
+
+/*
+ * Finds the most recent savepoint with a given name.
+ *
+ * Returns its index, or -1 if there is none.
+ */
+static int transaction_find_savepoint(Table *table, const char *name) {
+  for (int i = (int)table->num_savepoints - 1; i >= 0; i--) {
+    if (strcmp(table->savepoint_names[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Starts a transaction.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * The transaction holds the table's writer_lock until it commits or rolls
+ * back, so statements from this thread run inside it while other writers
+ * wait. Readers are not affected; snapshots see none of its changes until it
+ * commits.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_TRANSACTION_ACTIVE if one is already
+ * running on this thread.
+ */
+ExecuteResult transaction_begin(Table *table) {
+  if (table_in_transaction(table)) {
+    return EXECUTE_TRANSACTION_ACTIVE;
+  }
+
+  pthread_mutex_lock(&table->writer_lock);
+  table->in_transaction = true;
+  table->transaction_thread = pthread_self();
+  table->transaction_num_pages = table->pager->num_pages;
+  table->num_savepoints = 0;
+  // Copy-on-write never changes committed pages, so has nothing to undo
+  table->pager->undo_depth = table->cow == NULL ? 1 : 0;
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Commits the transaction.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Every page the transaction changed goes to the write-ahead log with a
+ * single fsync, then the changes are published to new snapshots, and the
+ * rows it inserted to the planner's statistics.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_NO_TRANSACTION.
+ */
+ExecuteResult transaction_commit(Table *table) {
+  if (!table_in_transaction(table)) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+
+  PendingRows inserted = table->pending_rows;
+  transaction_end(table);
+  table_end_write(table);
+  table_stats_commit(table, &inserted);
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Rolls the transaction back, undoing all of its changes.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ *
+ * Returns EXECUTE_SUCCESS, or EXECUTE_NO_TRANSACTION.
+ */
+ExecuteResult transaction_rollback(Table *table) {
+  if (!table_in_transaction(table)) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+
+  if (table->cow != NULL) {
+    cow_rollback(table);
+  } else {
+    transaction_undo(table, 1, table->transaction_num_pages);
+  }
+  table_stats_rollback(table, -1);
+  transaction_end(table);
+  pthread_mutex_unlock(&table->writer_lock);
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Marks a point in the transaction that it can later be rolled back to.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - name: The name of the savepoint. Names may repeat; the most recent one
+ * wins.
+ *
+ * Savepoints rely on the undo log, which copy-on-write tables do not keep.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_NO_TRANSACTION,
+ * EXECUTE_TOO_MANY_SAVEPOINTS, or EXECUTE_NOT_SUPPORTED.
+ */
+ExecuteResult transaction_savepoint(Table *table, const char *name) {
+  if (!table_in_transaction(table)) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+  if (table->cow != NULL) {
+    return EXECUTE_NOT_SUPPORTED;
+  }
+  if (table->num_savepoints == TRANSACTION_MAX_SAVEPOINTS) {
+    return EXECUTE_TOO_MANY_SAVEPOINTS;
+  }
+
+  uint32_t index = table->num_savepoints++;
+  strcpy(table->savepoint_names[index], name);
+  table->savepoint_num_pages[index] = table->pager->num_pages;
+  table->savepoint_pending_rows[index] = table->pending_rows;
+  table->pager->undo_depth = index + 2;
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Forgets a savepoint, and every savepoint made after it, keeping their
+ * changes as part of the enclosing transaction or savepoint.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - name: The name of the savepoint.
+ *
+ * The undo log entries made since the savepoint are handed down to the
+ * enclosing depth, so rolling that back still undoes them.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_NO_TRANSACTION, or
+ * EXECUTE_NO_SUCH_SAVEPOINT.
+ */
+ExecuteResult transaction_release(Table *table, const char *name) {
+  if (!table_in_transaction(table)) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+  int index = transaction_find_savepoint(table, name);
+  if (index == -1) {
+    return EXECUTE_NO_SUCH_SAVEPOINT;
+  }
+
+  Pager *pager = table->pager;
+  uint32_t depth = index + 1;
+  for (uint32_t i = 0; i < pager->undo_log_length; i++) {
+    UndoEntry *entry = &pager->undo_log[i];
+    if (entry->depth > depth) {
+      entry->depth = depth;
+    }
+    if (pager->undo_depths[entry->page_num] > depth) {
+      pager->undo_depths[entry->page_num] = depth;
+    }
+  }
+  table->num_savepoints = index;
+  pager->undo_depth = depth;
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Undoes the changes made since a savepoint, keeping the savepoint.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - name: The name of the savepoint.
+ *
+ * Savepoints made after it are forgotten. The transaction stays open.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_NO_TRANSACTION, or
+ * EXECUTE_NO_SUCH_SAVEPOINT.
+ */
+ExecuteResult transaction_rollback_to(Table *table, const char *name) {
+  if (!table_in_transaction(table)) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+  int index = transaction_find_savepoint(table, name);
+  if (index == -1) {
+    return EXECUTE_NO_SUCH_SAVEPOINT;
+  }
+
+  transaction_undo(table, index + 2, table->savepoint_num_pages[index]);
+  table_stats_rollback(table, index);
+  table->num_savepoints = index + 1;
+  table->pager->undo_depth = index + 2;
+
+  return EXECUTE_SUCCESS;
+}
+
+/*
+ * Starts a write that is kept whole or undone whole, such as an import that
+ * may run out of room partway.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - nested: Set to whether the write runs inside the caller's transaction.
+ *
+ * Outside a transaction, the write gets a transaction of its own. Inside one,
+ * it gets a savepoint, see TRANSACTION_ATOMIC_SAVEPOINT, so undoing it keeps
+ * the transaction's earlier changes.
+ *
+ * Returns EXECUTE_SUCCESS, or the error of transaction_savepoint.
+ */
+ExecuteResult transaction_begin_atomic(Table *table, bool *nested) {
+  *nested = table_in_transaction(table);
+  if (*nested) {
+    return transaction_savepoint(table, TRANSACTION_ATOMIC_SAVEPOINT);
+  }
+  return transaction_begin(table);
+}
+
+/*
+ * Ends a write started with transaction_begin_atomic.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - nested: As set by transaction_begin_atomic.
+ * - keep: Whether to keep the write, or undo all of it.
+ *
+ * Does not return a value.
+ */
+void transaction_end_atomic(Table *table, bool nested, bool keep) {
+  if (!nested) {
+    if (keep) {
+      transaction_commit(table);
+    } else {
+      transaction_rollback(table);
+    }
+    return;
+  }
+  if (!keep) {
+    transaction_rollback_to(table, TRANSACTION_ATOMIC_SAVEPOINT);
+  }
+  transaction_release(table, TRANSACTION_ATOMIC_SAVEPOINT);
+}
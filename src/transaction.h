@@ -0,0 +1,19 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include "constants.h"
+
+// The savepoint behind a write done whole or not at all inside a
+// transaction; statements split names at spaces, so none can name it
+#define TRANSACTION_ATOMIC_SAVEPOINT "atomic write"
+
+ExecuteResult transaction_begin(Table *table);
+ExecuteResult transaction_commit(Table *table);
+ExecuteResult transaction_rollback(Table *table);
+ExecuteResult transaction_savepoint(Table *table, const char *name);
+ExecuteResult transaction_release(Table *table, const char *name);
+ExecuteResult transaction_rollback_to(Table *table, const char *name);
+ExecuteResult transaction_begin_atomic(Table *table, bool *nested);
+void transaction_end_atomic(Table *table, bool nested, bool keep);
+
+#endif
@@ -0,0 +1,182 @@
+#include "vacuum.h"
+#include "backup.h"
+#include "btree.h"
+#include "cursor.h"
+#include "pager.h"
+#include "serialize.h"
+#include "stats.h"
+#include "table.h"
+#include "wal.h"
+
+/*
+ * Syncs the directory that holds a file, so that a rename into that directory
+ * survives a crash.
+ */
+static void fsync_directory(const char *filename) {
+  char *directory = strdup(filename);
+  char *slash = strrchr(directory, '/');
+  if (slash == NULL) {
+    strcpy(directory, ".");
+  } else if (slash == directory) {
+    slash[1] = 0;
+  } else {
+    slash[0] = 0;
+  }
+
+  int fd = open(directory, O_RDONLY);
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+  free(directory);
+}
+
+/*
+ * Rebuilds the database file with its rows packed in key order.
+ *
+ * Parameters:
+ * - table: A pointer to the Table structure.
+ * - fill_percent: How full to pack each node, from 1 to 100.
+ * - old_num_pages: Set to the number of pages before the rebuild.
+ * - new_num_pages: Set to the number of pages after it.
+ * - error: Set to why the vacuum failed, up to SQLITEDB_ERRMSG_SIZE bytes,
+ * when it returns EXECUTE_ERROR.
+ *
+ * Every row is copied, in key order, into a TableBuilder on a fresh temporary
+ * file next to the database. The leaves land on ascending pages in the order
+ * a scan visits them, filled to fill_percent, with the internal levels built
+ * on top. The temporary file is synced and renamed over the database, and the
+ * table switches to the new file. Until the rename, the original file is left
+ * untouched, so a crash leaves either the old or the new database.
+ *
+ * A running backup is completed first, since the page numbers it tracks do not
+ * survive the rebuild, and the write-ahead log is checkpointed. Vacuuming is
+ * not allowed inside a transaction. Before the switch, the table waits for
+ * every reader on other threads to finish, see table_drain_readers, so the
+ * calling thread must not have a snapshot open. A read or write that fails,
+ * see pager_fail, fails the vacuum.
+ *
+ * Returns EXECUTE_SUCCESS, EXECUTE_TABLE_FULL if the rows do not fit into the
+ * new file, or EXECUTE_ERROR. The database is left as it was unless the
+ * vacuum succeeds.
+ */
+ExecuteResult vacuum_table(Table *table, uint32_t fill_percent,
+                           uint32_t *old_num_pages, uint32_t *new_num_pages,
+                           char *error) {
+  if (table->in_transaction) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE,
+             "Error: Cannot vacuum inside a transaction.");
+    return EXECUTE_ERROR;
+  }
+  if (backup_finish(table, error) != EXECUTE_SUCCESS) {
+    return EXECUTE_ERROR;
+  }
+
+  Pager *pager = table->pager;
+  // Nothing may be left in the log to replay onto the new file after a crash
+  wal_checkpoint(pager);
+  if (pager_failed(pager, error)) {
+    return EXECUTE_ERROR;
+  }
+  char *filename = strdup(pager->filename);
+  size_t temp_filename_size = strlen(pager->filename) + sizeof("-vacuum");
+  char *temp_filename = malloc(temp_filename_size);
+  if (filename == NULL || temp_filename == NULL) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error: Out of memory.");
+    free(temp_filename);
+    free(filename);
+    return EXECUTE_ERROR;
+  }
+  snprintf(temp_filename, temp_filename_size, "%s-vacuum", filename);
+  unlink(temp_filename);
+
+  Table temp_table;
+  memset(&temp_table, 0, sizeof(Table));
+  temp_table.pager = pager_open(temp_filename, error);
+  if (temp_table.pager == NULL) {
+    free(temp_filename);
+    free(filename);
+    return EXECUTE_ERROR;
+  }
+  temp_table.root_page_num = 0;
+  temp_table.backup = NULL;
+  temp_table.compact_enabled = false;
+  pthread_mutex_init(&temp_table.stats_lock, NULL);
+  void *root = get_page(temp_table.pager, 0);
+  pager_mark_dirty(temp_table.pager, 0);
+  initialize_leaf_node(root);
+  set_node_root(root, true);
+  *node_parent(root) = 0;
+
+  TableBuilder builder;
+  ExecuteResult result = EXECUTE_SUCCESS;
+  table_builder_init(&builder, &temp_table, fill_percent);
+
+  Row row;
+  Cursor *cursor = table_start(table);
+  while (result == EXECUTE_SUCCESS && !(cursor->end_of_table)) {
+    deserialize_row(cursor_value(cursor), &row);
+    result = table_builder_add(&builder, &row);
+    cursor_advance(cursor);
+  }
+  cursor_close(cursor);
+  table_builder_finish(&builder);
+  pthread_mutex_destroy(&temp_table.stats_lock);
+
+  if (result == EXECUTE_SUCCESS) {
+    pager_sync(temp_table.pager);
+  }
+  // Reading the old file can fail the old pager too
+  if (result == EXECUTE_SUCCESS && (pager_failed(pager, error) ||
+                                    pager_failed(temp_table.pager, error))) {
+    result = EXECUTE_ERROR;
+  }
+  if (result != EXECUTE_SUCCESS) {
+    pager_close(temp_table.pager);
+    unlink(temp_filename);
+    free(temp_filename);
+    free(filename);
+    return result;
+  }
+  *old_num_pages = pager->num_pages;
+  *new_num_pages = temp_table.pager->num_pages;
+  pager_close(temp_table.pager);
+
+  if (rename(temp_filename, filename) == -1) {
+    snprintf(error, SQLITEDB_ERRMSG_SIZE, "Error replacing db file: %d",
+             errno);
+    unlink(temp_filename);
+    free(temp_filename);
+    free(filename);
+    return EXECUTE_ERROR;
+  }
+  fsync_directory(filename);
+
+  Pager *new_pager = pager_open(filename, error);
+  if (new_pager == NULL) {
+    // The file now holds the vacuumed rows, which the old pager must not
+    // write over; the database has to be opened again
+    pager_fail(pager, "Error reopening db file", errno);
+    free(temp_filename);
+    free(filename);
+    return EXECUTE_ERROR;
+  }
+  // Snapshots, lookups and scan workers on other threads may still be
+  // reading the old pager
+  table_drain_readers(table);
+  // The old file is gone; its unwritten changes are already in the new one
+  for (uint32_t i = 0; i < pager->num_pages; i++) {
+    pager->dirty[i] = false;
+  }
+  // The counters describe the database, not the file that holds it
+  memcpy(new_pager->stats, pager->stats, sizeof(pager->stats));
+  __atomic_store_n(&table->pager, new_pager, __ATOMIC_RELEASE);
+  table_resume_readers(table);
+  pager_close(pager);
+  // The rows are the same, but they sit on fewer leaves
+  table_stats_invalidate(table);
+
+  free(temp_filename);
+  free(filename);
+  return EXECUTE_SUCCESS;
+}
@@ -0,0 +1,12 @@
+#ifndef VACUUM_H
+#define VACUUM_H
+
+#include "constants.h"
+
+#define VACUUM_FILL_PERCENT 90
+
+ExecuteResult vacuum_table(Table *table, uint32_t fill_percent,
+                           uint32_t *old_num_pages, uint32_t *new_num_pages,
+                           char *error);
+
+#endif
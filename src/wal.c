@@ -0,0 +1,318 @@
+#include "wal.h"
+#include "checksum.h"
+#include "pager.h"
+#include "profile.h"
+
+/*
+ * Returns the name of the write-ahead log that belongs to a database file.
+ *
+ * Parameters:
+ * - filename: The name of the database file.
+ *
+ * Returns a newly allocated string that the caller must free.
+ */
+static char *wal_filename(const char *filename) {
+  char *name = malloc(strlen(filename) + strlen("-wal") + 1);
+  sprintf(name, "%s-wal", filename);
+  return name;
+}
+
+/*
+ * Computes the checksum of a frame.
+ *
+ * Parameters:
+ * - checksum: The checksum of the previous frame, or 0 for the first frame.
+ * - header: The frame header; its first two fields are covered.
+ * - page: The page stored in the frame.
+ *
+ * Chaining every frame onto the one before it means a frame only checks out
+ * if every frame before it in the log does too.
+ *
+ * Returns the checksum of the frame.
+ */
+static uint32_t wal_frame_checksum(uint32_t checksum, const uint32_t *header,
+                                   const void *page) {
+  checksum = checksum_crc32(checksum, header, 2 * sizeof(uint32_t));
+  return checksum_crc32(checksum, page, PAGE_SIZE);
+}
+
+/*
+ * Empties the log, leaving just its header, and waits until that is durable.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * Frames are only ever appended after this returns, so a torn append can
+ * never be confused with frames from before the reset. If the reset fails,
+ * so does the pager, see pager_fail.
+ *
+ * Does not return a value.
+ */
+static void wal_reset(Pager *pager) {
+  char header[WAL_HEADER_SIZE] = {0};
+  uint32_t version = WAL_VERSION;
+  memcpy(header, WAL_MAGIC, strlen(WAL_MAGIC));
+  memcpy(header + 8, &version, sizeof(version));
+  memcpy(header + 12, &PAGE_SIZE, sizeof(PAGE_SIZE));
+
+  if (ftruncate(pager->wal_file_descriptor, 0) == -1 ||
+      pwrite(pager->wal_file_descriptor, header, WAL_HEADER_SIZE, 0) !=
+          WAL_HEADER_SIZE ||
+      pager_fsync(pager, pager->wal_file_descriptor, false) == -1) {
+    pager_fail(pager, "Error resetting write-ahead log", errno);
+    return;
+  }
+  pager_count(&pager_thread_stats(pager)->bytes_written, WAL_HEADER_SIZE);
+
+  pager->wal_num_frames = 0;
+  pager->wal_checksum = 0;
+}
+
+/*
+ * Copies the committed transactions found in a log into the database file.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure. Only its file descriptors are
+ * used; nothing has been read into the cache yet.
+ *
+ * The frames are read until one does not check out. Everything up to the
+ * last commit frame before that point is copied into the database file,
+ * which is then cut to the size recorded by that commit and synced. A
+ * transaction whose commit frame never made it to disk is ignored. If the
+ * copy fails, so does the pager, see pager_fail, and the log is left for the
+ * next open to try again.
+ *
+ * Does not return a value.
+ */
+static void wal_recover(Pager *pager) {
+  int fd = pager->wal_file_descriptor;
+  char header[WAL_HEADER_SIZE];
+  if (pread(fd, header, WAL_HEADER_SIZE, 0) != WAL_HEADER_SIZE ||
+      memcmp(header, WAL_MAGIC, strlen(WAL_MAGIC)) != 0) {
+    return;
+  }
+
+  void *page = malloc(PAGE_SIZE);
+  uint32_t frame[3];
+  uint32_t checksum = 0;
+  uint32_t num_frames = 0;
+  uint32_t num_committed_frames = 0;
+  uint32_t committed_num_pages = 0;
+
+  off_t offset = WAL_HEADER_SIZE;
+  while (pread(fd, frame, WAL_FRAME_HEADER_SIZE, offset) ==
+             WAL_FRAME_HEADER_SIZE &&
+         pread(fd, page, PAGE_SIZE, offset + WAL_FRAME_HEADER_SIZE) ==
+             PAGE_SIZE) {
+    checksum = wal_frame_checksum(checksum, frame, page);
+    if (checksum != frame[2]) {
+      break;
+    }
+    num_frames++;
+    if (frame[1] != 0) {
+      num_committed_frames = num_frames;
+      committed_num_pages = frame[1];
+    }
+    offset += WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+  }
+
+  offset = WAL_HEADER_SIZE;
+  for (uint32_t i = 0; i < num_committed_frames; i++) {
+    pread(fd, frame, WAL_FRAME_HEADER_SIZE, offset);
+    pread(fd, page, PAGE_SIZE, offset + WAL_FRAME_HEADER_SIZE);
+    if (pwrite(pager->file_descriptor, page, PAGE_SIZE,
+               (off_t)frame[0] * PAGE_SIZE) != PAGE_SIZE) {
+      pager_fail(pager, "Error recovering from write-ahead log", errno);
+      free(page);
+      return;
+    }
+    offset += WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+  }
+  free(page);
+
+  if (num_committed_frames > 0) {
+    if (ftruncate(pager->file_descriptor,
+                  (off_t)committed_num_pages * PAGE_SIZE) == -1 ||
+        pager_fsync(pager, pager->file_descriptor, false) == -1) {
+      pager_fail(pager, "Error recovering from write-ahead log", errno);
+    }
+  }
+}
+
+/*
+ * Opens the write-ahead log of a database, recovering from it if needed.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure, whose database file is open but
+ * not yet read.
+ * - filename: The name of the database file.
+ *
+ * A log left behind by a process that did not close the database holds
+ * transactions that were committed but not yet copied into the database
+ * file. Those are copied over before anything is read. The log is then
+ * emptied for this session. If any of that fails, so does the pager, see
+ * pager_fail, and pager_open gives up on the database.
+ *
+ * Does not return a value.
+ */
+void wal_open(Pager *pager, const char *filename) {
+  char *name = wal_filename(filename);
+  pager->wal_file_descriptor = open(name, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  free(name);
+  pager->num_wal_pending = 0;
+  if (pager->wal_file_descriptor == -1) {
+    pager_fail(pager, "Unable to open write-ahead log", errno);
+    return;
+  }
+
+  wal_recover(pager);
+  // A log that could not be copied over must not be emptied
+  if (pager->io_error == 0) {
+    wal_reset(pager);
+  }
+}
+
+/*
+ * Makes every page changed since the last commit durable.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * The changed pages are appended to the log as frames, the last of which
+ * records the size of the database and so marks the commit. All frames are
+ * written at once and followed by a single fsync of the log, however many
+ * pages the transaction touched. The pages are only copied into the database
+ * file by a later checkpoint, which runs once the log has grown past
+ * WAL_AUTOCHECKPOINT_FRAMES.
+ *
+ * If the frames cannot be written, the pager fails, see pager_fail, and
+ * nothing is appended from then on, so the log ends with the last commit
+ * that made it to disk.
+ *
+ * Does not return a value.
+ */
+void wal_commit(Pager *pager) {
+  if (pager->io_error != 0) {
+    return;
+  }
+
+  uint32_t num_frames = 0;
+  for (uint32_t i = 0; i < pager->num_wal_pending; i++) {
+    if (pager->wal_pending_pages[i] < pager->num_pages) {
+      num_frames++;
+    }
+  }
+
+  if (num_frames > 0) {
+    size_t frame_size = WAL_FRAME_HEADER_SIZE + PAGE_SIZE;
+    char *buffer = malloc(num_frames * frame_size);
+    char *frame = buffer;
+    uint32_t frames_left = num_frames;
+
+    for (uint32_t i = 0; i < pager->num_wal_pending; i++) {
+      uint32_t page_num = pager->wal_pending_pages[i];
+      if (page_num >= pager->num_pages) {
+        continue;
+      }
+      frames_left--;
+
+      uint32_t header[3];
+      header[0] = page_num;
+      header[1] = frames_left == 0 ? pager->num_pages : 0;
+      void *page = get_page(pager, page_num);
+      pager->wal_checksum = wal_frame_checksum(pager->wal_checksum, header,
+                                               page);
+      header[2] = pager->wal_checksum;
+
+      memcpy(frame, header, WAL_FRAME_HEADER_SIZE);
+      memcpy(frame + WAL_FRAME_HEADER_SIZE, page, PAGE_SIZE);
+      frame += frame_size;
+    }
+
+    off_t offset = WAL_HEADER_SIZE + (off_t)pager->wal_num_frames * frame_size;
+    profile_counters.pages_written += num_frames;
+    profile_begin(PROFILE_PHASE_IO);
+    uint64_t start_ns = profile_clock(CLOCK_MONOTONIC);
+    ssize_t bytes_written = pwrite(pager->wal_file_descriptor, buffer,
+                                   num_frames * frame_size, offset);
+    profile_counters.io_wait_ns += profile_clock(CLOCK_MONOTONIC) - start_ns;
+    profile_end();
+    free(buffer);
+    if (bytes_written != (ssize_t)(num_frames * frame_size) ||
+        pager_fsync(pager, pager->wal_file_descriptor, true) == -1) {
+      pager_fail(pager, "Error writing write-ahead log", errno);
+      return;
+    }
+    PagerStats *stats = pager_thread_stats(pager);
+    pager_count(&stats->bytes_written, bytes_written);
+    pager_count(&stats->wal_commits, 1);
+    pager_count(&stats->wal_frames, num_frames);
+    pager->wal_num_frames += num_frames;
+  }
+
+  for (uint32_t i = 0; i < pager->num_wal_pending; i++) {
+    pager->wal_pending[pager->wal_pending_pages[i]] = false;
+  }
+  pager->num_wal_pending = 0;
+
+  if (pager->wal_num_frames >= WAL_AUTOCHECKPOINT_FRAMES) {
+    wal_checkpoint(pager);
+  }
+}
+
+/*
+ * Copies every committed page into the database file and empties the log.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * Must not run while a transaction has uncommitted changes, because every
+ * dirty page is written. Pages freed off the end of the database are cut
+ * from the file here. The database file is synced before the log is
+ * emptied, so a crash at any point leaves one of the two complete. For the
+ * same reason a failed pager, see pager_fail, is not checkpointed at all,
+ * and one that fails during the checkpoint keeps its log.
+ *
+ * Does not return a value.
+ */
+void wal_checkpoint(Pager *pager) {
+  if (pager->io_error != 0) {
+    return;
+  }
+  if (pager->file_length > pager->num_pages * PAGE_SIZE) {
+    if (ftruncate(pager->file_descriptor, pager->num_pages * PAGE_SIZE) == -1) {
+      pager_fail(pager, "Error truncating file", errno);
+      return;
+    }
+    pager->file_length = pager->num_pages * PAGE_SIZE;
+  }
+  pager_sync(pager);
+  if (pager->io_error != 0) {
+    return;
+  }
+  wal_reset(pager);
+  pager_count(&pager_thread_stats(pager)->wal_checkpoints, 1);
+}
+
+/*
+ * Checkpoints and removes the write-ahead log of a database being closed.
+ *
+ * Parameters:
+ * - pager: A pointer to the Pager structure.
+ *
+ * The log of a failed pager, see pager_fail, is kept, since it may hold
+ * commits the database file does not; the next open recovers them.
+ *
+ * Does not return a value.
+ */
+void wal_close(Pager *pager) {
+  wal_checkpoint(pager);
+  close(pager->wal_file_descriptor);
+  if (pager->io_error != 0) {
+    return;
+  }
+
+  char *name = wal_filename(pager->filename);
+  unlink(name);
+  free(name);
+}
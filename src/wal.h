@@ -0,0 +1,17 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include "constants.h"
+
+#define WAL_MAGIC "SQLTWAL"
+#define WAL_VERSION 1
+#define WAL_HEADER_SIZE 16
+#define WAL_FRAME_HEADER_SIZE 12
+#define WAL_AUTOCHECKPOINT_FRAMES 1000
+
+void wal_open(Pager *pager, const char *filename);
+void wal_commit(Pager *pager);
+void wal_checkpoint(Pager *pager);
+void wal_close(Pager *pager);
+
+#endif
@@ -0,0 +1,128 @@
+#include "../src/sqlitedb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Drives a database through the public API alone, the way the REPL does,
+ * and prints what each call returned.
+ */
+
+#define NUM_ROWS 40
+
+static void check(SqliteDb *db, const char *call, int result, int expected) {
+  if (result != expected) {
+    printf("%s: expected %d, got %d: %s\n", call, expected, result,
+           sqlitedb_errmsg(db));
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void print_select(SqliteDb *db, const char *sql) {
+  SqliteStmt *stmt;
+  check(db, "prepare", sqlitedb_prepare(db, sql, &stmt), SQLITEDB_OK);
+  sqlitedb_bind_int(stmt, 1, NUM_ROWS - 2);
+  printf("%s:", sql);
+  int result;
+  while ((result = sqlitedb_step(stmt)) == SQLITEDB_ROW) {
+    for (int i = 0; i < sqlitedb_column_count(stmt); i++) {
+      printf(" %s", sqlitedb_column_text(stmt, i));
+    }
+    printf(";");
+  }
+  printf("\n");
+  check(db, "step", result, SQLITEDB_DONE);
+  sqlitedb_finalize(stmt);
+}
+
+static uint64_t count_rows(const char *filename) {
+  SqliteDb *db;
+  check(NULL, "open", sqlitedb_open(filename, &db), SQLITEDB_OK);
+  SqliteStats stats;
+  sqlitedb_stats(db, &stats);
+  sqlitedb_close(db);
+  return stats.rows;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    printf("Usage: api_test <database> <backup>\n");
+    return EXIT_FAILURE;
+  }
+
+  SqliteDb *db;
+  check(NULL, "open", sqlitedb_open(argv[1], &db), SQLITEDB_OK);
+
+  SqliteStmt *insert;
+  check(db, "prepare", sqlitedb_prepare(db, "insert ? ? ?", &insert),
+        SQLITEDB_OK);
+  for (int i = 1; i <= NUM_ROWS; i++) {
+    char username[32];
+    char email[32];
+    snprintf(username, sizeof(username), "user%d", i);
+    snprintf(email, sizeof(email), "person%d@example.com", i);
+    sqlitedb_bind_int(insert, 1, i);
+    sqlitedb_bind_text(insert, 2, username);
+    sqlitedb_bind_text(insert, 3, email);
+    check(db, "insert", sqlitedb_step(insert), SQLITEDB_DONE);
+    sqlitedb_reset(insert);
+  }
+  sqlitedb_bind_int(insert, 1, 1);
+  printf("duplicate insert: %d %s\n", sqlitedb_step(insert),
+         sqlitedb_errmsg(db));
+  printf("bind id -1: %d %s\n", sqlitedb_bind_int(insert, 1, -1),
+         sqlitedb_errmsg(db));
+  sqlitedb_finalize(insert);
+
+  print_select(db, "select where id > ?");
+  print_select(db, "select count(*)");
+
+  SqliteCursor *cursor;
+  sqlitedb_cursor_open(db, 20, &cursor);
+  printf("cursor from 20:");
+  for (int i = 0; i < 3 && sqlitedb_cursor_next(cursor) == SQLITEDB_ROW; i++) {
+    printf(" %u %s %s;", sqlitedb_cursor_id(cursor),
+           sqlitedb_cursor_username(cursor), sqlitedb_cursor_email(cursor));
+  }
+  printf("\n");
+  sqlitedb_cursor_close(cursor);
+
+  // A page per step, so the backup spans several calls to sqlitedb_idle
+  unlink(argv[2]);
+  check(db, "backup", sqlitedb_backup(db, argv[2], 1), SQLITEDB_OK);
+  for (int i = 0; i < 10; i++) {
+    uint32_t backup_pages;
+    int result = sqlitedb_idle(db, &backup_pages);
+    if (result == SQLITEDB_DONE) {
+      printf("Backup complete: %u pages copied.\n", backup_pages);
+    } else {
+      check(db, "idle", result, SQLITEDB_OK);
+    }
+  }
+  printf("backup rows: %lu\n", (unsigned long)count_rows(argv[2]));
+
+  uint32_t old_num_pages, new_num_pages;
+  printf("vacuum to 101%%: %d %s\n",
+         sqlitedb_vacuum(db, 101, &old_num_pages, &new_num_pages),
+         sqlitedb_errmsg(db));
+  check(db, "vacuum",
+        sqlitedb_vacuum(db, 100, &old_num_pages, &new_num_pages), SQLITEDB_OK);
+  printf("Vacuumed %u pages into %u.\n", old_num_pages, new_num_pages);
+
+  sqlitedb_profile_reset();
+  print_select(db, "select count(*)");
+  SqliteProfile profile;
+  sqlitedb_profile(&profile);
+  printf("profile: rows examined %lu, pages written %lu\n",
+         (unsigned long)profile.rows_examined,
+         (unsigned long)profile.pages_written);
+
+  SqliteStats stats;
+  sqlitedb_stats(db, &stats);
+  printf("stats: rows %lu, leaf pages %u, height %u\n",
+         (unsigned long)stats.rows, stats.leaf_pages, stats.tree_height);
+
+  sqlitedb_close(db);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+#include "../src/sqlitedb.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Runs lookups and a scan through the async API, against a table none of
+ * whose pages are cached, and prints what each one found. Only the public
+ * header is used, as an embedding program would.
+ */
+
+#define NUM_ROWS 300
+#define NUM_GETS 4
+
+typedef struct {
+  uint32_t key;
+  int completed;
+  char text[128];
+} GetResult;
+
+typedef struct {
+  uint32_t num_rows;
+  uint32_t last_id;
+  int in_order;
+  int completed;
+} ScanResult;
+
+static void on_get(void *context, const SqliteRow *row) {
+  GetResult *result = context;
+  result->completed++;
+  if (row == NULL) {
+    snprintf(result->text, sizeof(result->text), "not found");
+  } else {
+    snprintf(result->text, sizeof(result->text), "(%u, %s, %s)", row->id,
+             row->username, row->email);
+  }
+}
+
+static void on_scan(void *context, const SqliteRow *row) {
+  ScanResult *result = context;
+  if (row == NULL) {
+    result->completed++;
+    return;
+  }
+  if (row->id <= result->last_id) {
+    result->in_order = 0;
+  }
+  result->last_id = row->id;
+  result->num_rows++;
+}
+
+static void fill(const char *filename) {
+  SqliteDb *db;
+  if (sqlitedb_open(filename, &db) != SQLITEDB_OK) {
+    printf("%s\n", sqlitedb_errmsg(db));
+    exit(EXIT_FAILURE);
+  }
+  SqliteStmt *stmt;
+  sqlitedb_prepare(db, "insert ? ? ?", &stmt);
+  for (int i = 1; i <= NUM_ROWS; i++) {
+    char username[32];
+    char email[32];
+    snprintf(username, sizeof(username), "user%d", i);
+    snprintf(email, sizeof(email), "person%d@example.com", i);
+    sqlitedb_bind_int(stmt, 1, i);
+    sqlitedb_bind_text(stmt, 2, username);
+    sqlitedb_bind_text(stmt, 3, email);
+    if (sqlitedb_step(stmt) != SQLITEDB_DONE) {
+      printf("%s\n", sqlitedb_errmsg(db));
+      exit(EXIT_FAILURE);
+    }
+    sqlitedb_reset(stmt);
+  }
+  sqlitedb_finalize(stmt);
+  sqlitedb_close(db);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    printf("Usage: async_test <database>\n");
+    return EXIT_FAILURE;
+  }
+  fill(argv[1]);
+
+  // Reopened, so every operation starts at a page that has to be read
+  SqliteDb *db;
+  sqlitedb_open(argv[1], &db);
+  SqliteAsync *async;
+  sqlitedb_async_open(db, &async);
+
+  GetResult gets[NUM_GETS] = {
+      {1, 0, ""}, {150, 0, ""}, {NUM_ROWS, 0, ""}, {NUM_ROWS + 1, 0, ""}};
+  ScanResult scan = {0, 0, 1, 0};
+  for (int i = 0; i < NUM_GETS; i++) {
+    sqlitedb_async_get(async, gets[i].key, on_get, &gets[i]);
+  }
+  sqlitedb_async_scan(async, on_scan, &scan);
+
+  struct pollfd descriptor = {sqlitedb_async_fd(async), POLLIN, 0};
+  while (sqlitedb_async_poll(async, 0) > 0) {
+    if (poll(&descriptor, 1, 1000) <= 0) {
+      printf("Timed out waiting for reads\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (int i = 0; i < NUM_GETS; i++) {
+    printf("get %u: %s, completed %d time(s)\n", gets[i].key, gets[i].text,
+           gets[i].completed);
+  }
+  printf("scan: %u rows%s, completed %d time(s)\n", scan.num_rows,
+         scan.in_order ? " in key order" : " out of order", scan.completed);
+
+  sqlitedb_async_close(async);
+  sqlitedb_close(db);
+  return EXIT_SUCCESS;
+}